@@ -0,0 +1,711 @@
+#include "pch.hpp"
+#include "bracketIndex.hpp"
+
+#include <array>
+#include <algorithm>
+#include <limits>
+
+namespace cdx::syntax
+{
+	namespace
+	{
+		// Lowest depth of a run without brackets, far enough from overflowing when added to
+		constexpr std::int64_t noDepth{ std::numeric_limits<std::int64_t>::max() / 4 };
+		constexpr std::size_t npos{ std::size_t(-1) };
+
+		struct Depth
+		{
+			// Net change over the run
+			std::int64_t total{ 0 };
+			// Lowest depth relative to the run's start, before and after each of its brackets
+			std::int64_t minBefore{ noDepth }, minAfter{ noDepth };
+		};
+		struct Summary
+		{
+			std::size_t lines{ 0 };
+			std::array<Depth, maxBracketPairs> depth{};
+			std::uint32_t minIndent{ LineStructure::blank };
+		};
+
+		[[nodiscard]] Summary combine(const Summary & a, const Summary & b) noexcept
+		{
+			Summary s;
+			s.lines = a.lines + b.lines;
+			for (std::size_t p = 0; p < maxBracketPairs; ++p)
+			{
+				const auto & x = a.depth[p];
+				const auto & y = b.depth[p];
+				s.depth[p].total = x.total + y.total;
+				s.depth[p].minBefore = std::min(x.minBefore, x.total + y.minBefore);
+				s.depth[p].minAfter = std::min(x.minAfter, x.total + y.minAfter);
+			}
+			s.minIndent = std::min(a.minIndent, b.minIndent);
+			return s;
+		}
+		[[nodiscard]] Summary summarize(const LineStructure & line) noexcept
+		{
+			Summary s;
+			s.lines = 1;
+			for (const auto & b : line.brackets)
+			{
+				auto & d = s.depth[b.pair];
+				d.minBefore = std::min(d.minBefore, d.total);
+				d.total += b.bOpen ? 1 : -1;
+				d.minAfter = std::min(d.minAfter, d.total);
+			}
+			s.minIndent = line.indent;
+			return s;
+		}
+	}
+
+	struct BracketNode
+	{
+		std::unique_ptr<BracketNode> left, right;
+		std::uint32_t priority{ 0 };
+		LineStructure line;
+		Summary own, sum;
+
+		void update() noexcept
+		{
+			this->sum = this->own;
+			if (this->left)
+			{
+				this->sum = combine(this->left->sum, this->sum);
+			}
+			if (this->right)
+			{
+				this->sum = combine(this->sum, this->right->sum);
+			}
+		}
+	};
+
+	namespace
+	{
+		using Node = BracketNode;
+		using NodePtr = std::unique_ptr<Node>;
+
+		[[nodiscard]] std::size_t lines(const NodePtr & node) noexcept
+		{
+			return node ? node->sum.lines : 0;
+		}
+		[[nodiscard]] std::int64_t total(const NodePtr & node, std::size_t pair) noexcept
+		{
+			return node ? node->sum.depth[pair].total : 0;
+		}
+
+		// Lines [0, count) go left, the rest right
+		[[nodiscard]] std::pair<NodePtr, NodePtr> split(NodePtr node, std::size_t count) noexcept
+		{
+			if (!node)
+			{
+				return {};
+			}
+			if (count <= lines(node->left))
+			{
+				auto [a, b] = split(std::move(node->left), count);
+				node->left = std::move(b);
+				node->update();
+				return { std::move(a), std::move(node) };
+			}
+			auto [a, b] = split(std::move(node->right), count - lines(node->left) - 1);
+			node->right = std::move(a);
+			node->update();
+			return { std::move(node), std::move(b) };
+		}
+		[[nodiscard]] NodePtr merge(NodePtr a, NodePtr b) noexcept
+		{
+			if (!a || !b)
+			{
+				return a ? std::move(a) : std::move(b);
+			}
+			if (a->priority >= b->priority)
+			{
+				a->right = merge(std::move(a->right), std::move(b));
+				a->update();
+				return a;
+			}
+			b->left = merge(std::move(a), std::move(b->left));
+			b->update();
+			return b;
+		}
+
+		// First line at or after 'from' where the pair's depth falls below 'target' after one of its brackets
+		[[nodiscard]] std::size_t firstBelow(const Node * node, std::size_t base, std::int64_t depth, std::size_t from, std::size_t pair, std::int64_t target) noexcept
+		{
+			if (node == nullptr || base + node->sum.lines <= from)
+			{
+				return npos;
+			}
+			if (base >= from && depth + node->sum.depth[pair].minAfter >= target)
+			{
+				return npos;
+			}
+			auto self = base + lines(node->left);
+			auto r = firstBelow(node->left.get(), base, depth, from, pair, target);
+			if (r != npos)
+			{
+				return r;
+			}
+			depth += total(node->left, pair);
+			if (self >= from && depth + node->own.depth[pair].minAfter < target)
+			{
+				return self;
+			}
+			return firstBelow(node->right.get(), self + 1, depth + node->own.depth[pair].total, from, pair, target);
+		}
+		// Last line before 'before' where the pair's depth is at most 'target' before one of its brackets
+		[[nodiscard]] std::size_t lastAtMost(const Node * node, std::size_t base, std::int64_t depth, std::size_t before, std::size_t pair, std::int64_t target) noexcept
+		{
+			if (node == nullptr || base >= before)
+			{
+				return npos;
+			}
+			if (base + node->sum.lines <= before && depth + node->sum.depth[pair].minBefore > target)
+			{
+				return npos;
+			}
+			auto self = base + lines(node->left);
+			auto selfDepth = depth + total(node->left, pair);
+			auto r = lastAtMost(node->right.get(), self + 1, selfDepth + node->own.depth[pair].total, before, pair, target);
+			if (r != npos)
+			{
+				return r;
+			}
+			if (self < before && selfDepth + node->own.depth[pair].minBefore <= target)
+			{
+				return self;
+			}
+			return lastAtMost(node->left.get(), base, depth, before, pair, target);
+		}
+		// First line at or after 'from' indented at most 'indent', blank lines have the largest indent
+		[[nodiscard]] std::size_t firstIndentAtMost(const Node * node, std::size_t base, std::size_t from, std::uint32_t indent) noexcept
+		{
+			if (node == nullptr || base + node->sum.lines <= from)
+			{
+				return npos;
+			}
+			if (base >= from && node->sum.minIndent > indent)
+			{
+				return npos;
+			}
+			auto self = base + lines(node->left);
+			auto r = firstIndentAtMost(node->left.get(), base, from, indent);
+			if (r != npos)
+			{
+				return r;
+			}
+			if (self >= from && node->own.minIndent <= indent)
+			{
+				return self;
+			}
+			return firstIndentAtMost(node->right.get(), self + 1, from, indent);
+		}
+		[[nodiscard]] std::size_t lastIndentAtMost(const Node * node, std::size_t base, std::size_t before, std::uint32_t indent) noexcept
+		{
+			if (node == nullptr || base >= before)
+			{
+				return npos;
+			}
+			if (base + node->sum.lines <= before && node->sum.minIndent > indent)
+			{
+				return npos;
+			}
+			auto self = base + lines(node->left);
+			auto r = lastIndentAtMost(node->right.get(), self + 1, before, indent);
+			if (r != npos)
+			{
+				return r;
+			}
+			if (self < before && node->own.minIndent <= indent)
+			{
+				return self;
+			}
+			return lastIndentAtMost(node->left.get(), base, before, indent);
+		}
+
+		// Replaces a line and fixes the summaries on the way back up
+		bool assign(Node * node, std::size_t line, LineStructure && structure) noexcept
+		{
+			if (node == nullptr)
+			{
+				return false;
+			}
+			auto left = lines(node->left);
+			if (line == left)
+			{
+				node->line = std::move(structure);
+				node->own = summarize(node->line);
+			}
+			else if (!((line < left) ? assign(node->left.get(), line, std::move(structure)) : assign(node->right.get(), line - left - 1, std::move(structure))))
+			{
+				return false;
+			}
+			node->update();
+			return true;
+		}
+	}
+
+	std::uint32_t BracketIndex::priority() noexcept
+	{
+		// xorshift64*
+		this->m_seed ^= this->m_seed >> 12;
+		this->m_seed ^= this->m_seed << 25;
+		this->m_seed ^= this->m_seed >> 27;
+		return std::uint32_t((this->m_seed * 0x2545F4914F6CDD1D) >> 32);
+	}
+	BracketIndex::NodePtr BracketIndex::build(std::size_t count)
+	{
+		if (count == 0)
+		{
+			return nullptr;
+		}
+		// Balanced by position, priorities are raised to keep the heap order
+		auto node = std::make_unique<BracketNode>();
+		node->left = this->build(count / 2);
+		node->right = this->build(count - count / 2 - 1);
+		node->priority = this->priority();
+		if (node->left)
+		{
+			node->priority = std::max(node->priority, node->left->priority);
+		}
+		if (node->right)
+		{
+			node->priority = std::max(node->priority, node->right->priority);
+		}
+		node->own = summarize(node->line);
+		node->update();
+		return node;
+	}
+
+	const BracketNode * BracketIndex::locate(std::size_t line, std::int64_t * depths) const noexcept
+	{
+		std::fill_n(depths, maxBracketPairs, std::int64_t(0));
+		const BracketNode * node = this->m_root.get();
+		while (node != nullptr)
+		{
+			auto left = lines(node->left);
+			if (line < left)
+			{
+				node = node->left.get();
+				continue;
+			}
+			for (std::size_t p = 0; p < maxBracketPairs; ++p)
+			{
+				depths[p] += total(node->left, p);
+			}
+			if (line == left)
+			{
+				return node;
+			}
+			for (std::size_t p = 0; p < maxBracketPairs; ++p)
+			{
+				depths[p] += node->own.depth[p].total;
+			}
+			line -= left + 1;
+			node = node->right.get();
+		}
+		return nullptr;
+	}
+
+	std::optional<BracketPos> BracketIndex::findClose(std::size_t line, std::size_t pair, std::int64_t depth) const
+	{
+		// The close takes the depth below the one after its open
+		std::array<std::int64_t, maxBracketPairs> depths;
+		auto found = firstBelow(this->m_root.get(), 0, 0, line, pair, depth);
+		auto node = (found != npos) ? this->locate(found, depths.data()) : nullptr;
+		if (node == nullptr)
+		{
+			return std::nullopt;
+		}
+		auto d = depths[pair];
+		for (const auto & b : node->line.brackets)
+		{
+			if (b.pair != pair)
+			{
+				continue;
+			}
+			d += b.bOpen ? 1 : -1;
+			if (d < depth)
+			{
+				return BracketPos{ found, b.column };
+			}
+		}
+		return std::nullopt;
+	}
+	std::optional<BracketPos> BracketIndex::findOpen(std::size_t line, std::uint32_t column, std::size_t pair, std::int64_t depth) const
+	{
+		// The open is the last bracket before the position with a depth before it of at most 'depth'
+		std::array<std::int64_t, maxBracketPairs> depths;
+		auto node = this->locate(line, depths.data());
+		if (node == nullptr)
+		{
+			return std::nullopt;
+		}
+		std::optional<BracketPos> open;
+		auto d = depths[pair];
+		for (const auto & b : node->line.brackets)
+		{
+			if (b.column >= column)
+			{
+				break;
+			}
+			if (b.pair != pair)
+			{
+				continue;
+			}
+			if (d <= depth)
+			{
+				open = BracketPos{ line, b.column };
+			}
+			d += b.bOpen ? 1 : -1;
+		}
+		if (open)
+		{
+			return open;
+		}
+
+		auto found = lastAtMost(this->m_root.get(), 0, 0, line, pair, depth);
+		node = (found != npos) ? this->locate(found, depths.data()) : nullptr;
+		if (node == nullptr)
+		{
+			return std::nullopt;
+		}
+		d = depths[pair];
+		for (const auto & b : node->line.brackets)
+		{
+			if (b.pair != pair)
+			{
+				continue;
+			}
+			if (d <= depth)
+			{
+				open = BracketPos{ found, b.column };
+			}
+			d += b.bOpen ? 1 : -1;
+		}
+		return open;
+	}
+
+	COMFYDX_API BracketIndex::BracketIndex() = default;
+	COMFYDX_API BracketIndex::BracketIndex(BracketIndex && other) noexcept = default;
+	COMFYDX_API BracketIndex & BracketIndex::operator=(BracketIndex && other) noexcept = default;
+	COMFYDX_API BracketIndex::~BracketIndex() noexcept = default;
+
+	COMFYDX_API void BracketIndex::reset(std::size_t lines)
+	{
+		this->m_root.reset();
+		this->m_root = this->build(lines);
+	}
+	COMFYDX_API void BracketIndex::insert(std::size_t line, std::size_t count)
+	{
+		auto [before, after] = split(std::move(this->m_root), line);
+		auto added = this->build(count);
+		this->m_root = merge(merge(std::move(before), std::move(added)), std::move(after));
+	}
+	COMFYDX_API void BracketIndex::erase(std::size_t line, std::size_t count)
+	{
+		auto [before, rest] = split(std::move(this->m_root), line);
+		auto [removed, after] = split(std::move(rest), count);
+		this->m_root = merge(std::move(before), std::move(after));
+	}
+	COMFYDX_API void BracketIndex::setLine(std::size_t line, LineStructure structure)
+	{
+		assign(this->m_root.get(), line, std::move(structure));
+	}
+
+	COMFYDX_API std::size_t BracketIndex::lineCount() const noexcept
+	{
+		return lines(this->m_root);
+	}
+	COMFYDX_API const LineStructure & BracketIndex::line(std::size_t line) const noexcept
+	{
+		static const LineStructure none;
+		std::array<std::int64_t, maxBracketPairs> depths;
+		auto node = this->locate(line, depths.data());
+		return node ? node->line : none;
+	}
+
+	COMFYDX_API std::optional<BracketPos> BracketIndex::matchingBracket(std::size_t line, std::uint32_t column) const
+	{
+		std::array<std::int64_t, maxBracketPairs> depths;
+		auto node = this->locate(line, depths.data());
+		if (node == nullptr)
+		{
+			return std::nullopt;
+		}
+		const auto & brackets = node->line.brackets;
+		auto it = std::find_if(brackets.begin(), brackets.end(), [column](const Bracket & b)
+		{
+			return b.column == column;
+		});
+		if (it == brackets.end())
+		{
+			return std::nullopt;
+		}
+
+		auto pair = it->pair;
+		auto depth = depths[pair];
+		for (auto b = brackets.begin(); b != it; ++b)
+		{
+			if (b->pair == pair)
+			{
+				depth += b->bOpen ? 1 : -1;
+			}
+		}
+		if (!it->bOpen)
+		{
+			return this->findOpen(line, column, pair, depth - 1);
+		}
+
+		// Closed on the same line?
+		auto target = depth + 1;
+		for (auto b = it + 1; b != brackets.end(); ++b)
+		{
+			if (b->pair != pair)
+			{
+				continue;
+			}
+			depth += b->bOpen ? 1 : -1;
+			if (depth + 1 < target)
+			{
+				return BracketPos{ line, b->column };
+			}
+		}
+		return this->findClose(line + 1, pair, target);
+	}
+	COMFYDX_API std::optional<BracketBlock> BracketIndex::enclosingBlock(std::size_t line, std::uint32_t column) const
+	{
+		std::array<std::int64_t, maxBracketPairs> depths;
+		auto node = this->locate(line, depths.data());
+		if (node == nullptr)
+		{
+			return std::nullopt;
+		}
+		for (const auto & b : node->line.brackets)
+		{
+			if (b.column >= column)
+			{
+				break;
+			}
+			depths[b.pair] += b.bOpen ? 1 : -1;
+		}
+
+		// Innermost is the open found last among all pairs
+		std::optional<BracketPos> open;
+		for (std::size_t p = 0; p < maxBracketPairs; ++p)
+		{
+			auto pos = this->findOpen(line, column, p, depths[p] - 1);
+			if (pos && (!open || pos->line > open->line || (pos->line == open->line && pos->column > open->column)))
+			{
+				open = pos;
+			}
+		}
+		if (!open)
+		{
+			return std::nullopt;
+		}
+		return BracketBlock{ *open, this->matchingBracket(open->line, open->column) };
+	}
+	COMFYDX_API std::vector<FoldRange> BracketIndex::foldRanges(std::size_t first, std::size_t last) const
+	{
+		std::vector<FoldRange> ranges;
+		auto count = this->lineCount();
+		last = std::min(last, count);
+		std::array<std::int64_t, maxBracketPairs> depths;
+		for (auto l = first; l < last; ++l)
+		{
+			auto node = this->locate(l, depths.data());
+
+			// First open bracket left open by the line
+			std::array<std::vector<std::uint32_t>, maxBracketPairs> opens;
+			for (const auto & b : node->line.brackets)
+			{
+				if (b.bOpen)
+				{
+					opens[b.pair].push_back(b.column);
+				}
+				else if (!opens[b.pair].empty())
+				{
+					opens[b.pair].pop_back();
+				}
+			}
+			std::optional<std::uint32_t> open;
+			for (const auto & columns : opens)
+			{
+				if (!columns.empty() && (!open || columns.front() < *open))
+				{
+					open = columns.front();
+				}
+			}
+			if (open)
+			{
+				auto close = this->matchingBracket(l, *open);
+				if (close && close->line > l + 1)
+				{
+					ranges.push_back({ l, close->line - 1 });
+					continue;
+				}
+			}
+
+			// Else the lines indented deeper than it
+			auto indent = node->line.indent;
+			if (indent == LineStructure::blank)
+			{
+				continue;
+			}
+			auto next = firstIndentAtMost(this->m_root.get(), 0, l + 1, LineStructure::blank - 1);
+			if (next == npos || this->line(next).indent <= indent)
+			{
+				continue;
+			}
+			auto end = firstIndentAtMost(this->m_root.get(), 0, next, indent);
+			auto lastDeeper = lastIndentAtMost(this->m_root.get(), 0, (end == npos) ? count : end, LineStructure::blank - 1);
+			ranges.push_back({ l, lastDeeper });
+		}
+		return ranges;
+	}
+
+	void FoldState::update()
+	{
+		this->m_hiddenBefore.resize(this->m_collapsed.size() + 1);
+		this->m_hiddenBefore[0] = 0;
+		for (std::size_t i = 0; i < this->m_collapsed.size(); ++i)
+		{
+			const auto & r = this->m_collapsed[i];
+			this->m_hiddenBefore[i + 1] = this->m_hiddenBefore[i] + (r.last - r.first);
+		}
+	}
+
+	COMFYDX_API bool FoldState::collapse(FoldRange range)
+	{
+		if (range.last <= range.first || this->hidden(range.first))
+		{
+			return false;
+		}
+		// Regions before the header end before it, the ones starting inside have to end inside too
+		auto lo = std::partition_point(this->m_collapsed.begin(), this->m_collapsed.end(), [&](const FoldRange & r)
+		{
+			return r.first < range.first;
+		});
+		auto hi = lo;
+		for (; hi != this->m_collapsed.end() && hi->first <= range.last; ++hi)
+		{
+			if (hi->last > range.last)
+			{
+				return false;
+			}
+		}
+		if (hi - lo == 1 && lo->first == range.first && lo->last == range.last)
+		{
+			return false;
+		}
+		lo = this->m_collapsed.erase(lo, hi);
+		this->m_collapsed.insert(lo, range);
+		this->update();
+		return true;
+	}
+	COMFYDX_API bool FoldState::expand(std::size_t line)
+	{
+		auto it = std::partition_point(this->m_collapsed.begin(), this->m_collapsed.end(), [line](const FoldRange & r)
+		{
+			return r.first <= line;
+		});
+		if (it == this->m_collapsed.begin() || (--it)->last < line)
+		{
+			return false;
+		}
+		this->m_collapsed.erase(it);
+		this->update();
+		return true;
+	}
+	COMFYDX_API void FoldState::expandAll() noexcept
+	{
+		this->m_collapsed.clear();
+		this->m_hiddenBefore.assign(1, 0);
+	}
+	COMFYDX_API void FoldState::edit(std::span<const text::LineEdit> edits)
+	{
+		if (this->m_collapsed.empty())
+		{
+			return;
+		}
+		// Back to front, so every edit still sees the line numbers it was made in
+		for (auto e = edits.rbegin(); e != edits.rend(); ++e)
+		{
+			auto end = e->first + e->removed;
+			std::erase_if(this->m_collapsed, [&](FoldRange & r)
+			{
+				if (r.last < e->first)
+				{
+					return false;
+				}
+				if (r.first > end)
+				{
+					r.first += e->added;
+					r.first -= e->removed;
+					r.last += e->added;
+					r.last -= e->removed;
+					return false;
+				}
+				// Edited in the hidden lines only, the region grows or shrinks with them
+				if (r.first < e->first && end <= r.last)
+				{
+					r.last += e->added;
+					r.last -= e->removed;
+					return r.last <= r.first;
+				}
+				return true;
+			});
+		}
+		this->update();
+	}
+
+	COMFYDX_API bool FoldState::hidden(std::size_t line) const noexcept
+	{
+		auto it = std::partition_point(this->m_collapsed.begin(), this->m_collapsed.end(), [line](const FoldRange & r)
+		{
+			return r.first < line;
+		});
+		return it != this->m_collapsed.begin() && line <= (it - 1)->last;
+	}
+	COMFYDX_API std::size_t FoldState::visibleLine(std::size_t line) const noexcept
+	{
+		auto i = std::size_t(std::partition_point(this->m_collapsed.begin(), this->m_collapsed.end(), [line](const FoldRange & r)
+		{
+			return r.first < line;
+		}) - this->m_collapsed.begin());
+		if (i > 0 && line <= this->m_collapsed[i - 1].last)
+		{
+			--i;
+			line = this->m_collapsed[i].first;
+		}
+		return line - this->m_hiddenBefore[i];
+	}
+	COMFYDX_API std::size_t FoldState::documentLine(std::size_t visible) const noexcept
+	{
+		// Last region whose header is at or above the row
+		std::size_t lo = 0, hi = this->m_collapsed.size();
+		while (lo < hi)
+		{
+			auto mid = (lo + hi) / 2;
+			if (this->m_collapsed[mid].first - this->m_hiddenBefore[mid] <= visible)
+			{
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+		if (lo == 0)
+		{
+			return visible;
+		}
+		const auto & r = this->m_collapsed[lo - 1];
+		if (r.first - this->m_hiddenBefore[lo - 1] == visible)
+		{
+			return r.first;
+		}
+		return visible + this->m_hiddenBefore[lo];
+	}
+}
@@ -0,0 +1,418 @@
+#include "pch.hpp"
+#include "columnIndex.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CE_SSE2 1
+#endif
+
+namespace ce
+{
+	namespace
+	{
+		struct Range
+		{
+			char32_t first, last;
+		};
+
+		// Combining marks, joiners, variation selectors, emoji modifiers and tags
+		constexpr Range extenders[]
+		{
+			{ 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF },
+			{ 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A },
+			{ 0x064B, 0x065F }, { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+			{ 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0900, 0x0903 }, { 0x093A, 0x094F },
+			{ 0x0951, 0x0957 }, { 0x0962, 0x0963 }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A },
+			{ 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF }, { 0x200C, 0x200D },
+			{ 0x20D0, 0x20FF }, { 0x302A, 0x302F }, { 0x3099, 0x309A }, { 0xFE00, 0xFE0F },
+			{ 0xFE20, 0xFE2F }, { 0x1F3FB, 0x1F3FF }, { 0xE0020, 0xE007F }, { 0xE0100, 0xE01EF },
+		};
+		constexpr Range wide[]
+		{
+			{ 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC },
+			{ 0x2614, 0x2615 }, { 0x2648, 0x2653 }, { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE },
+			{ 0x2705, 0x2705 }, { 0x270A, 0x270B }, { 0x2728, 0x2728 }, { 0x274C, 0x274C },
+			{ 0x2753, 0x2755 }, { 0x2795, 0x2797 }, { 0x2B1B, 0x2B1C }, { 0x2E80, 0x303E },
+			{ 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+			{ 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 },
+			{ 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x18AFF },
+			{ 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E },
+			{ 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 }, { 0x1F300, 0x1F64F }, { 0x1F680, 0x1F6FF },
+			{ 0x1F7E0, 0x1F7EB }, { 0x1F900, 0x1F9FF }, { 0x1FA70, 0x1FAFF }, { 0x20000, 0x3FFFD },
+		};
+
+		template<std::size_t N>
+		[[nodiscard]] bool inTable(const Range(&table)[N], char32_t cp) noexcept
+		{
+			if (cp < table[0].first)
+			{
+				return false;
+			}
+			auto it = std::upper_bound(std::begin(table), std::end(table), cp, [](char32_t val, const Range & r)
+			{
+				return val < r.first;
+			});
+			return cp <= std::prev(it)->last;
+		}
+
+		[[nodiscard]] constexpr bool isControl(char32_t cp) noexcept
+		{
+			return cp < 0x20 || (cp >= 0x7F && cp < 0xA0);
+		}
+		[[nodiscard]] constexpr bool isRegional(char32_t cp) noexcept
+		{
+			return cp >= 0x1F1E6 && cp <= 0x1F1FF;
+		}
+		[[nodiscard]] constexpr bool isPictographic(char32_t cp) noexcept
+		{
+			return (cp >= 0x2600 && cp <= 0x27BF) || (cp >= 0x1F000 && cp <= 0x1FAFF);
+		}
+
+		struct Step
+		{
+			char32_t cp;
+			std::uint8_t len;
+			bool bStarts;
+		};
+
+		// Decodes like Utf8ToUtf16, a broken sequence is one U+FFFD spanning its maximal subpart
+		Step peek(const ColumnIndex::Scanner & s, std::string_view line) noexcept
+		{
+			auto p = reinterpret_cast<const unsigned char *>(line.data()) + s.pos.byte;
+			auto avail = line.size() - s.pos.byte;
+
+			Step st{ 0xFFFD, 1, true };
+			unsigned char lead = p[0];
+			unsigned need = 0;
+			unsigned char lower = 0x80, upper = 0xBF;
+			if (lead < 0x80)
+			{
+				st.cp = lead;
+			}
+			else if (lead >= 0xC2 && lead <= 0xDF)
+			{
+				need = 1;
+				st.cp = lead & 0x1F;
+			}
+			else if (lead >= 0xE0 && lead <= 0xEF)
+			{
+				need = 2;
+				st.cp = lead & 0x0F;
+				lower = (lead == 0xE0) ? 0xA0 : 0x80;
+				upper = (lead == 0xED) ? 0x9F : 0xBF;
+			}
+			else if (lead >= 0xF0 && lead <= 0xF4)
+			{
+				need = 3;
+				st.cp = lead & 0x07;
+				lower = (lead == 0xF0) ? 0x90 : 0x80;
+				upper = (lead == 0xF4) ? 0x8F : 0xBF;
+			}
+			for (unsigned i = 1; i <= need; ++i)
+			{
+				if (i >= avail || p[i] < lower || p[i] > upper)
+				{
+					st.cp = 0xFFFD;
+					break;
+				}
+				st.cp = (st.cp << 6) | (p[i] & 0x3F);
+				lower = 0x80;
+				upper = 0xBF;
+				++st.len;
+			}
+
+			// Simplified UAX #29 extended grapheme cluster rules
+			auto prev = s.prev;
+			if (s.bClusterStart)
+			{
+				st.bStarts = true;
+			}
+			else if (prev == '\r' && st.cp == '\n')
+			{
+				st.bStarts = false;
+			}
+			else if (isControl(prev) || isControl(st.cp))
+			{
+				st.bStarts = true;
+			}
+			else if (inTable(extenders, st.cp))
+			{
+				st.bStarts = false;
+			}
+			else if (prev == 0x200D && isPictographic(st.cp))
+			{
+				st.bStarts = false;
+			}
+			else if (isRegional(prev) && isRegional(st.cp))
+			{
+				st.bStarts = (s.regionalCount % 2) == 0;
+			}
+			else if (st.cp >= 0x1160 && st.cp <= 0x11FF && ((prev >= 0x1100 && prev <= 0x11FF) || (prev >= 0xAC00 && prev <= 0xD7A3)))
+			{
+				st.bStarts = false;
+			}
+			return st;
+		}
+		void advance(ColumnIndex::Scanner & s, const Step & st, std::uint8_t tabSize) noexcept
+		{
+			s.pos.byte += st.len;
+			s.pos.utf16 += (st.cp >= 0x10000) ? 2 : 1;
+			++s.pos.codePoint;
+			if (st.bStarts)
+			{
+				++s.pos.grapheme;
+				s.pos.column += (st.cp == '\t') ? tabSize - s.pos.column % tabSize : columnWidth(st.cp);
+			}
+			s.regionalCount = isRegional(st.cp) ? s.regionalCount + 1 : 0;
+			s.prev = st.cp;
+			s.bClusterStart = false;
+		}
+
+		constexpr std::size_t block{ 16 };
+
+		// Printable ASCII is one byte, one unit, one cluster and one column per character
+		[[nodiscard]] bool printableBlock(const ColumnIndex::Scanner & s, std::string_view line) noexcept
+		{
+			if (line.size() - s.pos.byte < block)
+			{
+				return false;
+			}
+			auto p = line.data() + s.pos.byte;
+#ifdef CE_SSE2
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			// Signed compare flags controls and all bytes >= 0x80 at once
+			auto bad = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+			return _mm_movemask_epi8(bad) == 0;
+#else
+			unsigned bad = 0;
+			for (std::size_t i = 0; i < block; ++i)
+			{
+				auto byte = static_cast<unsigned char>(p[i]);
+				bad |= unsigned(byte < 0x20 || byte >= 0x7F);
+			}
+			return bad == 0;
+#endif
+		}
+		void skipBlock(ColumnIndex::Scanner & s, std::string_view line) noexcept
+		{
+			s.pos.byte      += block;
+			s.pos.utf16     += block;
+			s.pos.codePoint += block;
+			s.pos.grapheme  += block;
+			s.pos.column    += block;
+			s.prev = static_cast<unsigned char>(line[s.pos.byte - 1]);
+			s.regionalCount = 0;
+			s.bClusterStart = false;
+		}
+
+		// Calls newRow(byte) for every row after the first one, returns the row count
+		template<typename Fn>
+		std::size_t wrap(std::string_view line, std::size_t columns, std::uint8_t tabSize, Fn && newRow)
+		{
+			columns = std::max<std::size_t>(columns, 1);
+			tabSize = (tabSize == 0) ? std::uint8_t(1) : tabSize;
+			// Only tabs are wider than their bytes
+			if (line.size() <= columns && line.find('\t') == std::string_view::npos)
+			{
+				return 1;
+			}
+
+			ColumnIndex::Scanner s{};
+			std::size_t rows = 1;
+			TextPos row{}, wordStart{};
+			auto startRow = [&](const TextPos & pos)
+			{
+				row = pos;
+				++rows;
+				newRow(pos.byte);
+			};
+			while (s.pos.byte < line.size())
+			{
+				if (s.pos.column - row.column + block <= columns && printableBlock(s, line))
+				{
+					auto space = line.substr(s.pos.byte, block).rfind(' ');
+					if (space != std::string_view::npos)
+					{
+						wordStart = s.pos;
+						wordStart.byte += space + 1;
+						wordStart.column += space + 1;
+					}
+					skipBlock(s, line);
+					continue;
+				}
+
+				auto st = peek(s, line);
+				auto before = s.pos;
+				advance(s, st, tabSize);
+				if (!st.bStarts)
+				{
+					continue;
+				}
+				if (st.cp == ' ' || st.cp == '\t')
+				{
+					wordStart = s.pos;
+					continue;
+				}
+				if (s.pos.column - row.column > columns && before.byte > row.byte)
+				{
+					if (wordStart.byte > row.byte)
+					{
+						startRow(wordStart);
+					}
+					// A cluster that still doesn't fit starts a row of its own
+					if (s.pos.column - row.column > columns && before.byte > row.byte)
+					{
+						startRow(before);
+					}
+				}
+			}
+			return rows;
+		}
+	}
+
+	COMFYDX_API std::uint8_t columnWidth(char32_t cp) noexcept
+	{
+		if (cp < 0x7F)
+		{
+			return cp >= 0x20;
+		}
+		else if (isControl(cp) || inTable(extenders, cp))
+		{
+			return 0;
+		}
+		return inTable(wide, cp) ? 2 : 1;
+	}
+
+	void ColumnIndex::build(std::string_view line, Unit unit, std::size_t value) noexcept
+	{
+		auto & s = this->m_build;
+		while (!this->m_bComplete && ColumnIndex::get(s.pos, unit) <= value)
+		{
+			if (s.pos.byte >= line.size())
+			{
+				this->m_bComplete = true;
+				break;
+			}
+
+			bool due = s.pos.codePoint - this->m_checkpoints.back().codePoint >= this->m_interval;
+			if (printableBlock(s, line))
+			{
+				if (due)
+				{
+					this->m_checkpoints.push_back(s.pos);
+				}
+				skipBlock(s, line);
+				continue;
+			}
+
+			auto st = peek(s, line);
+			if (due && st.bStarts)
+			{
+				this->m_checkpoints.push_back(s.pos);
+			}
+			advance(s, st, this->m_tabSize);
+		}
+	}
+
+	COMFYDX_API TextPos ColumnIndex::find(std::string_view line, Unit unit, std::size_t value) noexcept
+	{
+		this->build(line, unit, value);
+
+		auto first = this->m_checkpoints.begin() + 1, last = this->m_checkpoints.end();
+		auto it = last;
+		if (unit == Unit::column)
+		{
+			// Zero-width clusters share their column with the next one, start before the first of them
+			it = std::lower_bound(first, last, value, [](const TextPos & pos, std::size_t val)
+			{
+				return pos.column < val;
+			});
+		}
+		else
+		{
+			it = std::upper_bound(first, last, value, [unit](std::size_t val, const TextPos & pos)
+			{
+				return val < ColumnIndex::get(pos, unit);
+			});
+		}
+		Scanner s{ *std::prev(it) };
+
+		const bool clusterUnit = (unit == Unit::grapheme || unit == Unit::column);
+		// Checkpoints are always cluster starts
+		auto boundary = s.pos;
+		while (s.pos.byte < line.size())
+		{
+			if (ColumnIndex::get(s.pos, unit) + block <= value && printableBlock(s, line))
+			{
+				skipBlock(s, line);
+				boundary = s.pos;
+				--boundary.byte;
+				--boundary.utf16;
+				--boundary.codePoint;
+				--boundary.grapheme;
+				--boundary.column;
+				continue;
+			}
+
+			auto st = peek(s, line);
+			if (!clusterUnit || st.bStarts)
+			{
+				auto current = ColumnIndex::get(s.pos, unit);
+				if (current == value)
+				{
+					return s.pos;
+				}
+				else if (current > value)
+				{
+					return boundary;
+				}
+				boundary = s.pos;
+			}
+			advance(s, st, this->m_tabSize);
+		}
+		return (ColumnIndex::get(s.pos, unit) <= value) ? s.pos : boundary;
+	}
+	COMFYDX_API TextPos ColumnIndex::end(std::string_view line) noexcept
+	{
+		this->build(line, Unit::byte, line.size());
+		return this->m_build.pos;
+	}
+
+	COMFYDX_API void ColumnIndex::invalidate(std::size_t fromByte) noexcept
+	{
+		// A code point starting less than 4 bytes before the edit may decode differently now
+		auto keep = (fromByte > 4) ? fromByte - 4 : 0;
+		auto it = std::upper_bound(this->m_checkpoints.begin() + 1, this->m_checkpoints.end(), keep, [](std::size_t val, const TextPos & pos)
+		{
+			return val < pos.byte;
+		});
+		this->m_checkpoints.erase(it, this->m_checkpoints.end());
+
+		this->m_build = Scanner{ this->m_checkpoints.back() };
+		this->m_bComplete = false;
+	}
+	COMFYDX_API void ColumnIndex::setTabSize(std::uint8_t tabSize) noexcept
+	{
+		this->m_tabSize = (tabSize == 0) ? std::uint8_t(1) : tabSize;
+		this->invalidate();
+	}
+
+	COMFYDX_API std::size_t wrappedRows(std::string_view line, std::size_t columns, std::uint8_t tabSize) noexcept
+	{
+		return wrap(line, columns, tabSize, [](std::size_t)
+		{
+		});
+	}
+	COMFYDX_API std::vector<std::size_t> wrapLine(std::string_view line, std::size_t columns, std::uint8_t tabSize)
+	{
+		std::vector<std::size_t> starts;
+		wrap(line, columns, tabSize, [&starts](std::size_t byte)
+		{
+			starts.push_back(byte);
+		});
+		return starts;
+	}
+}
@@ -0,0 +1,762 @@
+#include "pch.hpp"
+#include "diff.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <bit>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define CE_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char *>(p), _MM_HINT_T0)
+#else
+#define CE_PREFETCH(p) static_cast<void>(p)
+#endif
+
+namespace cdx::text
+{
+	namespace
+	{
+		constexpr std::uint32_t noId{ 0xFFFFFFFF };
+		constexpr std::size_t npos{ std::size_t(-1) };
+		// Lines occurring more often in a range aren't used as anchors by histogram diff
+		constexpr std::uint32_t maxOccurrences{ 64 };
+
+		// Thrown from deep inside the algorithms when the diff is cancelled
+		struct Stopped
+		{
+		};
+
+		[[nodiscard]] std::uint64_t hashLine(std::string_view line) noexcept
+		{
+			constexpr std::uint64_t prime{ 0x9E3779B97F4A7C15 };
+			std::uint64_t h = line.size();
+			std::size_t i = 0;
+			for (; i + 8 <= line.size(); i += 8)
+			{
+				std::uint64_t word;
+				std::memcpy(&word, line.data() + i, 8);
+				h = (std::rotl(h, 23) ^ word) * prime;
+			}
+			if (i < line.size())
+			{
+				std::uint64_t word = 0;
+				std::memcpy(&word, line.data() + i, line.size() - i);
+				h = (std::rotl(h, 23) ^ word) * prime;
+			}
+			h ^= h >> 29;
+			h *= 0xBF58476D1CE4E5B9;
+			return h ^ (h >> 32);
+		}
+
+		/*
+		 * Gives equal lines of both texts the same id, open addressing on the line
+		 * hash. A hash match is only a candidate, the bytes are compared with the
+		 * id's first line, so colliding lines get ids of their own.
+		 */
+		class LineIds
+		{
+		private:
+			struct Slot
+			{
+				std::uint64_t hash{};
+				std::uint32_t id{ noId };
+			};
+			// Slots of the lines this far ahead are fetched while the current one is probed
+			static constexpr std::size_t prefetchAhead{ 16 };
+
+			std::vector<Slot> m_slots = std::vector<Slot>(1 << 12);
+			// First line of every id, views into the snapshots or m_joined
+			std::vector<std::string_view> m_lines;
+			// Lines that were put together from several chunks
+			std::deque<std::string> m_joined;
+
+			void grow()
+			{
+				std::vector<Slot> slots(this->m_slots.size() * 2);
+				auto mask = slots.size() - 1;
+				for (const auto & slot : this->m_slots)
+				{
+					if (slot.id == noId)
+					{
+						continue;
+					}
+					auto i = std::size_t(slot.hash) & mask;
+					while (slots[i].id != noId)
+					{
+						i = (i + 1) & mask;
+					}
+					slots[i] = slot;
+				}
+				this->m_slots = std::move(slots);
+			}
+
+		public:
+			// Copy of a line that doesn't live in one chunk, valid as long as the ids
+			[[nodiscard]] std::string_view keep(std::string_view line)
+			{
+				return this->m_joined.emplace_back(line);
+			}
+			// 'lines' must stay valid as long as the ids
+			void intern(std::span<const std::uint64_t> hashes, std::span<const std::string_view> lines, std::vector<std::uint32_t> & out)
+			{
+				while (2 * (this->m_lines.size() + hashes.size()) >= this->m_slots.size())
+				{
+					this->grow();
+				}
+				auto mask = this->m_slots.size() - 1;
+				for (std::size_t k = 0; k < hashes.size(); ++k)
+				{
+					if (k + prefetchAhead < hashes.size())
+					{
+						CE_PREFETCH(&this->m_slots[std::size_t(hashes[k + prefetchAhead]) & mask]);
+					}
+					auto hash = hashes[k];
+					for (auto i = std::size_t(hash) & mask;; i = (i + 1) & mask)
+					{
+						auto & slot = this->m_slots[i];
+						if (slot.id == noId)
+						{
+							slot = { hash, std::uint32_t(this->m_lines.size()) };
+							out.push_back(slot.id);
+							this->m_lines.push_back(lines[k]);
+							break;
+						}
+						if (slot.hash == hash && this->m_lines[slot.id] == lines[k])
+						{
+							out.push_back(slot.id);
+							break;
+						}
+					}
+				}
+			}
+			[[nodiscard]] std::size_t count() const noexcept
+			{
+				return this->m_lines.size();
+			}
+		};
+
+		// Ids of the lines in [start, end), which ends at a line start or the end of the text
+		void collect(const TextSnapshot & text, std::size_t start, std::size_t end, LineIds & ids, std::vector<std::uint32_t> & out, const std::stop_token & stop)
+		{
+			constexpr std::size_t batch{ 1024 };
+			std::vector<std::uint64_t> hashes;
+			std::vector<std::string_view> lines;
+			hashes.reserve(batch);
+			lines.reserve(batch);
+			// Line that started in an earlier chunk
+			std::string pending;
+			auto add = [&](std::string_view line)
+			{
+				hashes.push_back(hashLine(line));
+				lines.push_back(line);
+				if (hashes.size() == batch)
+				{
+					ids.intern(hashes, lines, out);
+					hashes.clear();
+					lines.clear();
+				}
+			};
+			text.forEachChunk(start, end - start, [&](std::string_view chunk)
+			{
+				if (stop.stop_requested())
+				{
+					throw Stopped{};
+				}
+				while (!chunk.empty())
+				{
+					auto lf = chunk.find('\n');
+					if (lf == std::string_view::npos)
+					{
+						pending.append(chunk);
+						break;
+					}
+					auto line = chunk.substr(0, lf + 1);
+					chunk.remove_prefix(lf + 1);
+					if (pending.empty())
+					{
+						add(line);
+					}
+					else
+					{
+						pending.append(line);
+						add(ids.keep(pending));
+						pending.clear();
+					}
+				}
+				return true;
+			});
+			// The last line, empty if the text ends in '\n'
+			if (end == text.size())
+			{
+				add(ids.keep(pending));
+			}
+			ids.intern(hashes, lines, out);
+		}
+
+		// Offset of the first byte where two runs of bytes differ, or 'count'
+		[[nodiscard]] std::size_t mismatch(const char * a, const char * b, std::size_t count) noexcept
+		{
+			constexpr std::size_t block{ 256 };
+			std::size_t i = 0;
+			while (i + block <= count && std::memcmp(a + i, b + i, block) == 0)
+			{
+				i += block;
+			}
+			while (i < count && a[i] == b[i])
+			{
+				++i;
+			}
+			return i;
+		}
+		// Same from the end, the amount of equal bytes before both ends
+		[[nodiscard]] std::size_t mismatchBack(const char * aEnd, const char * bEnd, std::size_t count) noexcept
+		{
+			constexpr std::size_t block{ 256 };
+			std::size_t i = 0;
+			while (i + block <= count && std::memcmp(aEnd - i - block, bEnd - i - block, block) == 0)
+			{
+				i += block;
+			}
+			while (i < count && aEnd[-std::ptrdiff_t(i) - 1] == bEnd[-std::ptrdiff_t(i) - 1])
+			{
+				++i;
+			}
+			return i;
+		}
+
+		/*
+		 * Bytes both texts start with. Snapshots of one table share most of their
+		 * pieces, runs at the same buffer address are equal without reading them.
+		 */
+		[[nodiscard]] std::size_t commonPrefix(const TextSnapshot & a, std::span<const Piece> pa, const TextSnapshot & b, std::span<const Piece> pb) noexcept
+		{
+			std::size_t common = 0, i = 0, j = 0, inA = 0, inB = 0;
+			while (i < pa.size() && j < pb.size())
+			{
+				auto x = a.pieceText(pa[i]).substr(inA);
+				auto y = b.pieceText(pb[j]).substr(inB);
+				auto count = std::min(x.size(), y.size());
+				if (x.data() != y.data())
+				{
+					auto equal = mismatch(x.data(), y.data(), count);
+					if (equal != count)
+					{
+						return common + equal;
+					}
+				}
+				common += count;
+				inA += count;
+				inB += count;
+				if (inA == pa[i].length)
+				{
+					++i;
+					inA = 0;
+				}
+				if (inB == pb[j].length)
+				{
+					++j;
+					inB = 0;
+				}
+			}
+			return common;
+		}
+		// Bytes both texts end with, up to 'limit'
+		[[nodiscard]] std::size_t commonSuffix(const TextSnapshot & a, std::span<const Piece> pa, const TextSnapshot & b, std::span<const Piece> pb, std::size_t limit) noexcept
+		{
+			// Bytes of the last unfinished pieces that were compared already
+			std::size_t common = 0, i = pa.size(), j = pb.size(), inA = 0, inB = 0;
+			while (i != 0 && j != 0 && common < limit)
+			{
+				auto x = a.pieceText(pa[i - 1]);
+				auto y = b.pieceText(pb[j - 1]);
+				x.remove_suffix(inA);
+				y.remove_suffix(inB);
+				auto count = std::min({ x.size(), y.size(), limit - common });
+				if (x.data() + x.size() != y.data() + y.size())
+				{
+					auto equal = mismatchBack(x.data() + x.size(), y.data() + y.size(), count);
+					if (equal != count)
+					{
+						return common + equal;
+					}
+				}
+				common += count;
+				inA += count;
+				inB += count;
+				if (inA == pa[i - 1].length)
+				{
+					--i;
+					inA = 0;
+				}
+				if (inB == pb[j - 1].length)
+				{
+					--j;
+					inB = 0;
+				}
+			}
+			return std::min(common, limit);
+		}
+
+		// Lines [a, a + length) equal lines [b, b + length)
+		struct Run
+		{
+			std::size_t a, b, length;
+		};
+		struct Range
+		{
+			std::size_t a0, a1, b0, b1;
+		};
+
+		class Differ
+		{
+		private:
+			std::span<const std::uint32_t> m_a, m_b;
+			const std::stop_token & m_stop;
+			std::vector<Run> m_runs;
+
+			// Per line id
+			std::vector<std::uint32_t> m_count;
+			std::vector<std::size_t> m_head;
+			std::vector<std::uint8_t> m_sides;
+			// Per line of a, next occurrence of the same line in the range
+			std::vector<std::size_t> m_next;
+			std::vector<std::int64_t> m_forward, m_backward;
+
+			void checkStop() const
+			{
+				if (this->m_stop.stop_requested())
+				{
+					throw Stopped{};
+				}
+			}
+
+			// Emits the common lines at both ends and removes them from the range
+			static void strip(std::span<const std::uint32_t> a, std::span<const std::uint32_t> b, Range & r, std::vector<Run> & runs)
+			{
+				auto start = r.a0;
+				while (r.a0 < r.a1 && r.b0 < r.b1 && a[r.a0] == b[r.b0])
+				{
+					++r.a0;
+					++r.b0;
+				}
+				if (r.a0 != start)
+				{
+					runs.push_back({ start, r.b0 - (r.a0 - start), r.a0 - start });
+				}
+				auto end = r.a1;
+				while (r.a1 > r.a0 && r.b1 > r.b0 && a[r.a1 - 1] == b[r.b1 - 1])
+				{
+					--r.a1;
+					--r.b1;
+				}
+				if (r.a1 != end)
+				{
+					runs.push_back({ r.a1, r.b1, end - r.a1 });
+				}
+			}
+
+			// Longest run around one of the rarest lines both sides of the range share
+			[[nodiscard]] bool anchor(const Range & r, Run & best)
+			{
+				const auto & a = this->m_a;
+				const auto & b = this->m_b;
+				for (auto i = r.a1; i-- > r.a0;)
+				{
+					auto id = a[i];
+					if (this->m_count[id]++ == 0)
+					{
+						this->m_head[id] = npos;
+					}
+					this->m_next[i] = this->m_head[id];
+					this->m_head[id] = i;
+				}
+
+				std::size_t bestLength = 0;
+				auto bestCount = maxOccurrences + 1;
+				for (auto j = r.b0; j < r.b1;)
+				{
+					auto count = this->m_count[b[j]];
+					if (count == 0 || count > maxOccurrences || count > bestCount)
+					{
+						++j;
+						continue;
+					}
+					// Lines of b inside a run found from this one can't start a longer one
+					auto nextJ = j + 1;
+					for (auto i = this->m_head[b[j]]; i != npos; i = this->m_next[i])
+					{
+						auto as = i, bs = j, ae = i + 1, be = j + 1;
+						auto rarest = count;
+						while (as > r.a0 && bs > r.b0 && a[as - 1] == b[bs - 1])
+						{
+							--as;
+							--bs;
+							rarest = std::min(rarest, this->m_count[a[as]]);
+						}
+						while (ae < r.a1 && be < r.b1 && a[ae] == b[be])
+						{
+							rarest = std::min(rarest, this->m_count[a[ae]]);
+							++ae;
+							++be;
+						}
+						nextJ = std::max(nextJ, be);
+						if (ae - as > bestLength || rarest < bestCount)
+						{
+							best = { as, bs, ae - as };
+							bestLength = ae - as;
+							bestCount = rarest;
+						}
+					}
+					j = nextJ;
+				}
+
+				for (auto i = r.a0; i < r.a1; ++i)
+				{
+					this->m_count[a[i]] = 0;
+				}
+				return bestLength != 0;
+			}
+
+			/*
+			 * Middle snake of a range as in Myers' linear space refinement: the
+			 * forward and backward searches meet on the diagonal run of an optimal
+			 * path, the halves before and after it are solved separately.
+			 */
+			[[nodiscard]] bool middleSnake(std::span<const std::uint32_t> a, std::span<const std::uint32_t> b, const Range & r, Range & snake)
+			{
+				auto n = std::int64_t(r.a1 - r.a0), m = std::int64_t(r.b1 - r.b0);
+				auto delta = n - m;
+				bool bOdd = (delta & 1) != 0;
+				auto limit = std::min<std::int64_t>((n + m + 1) / 2, std::int64_t(maxDiffCost / 2) + 1);
+				auto offset = limit + 1;
+				this->m_forward.assign(std::size_t(2 * offset + 1), 0);
+				this->m_backward.assign(std::size_t(2 * offset + 1), 0);
+				auto * vf = this->m_forward.data() + offset;
+				auto * vb = this->m_backward.data() + offset;
+				auto at = [&](std::int64_t x, std::int64_t y)
+				{
+					return a[r.a0 + std::size_t(x)] == b[r.b0 + std::size_t(y)];
+				};
+
+				for (std::int64_t d = 0; d <= limit; ++d)
+				{
+					if ((d & 63) == 0)
+					{
+						this->checkStop();
+					}
+					for (auto k = -d; k <= d; k += 2)
+					{
+						auto x = (k == -d || (k != d && vf[k - 1] < vf[k + 1])) ? vf[k + 1] : vf[k - 1] + 1;
+						auto y = x - k;
+						auto x0 = x, y0 = y;
+						while (x < n && y < m && at(x, y))
+						{
+							++x;
+							++y;
+						}
+						vf[k] = x;
+						if (bOdd && k - delta >= -(d - 1) && k - delta <= d - 1 && vf[k] + vb[delta - k] >= n)
+						{
+							snake = { r.a0 + std::size_t(x0), r.a0 + std::size_t(x), r.b0 + std::size_t(y0), r.b0 + std::size_t(y) };
+							return true;
+						}
+					}
+					for (auto k = -d; k <= d; k += 2)
+					{
+						auto x = (k == -d || (k != d && vb[k - 1] < vb[k + 1])) ? vb[k + 1] : vb[k - 1] + 1;
+						auto y = x - k;
+						auto x0 = x, y0 = y;
+						while (x < n && y < m && at(n - x - 1, m - y - 1))
+						{
+							++x;
+							++y;
+						}
+						vb[k] = x;
+						if (!bOdd && k - delta >= -d && k - delta <= d && vb[k] + vf[delta - k] >= n)
+						{
+							snake = { r.a0 + std::size_t(n - x), r.a0 + std::size_t(n - x0), r.b0 + std::size_t(m - y), r.b0 + std::size_t(m - y0) };
+							return true;
+						}
+					}
+				}
+				// Too far apart, the range stays a single change
+				return false;
+			}
+			void lcs(std::span<const std::uint32_t> a, std::span<const std::uint32_t> b, Range r, std::vector<Run> & runs)
+			{
+				strip(a, b, r, runs);
+				if (r.a0 == r.a1 || r.b0 == r.b1)
+				{
+					return;
+				}
+				Range snake;
+				if (!this->middleSnake(a, b, r, snake))
+				{
+					return;
+				}
+				this->lcs(a, b, { r.a0, snake.a0, r.b0, snake.b0 }, runs);
+				if (snake.a1 != snake.a0)
+				{
+					runs.push_back({ snake.a0, snake.b0, snake.a1 - snake.a0 });
+				}
+				this->lcs(a, b, { snake.a1, r.a1, snake.b1, r.b1 }, runs);
+			}
+
+		public:
+			Differ(std::span<const std::uint32_t> a, std::span<const std::uint32_t> b, std::size_t ids, const std::stop_token & stop)
+				: m_a{ a }, m_b{ b }, m_stop{ stop }, m_count(ids), m_head(ids), m_sides(ids), m_next(a.size())
+			{
+			}
+
+			void myers(Range r)
+			{
+				const auto & a = this->m_a;
+				const auto & b = this->m_b;
+				// Lines only one side has can't be matched, leaving them out shortens the search
+				for (auto i = r.a0; i < r.a1; ++i)
+				{
+					this->m_sides[a[i]] |= 1;
+				}
+				for (auto j = r.b0; j < r.b1; ++j)
+				{
+					this->m_sides[b[j]] |= 2;
+				}
+				std::vector<std::uint32_t> fa, fb;
+				std::vector<std::size_t> ia, ib;
+				for (auto i = r.a0; i < r.a1; ++i)
+				{
+					if (this->m_sides[a[i]] == 3)
+					{
+						fa.push_back(a[i]);
+						ia.push_back(i);
+					}
+				}
+				for (auto j = r.b0; j < r.b1; ++j)
+				{
+					if (this->m_sides[b[j]] == 3)
+					{
+						fb.push_back(b[j]);
+						ib.push_back(j);
+					}
+				}
+				for (auto i = r.a0; i < r.a1; ++i)
+				{
+					this->m_sides[a[i]] = 0;
+				}
+				for (auto j = r.b0; j < r.b1; ++j)
+				{
+					this->m_sides[b[j]] = 0;
+				}
+
+				std::vector<Run> runs;
+				this->lcs(fa, fb, { 0, fa.size(), 0, fb.size() }, runs);
+				// Back to the original lines, a run breaks up where dropped lines were between
+				for (const auto & run : runs)
+				{
+					for (std::size_t k = 0; k < run.length;)
+					{
+						auto start = k++;
+						while (k < run.length && ia[run.a + k] == ia[run.a + k - 1] + 1 && ib[run.b + k] == ib[run.b + k - 1] + 1)
+						{
+							++k;
+						}
+						this->m_runs.push_back({ ia[run.a + start], ib[run.b + start], k - start });
+					}
+				}
+			}
+			void histogram(Range whole)
+			{
+				std::vector<Range> todo{ whole };
+				while (!todo.empty())
+				{
+					auto r = todo.back();
+					todo.pop_back();
+					strip(this->m_a, this->m_b, r, this->m_runs);
+					if (r.a0 == r.a1 || r.b0 == r.b1)
+					{
+						continue;
+					}
+					this->checkStop();
+					Run best{};
+					if (!this->anchor(r, best))
+					{
+						this->myers(r);
+						continue;
+					}
+					this->m_runs.push_back(best);
+					todo.push_back({ r.a0, best.a, r.b0, best.b });
+					todo.push_back({ best.a + best.length, r.a1, best.b + best.length, r.b1 });
+				}
+			}
+
+			// Hunks of the lines after the first 'base' ones, which are equal
+			[[nodiscard]] std::vector<DiffHunk> hunks(std::size_t base)
+			{
+				std::sort(this->m_runs.begin(), this->m_runs.end(), [](const Run & x, const Run & y)
+				{
+					return x.a < y.a;
+				});
+				std::vector<DiffHunk> hunks;
+				std::size_t a = 0, b = 0;
+				for (const auto & run : this->m_runs)
+				{
+					if (run.a != a || run.b != b)
+					{
+						hunks.push_back({ base + a, run.a - a, base + b, run.b - b });
+					}
+					a = run.a + run.length;
+					b = run.b + run.length;
+				}
+				if (a != this->m_a.size() || b != this->m_b.size())
+				{
+					hunks.push_back({ base + a, this->m_a.size() - a, base + b, this->m_b.size() - b });
+				}
+				return hunks;
+			}
+		};
+
+		// First byte of a line, the end of the text for the line after the last one
+		[[nodiscard]] std::size_t lineOffset(const TextSnapshot & text, std::size_t line) noexcept
+		{
+			return (line == 0) ? 0 : std::min(text.lineEnd(line - 1) + 1, text.size());
+		}
+	}
+
+	COMFYDX_API std::optional<std::vector<DiffHunk>> diffLines(const TextSnapshot & from, const TextSnapshot & to, DiffAlgorithm algorithm, std::stop_token stop)
+	{
+		try
+		{
+			// Only the lines between the common start and end are hashed
+			auto pa = from.pieces(0, from.size());
+			auto pb = to.pieces(0, to.size());
+			auto head = commonPrefix(from, pa, to, pb);
+			auto tail = commonSuffix(from, pa, to, pb, std::min(from.size(), to.size()) - head);
+			// A line belongs to the common end if the '\n' before it does
+			auto first = from.lineOf(head);
+			auto endA = from.lineOf(from.size() - tail) + 1;
+			auto endB = to.lineOf(to.size() - tail) + 1;
+
+			LineIds ids;
+			std::vector<std::uint32_t> a, b;
+			collect(from, lineOffset(from, first), lineOffset(from, endA), ids, a, stop);
+			collect(to, lineOffset(to, first), lineOffset(to, endB), ids, b, stop);
+
+			Differ differ{ a, b, ids.count(), stop };
+			Range whole{ 0, a.size(), 0, b.size() };
+			if (algorithm == DiffAlgorithm::histogram)
+			{
+				differ.histogram(whole);
+			}
+			else
+			{
+				differ.myers(whole);
+			}
+			return differ.hunks(first);
+		}
+		catch (const Stopped &)
+		{
+			return std::nullopt;
+		}
+	}
+
+	COMFYDX_API std::vector<TextEdit> diffEdits(const TextSnapshot & from, const TextSnapshot & to, std::span<const DiffHunk> hunks, std::string & storage)
+	{
+		// All new text first, the views are taken once the storage stopped growing
+		std::size_t total = 0;
+		for (const auto & hunk : hunks)
+		{
+			total += lineOffset(to, hunk.newFirst + hunk.newCount) - lineOffset(to, hunk.newFirst);
+		}
+		storage.clear();
+		storage.reserve(total);
+		for (const auto & hunk : hunks)
+		{
+			auto start = lineOffset(to, hunk.newFirst);
+			to.forEachChunk(start, lineOffset(to, hunk.newFirst + hunk.newCount) - start, [&storage](std::string_view chunk)
+			{
+				storage.append(chunk);
+				return true;
+			});
+		}
+
+		std::vector<TextEdit> edits;
+		edits.reserve(hunks.size());
+		std::size_t used = 0;
+		for (const auto & hunk : hunks)
+		{
+			auto start = lineOffset(from, hunk.oldFirst);
+			auto length = lineOffset(to, hunk.newFirst + hunk.newCount) - lineOffset(to, hunk.newFirst);
+			edits.push_back({ start, lineOffset(from, hunk.oldFirst + hunk.oldCount) - start, std::string_view{ storage }.substr(used, length) });
+			used += length;
+		}
+		return edits;
+	}
+	COMFYDX_API bool reload(PieceTable & table, UndoHistory * history, const TextSnapshot & to, std::stop_token stop)
+	{
+		auto from = table.snapshot();
+		auto hunks = diffLines(from, to, DiffAlgorithm::histogram, stop);
+		if (!hunks)
+		{
+			return false;
+		}
+		if (hunks->empty())
+		{
+			return true;
+		}
+
+		std::string storage;
+		auto edits = diffEdits(from, to, *hunks, storage);
+		if (history != nullptr)
+		{
+			history->apply(table, edits);
+		}
+		else
+		{
+			table.apply(edits);
+		}
+		return true;
+	}
+
+	COMFYDX_API DiffTask::DiffTask(TextSnapshot from, TextSnapshot to, Notify notify, DiffAlgorithm algorithm)
+		: m_from{ std::move(from) }, m_to{ std::move(to) }, m_algorithm{ algorithm }, m_notify{ std::move(notify) }
+	{
+		this->m_worker = std::jthread([this](std::stop_token stop)
+		{
+			this->work(stop);
+		});
+	}
+	COMFYDX_API DiffTask::~DiffTask() noexcept
+	{
+		this->cancel();
+		this->wait();
+	}
+
+	void DiffTask::work(std::stop_token stop) noexcept
+	{
+		try
+		{
+			this->m_hunks = diffLines(this->m_from, this->m_to, this->m_algorithm, stop);
+		}
+		catch (...)
+		{
+			this->m_hunks.reset();
+		}
+		this->m_bDone.store(true, std::memory_order_release);
+		if (this->m_hunks && this->m_notify)
+		{
+			this->m_notify();
+		}
+	}
+
+	COMFYDX_API void DiffTask::cancel() noexcept
+	{
+		this->m_worker.request_stop();
+	}
+	COMFYDX_API void DiffTask::wait() noexcept
+	{
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.join();
+		}
+	}
+}
@@ -0,0 +1,474 @@
+#include "pch.hpp"
+#include "encoding.hpp"
+
+#include <bit>
+#include <thread>
+#include <vector>
+#include <future>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CE_SSE2 1
+#endif
+
+namespace ce
+{
+	namespace
+	{
+		constexpr std::size_t block{ 16 };
+
+		[[nodiscard]] constexpr bool isControl(unsigned char byte) noexcept
+		{
+			// Controls that never show up in text, NUL is counted separately
+			return byte != 0 && byte < 0x20 && byte != '\t' && byte != '\n' && byte != '\r' && byte != '\f' && byte != 0x1B;
+		}
+		[[nodiscard]] constexpr bool isContinuation(unsigned char byte) noexcept
+		{
+			return (byte & 0xC0) == 0x80;
+		}
+
+#ifdef CE_SSE2
+		// Bit mask of the bytes in [first, last]
+		[[nodiscard]] std::uint32_t inRange(__m128i v, unsigned char first, unsigned char last) noexcept
+		{
+			auto off = _mm_sub_epi8(v, _mm_set1_epi8(char(first)));
+			return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8(char(last - first))), off)));
+		}
+		[[nodiscard]] std::uint32_t equalTo(__m128i v, unsigned char byte) noexcept
+		{
+			return std::uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(char(byte)))));
+		}
+
+		/*
+		 * Validates all sequences starting in the block at 'it', which must be at a
+		 * sequence start with two blocks readable. Returns the bytes they take,
+		 * continuation bytes past the block included, or 0 if one of them is broken.
+		 */
+		[[nodiscard]] std::size_t validUtf8Block(const unsigned char * it) noexcept
+		{
+			constexpr std::uint32_t blockMask{ (1u << block) - 1 };
+
+			auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+			auto nonAscii = std::uint32_t(_mm_movemask_epi8(lo));
+			if (nonAscii == 0)
+			{
+				return block;
+			}
+			// Continuation bytes of the last sequences may lie in the next block
+			auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it + block));
+			auto range = [lo, hi](unsigned char first, unsigned char last) noexcept
+			{
+				return inRange(lo, first, last) | (inRange(hi, first, last) << block);
+			};
+
+			auto lead2 = inRange(lo, 0xC2, 0xDF), lead3 = inRange(lo, 0xE0, 0xEF), lead4 = inRange(lo, 0xF0, 0xF4);
+			auto cont = range(0x80, 0xBF);
+			// Continuation bytes the leads need, any other one is stray
+			auto need = ((lead2 | lead3 | lead4) << 1) | ((lead3 | lead4) << 2) | (lead4 << 3);
+			if ((nonAscii & ~(lead2 | lead3 | lead4 | cont)) != 0 || (need & ~cont) != 0 || (cont & blockMask & ~need) != 0)
+			{
+				return 0;
+			}
+
+			// Second bytes making overlong forms, surrogates or code points past U+10FFFF
+			auto below90 = range(0x80, 0x8F), belowA0 = range(0x80, 0x9F);
+			if (((equalTo(lo, 0xE0) << 1) & belowA0) != 0 || ((equalTo(lo, 0xED) << 1) & ~belowA0) != 0 ||
+				((equalTo(lo, 0xF0) << 1) & below90) != 0 || ((equalTo(lo, 0xF4) << 1) & ~below90) != 0)
+			{
+				return 0;
+			}
+			return block + std::size_t(std::countr_one(need >> block));
+		}
+#endif
+
+		// Counts broken UTF-8 sequences, valid blocks are skipped vectorized, the rest is checked byte by byte
+		std::uint64_t countInvalidUtf8(const unsigned char * it, const unsigned char * end, bool complete) noexcept
+		{
+			std::uint64_t invalid = 0;
+#ifdef CE_SSE2
+			// A block with a broken sequence is left to the scalar check up to here
+			auto scalarUntil = it;
+#endif
+			while (it < end)
+			{
+#ifdef CE_SSE2
+				if (it >= scalarUntil)
+				{
+					while (end - it >= std::ptrdiff_t(2 * block))
+					{
+						auto valid = validUtf8Block(it);
+						if (valid == 0)
+						{
+							scalarUntil = it + block;
+							break;
+						}
+						it += valid;
+					}
+					while (end - it >= std::ptrdiff_t(block) && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(it))) == 0)
+					{
+						it += block;
+					}
+					if (it == end)
+					{
+						break;
+					}
+				}
+#endif
+				unsigned char lead = *it;
+				if (lead < 0x80)
+				{
+					++it;
+					continue;
+				}
+
+				unsigned need;
+				unsigned char lower = 0x80, upper = 0xBF;
+				if (lead >= 0xC2 && lead <= 0xDF)
+				{
+					need = 1;
+				}
+				else if (lead >= 0xE0 && lead <= 0xEF)
+				{
+					need = 2;
+					lower = (lead == 0xE0) ? 0xA0 : 0x80;
+					upper = (lead == 0xED) ? 0x9F : 0xBF;
+				}
+				else if (lead >= 0xF0 && lead <= 0xF4)
+				{
+					need = 3;
+					lower = (lead == 0xF0) ? 0x90 : 0x80;
+					upper = (lead == 0xF4) ? 0x8F : 0xBF;
+				}
+				else
+				{
+					++invalid;
+					++it;
+					continue;
+				}
+
+				++it;
+				for (; need > 0; --need)
+				{
+					if (it == end)
+					{
+						// Sequence cut by the end of a sample is not an error
+						invalid += complete;
+						return invalid;
+					}
+					if (*it < lower || *it > upper)
+					{
+						++invalid;
+						break;
+					}
+					lower = 0x80;
+					upper = 0xBF;
+					++it;
+				}
+			}
+			return invalid;
+		}
+
+		// 'data' must start at an even offset of the file for the NUL parity counts to be right
+		ByteStats scanCounts(const unsigned char * it, const unsigned char * end) noexcept
+		{
+			ByteStats st;
+			st.bytes = std::uint64_t(end - it);
+			bool prevCr = false;
+
+#ifdef CE_SSE2
+			const auto zero = _mm_setzero_si128(), vcr = _mm_set1_epi8('\r'), vlf = _mm_set1_epi8('\n');
+			const auto vspace = _mm_set1_epi8(0x20), even = _mm_set1_epi16(0x00FF);
+			const auto vtab = _mm_set1_epi8('\t'), vff = _mm_set1_epi8('\f'), vesc = _mm_set1_epi8(0x1B);
+			auto sum = [zero](__m128i acc) noexcept
+			{
+				auto s = _mm_sad_epu8(acc, zero);
+				return std::uint64_t(_mm_cvtsi128_si32(s)) + std::uint64_t(_mm_cvtsi128_si32(_mm_srli_si128(s, 8)));
+			};
+			// Byte lanes count up to 255 matches before they have to be flushed, a block
+			// is compared together with the next byte's block to find CR LF pairs
+			while (end - it > std::ptrdiff_t(block))
+			{
+				auto rounds = std::min<std::ptrdiff_t>((end - it - 1) / std::ptrdiff_t(block), 255);
+				auto nulEven = zero, nulOdd = zero, cr = zero, lf = zero, crlf = zero, high = zero, control = zero;
+				for (; rounds > 0; --rounds, it += block)
+				{
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+					auto next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it + 1));
+
+					auto isNul = _mm_cmpeq_epi8(v, zero), isCr = _mm_cmpeq_epi8(v, vcr), isLf = _mm_cmpeq_epi8(v, vlf);
+					nulEven = _mm_sub_epi8(nulEven, _mm_and_si128(isNul, even));
+					nulOdd  = _mm_sub_epi8(nulOdd, _mm_andnot_si128(even, isNul));
+					cr      = _mm_sub_epi8(cr, isCr);
+					lf      = _mm_sub_epi8(lf, isLf);
+					crlf    = _mm_sub_epi8(crlf, _mm_and_si128(isCr, _mm_cmpeq_epi8(next, vlf)));
+					high    = _mm_sub_epi8(high, _mm_cmplt_epi8(v, zero));
+
+					// Signed compares keep 0x01..0x1F only, NUL and bytes >= 0x80 fall out
+					auto low = _mm_and_si128(_mm_cmplt_epi8(v, vspace), _mm_cmpgt_epi8(v, zero));
+					auto allowed = _mm_or_si128(_mm_or_si128(isCr, isLf), _mm_or_si128(_mm_cmpeq_epi8(v, vtab),
+						_mm_or_si128(_mm_cmpeq_epi8(v, vff), _mm_cmpeq_epi8(v, vesc))));
+					control = _mm_sub_epi8(control, _mm_andnot_si128(allowed, low));
+				}
+				st.nulEven += sum(nulEven);
+				st.nulOdd  += sum(nulOdd);
+				st.cr      += sum(cr);
+				st.lf      += sum(lf);
+				st.crlf    += sum(crlf);
+				st.high    += sum(high);
+				st.control += sum(control);
+			}
+#endif
+			for (std::size_t i = 0; it != end; ++it, ++i)
+			{
+				unsigned char byte = *it;
+				if (byte == 0)
+				{
+					((i & 1) ? st.nulOdd : st.nulEven) += 1;
+				}
+				st.cr      += (byte == '\r');
+				st.lf      += (byte == '\n');
+				st.crlf    += (prevCr && byte == '\n');
+				st.high    += (byte >= 0x80);
+				st.control += isControl(byte);
+				prevCr = (byte == '\r');
+			}
+			return st;
+		}
+
+		void merge(ByteStats & lhs, const ByteStats & rhs) noexcept
+		{
+			lhs.bytes       += rhs.bytes;
+			lhs.high        += rhs.high;
+			lhs.control     += rhs.control;
+			lhs.nulEven     += rhs.nulEven;
+			lhs.nulOdd      += rhs.nulOdd;
+			lhs.cr          += rhs.cr;
+			lhs.lf          += rhs.lf;
+			lhs.crlf        += rhs.crlf;
+			lhs.invalidUtf8 += rhs.invalidUtf8;
+		}
+
+		void countUtf16LineEndings(std::span<const char> data, bool bigEndian, EncodingInfo & info) noexcept
+		{
+			info.lf = info.crlf = info.cr = 0;
+			bool prevCr = false;
+			for (std::size_t i = 0; i + 1 < data.size(); i += 2)
+			{
+				auto b0 = static_cast<unsigned char>(data[i]), b1 = static_cast<unsigned char>(data[i + 1]);
+				char16_t unit = bigEndian ? char16_t((b0 << 8) | b1) : char16_t((b1 << 8) | b0);
+				if (unit == u'\n')
+				{
+					++(prevCr ? info.crlf : info.lf);
+					if (prevCr)
+					{
+						--info.cr;
+					}
+				}
+				else if (unit == u'\r')
+				{
+					++info.cr;
+				}
+				prevCr = (unit == u'\r');
+			}
+		}
+
+		void rank(std::span<const char> data, std::uint8_t bomSize, Encoding bomEnc, EncodingInfo & info) noexcept
+		{
+			const auto & st = info.stats;
+			info.bomSize = bomSize;
+
+			std::array<float, 6> score{};
+			auto & s8 = score[std::size_t(Encoding::utf8)];
+			auto & s16le = score[std::size_t(Encoding::utf16le)];
+			auto & s16be = score[std::size_t(Encoding::utf16be)];
+			auto & sLatin = score[std::size_t(Encoding::latin1)];
+			auto & sBin = score[std::size_t(Encoding::binary)];
+
+			if (bomSize != 0)
+			{
+				score[std::size_t(bomEnc)] = 1.0f;
+			}
+			else if (st.bytes == 0)
+			{
+				s8 = 1.0f;
+			}
+			else
+			{
+				const float half = float(std::max<std::uint64_t>(st.bytes / 2, 1));
+				const float evenNul = float(st.nulEven) / half, oddNul = float(st.nulOdd) / half;
+				const float control = float(st.control) / float(st.bytes);
+
+				// Latin text in UTF-16 has every other byte zero
+				s16le = std::clamp(oddNul - evenNul * 4.0f, 0.0f, 1.0f) * 0.95f;
+				s16be = std::clamp(evenNul - oddNul * 4.0f, 0.0f, 1.0f) * 0.95f;
+
+				const float nulDensity = float(st.nul()) / float(st.bytes);
+				sBin = std::clamp(nulDensity * 8.0f + control * 16.0f, 0.0f, 1.0f) - std::max(s16le, s16be);
+
+				if (st.nul() == 0)
+				{
+					const float clean = std::clamp(1.0f - control * 16.0f, 0.0f, 1.0f);
+					if (st.invalidUtf8 == 0)
+					{
+						// Pure ASCII is valid in both, but UTF-8 is the safer choice for edits
+						s8 = (st.high == 0 ? 0.9f : 0.99f) * clean;
+						sLatin = (st.high == 0 ? 0.5f : 0.2f) * clean;
+					}
+					else
+					{
+						const float broken = float(st.invalidUtf8) / float(std::max<std::uint64_t>(st.high, 1));
+						s8 = std::clamp(0.5f - broken, 0.0f, 0.5f) * clean;
+						sLatin = 0.8f * clean;
+					}
+				}
+			}
+
+			std::array<Encoding, 5> order{ Encoding::utf8, Encoding::utf16le, Encoding::utf16be, Encoding::latin1, Encoding::binary };
+			std::stable_sort(order.begin(), order.end(), [&score](Encoding a, Encoding b)
+			{
+				return score[std::size_t(a)] > score[std::size_t(b)];
+			});
+			for (std::size_t i = 0; i < info.candidates.size(); ++i)
+			{
+				if (score[std::size_t(order[i])] > 0.0f)
+				{
+					info.candidates[i] = { order[i], score[std::size_t(order[i])] };
+				}
+			}
+			if (info.best() == Encoding::unknown)
+			{
+				info.candidates[0] = { Encoding::binary, 0.0f };
+			}
+
+			if (info.best() == Encoding::utf16le || info.best() == Encoding::utf16be)
+			{
+				countUtf16LineEndings(data.subspan(bomSize), info.best() == Encoding::utf16be, info);
+			}
+			else
+			{
+				info.crlf = st.crlf;
+				info.lf = st.lf - st.crlf;
+				info.cr = st.cr - st.crlf;
+			}
+
+			info.bMixedLineEndings = (info.lf != 0) + (info.crlf != 0) + (info.cr != 0) > 1;
+			if (info.lf == 0 && info.crlf == 0 && info.cr == 0)
+			{
+				info.lineEnding = LineEnding::none;
+			}
+			else if (info.crlf >= info.lf && info.crlf >= info.cr)
+			{
+				info.lineEnding = LineEnding::crlf;
+			}
+			else
+			{
+				info.lineEnding = (info.lf >= info.cr) ? LineEnding::lf : LineEnding::cr;
+			}
+		}
+	}
+
+	COMFYDX_API std::uint8_t detectBom(std::span<const char> data, Encoding & enc) noexcept
+	{
+		auto at = [data](std::size_t i) noexcept
+		{
+			return static_cast<unsigned char>(data[i]);
+		};
+		if (data.size() >= 3 && at(0) == 0xEF && at(1) == 0xBB && at(2) == 0xBF)
+		{
+			enc = Encoding::utf8;
+			return 3;
+		}
+		else if (data.size() >= 2 && at(0) == 0xFF && at(1) == 0xFE)
+		{
+			enc = Encoding::utf16le;
+			return 2;
+		}
+		else if (data.size() >= 2 && at(0) == 0xFE && at(1) == 0xFF)
+		{
+			enc = Encoding::utf16be;
+			return 2;
+		}
+		enc = Encoding::unknown;
+		return 0;
+	}
+
+	COMFYDX_API ByteStats scanBytes(std::span<const char> data, bool complete) noexcept
+	{
+		auto begin = reinterpret_cast<const unsigned char *>(data.data());
+		auto end = begin + data.size();
+
+		auto st = scanCounts(begin, end);
+		st.invalidUtf8 = countInvalidUtf8(begin, end, complete);
+		return st;
+	}
+
+	COMFYDX_API EncodingInfo detectEncoding(std::span<const char> sample, bool complete) noexcept
+	{
+		Encoding bomEnc;
+		auto bomSize = detectBom(sample, bomEnc);
+
+		EncodingInfo info;
+		info.stats = scanBytes(sample.subspan(bomSize), complete);
+		rank(sample, bomSize, bomEnc, info);
+		return info;
+	}
+	COMFYDX_API EncodingInfo detectEncodingParallel(std::span<const char> data, unsigned threads)
+	{
+		constexpr std::size_t minChunk{ 1 << 22 };
+
+		if (threads == 0)
+		{
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		Encoding bomEnc;
+		auto bomSize = detectBom(data, bomEnc);
+		auto body = data.subspan(bomSize);
+
+		threads = unsigned(std::clamp<std::size_t>(body.size() / minChunk, 1, threads));
+		if (threads == 1)
+		{
+			return detectEncoding(data, true);
+		}
+
+		// Counting borders are even for NUL parity, validation borders are moved to the next UTF-8 lead byte
+		auto bytes = reinterpret_cast<const unsigned char *>(body.data());
+		std::vector<std::size_t> borders{ 0 }, leads{ 0 };
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			auto pos = (body.size() / threads * i) & ~std::size_t(1);
+			borders.push_back(pos);
+			for (std::size_t n = 0; n < 3 && pos < body.size() && isContinuation(bytes[pos]); ++n)
+			{
+				++pos;
+			}
+			leads.push_back(pos);
+		}
+		borders.push_back(body.size());
+		leads.push_back(body.size());
+
+		std::vector<std::future<ByteStats>> parts;
+		for (std::size_t i = 0; i + 1 < borders.size(); ++i)
+		{
+			parts.push_back(std::async(std::launch::async, [bytes, i, &borders, &leads]() noexcept
+			{
+				auto st = scanCounts(bytes + borders[i], bytes + borders[i + 1]);
+				st.invalidUtf8 = countInvalidUtf8(bytes + leads[i], bytes + leads[i + 1], true);
+				return st;
+			}));
+		}
+
+		EncodingInfo info;
+		for (std::size_t i = 0; i < parts.size(); ++i)
+		{
+			merge(info.stats, parts[i].get());
+			auto b = borders[i + 1];
+			if (b != 0 && b < body.size() && body[b - 1] == '\r' && body[b] == '\n')
+			{
+				++info.stats.crlf;
+			}
+		}
+		rank(data, bomSize, bomEnc, info);
+		return info;
+	}
+}
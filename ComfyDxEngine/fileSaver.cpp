@@ -0,0 +1,539 @@
+#include "pch.hpp"
+#include "fileSaver.hpp"
+#include "transcode.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace cdx::io
+{
+	namespace
+	{
+		constexpr std::size_t pageSize{ 4096 };
+		// Text handled per step, bounds the scratch buffers and the cancel latency
+		constexpr std::size_t sliceSize{ 64 << 10 };
+		// Fits the UTF-16 of a slice whose line breaks all doubled
+		constexpr std::size_t minBuffer{ 4 * sliceSize + pageSize };
+
+		[[nodiscard]] std::string describe(const std::filesystem::path & path, const char * what)
+		{
+#ifdef _WIN32
+			auto code = ::GetLastError();
+#else
+			auto code = errno;
+#endif
+			return std::string(what) + " \"" + path.string() + "\" (" + std::system_category().message(int(code)) + ")!";
+		}
+
+		// Write-only handle of the new file
+		class OutputFile
+		{
+		private:
+			std::filesystem::path m_path;
+#ifdef _WIN32
+			HANDLE m_file{ INVALID_HANDLE_VALUE };
+#else
+			int m_fd{ -1 };
+#endif
+
+		public:
+			OutputFile() noexcept = default;
+			OutputFile(const OutputFile &) = delete;
+			OutputFile & operator=(const OutputFile &) = delete;
+			~OutputFile() noexcept
+			{
+				this->close();
+			}
+
+#ifdef _WIN32
+
+			// Fails if the file exists, a temporary name is never shared
+			void create(const std::filesystem::path & path, const std::filesystem::path &)
+			{
+				this->m_path = path;
+				this->m_file = ::CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+				if (this->m_file == INVALID_HANDLE_VALUE)
+				{
+					throw std::runtime_error(describe(path, "Cannot create"));
+				}
+			}
+			void write(const char * data, std::size_t size)
+			{
+				while (size != 0)
+				{
+					DWORD written = 0;
+					if (!::WriteFile(this->m_file, data, DWORD(std::min<std::size_t>(size, 1 << 30)), &written, nullptr) || written == 0)
+					{
+						throw std::runtime_error(describe(this->m_path, "Cannot write"));
+					}
+					data += written;
+					size -= written;
+				}
+			}
+			void sync()
+			{
+				if (!::FlushFileBuffers(this->m_file))
+				{
+					throw std::runtime_error(describe(this->m_path, "Cannot flush"));
+				}
+			}
+			void finish()
+			{
+				auto file = std::exchange(this->m_file, INVALID_HANDLE_VALUE);
+				if (!::CloseHandle(file))
+				{
+					throw std::runtime_error(describe(this->m_path, "Cannot close"));
+				}
+			}
+			void close() noexcept
+			{
+				if (this->m_file != INVALID_HANDLE_VALUE)
+				{
+					::CloseHandle(this->m_file);
+					this->m_file = INVALID_HANDLE_VALUE;
+				}
+			}
+
+#else
+
+			// Fails if the file exists, a temporary name is never shared. Takes over the permissions of 'target'
+			void create(const std::filesystem::path & path, const std::filesystem::path & target)
+			{
+				this->m_path = path;
+				this->m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+				if (this->m_fd < 0)
+				{
+					throw std::runtime_error(describe(path, "Cannot create"));
+				}
+				struct stat st;
+				if (::stat(target.c_str(), &st) == 0)
+				{
+					::fchmod(this->m_fd, st.st_mode & 07777);
+				}
+			}
+			void write(const char * data, std::size_t size)
+			{
+				while (size != 0)
+				{
+					auto written = ::write(this->m_fd, data, std::min<std::size_t>(size, 1 << 30));
+					if (written < 0 && errno == EINTR)
+					{
+						continue;
+					}
+					if (written <= 0)
+					{
+						throw std::runtime_error(describe(this->m_path, "Cannot write"));
+					}
+					data += written;
+					size -= std::size_t(written);
+				}
+			}
+			void sync()
+			{
+				if (::fsync(this->m_fd) != 0)
+				{
+					throw std::runtime_error(describe(this->m_path, "Cannot flush"));
+				}
+			}
+			void finish()
+			{
+				// Some file systems only report write errors here
+				if (::close(std::exchange(this->m_fd, -1)) != 0)
+				{
+					throw std::runtime_error(describe(this->m_path, "Cannot close"));
+				}
+			}
+			void close() noexcept
+			{
+				if (this->m_fd >= 0)
+				{
+					::close(this->m_fd);
+					this->m_fd = -1;
+				}
+			}
+
+#endif
+		};
+
+		void replace(const std::filesystem::path & temp, const std::filesystem::path & path, bool bSync)
+		{
+#ifdef _WIN32
+			DWORD flags = MOVEFILE_REPLACE_EXISTING | (bSync ? MOVEFILE_WRITE_THROUGH : 0);
+			if (!::MoveFileExW(temp.c_str(), path.c_str(), flags))
+			{
+				throw std::runtime_error(describe(path, "Cannot replace"));
+			}
+#else
+			if (::rename(temp.c_str(), path.c_str()) != 0)
+			{
+				throw std::runtime_error(describe(path, "Cannot replace"));
+			}
+			if (bSync)
+			{
+				// The rename itself only survives a crash once the directory is flushed
+				auto dir = path.parent_path();
+				int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+				if (fd >= 0)
+				{
+					::fsync(fd);
+					::close(fd);
+				}
+			}
+#endif
+		}
+
+		struct AlignedDelete
+		{
+			void operator()(char * p) const noexcept
+			{
+				::operator delete(p, std::align_val_t{ pageSize });
+			}
+		};
+
+		// Collects output into whole pages, so the file is written in few large aligned writes
+		class Sink
+		{
+		private:
+			OutputFile & m_file;
+			std::unique_ptr<char, AlignedDelete> m_buffer;
+			std::size_t m_capacity, m_size{ 0 };
+			std::atomic<std::uint64_t> & m_bytesWritten;
+
+		public:
+			Sink(OutputFile & file, std::size_t capacity, std::atomic<std::uint64_t> & bytesWritten)
+				: m_file{ file }, m_capacity{ (std::max(capacity, minBuffer) + pageSize - 1) / pageSize * pageSize }, m_bytesWritten{ bytesWritten }
+			{
+				this->m_buffer.reset(static_cast<char *>(::operator new(this->m_capacity, std::align_val_t{ pageSize })));
+			}
+
+			void flush()
+			{
+				if (this->m_size != 0)
+				{
+					this->m_file.write(this->m_buffer.get(), this->m_size);
+					this->m_bytesWritten.fetch_add(this->m_size, std::memory_order_relaxed);
+					this->m_size = 0;
+				}
+			}
+			// Room for 'count' <= minBuffer bytes, filled with commit()
+			[[nodiscard]] char * reserve(std::size_t count)
+			{
+				if (this->m_capacity - this->m_size < count)
+				{
+					this->flush();
+				}
+				return this->m_buffer.get() + this->m_size;
+			}
+			void commit(std::size_t count) noexcept
+			{
+				this->m_size += count;
+			}
+			void put(std::string_view bytes)
+			{
+				while (!bytes.empty())
+				{
+					auto count = std::min(bytes.size(), this->m_capacity - this->m_size);
+					std::memcpy(this->m_buffer.get() + this->m_size, bytes.data(), count);
+					this->m_size += count;
+					bytes.remove_prefix(count);
+					if (this->m_size == this->m_capacity)
+					{
+						this->flush();
+					}
+				}
+			}
+		};
+
+		// Line ending normalization and transcoding of UTF-8 text, fed slice by slice
+		class Encoder
+		{
+		private:
+			Sink & m_sink;
+			ce::Encoding m_encoding;
+			std::string_view m_lineBreak;
+			bool m_bPendingCr{ false }, m_bLowSurrogate{ false };
+
+			std::string m_normalized;
+			std::vector<char16_t> m_units;
+			ce::Utf8ToUtf16 m_decoder;
+
+			[[nodiscard]] bool raw() const noexcept
+			{
+				return this->m_encoding == ce::Encoding::unknown || this->m_encoding == ce::Encoding::binary;
+			}
+
+			void encode(std::string_view text, bool last)
+			{
+				if (this->raw() || this->m_encoding == ce::Encoding::utf8)
+				{
+					this->m_sink.put(text);
+					return;
+				}
+				do
+				{
+					auto res = this->m_decoder.feed(text, this->m_units, last);
+					text.remove_prefix(res.read);
+					std::span<const char16_t> units{ this->m_units.data(), res.written };
+					if (this->m_encoding == ce::Encoding::latin1)
+					{
+						auto out = this->m_sink.reserve(units.size());
+						std::size_t size = 0;
+						for (auto unit : units)
+						{
+							// The low half of a pair was already written as '?'
+							if (std::exchange(this->m_bLowSurrogate, false) && unit >= 0xDC00 && unit < 0xE000)
+							{
+								continue;
+							}
+							this->m_bLowSurrogate = (unit >= 0xD800 && unit < 0xDC00);
+							out[size++] = (unit < 0x100) ? char(unit) : '?';
+						}
+						this->m_sink.commit(size);
+					}
+					else
+					{
+						auto out = this->m_sink.reserve(2 * units.size());
+						int high = (this->m_encoding == ce::Encoding::utf16be) ? 0 : 1;
+						for (auto unit : units)
+						{
+							out[high] = char(unit >> 8);
+							out[1 - high] = char(unit & 0xFF);
+							out += 2;
+						}
+						this->m_sink.commit(2 * units.size());
+					}
+				} while (!text.empty());
+			}
+
+		public:
+			Encoder(Sink & sink, const SaveOptions & options)
+				: m_sink{ sink }, m_encoding{ options.encoding }
+			{
+				switch (this->raw() ? ce::LineEnding::none : options.lineEnding)
+				{
+				case ce::LineEnding::lf:
+					this->m_lineBreak = "\n";
+					break;
+				case ce::LineEnding::crlf:
+					this->m_lineBreak = "\r\n";
+					break;
+				case ce::LineEnding::cr:
+					this->m_lineBreak = "\r";
+					break;
+				default:
+					break;
+				}
+				if (!this->m_lineBreak.empty())
+				{
+					this->m_normalized.reserve(2 * sliceSize + 2);
+				}
+				this->m_units.resize(ce::Utf8ToUtf16::maxOutput(2 * sliceSize + 2));
+			}
+
+			void bom()
+			{
+				switch (this->m_encoding)
+				{
+				case ce::Encoding::utf8:
+					this->m_sink.put("\xEF\xBB\xBF");
+					break;
+				case ce::Encoding::utf16le:
+					this->m_sink.put("\xFF\xFE");
+					break;
+				case ce::Encoding::utf16be:
+					this->m_sink.put("\xFE\xFF");
+					break;
+				default:
+					break;
+				}
+			}
+			// At most sliceSize bytes
+			void feed(std::string_view text)
+			{
+				if (this->m_lineBreak.empty())
+				{
+					this->encode(text, false);
+					return;
+				}
+
+				auto & out = this->m_normalized;
+				out.clear();
+				// A '\r' ending the previous slice may have been the first half of "\r\n"
+				if (this->m_bPendingCr && !text.empty())
+				{
+					this->m_bPendingCr = false;
+					out += this->m_lineBreak;
+					if (text.front() == '\n')
+					{
+						text.remove_prefix(1);
+					}
+				}
+				while (!text.empty())
+				{
+					auto it = std::find_if(text.begin(), text.end(), [](char c)
+					{
+						return c == '\n' || c == '\r';
+					});
+					auto run = std::size_t(it - text.begin());
+					out.append(text.data(), run);
+					if (run == text.size())
+					{
+						break;
+					}
+					if (text[run] == '\r' && run + 1 == text.size())
+					{
+						this->m_bPendingCr = true;
+						break;
+					}
+					out += this->m_lineBreak;
+					text.remove_prefix(run + ((text[run] == '\r' && text[run + 1] == '\n') ? 2 : 1));
+				}
+				this->encode(out, false);
+			}
+			void finish()
+			{
+				if (std::exchange(this->m_bPendingCr, false))
+				{
+					this->encode(this->m_lineBreak, false);
+				}
+				this->encode({}, true);
+				this->m_sink.flush();
+			}
+		};
+
+		bool save(const text::TextSnapshot & text, const std::filesystem::path & path, const SaveOptions & options, std::string & error, std::stop_token stop,
+			std::atomic<std::uint64_t> & bytesRead, std::atomic<std::uint64_t> & bytesWritten) noexcept
+		{
+			error.clear();
+			std::filesystem::path temp;
+			try
+			{
+				auto id = std::uintptr_t(&text) ^ std::uintptr_t(std::chrono::steady_clock::now().time_since_epoch().count());
+				temp = path;
+				temp += "." + std::to_string(id) + ".tmp";
+
+				OutputFile file;
+				file.create(temp, path);
+				Sink sink{ file, options.bufferSize, bytesWritten };
+				Encoder encoder{ sink, options };
+				if (options.bBom)
+				{
+					encoder.bom();
+				}
+
+				bool bStopped = false;
+				text.forEachChunk(0, text.size(), [&](std::string_view chunk)
+				{
+					while (!chunk.empty())
+					{
+						if (stop.stop_requested())
+						{
+							bStopped = true;
+							return false;
+						}
+						auto slice = chunk.substr(0, sliceSize);
+						encoder.feed(slice);
+						chunk.remove_prefix(slice.size());
+						bytesRead.fetch_add(slice.size(), std::memory_order_relaxed);
+					}
+					return true;
+				});
+				if (bStopped || stop.stop_requested())
+				{
+					throw std::runtime_error("Saving \"" + path.string() + "\" was cancelled!");
+				}
+				encoder.finish();
+
+				if (options.bSync)
+				{
+					file.sync();
+				}
+				file.finish();
+				replace(temp, path, options.bSync);
+				return true;
+			}
+			catch (const std::exception & e)
+			{
+				error = e.what();
+			}
+			catch (...)
+			{
+				error = "Cannot save \"" + path.string() + "\"!";
+			}
+			if (!temp.empty())
+			{
+				std::error_code ec;
+				std::filesystem::remove(temp, ec);
+			}
+			return false;
+		}
+	}
+
+	COMFYDX_API bool saveFile(const text::TextSnapshot & text, const std::filesystem::path & path, const SaveOptions & options, std::string & error, std::stop_token stop)
+	{
+		std::atomic<std::uint64_t> bytesRead{ 0 }, bytesWritten{ 0 };
+		return save(text, path, options, error, stop, bytesRead, bytesWritten);
+	}
+
+	COMFYDX_API FileSaver::FileSaver(text::TextSnapshot text, std::filesystem::path path, SaveOptions options, Notify notify)
+		: m_text{ std::move(text) }, m_path{ std::move(path) }, m_options{ options }, m_notify{ std::move(notify) }
+	{
+	}
+	COMFYDX_API FileSaver::~FileSaver() noexcept
+	{
+		this->cancel();
+		this->wait();
+	}
+
+	COMFYDX_API bool FileSaver::start()
+	{
+		if (this->m_worker.joinable())
+		{
+			return false;
+		}
+		this->m_bDone.store(false, std::memory_order_relaxed);
+		this->m_bOk.store(false, std::memory_order_relaxed);
+		this->m_bytesRead.store(0, std::memory_order_relaxed);
+		this->m_bytesWritten.store(0, std::memory_order_relaxed);
+		this->m_worker = std::jthread([this](std::stop_token stop)
+		{
+			this->work(stop);
+		});
+		return true;
+	}
+	COMFYDX_API void FileSaver::cancel() noexcept
+	{
+		this->m_worker.request_stop();
+	}
+	COMFYDX_API void FileSaver::wait() noexcept
+	{
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.join();
+		}
+	}
+
+	void FileSaver::work(std::stop_token stop) noexcept
+	{
+		bool ok = save(this->m_text, this->m_path, this->m_options, this->m_error, stop, this->m_bytesRead, this->m_bytesWritten);
+
+		this->m_bOk.store(ok, std::memory_order_release);
+		this->m_bDone.store(true, std::memory_order_release);
+		if (this->m_notify)
+		{
+			this->m_notify();
+		}
+	}
+}
@@ -0,0 +1,577 @@
+#include "pch.hpp"
+#include "fileViewer.hpp"
+#include "lineIndex.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cdx::text
+{
+	namespace
+	{
+		constexpr std::uint64_t noOffset{ std::numeric_limits<std::uint64_t>::max() };
+		// Windows must start at the allocation granularity, 64 KiB on Windows
+		constexpr std::size_t windowAlign{ 128 << 10 };
+		// Until the first line feed is seen
+		constexpr double guessedLineLength{ 100.0 };
+	}
+
+	COMFYDX_API FileViewer::~FileViewer() noexcept
+	{
+		this->close();
+	}
+
+	COMFYDX_API bool FileViewer::open(const std::filesystem::path & path, ViewerOptions options) noexcept
+	{
+		this->close();
+
+		options.windowSize = std::max((options.windowSize + windowAlign - 1) / windowAlign * windowAlign, 2 * windowAlign);
+		options.checkpointLines = std::max<std::size_t>(options.checkpointLines, 1);
+		options.readChunk = std::max<std::size_t>(options.readChunk, 64 << 10);
+		this->m_options = options;
+
+#ifdef _WIN32
+		HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		this->m_file = file;
+		if (::GetFileType(file) != FILE_TYPE_DISK)
+		{
+			this->close();
+			return false;
+		}
+#else
+		this->m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (this->m_fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		// Pipes have neither a size nor random access
+		if (::fstat(this->m_fd, &st) != 0 || !S_ISREG(st.st_mode))
+		{
+			this->close();
+			return false;
+		}
+#endif
+		this->m_bMappable = true;
+		auto size = this->querySize();
+		if (size == noOffset)
+		{
+			this->close();
+			return false;
+		}
+		this->m_size = size;
+		this->m_sizeSeen.store(size, std::memory_order_relaxed);
+		this->m_checkpoints.assign(1, 0);
+		if (!this->remap())
+		{
+			this->m_bMappable = false;
+		}
+
+		try
+		{
+			this->m_worker = std::jthread([this](std::stop_token stop)
+			{
+				this->index(stop);
+			});
+		}
+		catch (...)
+		{
+			this->close();
+			return false;
+		}
+		this->m_bOpen = true;
+		return true;
+	}
+	COMFYDX_API void FileViewer::close() noexcept
+	{
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.request_stop();
+			this->m_worker.join();
+		}
+		for (auto & window : this->m_windows)
+		{
+			this->unmap(window);
+		}
+		this->m_windows.clear();
+#ifdef _WIN32
+		if (this->m_mapping != nullptr)
+		{
+			::CloseHandle(this->m_mapping);
+			this->m_mapping = nullptr;
+		}
+		if (this->m_file != nullptr)
+		{
+			::CloseHandle(this->m_file);
+			this->m_file = nullptr;
+		}
+#else
+		if (this->m_fd >= 0)
+		{
+			::close(this->m_fd);
+			this->m_fd = -1;
+		}
+#endif
+		this->m_size = 0;
+		this->m_checkpoints.clear();
+		this->m_indexed = 0;
+		this->m_lineFeeds = 0;
+		this->m_bFailed = false;
+		this->m_sizeSeen.store(0, std::memory_order_relaxed);
+		this->m_indexedSeen.store(0, std::memory_order_relaxed);
+		this->m_bOpen = false;
+		this->m_bMappable = false;
+	}
+
+	COMFYDX_API bool FileViewer::refresh()
+	{
+		if (!this->m_bOpen)
+		{
+			return false;
+		}
+		auto size = this->querySize();
+		if (size == noOffset)
+		{
+			return false;
+		}
+
+		bool bTruncated = false;
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			if (size == this->m_size)
+			{
+				return false;
+			}
+			bTruncated = size < this->m_size;
+			if (bTruncated)
+			{
+				// The worker drops what it is reading for the old contents
+				++this->m_generation;
+				this->m_checkpoints.assign(1, 0);
+				this->m_indexed = 0;
+				this->m_lineFeeds = 0;
+				this->m_indexedSeen.store(0, std::memory_order_relaxed);
+			}
+			this->m_size = size;
+			this->m_bFailed = false;
+			this->m_sizeSeen.store(size, std::memory_order_relaxed);
+		}
+		this->m_grown.notify_all();
+
+		// Windows that ended at the old end of the file are buffered, only the appended bytes are read
+		std::erase_if(this->m_windows, [&](Window & window)
+		{
+			if (!bTruncated && window.length == this->m_options.windowSize)
+			{
+				return false;
+			}
+			if (!bTruncated && window.buffer)
+			{
+				auto start = window.index * this->stride();
+				auto length = std::size_t(std::min<std::uint64_t>(this->m_options.windowSize, size - start));
+				if (this->readAt(start + window.length, window.buffer.get() + window.length, length - window.length))
+				{
+					window.length = length;
+					return false;
+				}
+			}
+			this->unmap(window);
+			return true;
+		});
+		if (this->m_bMappable && !this->remap())
+		{
+			this->m_bMappable = false;
+		}
+		return true;
+	}
+
+	void FileViewer::index(std::stop_token stop) noexcept
+	{
+		std::unique_ptr<char[]> buffer{ new (std::nothrow) char[this->m_options.readChunk] };
+		if (!buffer)
+		{
+			return;
+		}
+		const std::uint64_t every = this->m_options.checkpointLines;
+		std::vector<std::uint64_t> found;
+
+		std::unique_lock lock{ this->m_mutex };
+		while (this->m_grown.wait(lock, stop, [this]
+		{
+			return !this->m_bFailed && this->m_indexed < this->m_size;
+		}))
+		{
+			auto generation = this->m_generation;
+			auto offset = this->m_indexed;
+			auto length = std::size_t(std::min<std::uint64_t>(this->m_size - offset, this->m_options.readChunk));
+			auto feeds = this->m_lineFeeds;
+			// Line feed (0-based) that precedes the next checkpoint
+			auto target = std::uint64_t(this->m_checkpoints.size()) * every - 1;
+			lock.unlock();
+
+			found.clear();
+			bool bRead = this->readAt(offset, buffer.get(), length);
+			if (bRead)
+			{
+				std::string_view chunk{ buffer.get(), length };
+				auto end = feeds + countLineFeeds(chunk);
+				std::size_t at = 0;
+				for (; target < end; target += every)
+				{
+					at += findLineFeed(chunk.substr(at), std::size_t(target - feeds)) + 1;
+					feeds = target + 1;
+					found.push_back(offset + at);
+				}
+				feeds = end;
+			}
+
+			lock.lock();
+			if (generation != this->m_generation)
+			{
+				continue;
+			}
+			if (!bRead)
+			{
+				// Most likely truncated, retried once refresh() sees the new size
+				this->m_bFailed = true;
+				continue;
+			}
+			this->m_checkpoints.insert(this->m_checkpoints.end(), found.begin(), found.end());
+			this->m_indexed = offset + length;
+			this->m_lineFeeds = feeds;
+			this->m_indexedSeen.store(this->m_indexed, std::memory_order_relaxed);
+		}
+	}
+
+#ifdef _WIN32
+
+	bool FileViewer::readAt(std::uint64_t offset, char * out, std::size_t length) noexcept
+	{
+		while (length > 0)
+		{
+			OVERLAPPED overlapped{};
+			overlapped.Offset = DWORD(offset);
+			overlapped.OffsetHigh = DWORD(offset >> 32);
+			DWORD want = DWORD(std::min<std::size_t>(length, 1 << 30)), got = 0;
+			if (!::ReadFile(static_cast<HANDLE>(this->m_file), out, want, &got, &overlapped) || got == 0)
+			{
+				return false;
+			}
+			out += got;
+			offset += got;
+			length -= got;
+		}
+		return true;
+	}
+	std::uint64_t FileViewer::querySize() noexcept
+	{
+		LARGE_INTEGER size;
+		if (!::GetFileSizeEx(static_cast<HANDLE>(this->m_file), &size))
+		{
+			return noOffset;
+		}
+		return std::uint64_t(size.QuadPart);
+	}
+	bool FileViewer::remap() noexcept
+	{
+		// A mapping can't grow, views of the old one stay valid after it is closed
+		if (this->m_mapping != nullptr)
+		{
+			::CloseHandle(this->m_mapping);
+			this->m_mapping = nullptr;
+		}
+		if (this->m_sizeSeen.load(std::memory_order_relaxed) == 0)
+		{
+			return true;
+		}
+		this->m_mapping = ::CreateFileMappingW(static_cast<HANDLE>(this->m_file), nullptr, PAGE_READONLY, 0, 0, nullptr);
+		return this->m_mapping != nullptr;
+	}
+	void FileViewer::unmap(Window & window) noexcept
+	{
+		if (!window.buffer && window.data != nullptr)
+		{
+			::UnmapViewOfFile(window.data);
+		}
+		window.buffer.reset();
+		window.data = nullptr;
+		window.length = 0;
+	}
+
+#else
+
+	bool FileViewer::readAt(std::uint64_t offset, char * out, std::size_t length) noexcept
+	{
+		while (length > 0)
+		{
+			auto got = ::pread(this->m_fd, out, length, off_t(offset));
+			if (got <= 0)
+			{
+				return false;
+			}
+			out += got;
+			offset += std::uint64_t(got);
+			length -= std::size_t(got);
+		}
+		return true;
+	}
+	std::uint64_t FileViewer::querySize() noexcept
+	{
+		struct stat st;
+		if (::fstat(this->m_fd, &st) != 0)
+		{
+			return noOffset;
+		}
+		return std::uint64_t(st.st_size);
+	}
+	bool FileViewer::remap() noexcept
+	{
+		// Windows are mapped straight from the descriptor
+		return true;
+	}
+	void FileViewer::unmap(Window & window) noexcept
+	{
+		if (!window.buffer && window.data != nullptr)
+		{
+			::munmap(const_cast<char *>(window.data), window.length);
+		}
+		window.buffer.reset();
+		window.data = nullptr;
+		window.length = 0;
+	}
+
+#endif
+
+	FileViewer::Window * FileViewer::window(std::uint64_t index, std::uint64_t size)
+	{
+		for (auto & window : this->m_windows)
+		{
+			if (window.index == index)
+			{
+				window.lastUse = ++this->m_useCounter;
+				return &window;
+			}
+		}
+
+		Window * slot = nullptr;
+		auto maxWindows = std::max<std::size_t>(this->m_options.memoryBudget / this->m_options.windowSize, 2);
+		if (this->m_windows.size() >= maxWindows)
+		{
+			slot = &*std::min_element(this->m_windows.begin(), this->m_windows.end(), [](const Window & lhs, const Window & rhs)
+			{
+				return lhs.lastUse < rhs.lastUse;
+			});
+			this->unmap(*slot);
+		}
+		else
+		{
+			slot = &this->m_windows.emplace_back();
+		}
+
+		auto start = index * this->stride();
+		auto length = std::size_t(std::min<std::uint64_t>(this->m_options.windowSize, size - start));
+		slot->index = index;
+		slot->lastUse = ++this->m_useCounter;
+		// The window at the end of the file is read instead, so a truncation there never faults
+		if (this->m_bMappable && length == this->m_options.windowSize)
+		{
+#ifdef _WIN32
+			slot->data = static_cast<const char *>(::MapViewOfFile(this->m_mapping, FILE_MAP_READ, DWORD(start >> 32), DWORD(start), length));
+#else
+			auto data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, this->m_fd, off_t(start));
+			slot->data = (data != MAP_FAILED) ? static_cast<const char *>(data) : nullptr;
+#endif
+			if (slot->data == nullptr)
+			{
+				// Falls back to reading, e.g. on a network share that can't be mapped
+				this->m_bMappable = false;
+			}
+		}
+		if (slot->data == nullptr)
+		{
+			// A whole window, refresh() appends to the one at the end
+			slot->buffer.reset(new (std::nothrow) char[this->m_options.windowSize]);
+			if (!slot->buffer || !this->readAt(start, slot->buffer.get(), length))
+			{
+				slot->buffer.reset();
+				std::erase_if(this->m_windows, [](const Window & window)
+				{
+					return window.data == nullptr && !window.buffer;
+				});
+				return nullptr;
+			}
+			slot->data = slot->buffer.get();
+		}
+		slot->length = length;
+		return slot;
+	}
+
+	COMFYDX_API std::string_view FileViewer::read(std::uint64_t offset, std::size_t length)
+	{
+		if (!this->m_bOpen)
+		{
+			return {};
+		}
+		// Mapped bytes past a new end of the file fault, a truncation drops the windows first
+		auto current = this->querySize();
+		if (current != noOffset && current < this->size())
+		{
+			this->refresh();
+		}
+
+		auto size = this->size();
+		if (offset >= size)
+		{
+			return {};
+		}
+		length = std::size_t(std::min<std::uint64_t>({ length, this->stride(), size - offset }));
+		auto index = offset / this->stride();
+		auto window = this->window(index, size);
+		if (window == nullptr)
+		{
+			return {};
+		}
+		auto at = std::size_t(offset - index * this->stride());
+		return { window->data + at, std::min(length, window->length - at) };
+	}
+
+	std::uint64_t FileViewer::skipLines(std::uint64_t offset, std::uint64_t n)
+	{
+		while (true)
+		{
+			auto chunk = this->read(offset, this->stride());
+			if (chunk.empty())
+			{
+				return noOffset;
+			}
+			auto count = countLineFeeds(chunk);
+			if (n < count)
+			{
+				return offset + findLineFeed(chunk, std::size_t(n)) + 1;
+			}
+			n -= count;
+			offset += chunk.size();
+		}
+	}
+	std::uint64_t FileViewer::countLines(std::uint64_t from, std::uint64_t to)
+	{
+		std::uint64_t count = 0;
+		while (from < to)
+		{
+			auto chunk = this->read(from, std::size_t(std::min<std::uint64_t>(to - from, this->stride())));
+			if (chunk.empty())
+			{
+				break;
+			}
+			count += countLineFeeds(chunk);
+			from += chunk.size();
+		}
+		return count;
+	}
+
+	double FileViewer::averageLine() const noexcept
+	{
+		if (this->m_lineFeeds == 0)
+		{
+			// No line feed yet, the first line is at least this long
+			return std::max(double(this->m_indexed), guessedLineLength);
+		}
+		return double(this->m_indexed) / double(this->m_lineFeeds);
+	}
+
+	COMFYDX_API ViewerLine FileViewer::lineAt(std::uint64_t offset)
+	{
+		offset = std::min(offset, this->size());
+
+		// Back to the start of the line
+		auto start = offset;
+		auto back = std::min<std::uint64_t>(offset, this->stride());
+		auto before = this->read(offset - back, std::size_t(back));
+		auto lf = before.rfind('\n');
+		if (lf != std::string_view::npos)
+		{
+			start = offset - before.size() + lf + 1;
+		}
+		else if (back == offset)
+		{
+			start = 0;
+		}
+
+		std::unique_lock lock{ this->m_mutex };
+		auto last = this->m_checkpoints.back();
+		if (start <= this->m_indexed || start - last <= this->m_options.windowSize)
+		{
+			// Exact, at most a checkpoint interval or a window to scan
+			auto it = std::upper_bound(this->m_checkpoints.begin(), this->m_checkpoints.end(), start) - 1;
+			auto line = std::uint64_t(it - this->m_checkpoints.begin()) * this->m_options.checkpointLines;
+			auto from = *it;
+			lock.unlock();
+			return { line + this->countLines(from, start), start, true };
+		}
+
+		auto average = this->averageLine();
+		auto line = this->m_lineFeeds + std::uint64_t(double(start - this->m_indexed) / average);
+		return { line, start, false };
+	}
+	COMFYDX_API ViewerLine FileViewer::locate(std::uint64_t line)
+	{
+		std::unique_lock lock{ this->m_mutex };
+		const std::uint64_t every = this->m_options.checkpointLines;
+		auto checkpoint = std::min<std::uint64_t>(line / every, this->m_checkpoints.size() - 1);
+		auto from = this->m_checkpoints[checkpoint];
+		auto skip = line - checkpoint * every;
+		auto average = this->averageLine();
+		// Fewer than 'every' lines follow the last checkpoint of a complete index
+		bool bComplete = this->m_indexed == this->m_size;
+		lock.unlock();
+
+		if (skip < every || bComplete || double(skip) * average <= double(this->m_options.windowSize))
+		{
+			auto offset = (skip != 0) ? this->skipLines(from, skip - 1) : from;
+			if (offset == noOffset)
+			{
+				return this->lineAt(this->size());
+			}
+			return { line, offset, true };
+		}
+
+		auto estimate = from + std::uint64_t(double(skip) * average);
+		if (estimate >= this->size())
+		{
+			return this->lineAt(this->size());
+		}
+		auto found = this->lineAt(estimate);
+		return { found.bExact ? found.line : line, found.offset, found.bExact };
+	}
+	COMFYDX_API ViewerLine FileViewer::lineCount()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		if (this->m_indexed == this->m_size)
+		{
+			return { this->m_lineFeeds + 1, this->m_size, true };
+		}
+		auto average = this->averageLine();
+		return { this->m_lineFeeds + std::uint64_t(double(this->m_size - this->m_indexed) / average) + 1, this->m_size, false };
+	}
+
+	COMFYDX_API std::size_t FileViewer::resident() const noexcept
+	{
+		std::size_t total = 0;
+		for (const auto & window : this->m_windows)
+		{
+			total += window.buffer ? this->m_options.windowSize : window.length;
+		}
+		return total;
+	}
+}
@@ -0,0 +1,868 @@
+#include "pch.hpp"
+#include "fileWatcher.hpp"
+#include "varint.hpp"
+
+#include <algorithm>
+#include <span>
+#include <fstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
+
+namespace cdx::io
+{
+	struct WatchedDir
+	{
+		std::filesystem::path path;
+		// Watched files by name, lowercase on Windows
+		std::unordered_map<std::filesystem::path::string_type, std::vector<WatchId>> names;
+		// No native watch, the files are polled
+		bool bPolled{ false };
+#ifdef _WIN32
+		HANDLE handle{ INVALID_HANDLE_VALUE };
+		OVERLAPPED overlapped{};
+		std::unique_ptr<DWORD[]> buffer;
+		// A read is pending, the buffer has to stay until it completes
+		bool bArmed{ false };
+#else
+		int wd{ -1 };
+#endif
+	};
+
+	namespace
+	{
+#ifdef _WIN32
+		constexpr DWORD notifyBufferSize{ 64 << 10 };
+		constexpr DWORD notifyFilter{ FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE };
+#elif defined(__linux__)
+		constexpr std::uint32_t notifyMask{ IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR };
+#endif
+
+		// NTFS names are case-insensitive, events report them as they are on disk
+		[[nodiscard]] std::filesystem::path::string_type nameKey(std::filesystem::path::string_type name)
+		{
+#ifdef _WIN32
+			if (!name.empty())
+			{
+				::CharLowerBuffW(name.data(), DWORD(name.size()));
+			}
+#endif
+			return name;
+		}
+
+		[[nodiscard]] std::uint64_t blockHash(std::string_view bytes) noexcept
+		{
+			return io::checksum(bytes);
+		}
+
+		// Whole blocks that differ, adjacent ones merged
+		[[nodiscard]] std::vector<ByteRange> changedBlocks(std::span<const std::uint64_t> old, std::span<const std::uint64_t> now, std::uint64_t size, std::uint64_t blockSize)
+		{
+			std::vector<ByteRange> ranges;
+			for (std::size_t i = 0; i < now.size(); ++i)
+			{
+				if (i < old.size() && old[i] == now[i])
+				{
+					continue;
+				}
+				auto offset = i * blockSize;
+				auto length = std::min(blockSize, size - offset);
+				if (!ranges.empty() && ranges.back().offset + ranges.back().length == offset)
+				{
+					ranges.back().length += length;
+				}
+				else
+				{
+					ranges.push_back({ offset, length });
+				}
+			}
+			return ranges;
+		}
+	}
+
+	COMFYDX_API FileWatcher::FileWatcher(Notify notify, WatchOptions options)
+		: m_notify{ std::move(notify) }, m_options{ options }
+	{
+		this->m_options.blockSize = std::max<std::size_t>(this->m_options.blockSize, 4096);
+		this->m_bNative.store(this->openNative(), std::memory_order_relaxed);
+
+		auto threads = this->m_options.threads;
+		if (threads == 0)
+		{
+			threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+		}
+		for (unsigned i = 0; i < threads; ++i)
+		{
+			this->m_workers.emplace_back([this](std::stop_token stop)
+			{
+				this->work(stop);
+			});
+		}
+		this->m_monitor = std::jthread([this](std::stop_token stop)
+		{
+			this->monitor(stop);
+		});
+	}
+	COMFYDX_API FileWatcher::~FileWatcher() noexcept
+	{
+		this->m_monitor.request_stop();
+		this->wake();
+		if (this->m_monitor.joinable())
+		{
+			this->m_monitor.join();
+		}
+		for (auto & worker : this->m_workers)
+		{
+			worker.request_stop();
+		}
+		this->m_workers.clear();
+		this->closeNative();
+	}
+
+	COMFYDX_API WatchId FileWatcher::watch(const std::filesystem::path & path, int priority)
+	{
+		std::error_code ec;
+		auto absolute = std::filesystem::absolute(path, ec).lexically_normal();
+		if (ec)
+		{
+			absolute = path;
+		}
+
+		File file;
+		file.path = absolute;
+		file.dir = nameKey(absolute.parent_path().native());
+		file.priority = priority;
+		// Changes before the first check are seen by the stamp
+		file.stamp.size = std::filesystem::file_size(absolute, ec);
+		if (!ec)
+		{
+			file.stamp.time = std::uint64_t(std::filesystem::last_write_time(absolute, ec).time_since_epoch().count());
+			file.stamp.bExists = !ec;
+		}
+		file.polled = file.stamp;
+
+		WatchId id;
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			id = ++this->m_nextId;
+			auto & dir = this->m_dirs[file.dir];
+			if (!dir)
+			{
+				dir = std::make_unique<WatchedDir>();
+				dir->path = absolute.parent_path();
+				this->m_bDirsChanged = true;
+			}
+			dir->names[nameKey(absolute.filename().native())].push_back(id);
+			auto & added = this->m_files.emplace(id, std::move(file)).first->second;
+			this->enqueue(id, added);
+		}
+		this->wake();
+		return id;
+	}
+	COMFYDX_API void FileWatcher::unwatch(WatchId id)
+	{
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			auto it = this->m_files.find(id);
+			if (it == this->m_files.end())
+			{
+				return;
+			}
+			auto & file = it->second;
+			if (file.bQueued)
+			{
+				this->m_queue.erase({ !file.bKnown, file.priority, file.queueSeq, id });
+			}
+
+			auto dirIt = this->m_dirs.find(file.dir);
+			if (dirIt != this->m_dirs.end())
+			{
+				auto & names = dirIt->second->names;
+				auto nameIt = names.find(nameKey(file.path.filename().native()));
+				if (nameIt != names.end())
+				{
+					std::erase(nameIt->second, id);
+					if (nameIt->second.empty())
+					{
+						names.erase(nameIt);
+					}
+				}
+				if (names.empty())
+				{
+					this->m_closing.push_back(std::move(dirIt->second));
+					this->m_dirs.erase(dirIt);
+					this->m_bDirsChanged = true;
+				}
+			}
+			// A running check finds the file gone and drops its result
+			this->m_files.erase(it);
+		}
+		this->wake();
+	}
+	COMFYDX_API void FileWatcher::setPriority(WatchId id, int priority)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		auto it = this->m_files.find(id);
+		if (it == this->m_files.end() || it->second.priority == priority)
+		{
+			return;
+		}
+		auto & file = it->second;
+		if (file.bQueued)
+		{
+			this->m_queue.erase({ !file.bKnown, file.priority, file.queueSeq, id });
+			this->m_queue.insert({ !file.bKnown, priority, file.queueSeq, id });
+		}
+		file.priority = priority;
+	}
+	COMFYDX_API std::size_t FileWatcher::watchCount()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		return this->m_files.size();
+	}
+
+	void FileWatcher::touched(WatchedDir & dir, const DirKey & name, Clock::time_point now)
+	{
+		auto it = dir.names.find(nameKey(name));
+		if (it == dir.names.end())
+		{
+			return;
+		}
+		for (auto id : it->second)
+		{
+			this->touchedFile(id, now);
+		}
+	}
+	void FileWatcher::touchedAll(WatchedDir & dir, Clock::time_point now)
+	{
+		for (const auto & [name, ids] : dir.names)
+		{
+			for (auto id : ids)
+			{
+				this->touchedFile(id, now);
+			}
+		}
+	}
+	void FileWatcher::touchedFile(WatchId id, Clock::time_point now)
+	{
+		auto it = this->m_files.find(id);
+		if (it == this->m_files.end())
+		{
+			return;
+		}
+		auto & file = it->second;
+		file.lastEvent = now;
+		if (!file.bPending)
+		{
+			file.bPending = true;
+			file.firstEvent = now;
+			this->m_pending.push_back(id);
+		}
+	}
+	void FileWatcher::enqueue(WatchId id, File & file)
+	{
+		if (file.bRunning)
+		{
+			file.bAgain = true;
+			return;
+		}
+		if (file.bQueued)
+		{
+			return;
+		}
+		file.queueSeq = ++this->m_nextSeq;
+		file.bQueued = true;
+		this->m_queue.insert({ !file.bKnown, file.priority, file.queueSeq, id });
+		this->m_jobReady.notify_one();
+	}
+
+	FileWatcher::Clock::duration FileWatcher::settle(Clock::time_point now)
+	{
+		auto next = now + std::chrono::seconds(1);
+		std::erase_if(this->m_pending, [&](WatchId id)
+		{
+			auto it = this->m_files.find(id);
+			if (it == this->m_files.end() || !it->second.bPending)
+			{
+				return true;
+			}
+			auto & file = it->second;
+			auto due = std::min(file.lastEvent + this->m_options.settle, file.firstEvent + this->m_options.maxDelay);
+			if (due > now)
+			{
+				next = std::min(next, due);
+				return false;
+			}
+			file.bPending = false;
+			this->enqueue(id, file);
+			return true;
+		});
+		return next - now;
+	}
+	void FileWatcher::poll(Clock::time_point now)
+	{
+		struct Probe
+		{
+			WatchId id{};
+			std::filesystem::path path;
+			FileStamp stamp;
+		};
+		std::vector<Probe> probes;
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			if (now < this->m_nextPoll)
+			{
+				return;
+			}
+			this->m_nextPoll = now + this->m_options.pollInterval;
+			for (const auto & [key, dir] : this->m_dirs)
+			{
+				if (!dir->bPolled)
+				{
+					continue;
+				}
+				for (const auto & [name, ids] : dir->names)
+				{
+					for (auto id : ids)
+					{
+						const auto & file = this->m_files.at(id);
+						probes.push_back({ id, file.path, file.polled });
+					}
+				}
+			}
+		}
+		if (probes.empty())
+		{
+			return;
+		}
+
+		// Stat outside of the lock, there may be thousands
+		std::erase_if(probes, [](Probe & probe)
+		{
+			std::error_code ec;
+			FileStamp stamp;
+			stamp.size = std::filesystem::file_size(probe.path, ec);
+			if (!ec)
+			{
+				stamp.time = std::uint64_t(std::filesystem::last_write_time(probe.path, ec).time_since_epoch().count());
+				stamp.bExists = !ec;
+			}
+			return std::exchange(probe.stamp, stamp) == stamp;
+		});
+		std::scoped_lock lock{ this->m_mutex };
+		for (const auto & probe : probes)
+		{
+			auto it = this->m_files.find(probe.id);
+			if (it == this->m_files.end())
+			{
+				continue;
+			}
+			this->touchedFile(probe.id, now);
+			// Settled once the next poll saw no change
+			it->second.lastEvent = now + this->m_options.pollInterval;
+			it->second.polled = probe.stamp;
+		}
+	}
+
+	void FileWatcher::monitor(std::stop_token stop) noexcept
+	{
+		while (!stop.stop_requested())
+		{
+			try
+			{
+				this->syncDirs();
+				auto now = Clock::now();
+				this->poll(now);
+				Clock::duration timeout;
+				{
+					std::scoped_lock lock{ this->m_mutex };
+					timeout = this->settle(now);
+					if (std::any_of(this->m_dirs.begin(), this->m_dirs.end(), [](const auto & dir)
+					{
+						return dir.second->bPolled;
+					}))
+					{
+						timeout = std::min<Clock::duration>(timeout, this->m_nextPoll - now);
+					}
+				}
+				this->waitEvents(std::max<Clock::duration>(timeout, Clock::duration::zero()));
+			}
+			catch (...)
+			{
+				// Out of memory, try again later
+				std::this_thread::sleep_for(this->m_options.settle);
+			}
+		}
+	}
+
+	void FileWatcher::work(std::stop_token stop) noexcept
+	{
+		std::unique_ptr<char[]> buffer{ new (std::nothrow) char[this->m_options.blockSize] };
+		if (!buffer)
+		{
+			return;
+		}
+		std::unique_lock lock{ this->m_mutex };
+		while (this->m_jobReady.wait(lock, stop, [this]
+		{
+			return !this->m_queue.empty();
+		}))
+		{
+			auto key = *this->m_queue.begin();
+			this->m_queue.erase(this->m_queue.begin());
+			auto & file = this->m_files.at(key.id);
+			file.bQueued = false;
+			file.bRunning = true;
+			auto path = file.path;
+			auto oldStamp = file.stamp;
+			auto oldBlocks = std::move(file.blocks);
+			bool bKnown = file.bKnown;
+			lock.unlock();
+
+			FileChange change;
+			change.id = key.id;
+			change.path = path;
+			FileStamp stamp;
+			std::vector<std::uint64_t> blocks;
+			bool bRead = true;
+			try
+			{
+				std::error_code ec;
+				stamp.size = std::filesystem::file_size(path, ec);
+				if (!ec)
+				{
+					stamp.time = std::uint64_t(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+					stamp.bExists = !ec;
+				}
+				if (stamp.bExists)
+				{
+					// Streamed, a mapping would keep writers from truncating the file on Windows
+					std::ifstream in{ path, std::ios::binary };
+					stamp.size = 0;
+					while (in)
+					{
+						in.read(buffer.get(), std::streamsize(this->m_options.blockSize));
+						auto got = std::size_t(in.gcount());
+						if (got == 0)
+						{
+							break;
+						}
+						blocks.push_back(blockHash({ buffer.get(), got }));
+						stamp.size += got;
+					}
+					bRead = in.eof();
+					this->m_bytesHashed.fetch_add(stamp.size, std::memory_order_relaxed);
+				}
+			}
+			catch (...)
+			{
+				bRead = false;
+			}
+			change.size = stamp.size;
+
+			bool bReport = false;
+			if (bRead)
+			{
+				if (!stamp.bExists)
+				{
+					change.bRemoved = true;
+					bReport = oldStamp.bExists;
+				}
+				else if (!bKnown)
+				{
+					// Changed between watch() and this first look, the old contents are unknown
+					if (stamp != oldStamp)
+					{
+						change.changed.push_back({ 0, stamp.size });
+						bReport = true;
+					}
+				}
+				else
+				{
+					change.changed = changedBlocks(oldBlocks, blocks, stamp.size, this->m_options.blockSize);
+					bReport = !change.changed.empty() || stamp.size != oldStamp.size || !oldStamp.bExists;
+				}
+			}
+
+			lock.lock();
+			auto it = this->m_files.find(key.id);
+			if (it == this->m_files.end())
+			{
+				continue;
+			}
+			auto & checked = it->second;
+			checked.bRunning = false;
+			if (bRead)
+			{
+				checked.stamp = stamp;
+				checked.blocks = std::move(blocks);
+				checked.bKnown = true;
+			}
+			else
+			{
+				// Locked by the writer, look again once it settles
+				checked.blocks = std::move(oldBlocks);
+				this->touchedFile(key.id, Clock::now());
+				this->wake();
+			}
+			if (std::exchange(checked.bAgain, false))
+			{
+				this->enqueue(key.id, checked);
+			}
+			if (bReport && this->m_notify)
+			{
+				lock.unlock();
+				this->m_changes.fetch_add(1, std::memory_order_relaxed);
+				try
+				{
+					this->m_notify(change, stop);
+				}
+				catch (...)
+				{
+				}
+				lock.lock();
+			}
+		}
+	}
+
+#ifdef _WIN32
+
+	bool FileWatcher::openNative() noexcept
+	{
+		// Also wakes up the monitor when polling
+		this->m_port = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+		return this->m_port != nullptr && !this->m_options.bPolling;
+	}
+	void FileWatcher::closeNative() noexcept
+	{
+		std::size_t armed = 0;
+		auto close = [&](WatchedDir & dir)
+		{
+			if (dir.handle != INVALID_HANDLE_VALUE)
+			{
+				::CancelIoEx(dir.handle, &dir.overlapped);
+				::CloseHandle(dir.handle);
+				dir.handle = INVALID_HANDLE_VALUE;
+			}
+			armed += dir.bArmed;
+		};
+		for (auto & [key, dir] : this->m_dirs)
+		{
+			close(*dir);
+		}
+		for (auto & dir : this->m_closing)
+		{
+			close(*dir);
+		}
+		// Cancelled reads still complete into their buffers
+		while (armed != 0 && this->m_port != nullptr)
+		{
+			DWORD bytes;
+			ULONG_PTR key;
+			OVERLAPPED * overlapped;
+			if (!::GetQueuedCompletionStatus(this->m_port, &bytes, &key, &overlapped, 1000) && overlapped == nullptr)
+			{
+				break;
+			}
+			armed -= (overlapped != nullptr);
+		}
+		if (this->m_port != nullptr)
+		{
+			::CloseHandle(this->m_port);
+			this->m_port = nullptr;
+		}
+	}
+	void FileWatcher::wake() noexcept
+	{
+		if (this->m_port != nullptr)
+		{
+			::PostQueuedCompletionStatus(this->m_port, 0, 0, nullptr);
+		}
+	}
+
+	namespace
+	{
+		[[nodiscard]] bool arm(WatchedDir & dir) noexcept
+		{
+			dir.overlapped = {};
+			dir.bArmed = ::ReadDirectoryChangesW(dir.handle, dir.buffer.get(), notifyBufferSize, FALSE, notifyFilter, nullptr, &dir.overlapped, nullptr) != FALSE;
+			return dir.bArmed;
+		}
+	}
+
+	void FileWatcher::syncDirs()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		if (!std::exchange(this->m_bDirsChanged, false))
+		{
+			return;
+		}
+		std::erase_if(this->m_closing, [](const std::unique_ptr<WatchedDir> & dir)
+		{
+			if (dir->handle != INVALID_HANDLE_VALUE)
+			{
+				::CancelIoEx(dir->handle, &dir->overlapped);
+				::CloseHandle(dir->handle);
+				dir->handle = INVALID_HANDLE_VALUE;
+			}
+			// Freed once the cancelled read completed
+			return !dir->bArmed;
+		});
+
+		bool bNative = false;
+		for (auto & [key, dir] : this->m_dirs)
+		{
+			if (this->m_options.bPolling || this->m_port == nullptr)
+			{
+				dir->bPolled = true;
+			}
+			if (dir->bPolled)
+			{
+				continue;
+			}
+			if (dir->handle == INVALID_HANDLE_VALUE)
+			{
+				dir->handle = ::CreateFileW(dir->path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+					OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+				if (dir->handle == INVALID_HANDLE_VALUE ||
+					::CreateIoCompletionPort(dir->handle, this->m_port, ULONG_PTR(dir.get()), 0) == nullptr)
+				{
+					if (dir->handle != INVALID_HANDLE_VALUE)
+					{
+						::CloseHandle(dir->handle);
+						dir->handle = INVALID_HANDLE_VALUE;
+					}
+					dir->bPolled = true;
+					continue;
+				}
+				dir->buffer.reset(new DWORD[notifyBufferSize / sizeof(DWORD)]);
+				if (!arm(*dir))
+				{
+					::CloseHandle(dir->handle);
+					dir->handle = INVALID_HANDLE_VALUE;
+					dir->bPolled = true;
+					continue;
+				}
+			}
+			bNative = true;
+		}
+		this->m_bNative.store(bNative, std::memory_order_relaxed);
+	}
+	void FileWatcher::waitEvents(Clock::duration timeout)
+	{
+		auto ms = DWORD(std::min<std::int64_t>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count(), 1000));
+		while (true)
+		{
+			DWORD bytes = 0;
+			ULONG_PTR key = 0;
+			OVERLAPPED * overlapped = nullptr;
+			BOOL ok = ::GetQueuedCompletionStatus(this->m_port, &bytes, &key, &overlapped, ms);
+			if (overlapped == nullptr)
+			{
+				// Timeout or wake up
+				return;
+			}
+			ms = 0;
+
+			std::scoped_lock lock{ this->m_mutex };
+			auto dir = reinterpret_cast<WatchedDir *>(key);
+			dir->bArmed = false;
+			auto closing = std::find_if(this->m_closing.begin(), this->m_closing.end(), [dir](const std::unique_ptr<WatchedDir> & closed)
+			{
+				return closed.get() == dir;
+			});
+			if (closing != this->m_closing.end())
+			{
+				this->m_closing.erase(closing);
+				continue;
+			}
+
+			auto now = Clock::now();
+			if (!ok || bytes == 0)
+			{
+				// Overflow, or the directory is gone: everything may have changed
+				this->touchedAll(*dir, now);
+			}
+			else
+			{
+				auto at = reinterpret_cast<const char *>(dir->buffer.get());
+				while (true)
+				{
+					auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(at);
+					this->touched(*dir, { info->FileName, info->FileNameLength / sizeof(WCHAR) }, now);
+					if (info->NextEntryOffset == 0)
+					{
+						break;
+					}
+					at += info->NextEntryOffset;
+				}
+			}
+			if (!ok || !arm(*dir))
+			{
+				::CloseHandle(dir->handle);
+				dir->handle = INVALID_HANDLE_VALUE;
+				dir->bPolled = true;
+			}
+		}
+	}
+
+#else
+
+	bool FileWatcher::openNative() noexcept
+	{
+		if (::pipe(this->m_wake) != 0)
+		{
+			this->m_wake[0] = this->m_wake[1] = -1;
+		}
+		for (auto fd : this->m_wake)
+		{
+			if (fd >= 0)
+			{
+				::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+				::fcntl(fd, F_SETFD, FD_CLOEXEC);
+			}
+		}
+#ifdef __linux__
+		if (!this->m_options.bPolling)
+		{
+			this->m_inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		}
+#endif
+		return this->m_inotify >= 0;
+	}
+	void FileWatcher::closeNative() noexcept
+	{
+		for (auto fd : { this->m_inotify, this->m_wake[0], this->m_wake[1] })
+		{
+			if (fd >= 0)
+			{
+				::close(fd);
+			}
+		}
+		this->m_inotify = this->m_wake[0] = this->m_wake[1] = -1;
+	}
+	void FileWatcher::wake() noexcept
+	{
+		if (this->m_wake[1] >= 0)
+		{
+			char byte = 0;
+			[[maybe_unused]] auto written = ::write(this->m_wake[1], &byte, 1);
+		}
+	}
+
+	void FileWatcher::syncDirs()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		if (!std::exchange(this->m_bDirsChanged, false))
+		{
+			return;
+		}
+		for (auto & dir : this->m_closing)
+		{
+#ifdef __linux__
+			if (dir->wd >= 0)
+			{
+				::inotify_rm_watch(this->m_inotify, dir->wd);
+				this->m_watches.erase(dir->wd);
+			}
+#endif
+		}
+		this->m_closing.clear();
+
+		bool bNative = false;
+		for (auto & [key, dir] : this->m_dirs)
+		{
+			if (this->m_inotify < 0)
+			{
+				dir->bPolled = true;
+			}
+			if (dir->bPolled)
+			{
+				continue;
+			}
+#ifdef __linux__
+			if (dir->wd < 0)
+			{
+				// Fails once max_user_watches is reached
+				dir->wd = ::inotify_add_watch(this->m_inotify, dir->path.c_str(), notifyMask);
+				if (dir->wd < 0)
+				{
+					dir->bPolled = true;
+					continue;
+				}
+				this->m_watches[dir->wd] = dir.get();
+			}
+#endif
+			bNative = true;
+		}
+		this->m_bNative.store(bNative, std::memory_order_relaxed);
+	}
+	void FileWatcher::waitEvents(Clock::duration timeout)
+	{
+		pollfd fds[2]{ { this->m_wake[0], POLLIN, 0 }, { this->m_inotify, POLLIN, 0 } };
+		auto ms = int(std::min<std::int64_t>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count(), 1000));
+		if (::poll(fds, (this->m_inotify >= 0) ? 2 : 1, ms) <= 0)
+		{
+			return;
+		}
+		char drain[256];
+		while (this->m_wake[0] >= 0 && ::read(this->m_wake[0], drain, sizeof(drain)) > 0)
+		{
+		}
+
+#ifdef __linux__
+		alignas(inotify_event) char buffer[64 << 10];
+		while (this->m_inotify >= 0)
+		{
+			auto got = ::read(this->m_inotify, buffer, sizeof(buffer));
+			if (got <= 0)
+			{
+				break;
+			}
+			std::scoped_lock lock{ this->m_mutex };
+			auto now = Clock::now();
+			for (ssize_t at = 0; at < got;)
+			{
+				auto event = reinterpret_cast<const inotify_event *>(buffer + at);
+				at += ssize_t(sizeof(inotify_event) + event->len);
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					for (auto & [key, dir] : this->m_dirs)
+					{
+						this->touchedAll(*dir, now);
+					}
+					continue;
+				}
+				auto it = this->m_watches.find(event->wd);
+				if (it == this->m_watches.end())
+				{
+					continue;
+				}
+				auto & dir = *it->second;
+				if (event->mask & IN_IGNORED)
+				{
+					// The directory was deleted or unmounted, it is polled until it is back
+					this->m_watches.erase(it);
+					dir.wd = -1;
+					dir.bPolled = true;
+					this->touchedAll(dir, now);
+				}
+				else if (event->len != 0)
+				{
+					this->touched(dir, event->name, now);
+				}
+			}
+		}
+#endif
+	}
+
+#endif
+}
@@ -0,0 +1,363 @@
+#include "pch.hpp"
+#include "grammar.hpp"
+#include "varint.hpp"
+
+#include <jsonlite2.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace cdx::syntax
+{
+	namespace
+	{
+		using jsonlite2::jsonValue;
+
+		// jsonlite2 keeps strings as written, escapes included
+		[[nodiscard]] std::string unescape(std::string_view raw)
+		{
+			std::string out;
+			out.reserve(raw.size());
+			for (std::size_t i = 0; i < raw.size(); ++i)
+			{
+				if (raw[i] != '\\' || i + 1 == raw.size())
+				{
+					out += raw[i];
+					continue;
+				}
+				switch (auto c = raw[++i])
+				{
+				case 'n':
+					out += '\n';
+					break;
+				case 't':
+					out += '\t';
+					break;
+				case 'r':
+					out += '\r';
+					break;
+				case 'b':
+					out += '\b';
+					break;
+				case 'f':
+					out += '\f';
+					break;
+				case 'u':
+				{
+					char32_t cp = 0;
+					std::size_t digits = 0;
+					for (; digits < 4 && i + 1 < raw.size() && std::isxdigit((unsigned char)raw[i + 1]); ++digits)
+					{
+						auto h = raw[++i];
+						cp = cp * 16 + char32_t((h <= '9') ? h - '0' : (h | 0x20) - 'a' + 10);
+					}
+					if (digits != 4)
+					{
+						throw std::runtime_error("Invalid \\u escape!");
+					}
+					if (cp < 0x80)
+					{
+						out += char(cp);
+					}
+					else if (cp < 0x800)
+					{
+						out += char(0xC0 | (cp >> 6));
+						out += char(0x80 | (cp & 0x3F));
+					}
+					else
+					{
+						out += char(0xE0 | (cp >> 12));
+						out += char(0x80 | ((cp >> 6) & 0x3F));
+						out += char(0x80 | (cp & 0x3F));
+					}
+					break;
+				}
+				default:
+					// \" \\ \/
+					out += c;
+				}
+			}
+			return out;
+		}
+
+		[[nodiscard]] const jsonValue * member(const jsonValue & object, const std::string & key)
+		{
+			const auto & obj = object.getObject();
+			return obj.contains(key) ? &obj[key].get() : nullptr;
+		}
+		[[nodiscard]] std::string stringMember(const jsonValue & object, const std::string & key, std::string fallback = {})
+		{
+			auto value = member(object, key);
+			return value ? unescape(value->getString()) : fallback;
+		}
+		[[nodiscard]] bool boolMember(const jsonValue & object, const std::string & key, bool fallback)
+		{
+			auto value = member(object, key);
+			return value ? value->getBoolean() : fallback;
+		}
+	}
+
+	TokenKind Grammar::intern(std::string_view kind)
+	{
+		auto it = std::find(this->m_kinds.begin(), this->m_kinds.end(), kind);
+		if (it != this->m_kinds.end())
+		{
+			return TokenKind(it - this->m_kinds.begin());
+		}
+		if (this->m_kinds.size() > 0xFFFF)
+		{
+			throw std::runtime_error("Too many token kinds!");
+		}
+		this->m_kinds.emplace_back(kind);
+		return TokenKind(this->m_kinds.size() - 1);
+	}
+
+	COMFYDX_API std::shared_ptr<const Grammar> Grammar::fromJson(std::string_view json, std::string & error)
+	{
+		error.clear();
+		if (json.empty())
+		{
+			error = "Empty grammar!";
+			return nullptr;
+		}
+		try
+		{
+			auto root = jsonlite2::json::parse(json.data(), json.size());
+			const jsonValue & top = root;
+
+			auto grammar = std::make_shared<Grammar>();
+			grammar->m_name = stringMember(top, "name");
+			bool bIgnoreCase = boolMember(top, "ignoreCase", false);
+
+			// States are named before any rule can refer to them
+			const auto & states = top["states"]->getArray();
+			if (states.size() == 0 || states.size() > 0xFFFF)
+			{
+				throw std::runtime_error("A grammar needs 1 to 65535 states!");
+			}
+			for (std::size_t i = 0; i < states.size(); ++i)
+			{
+				GrammarState state;
+				state.name = stringMember(states[i], "name");
+				if (grammar->state(state.name))
+				{
+					throw std::runtime_error("Duplicate state \"" + state.name + "\"!");
+				}
+				state.kind = grammar->intern(stringMember(states[i], "token"));
+				grammar->m_states.push_back(std::move(state));
+			}
+
+			for (std::size_t i = 0; i < states.size(); ++i)
+			{
+				auto & state = grammar->m_states[i];
+				auto rules = member(states[i], "rules");
+				if (rules == nullptr)
+				{
+					continue;
+				}
+				for (std::size_t j = 0; j < rules->getArray().size(); ++j)
+				{
+					const auto & def = rules->getArray()[j];
+					auto where = "State \"" + state.name + "\", rule " + std::to_string(j) + ": ";
+
+					auto pattern = stringMember(def, "match");
+					auto mode = boolMember(def, "ignoreCase", bIgnoreCase) ? text::CaseMode::ascii : text::CaseMode::sensitive;
+					Rule rule;
+					rule.regex = text::RegexSearch{ pattern, mode };
+					if (!rule.regex.valid())
+					{
+						throw std::runtime_error(where + rule.regex.error() + " at " + std::to_string(rule.regex.errorOffset()));
+					}
+					rule.kind = grammar->intern(stringMember(def, "token"));
+
+					auto target = [&](const std::string & key)
+					{
+						auto name = stringMember(def, key);
+						auto id = grammar->state(name);
+						if (!id)
+						{
+							throw std::runtime_error(where + "unknown state \"" + name + "\"!");
+						}
+						return *id;
+					};
+					if (member(def, "push") != nullptr)
+					{
+						rule.action = RuleAction::push;
+						rule.target = target("push");
+					}
+					else if (member(def, "set") != nullptr)
+					{
+						rule.action = RuleAction::set;
+						rule.target = target("set");
+					}
+					else if (boolMember(def, "pop", false))
+					{
+						rule.action = RuleAction::pop;
+					}
+					state.rules.push_back(std::move(rule));
+				}
+			}
+
+			if (auto brackets = member(top, "brackets"))
+			{
+				const auto & pairs = brackets->getArray();
+				if (pairs.size() > maxBracketPairs)
+				{
+					throw std::runtime_error("At most " + std::to_string(maxBracketPairs) + " bracket pairs are supported!");
+				}
+				for (std::size_t i = 0; i < pairs.size(); ++i)
+				{
+					auto pair = unescape(pairs[i].getString());
+					if (pair.size() != 2 || (unsigned char)pair[0] >= 0x80 || (unsigned char)pair[1] >= 0x80 || pair[0] == pair[1])
+					{
+						throw std::runtime_error("Bracket pair \"" + pair + "\" is not two different ASCII characters!");
+					}
+					grammar->m_brackets.push_back({ pair[0], pair[1] });
+				}
+			}
+			if (auto ignored = member(top, "ignoreBracketsIn"))
+			{
+				const auto & kinds = ignored->getArray();
+				for (std::size_t i = 0; i < kinds.size(); ++i)
+				{
+					auto kind = grammar->intern(unescape(kinds[i].getString()));
+					grammar->m_noBrackets.resize(std::max<std::size_t>(grammar->m_noBrackets.size(), kind + 1));
+					grammar->m_noBrackets[kind] = true;
+				}
+			}
+			return grammar;
+		}
+		catch (const std::exception & e)
+		{
+			error = e.what();
+			return nullptr;
+		}
+	}
+
+	COMFYDX_API void Grammar::encode(std::string & out) const
+	{
+		io::putBytes(out, this->m_name);
+		io::putVarint(out, this->m_kinds.size());
+		for (const auto & kind : this->m_kinds)
+		{
+			io::putBytes(out, kind);
+		}
+		io::putVarint(out, this->m_states.size());
+		for (const auto & state : this->m_states)
+		{
+			io::putBytes(out, state.name);
+			io::putVarint(out, state.kind);
+			io::putVarint(out, state.rules.size());
+			for (const auto & rule : state.rules)
+			{
+				io::putVarint(out, rule.kind);
+				io::putVarint(out, std::uint64_t(rule.action));
+				io::putVarint(out, rule.target);
+				rule.regex.encode(out);
+			}
+		}
+		io::putVarint(out, this->m_brackets.size());
+		for (const auto & pair : this->m_brackets)
+		{
+			out += pair.open;
+			out += pair.close;
+		}
+		io::putVarint(out, this->m_noBrackets.size());
+		for (bool bIgnored : this->m_noBrackets)
+		{
+			out += char(bIgnored);
+		}
+	}
+	COMFYDX_API std::shared_ptr<const Grammar> Grammar::decode(std::string_view in)
+	{
+		auto grammar = std::make_shared<Grammar>();
+		std::string_view bytes;
+		std::uint64_t kinds, states;
+		if (!io::getBytes(in, bytes) || !io::getVarint(in, kinds) || kinds == 0 || kinds > 0x10000)
+		{
+			return nullptr;
+		}
+		grammar->m_name = bytes;
+		grammar->m_kinds.clear();
+		for (std::uint64_t i = 0; i < kinds; ++i)
+		{
+			if (!io::getBytes(in, bytes))
+			{
+				return nullptr;
+			}
+			grammar->m_kinds.emplace_back(bytes);
+		}
+
+		if (!io::getVarint(in, states) || states == 0 || states > 0xFFFF)
+		{
+			return nullptr;
+		}
+		grammar->m_states.resize(std::size_t(states));
+		for (auto & state : grammar->m_states)
+		{
+			std::uint64_t kind, rules;
+			if (!io::getBytes(in, bytes) || !io::getVarint(in, kind) || kind >= kinds || !io::getVarint(in, rules) || rules > in.size())
+			{
+				return nullptr;
+			}
+			state.name = bytes;
+			state.kind = TokenKind(kind);
+			state.rules.resize(std::size_t(rules));
+			for (auto & rule : state.rules)
+			{
+				std::uint64_t action, target;
+				if (!io::getVarint(in, kind) || kind >= kinds || !io::getVarint(in, action) || action > std::uint64_t(RuleAction::set) ||
+					!io::getVarint(in, target) || target >= states || !rule.regex.decode(in) || !rule.regex.valid())
+				{
+					return nullptr;
+				}
+				rule.kind = TokenKind(kind);
+				rule.action = RuleAction(action);
+				rule.target = StateId(target);
+			}
+		}
+
+		std::uint64_t pairs, ignored;
+		if (!io::getVarint(in, pairs) || pairs > maxBracketPairs || in.size() < 2 * pairs)
+		{
+			return nullptr;
+		}
+		for (std::uint64_t i = 0; i < pairs; ++i)
+		{
+			grammar->m_brackets.push_back({ in[0], in[1] });
+			in.remove_prefix(2);
+		}
+		if (!io::getVarint(in, ignored) || ignored > kinds || in.size() != ignored)
+		{
+			return nullptr;
+		}
+		for (auto c : in)
+		{
+			grammar->m_noBrackets.push_back(c != 0);
+		}
+		return grammar;
+	}
+
+	COMFYDX_API std::optional<TokenKind> Grammar::kind(std::string_view name) const noexcept
+	{
+		auto it = std::find(this->m_kinds.begin(), this->m_kinds.end(), name);
+		if (it == this->m_kinds.end())
+		{
+			return std::nullopt;
+		}
+		return TokenKind(it - this->m_kinds.begin());
+	}
+	COMFYDX_API std::optional<StateId> Grammar::state(std::string_view name) const noexcept
+	{
+		auto it = std::find_if(this->m_states.begin(), this->m_states.end(), [name](const GrammarState & state)
+		{
+			return state.name == name;
+		});
+		if (it == this->m_states.end())
+		{
+			return std::nullopt;
+		}
+		return StateId(it - this->m_states.begin());
+	}
+}
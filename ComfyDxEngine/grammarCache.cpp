@@ -0,0 +1,141 @@
+#include "pch.hpp"
+#include "grammarCache.hpp"
+#include "mappedFile.hpp"
+#include "varint.hpp"
+
+#include <fstream>
+#include <chrono>
+
+namespace cdx::syntax
+{
+	namespace
+	{
+		constexpr std::string_view magic{ "CDXG" };
+
+		struct SourceStamp
+		{
+			std::uint64_t size{}, time{};
+		};
+
+		// The grammar stored in an entry, null if it is stale or damaged
+		[[nodiscard]] std::shared_ptr<const Grammar> readEntry(std::string_view in, const SourceStamp & stamp)
+		{
+			std::uint64_t version, size, time, sum;
+			if (!in.starts_with(magic))
+			{
+				return nullptr;
+			}
+			in.remove_prefix(magic.size());
+			if (!io::getVarint(in, version) || version != GrammarCache::formatVersion ||
+				!io::getVarint(in, size) || size != stamp.size || !io::getVarint(in, time) || time != stamp.time ||
+				!io::getVarint(in, sum) || sum != io::checksum(in))
+			{
+				return nullptr;
+			}
+			return Grammar::decode(in);
+		}
+	}
+
+	COMFYDX_API GrammarCache::GrammarCache(std::filesystem::path dir)
+		: m_dir{ std::move(dir) }
+	{
+	}
+
+	std::filesystem::path GrammarCache::entryPath(const std::filesystem::path & source) const
+	{
+		std::error_code ec;
+		auto absolute = std::filesystem::absolute(source, ec);
+		auto key = (ec ? source : absolute).generic_u8string();
+		auto hash = io::checksum({ reinterpret_cast<const char *>(key.data()), key.size() });
+
+		// Readable stem, the hash of the full path keeps equally named grammars apart
+		char hex[17]{};
+		for (std::size_t i = 0; i < 16; ++i)
+		{
+			hex[i] = "0123456789abcdef"[(hash >> (60 - 4 * i)) & 0xF];
+		}
+		auto name = source.stem();
+		name += "-";
+		name += hex;
+		name += ".cdxg";
+		return this->m_dir / name;
+	}
+
+	COMFYDX_API std::shared_ptr<const Grammar> GrammarCache::load(const std::filesystem::path & source, std::string & error)
+	{
+		error.clear();
+		std::error_code ec;
+		SourceStamp stamp;
+		stamp.size = std::filesystem::file_size(source, ec);
+		if (!ec)
+		{
+			stamp.time = std::uint64_t(std::filesystem::last_write_time(source, ec).time_since_epoch().count());
+		}
+		if (ec)
+		{
+			error = "Can't read " + source.string() + ": " + ec.message();
+			return nullptr;
+		}
+
+		auto entry = this->entryPath(source);
+		{
+			io::MappedFile file;
+			if (file.open(entry))
+			{
+				if (auto grammar = readEntry(file.view(), stamp))
+				{
+					this->m_hits.fetch_add(1, std::memory_order_relaxed);
+					return grammar;
+				}
+			}
+		}
+		this->m_misses.fetch_add(1, std::memory_order_relaxed);
+
+		std::shared_ptr<const Grammar> grammar;
+		{
+			io::MappedFile json;
+			if (!json.open(source))
+			{
+				error = "Can't read " + source.string();
+				return nullptr;
+			}
+			grammar = Grammar::fromJson(json.view(), error);
+			if (!grammar)
+			{
+				error = source.string() + ": " + error;
+				return nullptr;
+			}
+		}
+
+		std::string payload;
+		grammar->encode(payload);
+		std::string bytes{ magic };
+		io::putVarint(bytes, formatVersion);
+		io::putVarint(bytes, stamp.size);
+		io::putVarint(bytes, stamp.time);
+		io::putVarint(bytes, io::checksum(payload));
+		bytes += payload;
+
+		// Written aside and renamed, readers never map a half-written entry
+		std::filesystem::create_directories(this->m_dir, ec);
+		auto id = std::uintptr_t(this) ^ std::uintptr_t(std::chrono::steady_clock::now().time_since_epoch().count());
+		auto temp = entry;
+		temp += '.';
+		temp += std::to_string(id);
+		temp += ".tmp";
+		bool bWritten;
+		{
+			std::ofstream out{ temp, std::ios::binary | std::ios::trunc };
+			bWritten = out && out.write(bytes.data(), std::streamsize(bytes.size())) && out.flush();
+		}
+		if (bWritten)
+		{
+			std::filesystem::rename(temp, entry, ec);
+		}
+		if (!bWritten || ec)
+		{
+			std::filesystem::remove(temp, ec);
+		}
+		return grammar;
+	}
+}
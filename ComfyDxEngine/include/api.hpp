@@ -0,0 +1,11 @@
+#pragma once
+
+#ifdef _WIN32
+	#ifdef COMFYDXENGINE_EXPORTS
+	#define COMFYDX_API __declspec(dllexport)
+	#else
+	#define COMFYDX_API __declspec(dllimport)
+	#endif
+#else
+	#define COMFYDX_API __attribute__((visibility("default")))
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <memory>
+#include <optional>
+#include <cstdint>
+
+#include "api.hpp"
+#include "grammar.hpp"
+#include "pieceTable.hpp"
+
+namespace cdx::syntax
+{
+	struct Bracket
+	{
+		// Byte offset in the line
+		std::uint32_t column{ 0 };
+		// Index into Grammar::brackets()
+		std::uint8_t pair{ 0 };
+		bool bOpen{ false };
+	};
+
+	// What the bracket index knows about a line
+	struct LineStructure
+	{
+		static constexpr std::uint32_t blank{ 0xFFFFFFFF };
+
+		std::vector<Bracket> brackets;
+		// Columns of leading whitespace, blank if there is nothing else
+		std::uint32_t indent{ blank };
+	};
+
+	struct BracketPos
+	{
+		std::size_t line{};
+		std::uint32_t column{};
+	};
+	struct BracketBlock
+	{
+		BracketPos open;
+		// Unset if the block is never closed
+		std::optional<BracketPos> close;
+	};
+	// Lines (first, last] can be hidden behind line 'first'
+	struct FoldRange
+	{
+		std::size_t first{}, last{};
+	};
+
+	struct BracketNode;
+
+	/*
+	 * Brackets and indentation of every line in an implicit treap. Every node
+	 * sums up its subtree: the line count, per bracket pair the net depth
+	 * change and the lowest depth reached, and the smallest indentation. So
+	 * the line where a depth or indentation is reached again is found by one
+	 * descent, every query is O(log n) plus the brackets of the lines it ends on.
+	 *
+	 * Pairs are matched independently, a stray ')' doesn't break up a {} block.
+	 */
+	class BracketIndex
+	{
+	private:
+		using NodePtr = std::unique_ptr<BracketNode>;
+
+		NodePtr m_root;
+		std::uint64_t m_seed{ 0x9E3779B97F4A7C15 };
+
+		[[nodiscard]] std::uint32_t priority() noexcept;
+		[[nodiscard]] NodePtr build(std::size_t count);
+		// The line's node and the bracket depths at its start
+		[[nodiscard]] const BracketNode * locate(std::size_t line, std::int64_t * depths) const noexcept;
+		[[nodiscard]] std::optional<BracketPos> findClose(std::size_t line, std::size_t pair, std::int64_t depth) const;
+		[[nodiscard]] std::optional<BracketPos> findOpen(std::size_t line, std::uint32_t column, std::size_t pair, std::int64_t depth) const;
+
+	public:
+		COMFYDX_API BracketIndex();
+		COMFYDX_API BracketIndex(BracketIndex && other) noexcept;
+		COMFYDX_API BracketIndex & operator=(BracketIndex && other) noexcept;
+		COMFYDX_API ~BracketIndex() noexcept;
+
+		// Starts over with 'lines' blank lines
+		COMFYDX_API void reset(std::size_t lines);
+		COMFYDX_API void insert(std::size_t line, std::size_t count);
+		COMFYDX_API void erase(std::size_t line, std::size_t count);
+		COMFYDX_API void setLine(std::size_t line, LineStructure structure);
+
+		[[nodiscard]] COMFYDX_API std::size_t lineCount() const noexcept;
+		[[nodiscard]] COMFYDX_API const LineStructure & line(std::size_t line) const noexcept;
+
+		// The bracket matching the one at 'column'
+		[[nodiscard]] COMFYDX_API std::optional<BracketPos> matchingBracket(std::size_t line, std::uint32_t column) const;
+		// Innermost bracket pair around the position, brackets at 'column' itself are outside of it
+		[[nodiscard]] COMFYDX_API std::optional<BracketBlock> enclosingBlock(std::size_t line, std::uint32_t column) const;
+		/*
+		 * Regions starting in lines [first, last): from a line's first bracket
+		 * closing on a later line up to the line before the closing one, else
+		 * from a line to the last one indented deeper after it.
+		 */
+		[[nodiscard]] COMFYDX_API std::vector<FoldRange> foldRanges(std::size_t first, std::size_t last) const;
+	};
+
+	/*
+	 * Collapsed regions of a view. Only the lines shown change, the text stays
+	 * as it is. Regions nest: collapsing one absorbs those inside of it, regions
+	 * inside a collapsed one can't be collapsed.
+	 */
+	class FoldState
+	{
+	private:
+		// Disjoint, sorted
+		std::vector<FoldRange> m_collapsed;
+		// Hidden lines in the regions before each one, plus the total
+		std::vector<std::size_t> m_hiddenBefore{ 0 };
+
+		void update();
+
+	public:
+		[[nodiscard]] const std::vector<FoldRange> & collapsed() const noexcept
+		{
+			return this->m_collapsed;
+		}
+
+		// False if the region is empty, hidden or overlaps a collapsed one partially
+		COMFYDX_API bool collapse(FoldRange range);
+		// Expands the region starting at or hiding 'line'
+		COMFYDX_API bool expand(std::size_t line);
+		COMFYDX_API void expandAll() noexcept;
+		// Regions whose first line was edited are expanded
+		COMFYDX_API void edit(std::span<const text::LineEdit> edits);
+
+		[[nodiscard]] COMFYDX_API bool hidden(std::size_t line) const noexcept;
+		// Row of a line among the visible ones, hidden lines map to the row of their region
+		[[nodiscard]] COMFYDX_API std::size_t visibleLine(std::size_t line) const noexcept;
+		[[nodiscard]] COMFYDX_API std::size_t documentLine(std::size_t visible) const noexcept;
+		[[nodiscard]] std::size_t visibleCount(std::size_t lineCount) const noexcept
+		{
+			return lineCount - this->m_hiddenBefore.back();
+		}
+	};
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace ce
+{
+	// The same position in a UTF-8 line measured in every unit the editor cares about
+	struct TextPos
+	{
+		std::size_t byte{}, utf16{}, codePoint{}, grapheme{}, column{};
+	};
+
+	/*
+	 * Per-line checkpoints for converting between byte offsets, UTF-16 code units
+	 * (DirectWrite), code points, grapheme clusters and visual columns. A checkpoint
+	 * is stored at the first cluster start after every 'interval' code points, so a
+	 * conversion is a binary search plus a bounded forward scan.
+	 *
+	 * The index does not own the text, every call gets the current line contents.
+	 * Checkpoints are built lazily, only as far as queries reach, and have to be
+	 * invalidated when the line is edited.
+	 */
+	class ColumnIndex
+	{
+	public:
+		enum class Unit : std::uint8_t
+		{
+			byte,
+			utf16,
+			codePoint,
+			grapheme,
+			column
+		};
+
+		// Decoder and cluster state, enough to continue scanning from anywhere
+		struct Scanner
+		{
+			TextPos pos{};
+			char32_t prev{ 0 };
+			std::uint32_t regionalCount{ 0 };
+			bool bClusterStart{ true };
+		};
+
+		static constexpr std::size_t defInterval{ 64 };
+
+	private:
+		std::vector<TextPos> m_checkpoints{ TextPos{} };
+		Scanner m_build{};
+		bool m_bComplete{ false };
+
+		std::size_t m_interval;
+		std::uint8_t m_tabSize;
+
+		void build(std::string_view line, Unit unit, std::size_t value) noexcept;
+
+	public:
+		explicit ColumnIndex(std::uint8_t tabSize = 4, std::size_t interval = defInterval) noexcept
+			: m_interval{ interval < 16 ? 16 : interval }, m_tabSize{ tabSize == 0 ? std::uint8_t(1) : tabSize }
+		{
+		}
+
+		[[nodiscard]] static constexpr std::size_t get(const TextPos & pos, Unit unit) noexcept
+		{
+			switch (unit)
+			{
+			case Unit::byte:
+				return pos.byte;
+			case Unit::utf16:
+				return pos.utf16;
+			case Unit::codePoint:
+				return pos.codePoint;
+			case Unit::grapheme:
+				return pos.grapheme;
+			default:
+				return pos.column;
+			}
+		}
+
+		/*
+		 * Resolves 'value' measured in 'unit' into a full position. Positions inside a
+		 * code point snap back to its start, grapheme and column positions snap back
+		 * to the start of the cluster that covers them. Values past the end give the end.
+		 */
+		COMFYDX_API TextPos find(std::string_view line, Unit unit, std::size_t value) noexcept;
+		[[nodiscard]] std::size_t convert(std::string_view line, Unit from, std::size_t value, Unit to) noexcept
+		{
+			return ColumnIndex::get(this->find(line, from, value), to);
+		}
+		COMFYDX_API TextPos end(std::string_view line) noexcept;
+
+		// Call after the line was modified starting at byte offset 'fromByte'
+		COMFYDX_API void invalidate(std::size_t fromByte = 0) noexcept;
+		COMFYDX_API void setTabSize(std::uint8_t tabSize) noexcept;
+
+		[[nodiscard]] std::size_t checkpoints() const noexcept
+		{
+			return this->m_checkpoints.size();
+		}
+	};
+
+	// Display width of a code point in columns: 0 for combining marks, 2 for wide East Asian and emoji
+	[[nodiscard]] COMFYDX_API std::uint8_t columnWidth(char32_t cp) noexcept;
+
+	/*
+	 * Rows a line takes when wrapped to 'columns': rows end after the last
+	 * space or tab that fits, words longer than a row are broken between
+	 * clusters. Whitespace at the end of a row never wraps.
+	 */
+	[[nodiscard]] COMFYDX_API std::size_t wrappedRows(std::string_view line, std::size_t columns, std::uint8_t tabSize) noexcept;
+	// Byte offsets where the rows after the first one start
+	[[nodiscard]] COMFYDX_API std::vector<std::size_t> wrapLine(std::string_view line, std::size_t columns, std::uint8_t tabSize);
+}
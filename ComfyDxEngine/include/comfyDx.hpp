@@ -1,10 +1,6 @@
 #pragma once
 
-#ifdef COMFYDXENGINE_EXPORTS
-#define COMFYDX_API __declspec(dllexport)
-#else
-#define COMFYDX_API __declspec(dllimport)
-#endif
+#include "api.hpp"
 
 #include "direct2d.hpp"
 #include "directwrite.hpp"
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+#include "pieceTable.hpp"
+#include "undoHistory.hpp"
+
+namespace cdx::text
+{
+	// Lines [oldFirst, oldFirst + oldCount) were replaced by lines [newFirst, newFirst + newCount)
+	struct DiffHunk
+	{
+		std::size_t oldFirst{}, oldCount{};
+		std::size_t newFirst{}, newCount{};
+	};
+
+	// Edit distance at which Myers' algorithm gives up on a range
+	constexpr std::size_t maxDiffCost{ 4096 };
+
+	enum class DiffAlgorithm : std::uint8_t
+	{
+		// Shortest edit script
+		myers,
+		// Anchors on the rarest common lines first, which keeps moved blocks and braces together
+		histogram
+	};
+
+	/*
+	 * Line diff of two snapshots. A line includes its '\n', so a missing final
+	 * line feed is a change of the last line. Lines are told apart by a 64-bit
+	 * hash of their bytes, equal hashes are confirmed by comparing the bytes.
+	 *
+	 * The common start and end are skipped byte-wise first, pieces both
+	 * snapshots share aren't even read. Histogram diff then splits the rest at
+	 * the longest run around a line that occurs rarely on both sides, ranges
+	 * without such a line go to Myers' linear space algorithm, after lines
+	 * that occur on one side only were dropped. Ranges needing more than
+	 * maxDiffCost edits there are replaced as a whole.
+	 *
+	 * Returns hunks sorted by line, or nothing if 'stop' was requested.
+	 */
+	[[nodiscard]] COMFYDX_API std::optional<std::vector<DiffHunk>> diffLines(const TextSnapshot & from, const TextSnapshot & to, DiffAlgorithm algorithm = DiffAlgorithm::histogram, std::stop_token stop = {});
+
+	// Edits in offsets of 'from' that turn it into 'to', their text is kept in 'storage'
+	[[nodiscard]] COMFYDX_API std::vector<TextEdit> diffEdits(const TextSnapshot & from, const TextSnapshot & to, std::span<const DiffHunk> hunks, std::string & storage);
+	/*
+	 * Makes the table's text equal to 'to' by replacing only the lines that
+	 * differ, recorded as a single undo step if a history is given. For
+	 * reloading a file that was changed on disk: untouched lines keep their
+	 * pieces, and with them markers, folds and highlighting. Returns false if
+	 * 'stop' was requested before anything was changed.
+	 */
+	COMFYDX_API bool reload(PieceTable & table, UndoHistory * history, const TextSnapshot & to, std::stop_token stop = {});
+
+	/*
+	 * diffLines() on a worker thread, e.g. for the gutter markers against the
+	 * saved file. Destroying the task cancels it.
+	 */
+	class DiffTask
+	{
+	public:
+		// Called on the worker thread once the hunks are ready
+		using Notify = std::function<void()>;
+
+	private:
+		TextSnapshot m_from, m_to;
+		DiffAlgorithm m_algorithm;
+		Notify m_notify;
+		std::optional<std::vector<DiffHunk>> m_hunks;
+		std::atomic<bool> m_bDone{ false };
+		std::jthread m_worker;
+
+		void work(std::stop_token stop) noexcept;
+
+	public:
+		COMFYDX_API DiffTask(TextSnapshot from, TextSnapshot to, Notify notify = {}, DiffAlgorithm algorithm = DiffAlgorithm::histogram);
+		DiffTask(const DiffTask &) = delete;
+		DiffTask & operator=(const DiffTask &) = delete;
+		COMFYDX_API ~DiffTask() noexcept;
+
+		COMFYDX_API void cancel() noexcept;
+		COMFYDX_API void wait() noexcept;
+
+		[[nodiscard]] const TextSnapshot & from() const noexcept
+		{
+			return this->m_from;
+		}
+		[[nodiscard]] const TextSnapshot & to() const noexcept
+		{
+			return this->m_to;
+		}
+		[[nodiscard]] bool done() const noexcept
+		{
+			return this->m_bDone.load(std::memory_order_acquire);
+		}
+		// Null until done(), and if the task was cancelled
+		[[nodiscard]] const std::vector<DiffHunk> * hunks() const noexcept
+		{
+			return (this->done() && this->m_hunks) ? &*this->m_hunks : nullptr;
+		}
+	};
+}
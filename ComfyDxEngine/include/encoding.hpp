@@ -0,0 +1,84 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace ce
+{
+	enum class Encoding : std::uint8_t
+	{
+		unknown,
+		utf8,
+		utf16le,
+		utf16be,
+		latin1,
+		binary
+	};
+	enum class LineEnding : std::uint8_t
+	{
+		none,
+		lf,
+		crlf,
+		cr
+	};
+
+	// Raw counters gathered from the inspected bytes
+	struct ByteStats
+	{
+		std::uint64_t bytes{}, high{}, control{};
+		std::uint64_t nulEven{}, nulOdd{};
+		std::uint64_t cr{}, lf{}, crlf{};
+		std::uint64_t invalidUtf8{};
+
+		[[nodiscard]] constexpr std::uint64_t nul() const noexcept
+		{
+			return this->nulEven + this->nulOdd;
+		}
+	};
+
+	struct EncodingInfo
+	{
+		struct Candidate
+		{
+			Encoding encoding{ Encoding::unknown };
+			float confidence{};
+		};
+
+		// Ranked by confidence, unused slots are Encoding::unknown
+		std::array<Candidate, 4> candidates{};
+		std::uint8_t bomSize{};
+
+		LineEnding lineEnding{ LineEnding::none };
+		bool bMixedLineEndings{ false };
+		// Line ending counts in code units of the best candidate
+		std::uint64_t lf{}, crlf{}, cr{};
+
+		ByteStats stats{};
+
+		[[nodiscard]] constexpr Encoding best() const noexcept
+		{
+			return this->candidates[0].encoding;
+		}
+		[[nodiscard]] constexpr float confidence() const noexcept
+		{
+			return this->candidates[0].confidence;
+		}
+	};
+
+	// Recognises UTF-8, UTF-16LE and UTF-16BE byte order marks, returns the BOM size
+	COMFYDX_API std::uint8_t detectBom(std::span<const char> data, Encoding & enc) noexcept;
+
+	COMFYDX_API ByteStats scanBytes(std::span<const char> data, bool complete = false) noexcept;
+
+	/*
+	 * Guesses encoding and line endings from a sample, usually the first few
+	 * hundred KiB of the file. 'complete' tells that the sample is the whole file,
+	 * so a sequence cut at the end counts as invalid.
+	 */
+	COMFYDX_API EncodingInfo detectEncoding(std::span<const char> sample, bool complete = false) noexcept;
+	// Same as detectEncoding, but scans the whole data on 'threads' workers (0 - hardware concurrency)
+	COMFYDX_API EncodingInfo detectEncodingParallel(std::span<const char> data, unsigned threads = 0);
+}
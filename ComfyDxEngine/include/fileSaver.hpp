@@ -0,0 +1,114 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+#include "encoding.hpp"
+#include "pieceTable.hpp"
+
+namespace cdx::io
+{
+	struct SaveOptions
+	{
+		// unknown and binary write the bytes as they are, line endings included
+		ce::Encoding encoding{ ce::Encoding::utf8 };
+		bool bBom{ false };
+		// Every "\r\n", '\r' and '\n' is written as this, none keeps them as they are
+		ce::LineEnding lineEnding{ ce::LineEnding::none };
+		// Bytes collected before each write, rounded up to whole pages
+		std::size_t bufferSize{ 4 << 20 };
+		// Flushes the file to disk before it replaces the old one
+		bool bSync{ true };
+	};
+
+	/*
+	 * Writes the snapshot to a temporary file next to 'path', flushes it to
+	 * disk and renames it over 'path', so the file is either the old or the
+	 * whole new version, never a mix. The old file is replaced, not
+	 * overwritten, a snapshot still mapping it stays valid.
+	 *
+	 * Pieces are encoded straight into one page-aligned buffer that is written
+	 * whenever it is full, nothing is copied per document: extra memory is the
+	 * buffer plus a few small scratch buffers. Characters latin1 can't encode
+	 * are written as '?'. Returns false with 'error' set if anything failed or
+	 * 'stop' was requested, the temporary file is removed then.
+	 */
+	[[nodiscard]] COMFYDX_API bool saveFile(const text::TextSnapshot & text, const std::filesystem::path & path, const SaveOptions & options, std::string & error, std::stop_token stop = {});
+
+	/*
+	 * saveFile() on a worker thread, typing goes on while a snapshot is being
+	 * saved. Destroying the saver cancels it.
+	 */
+	class FileSaver
+	{
+	public:
+		// Called on the worker thread when the save has finished or failed
+		using Notify = std::function<void()>;
+
+	private:
+		text::TextSnapshot m_text;
+		std::filesystem::path m_path;
+		SaveOptions m_options;
+		Notify m_notify;
+		std::string m_error;
+
+		std::atomic<std::uint64_t> m_bytesRead{ 0 }, m_bytesWritten{ 0 };
+		std::atomic<bool> m_bDone{ false }, m_bOk{ false };
+		std::jthread m_worker;
+
+		void work(std::stop_token stop) noexcept;
+
+	public:
+		COMFYDX_API FileSaver(text::TextSnapshot text, std::filesystem::path path, SaveOptions options = {}, Notify notify = {});
+		FileSaver(const FileSaver &) = delete;
+		FileSaver & operator=(const FileSaver &) = delete;
+		COMFYDX_API ~FileSaver() noexcept;
+
+		// Runs the worker; returns false if it is already running
+		COMFYDX_API bool start();
+		COMFYDX_API void cancel() noexcept;
+		COMFYDX_API void wait() noexcept;
+
+		[[nodiscard]] const text::TextSnapshot & text() const noexcept
+		{
+			return this->m_text;
+		}
+		[[nodiscard]] const std::filesystem::path & path() const noexcept
+		{
+			return this->m_path;
+		}
+		// Progress is bytesRead() of totalBytes()
+		[[nodiscard]] std::uint64_t bytesRead() const noexcept
+		{
+			return this->m_bytesRead.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] std::uint64_t totalBytes() const noexcept
+		{
+			return this->m_text.size();
+		}
+		[[nodiscard]] std::uint64_t bytesWritten() const noexcept
+		{
+			return this->m_bytesWritten.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] bool done() const noexcept
+		{
+			return this->m_bDone.load(std::memory_order_acquire);
+		}
+		// Whether the file was replaced
+		[[nodiscard]] bool ok() const noexcept
+		{
+			return this->m_bOk.load(std::memory_order_acquire);
+		}
+		// Why the save failed, empty until done()
+		[[nodiscard]] const std::string & error() const noexcept
+		{
+			static const std::string none;
+			return this->done() ? this->m_error : none;
+		}
+	};
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace cdx::text
+{
+	struct ViewerOptions
+	{
+		// Bytes mapped at a time, rounded up to 128 KiB; reads return at most half of it
+		std::size_t windowSize{ 16 << 20 };
+		// Upper bound of the mapped windows, at least two of them are kept
+		std::size_t memoryBudget{ 256 << 20 };
+		// Lines between the offsets kept by the line index
+		std::size_t checkpointLines{ 1024 };
+		// Read size of the background indexer
+		std::size_t readChunk{ 1 << 20 };
+	};
+
+	struct ViewerLine
+	{
+		// 0-based
+		std::uint64_t line{};
+		// Offset of the first byte of the line
+		std::uint64_t offset{};
+		// False while the index hasn't reached it, the line is estimated from the average length then
+		bool bExact{ false };
+	};
+
+	/*
+	 * Read-only view of files too large to load into a piece table, e.g.
+	 * multi-gigabyte logs. Only a few windows of the file are mapped at a time
+	 * and evicted least recently used, so resident memory stays within the
+	 * budget regardless of the file size.
+	 *
+	 * A worker reads the file once and records the offset of every
+	 * checkpointLines-th line, a few hundred KiB for billions of lines. Lines
+	 * before the indexed part are located exactly by scanning from the nearest
+	 * checkpoint, lines after it are estimated from the average line length, so
+	 * the view can scroll by byte position right after opening. refresh() picks
+	 * up appended bytes, only those are indexed again.
+	 *
+	 * Reads and lookups are meant for one thread, views returned by read() stay
+	 * valid until the next call on the viewer.
+	 *
+	 * Every read checks the file size, a truncated file, e.g. by logrotate's
+	 * copytruncate, drops its windows before any view is returned. The window at
+	 * the end of the file is read instead of mapped. One race remains on POSIX:
+	 * a truncation while the caller still holds a view of a mapped window makes
+	 * touching it fault with SIGBUS. On Windows a mapped file can't be truncated.
+	 */
+	class FileViewer
+	{
+	private:
+		struct Window
+		{
+			std::uint64_t index{ 0 };
+			const char * data{ nullptr };
+			std::size_t length{ 0 };
+			std::uint64_t lastUse{ 0 };
+			// A whole window, set at the end of the file and when it can't be mapped, e.g. on some network shares
+			std::unique_ptr<char[]> buffer;
+		};
+
+		ViewerOptions m_options;
+		bool m_bOpen{ false }, m_bMappable{ false };
+#ifdef _WIN32
+		void * m_file{ nullptr };
+		void * m_mapping{ nullptr };
+#else
+		int m_fd{ -1 };
+#endif
+
+		// Caller thread only
+		std::vector<Window> m_windows;
+		std::uint64_t m_useCounter{ 0 };
+
+		// Guarded by m_mutex
+		std::mutex m_mutex;
+		std::condition_variable_any m_grown;
+		std::uint64_t m_size{ 0 };
+		std::uint64_t m_generation{ 0 };
+		// m_checkpoints[i] - offset of line i * checkpointLines
+		std::vector<std::uint64_t> m_checkpoints;
+		std::uint64_t m_indexed{ 0 }, m_lineFeeds{ 0 };
+		bool m_bFailed{ false };
+
+		std::atomic<std::uint64_t> m_sizeSeen{ 0 }, m_indexedSeen{ 0 };
+		std::jthread m_worker;
+
+		void index(std::stop_token stop) noexcept;
+		[[nodiscard]] bool readAt(std::uint64_t offset, char * out, std::size_t length) noexcept;
+		[[nodiscard]] std::uint64_t querySize() noexcept;
+		[[nodiscard]] bool remap() noexcept;
+		void unmap(Window & window) noexcept;
+		[[nodiscard]] Window * window(std::uint64_t index, std::uint64_t size);
+		[[nodiscard]] std::size_t stride() const noexcept
+		{
+			return this->m_options.windowSize / 2;
+		}
+		// Offset right after the n-th (0-based) line feed at or after 'offset', UINT64_MAX if there are fewer
+		[[nodiscard]] std::uint64_t skipLines(std::uint64_t offset, std::uint64_t n);
+		[[nodiscard]] std::uint64_t countLines(std::uint64_t from, std::uint64_t to);
+		// Called with the lock held
+		[[nodiscard]] double averageLine() const noexcept;
+
+	public:
+		FileViewer() noexcept = default;
+		FileViewer(const FileViewer &) = delete;
+		FileViewer & operator=(const FileViewer &) = delete;
+		COMFYDX_API ~FileViewer() noexcept;
+
+		// Starts indexing in the background
+		[[nodiscard]] COMFYDX_API bool open(const std::filesystem::path & path, ViewerOptions options = {}) noexcept;
+		COMFYDX_API void close() noexcept;
+		/*
+		 * Picks up bytes appended since the last call, returns false if the size
+		 * didn't change. A file that shrank, e.g. a truncated log, is indexed from
+		 * scratch.
+		 */
+		COMFYDX_API bool refresh();
+
+		/*
+		 * Up to 'length' bytes at 'offset', at most half a window. Empty past the
+		 * end or if the file can't be read.
+		 */
+		[[nodiscard]] COMFYDX_API std::string_view read(std::uint64_t offset, std::size_t length);
+		// The line 'offset' is in; lines longer than half a window are shown from 'offset'
+		[[nodiscard]] COMFYDX_API ViewerLine lineAt(std::uint64_t offset);
+		// The start of a line, clamped to the last one
+		[[nodiscard]] COMFYDX_API ViewerLine locate(std::uint64_t line);
+		// Exact once indexing is done
+		[[nodiscard]] COMFYDX_API ViewerLine lineCount();
+
+		[[nodiscard]] bool isOpen() const noexcept
+		{
+			return this->m_bOpen;
+		}
+		[[nodiscard]] std::uint64_t size() const noexcept
+		{
+			return this->m_sizeSeen.load(std::memory_order_relaxed);
+		}
+		// Bytes from the start of the file that are indexed
+		[[nodiscard]] std::uint64_t indexed() const noexcept
+		{
+			return this->m_indexedSeen.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] bool done() const noexcept
+		{
+			return this->indexed() == this->size();
+		}
+		// Bytes currently mapped or buffered
+		[[nodiscard]] COMFYDX_API std::size_t resident() const noexcept;
+	};
+}
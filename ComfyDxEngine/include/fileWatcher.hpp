@@ -0,0 +1,201 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace cdx::io
+{
+	using WatchId = std::uint64_t;
+
+	struct ByteRange
+	{
+		std::uint64_t offset{}, length{};
+	};
+
+	struct FileChange
+	{
+		WatchId id{};
+		std::filesystem::path path;
+		// Parts of the new contents that differ from the last seen ones, in whole blocks
+		std::vector<ByteRange> changed;
+		std::uint64_t size{};
+		// Deleted or renamed away, reported again once it is back
+		bool bRemoved{ false };
+	};
+
+	struct WatchOptions
+	{
+		// A file is checked once it wasn't written for this long
+		std::chrono::milliseconds settle{ 150 };
+		// ...or this long after its first event, for files that are written continuously
+		std::chrono::milliseconds maxDelay{ 2000 };
+		// For directories without native notifications
+		std::chrono::milliseconds pollInterval{ 2000 };
+		// Polls every file even if native notifications are available
+		bool bPolling{ false };
+		// Workers checking files, 0 means half of the hardware threads
+		unsigned threads{ 0 };
+		// Granularity of the changed ranges
+		std::size_t blockSize{ 64 << 10 };
+	};
+
+	struct WatchedDir;
+
+	/*
+	 * Watches files for changes made by other programs. Directories are watched
+	 * rather than files, so tens of thousands of open files take a few native
+	 * watches and replacing a file by renaming is seen as well: inotify on
+	 * Linux, ReadDirectoryChangesW on Windows, stat() polling where neither is
+	 * available or the watch limit is reached.
+	 *
+	 * Events are collected per file until it settles, so a build rewriting a
+	 * file many times reports it once. The file is then hashed block-wise on a
+	 * worker and compared with the last seen version: rewrites with the same
+	 * contents are dropped, otherwise the notify callback gets the changed
+	 * ranges. Files are checked by priority, e.g. the visible tab first.
+	 */
+	class FileWatcher
+	{
+	public:
+		// Called on a worker thread, never for the same file twice at a time
+		using Notify = std::function<void(const FileChange & change, std::stop_token stop)>;
+
+	private:
+		using Clock = std::chrono::steady_clock;
+		using DirKey = std::filesystem::path::string_type;
+
+		struct FileStamp
+		{
+			std::uint64_t size{}, time{};
+			bool bExists{ false };
+
+			[[nodiscard]] bool operator==(const FileStamp &) const noexcept = default;
+		};
+		struct File
+		{
+			std::filesystem::path path;
+			DirKey dir;
+			int priority{ 0 };
+			std::uint64_t queueSeq{ 0 };
+			// Events not checked yet
+			Clock::time_point firstEvent, lastEvent;
+			bool bPending{ false }, bQueued{ false }, bRunning{ false }, bAgain{ false };
+			// Hashes of the last seen contents, unset until the first check
+			bool bKnown{ false };
+			FileStamp stamp;
+			std::vector<std::uint64_t> blocks;
+			// Last seen by poll()
+			FileStamp polled;
+		};
+		// Baseline checks last, then by priority, then first come first served
+		struct QueueKey
+		{
+			bool bBaseline{ false };
+			int priority{ 0 };
+			std::uint64_t seq{ 0 };
+			WatchId id{ 0 };
+
+			[[nodiscard]] bool operator<(const QueueKey & other) const noexcept
+			{
+				if (this->bBaseline != other.bBaseline)
+				{
+					return !this->bBaseline;
+				}
+				if (this->priority != other.priority)
+				{
+					return this->priority > other.priority;
+				}
+				return this->seq < other.seq;
+			}
+		};
+
+		Notify m_notify;
+		WatchOptions m_options;
+
+		std::mutex m_mutex;
+		std::condition_variable_any m_jobReady;
+		std::unordered_map<WatchId, File> m_files;
+		std::unordered_map<DirKey, std::unique_ptr<WatchedDir>> m_dirs;
+		// Directories whose native watch is gone, closed by the monitor
+		std::vector<std::unique_ptr<WatchedDir>> m_closing;
+		std::vector<WatchId> m_pending;
+		std::set<QueueKey> m_queue;
+		WatchId m_nextId{ 0 };
+		std::uint64_t m_nextSeq{ 0 };
+		bool m_bDirsChanged{ false };
+		Clock::time_point m_nextPoll;
+
+		std::atomic<std::uint64_t> m_bytesHashed{ 0 }, m_changes{ 0 };
+		std::atomic<bool> m_bNative{ false };
+#ifdef _WIN32
+		void * m_port{ nullptr };
+#else
+		int m_inotify{ -1 };
+		// Self-pipe waking up the monitor
+		int m_wake[2]{ -1, -1 };
+		std::unordered_map<int, WatchedDir *> m_watches;
+#endif
+		std::vector<std::jthread> m_workers;
+		std::jthread m_monitor;
+
+		void monitor(std::stop_token stop) noexcept;
+		void work(std::stop_token stop) noexcept;
+		void wake() noexcept;
+
+		// Platform parts, called by the monitor
+		[[nodiscard]] bool openNative() noexcept;
+		void closeNative() noexcept;
+		void syncDirs();
+		void waitEvents(Clock::duration timeout);
+		// Called with the lock held
+		void touched(WatchedDir & dir, const DirKey & name, Clock::time_point now);
+		void touchedAll(WatchedDir & dir, Clock::time_point now);
+		void touchedFile(WatchId id, Clock::time_point now);
+		void enqueue(WatchId id, File & file);
+		// Queues the files that settled, returns the time until the next one does
+		[[nodiscard]] Clock::duration settle(Clock::time_point now);
+		// Stats the files of polled directories every poll interval
+		void poll(Clock::time_point now);
+
+	public:
+		COMFYDX_API explicit FileWatcher(Notify notify, WatchOptions options = {});
+		FileWatcher(const FileWatcher &) = delete;
+		FileWatcher & operator=(const FileWatcher &) = delete;
+		COMFYDX_API ~FileWatcher() noexcept;
+
+		// The file is hashed in the background, changes are reported relative to that
+		COMFYDX_API WatchId watch(const std::filesystem::path & path, int priority = 0);
+		COMFYDX_API void unwatch(WatchId id);
+		// Higher is checked earlier
+		COMFYDX_API void setPriority(WatchId id, int priority);
+
+		[[nodiscard]] COMFYDX_API std::size_t watchCount();
+		// Whether native notifications are used for at least some directories
+		[[nodiscard]] bool native() const noexcept
+		{
+			return this->m_bNative.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] std::uint64_t bytesHashed() const noexcept
+		{
+			return this->m_bytesHashed.load(std::memory_order_relaxed);
+		}
+		// Changes handed to the notify callback
+		[[nodiscard]] std::uint64_t changes() const noexcept
+		{
+			return this->m_changes.load(std::memory_order_relaxed);
+		}
+	};
+}
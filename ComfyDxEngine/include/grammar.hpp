@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstdint>
+
+#include "api.hpp"
+#include "regexSearch.hpp"
+
+namespace cdx::syntax
+{
+	// Interned token scope name, 0 is plain text
+	using TokenKind = std::uint16_t;
+	// Index of a grammar state, 0 is where every document starts
+	using StateId = std::uint16_t;
+
+	// Most bracket pairs a grammar can define
+	constexpr std::size_t maxBracketPairs{ 4 };
+
+	struct BracketPair
+	{
+		char open{}, close{};
+	};
+
+	enum class RuleAction : std::uint8_t
+	{
+		none,
+		// Enters 'target' on top of the current state
+		push,
+		// Returns to the state below, the bottom state is never popped
+		pop,
+		// Replaces the current state with 'target'
+		set
+	};
+
+	struct Rule
+	{
+		text::RegexSearch regex;
+		TokenKind kind{ 0 };
+		RuleAction action{ RuleAction::none };
+		StateId target{ 0 };
+	};
+
+	struct GrammarState
+	{
+		std::string name;
+		// Kind of the text no rule matches
+		TokenKind kind{ 0 };
+		std::vector<Rule> rules;
+	};
+
+	/*
+	 * Data-driven lexer definition. Every state is a list of regex rules; at
+	 * each position the rule matching first wins, ties go to the earlier rule.
+	 * Rules never see more than one line, states carry over line breaks:
+	 *
+	 * {
+	 *   "name": "C",
+	 *   "ignoreCase": false,
+	 *   "states": [
+	 *     { "name": "root", "rules": [
+	 *       { "match": "//.*", "token": "comment" },
+	 *       { "match": "\"", "token": "string", "push": "string" },
+	 *       { "match": "\\b(?:if|else|while)\\b", "token": "keyword" } ] },
+	 *     { "name": "string", "token": "string", "rules": [
+	 *       { "match": "\\\\.", "token": "escape" },
+	 *       { "match": "\"", "token": "string", "pop": true } ] }
+	 *   ]
+	 * }
+	 *
+	 * The first state is the initial one. "push" and "set" name a state,
+	 * "ignoreCase" can be given per rule as well. Bracket matching and folding
+	 * use the optional
+	 *
+	 *   "brackets": [ "()", "[]", "{}" ],
+	 *   "ignoreBracketsIn": [ "comment", "string" ]
+	 *
+	 * the brackets being ASCII characters that count unless they are part of a
+	 * token of one of the listed kinds.
+	 */
+	class Grammar
+	{
+	private:
+		std::string m_name;
+		std::vector<std::string> m_kinds{ std::string{} };
+		std::vector<GrammarState> m_states;
+		std::vector<BracketPair> m_brackets;
+		// Per kind, whether brackets in its tokens are text
+		std::vector<bool> m_noBrackets;
+
+		TokenKind intern(std::string_view kind);
+
+	public:
+		// Null with a message in 'error' if the JSON or one of its patterns is invalid
+		[[nodiscard]] COMFYDX_API static std::shared_ptr<const Grammar> fromJson(std::string_view json, std::string & error);
+		// Compiled form with the patterns' programs, for GrammarCache
+		COMFYDX_API void encode(std::string & out) const;
+		// Null if 'in' isn't a grammar encode() of this engine build wrote
+		[[nodiscard]] COMFYDX_API static std::shared_ptr<const Grammar> decode(std::string_view in);
+
+		[[nodiscard]] const std::string & name() const noexcept
+		{
+			return this->m_name;
+		}
+		[[nodiscard]] const std::vector<GrammarState> & states() const noexcept
+		{
+			return this->m_states;
+		}
+		[[nodiscard]] const std::vector<BracketPair> & brackets() const noexcept
+		{
+			return this->m_brackets;
+		}
+		[[nodiscard]] bool bracketsIn(TokenKind kind) const noexcept
+		{
+			return kind >= this->m_noBrackets.size() || !this->m_noBrackets[kind];
+		}
+		[[nodiscard]] std::size_t kindCount() const noexcept
+		{
+			return this->m_kinds.size();
+		}
+		[[nodiscard]] const std::string & kindName(TokenKind kind) const noexcept
+		{
+			return this->m_kinds[kind];
+		}
+		[[nodiscard]] COMFYDX_API std::optional<TokenKind> kind(std::string_view name) const noexcept;
+		[[nodiscard]] COMFYDX_API std::optional<StateId> state(std::string_view name) const noexcept;
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+#include "grammar.hpp"
+
+namespace cdx::syntax
+{
+	/*
+	 * Compiled grammars on disk. A grammar's JSON source is parsed and its
+	 * patterns compiled once, the result goes to the cache directory and is
+	 * memory-mapped by later loads, as long as the source keeps its size and
+	 * write time. Entries are replaced atomically, several instances can share
+	 * one directory.
+	 */
+	class GrammarCache
+	{
+	public:
+		// Bump whenever Grammar::encode() or the compiled pattern layout changes
+		static constexpr std::uint64_t formatVersion{ 2 };
+
+	private:
+		std::filesystem::path m_dir;
+		std::atomic<std::size_t> m_hits{ 0 }, m_misses{ 0 };
+
+		[[nodiscard]] std::filesystem::path entryPath(const std::filesystem::path & source) const;
+
+	public:
+		COMFYDX_API explicit GrammarCache(std::filesystem::path dir);
+
+		[[nodiscard]] const std::filesystem::path & dir() const noexcept
+		{
+			return this->m_dir;
+		}
+		/*
+		 * Grammar of a JSON file, null with a message in 'error' if the file
+		 * can't be read or compiled. Failing to update the cache isn't an error.
+		 */
+		[[nodiscard]] COMFYDX_API std::shared_ptr<const Grammar> load(const std::filesystem::path & source, std::string & error);
+
+		[[nodiscard]] std::size_t hits() const noexcept
+		{
+			return this->m_hits.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] std::size_t misses() const noexcept
+		{
+			return this->m_misses.load(std::memory_order_relaxed);
+		}
+	};
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "api.hpp"
+#include "textSearch.hpp"
+#include "parallelSearch.hpp"
+
+namespace cdx::text
+{
+	/*
+	 * Search-as-you-type state of a find box. Complete match lists are cached
+	 * per query and snapshot, and new ones are derived from them where possible:
+	 *
+	 * - a query containing a cached one is checked at the cached matches only,
+	 *   as long as that needle can't overlap itself, so all its occurrences are
+	 *   known
+	 * - edits only have the text around them searched again, the scan stops as
+	 *   soon as it runs into an old match again
+	 *
+	 * Anything else is searched in the background. Until that is done,
+	 * matchesIn() searches the requested range right away, so the viewport can
+	 * be highlighted first.
+	 */
+	class IncrementalSearch
+	{
+	public:
+		static constexpr std::size_t defCacheSize{ 32 };
+		// Most matches of a cached query that are checked right away
+		static constexpr std::size_t maxNarrowed{ 256 << 10 };
+
+	private:
+		struct Entry
+		{
+			// Snapshot the matches belong to
+			NodePtr root;
+			std::string query;
+			CaseMode mode{};
+			std::vector<SearchMatch> matches;
+		};
+
+		TextSnapshot m_text;
+		std::string m_query;
+		CaseMode m_mode{ CaseMode::sensitive };
+		LiteralSearch m_search;
+
+		// Most recently used first
+		std::list<Entry> m_cache;
+		std::size_t m_cacheSize;
+		// Complete matches of the current query, null while they are searched
+		const Entry * m_current{ nullptr };
+
+		unsigned m_threads;
+		std::unique_ptr<ParallelSearch> m_worker;
+		std::mutex m_mutex;
+		std::vector<SearchMatch> m_found;
+
+		[[nodiscard]] const Entry * lookup(const NodePtr & root, std::string_view query, CaseMode mode);
+		const Entry & remember(Entry entry);
+		// Derives the current query's matches from a cached query it contains
+		[[nodiscard]] bool narrow();
+		void startSearch();
+		void stopSearch() noexcept;
+		void update();
+
+	public:
+		// 0 threads means one per hardware thread
+		COMFYDX_API explicit IncrementalSearch(std::size_t cacheSize = defCacheSize, unsigned threads = 0);
+		IncrementalSearch(const IncrementalSearch &) = delete;
+		IncrementalSearch & operator=(const IncrementalSearch &) = delete;
+		COMFYDX_API ~IncrementalSearch() noexcept;
+
+		[[nodiscard]] const TextSnapshot & text() const noexcept
+		{
+			return this->m_text;
+		}
+		[[nodiscard]] const std::string & query() const noexcept
+		{
+			return this->m_query;
+		}
+		[[nodiscard]] CaseMode mode() const noexcept
+		{
+			return this->m_mode;
+		}
+
+		// Switches to a text without a known relation to the current one
+		COMFYDX_API void setText(TextSnapshot text);
+		/*
+		 * The current text was changed into 'text' by a batch of edits in old
+		 * offsets, sorted and normalized like PieceTable::apply() leaves them.
+		 * Only the edited regions are searched again.
+		 */
+		COMFYDX_API void edit(TextSnapshot text, std::span<const TextEdit> edits);
+		// Returns whether the matches are complete right away
+		COMFYDX_API bool setQuery(std::string_view query, CaseMode mode = CaseMode::sensitive);
+
+		// Takes over the result of the background search once it is done, returns complete()
+		COMFYDX_API bool poll();
+		[[nodiscard]] bool complete() const noexcept
+		{
+			return this->m_current != nullptr;
+		}
+		// All matches in order, empty until complete()
+		[[nodiscard]] std::span<const SearchMatch> matches() const noexcept
+		{
+			return this->m_current ? std::span<const SearchMatch>{ this->m_current->matches } : std::span<const SearchMatch>{};
+		}
+		/*
+		 * Matches overlapping [from, to). While the matches aren't complete the
+		 * range is searched directly, self-overlapping needles may then be cut
+		 * differently than a search from the start would.
+		 */
+		[[nodiscard]] COMFYDX_API std::vector<SearchMatch> matchesIn(std::size_t from, std::size_t to) const;
+	};
+}
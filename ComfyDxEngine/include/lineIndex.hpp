@@ -0,0 +1,146 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace cdx::text
+{
+	struct TextCounts
+	{
+		std::size_t lineFeeds{}, codePoints{};
+		// Bytes starting a run of non-whitespace, like wc -w
+		std::size_t words{};
+	};
+
+	// ASCII whitespace separating words, everything else belongs to one
+	[[nodiscard]] constexpr bool isWordByte(char c) noexcept
+	{
+		return c != ' ' && (c < '\t' || c > '\r');
+	}
+
+	// Amount of '\n' bytes in the text, vectorized
+	[[nodiscard]] COMFYDX_API std::size_t countLineFeeds(std::string_view text) noexcept;
+	// Offset of the n-th (0-based) '\n' in the text, std::string_view::npos if there are fewer
+	[[nodiscard]] COMFYDX_API std::size_t findLineFeed(std::string_view text, std::size_t n) noexcept;
+	/*
+	 * Line feeds, UTF-8 code points (bytes that are not continuation bytes)
+	 * and word starts in one vectorized pass. 'bAfterSpace' tells whether the
+	 * byte before the text is whitespace, so a word running into it isn't
+	 * counted again.
+	 */
+	[[nodiscard]] COMFYDX_API TextCounts countText(std::string_view text, bool bAfterSpace = true) noexcept;
+
+	/*
+	 * Sparse index of one immutable or append-only buffer: line feed, code point
+	 * and word start counts at every block boundary. Counting or finding line
+	 * feeds in any byte range scans at most two partial blocks, so pieces can be
+	 * cut anywhere cheaply while the index stays a few MiB even for gigabyte
+	 * files.
+	 */
+	class BufferLines
+	{
+		friend class LineIndexer;
+
+	public:
+		static constexpr std::size_t block{ 16 * 1024 };
+
+	private:
+		// m_prefix[i] - counts in [0, i * block)
+		std::vector<TextCounts> m_prefix{ TextCounts{} };
+		std::size_t m_indexed{ 0 };
+		TextCounts m_tail;
+
+	public:
+		// Indexes buffer bytes that were appended since the last call
+		COMFYDX_API void update(std::string_view buffer);
+		void clear() noexcept
+		{
+			this->m_prefix.assign(1, TextCounts{});
+			this->m_indexed = 0;
+			this->m_tail = {};
+		}
+
+		[[nodiscard]] std::size_t indexed() const noexcept
+		{
+			return this->m_indexed;
+		}
+		// Line feeds in [0, end)
+		[[nodiscard]] COMFYDX_API std::size_t prefix(std::string_view buffer, std::size_t end) const noexcept;
+		// All counts in [0, end)
+		[[nodiscard]] COMFYDX_API TextCounts counts(std::string_view buffer, std::size_t end) const noexcept;
+		[[nodiscard]] std::size_t count(std::string_view buffer, std::size_t start, std::size_t end) const noexcept
+		{
+			return this->prefix(buffer, end) - this->prefix(buffer, start);
+		}
+		// Offset of the n-th (0-based) line feed at or after 'start'
+		[[nodiscard]] COMFYDX_API std::size_t find(std::string_view buffer, std::size_t start, std::size_t n) const noexcept;
+	};
+
+	/*
+	 * Builds the BufferLines of a large immutable buffer on background threads.
+	 * Every worker counts the next group of blocks on its own, finished groups
+	 * are summed up into the prefixes in order. Queries can be made at any
+	 * time: the part indexed so far is answered from the block prefixes, the
+	 * rest is scanned directly, so results are always exact, only slower near
+	 * the end of the buffer until indexing is done.
+	 */
+	class LineIndexer
+	{
+	public:
+		// Blocks a worker takes at a time
+		static constexpr std::size_t groupBlocks{ 64 };
+
+	private:
+		std::string_view m_buffer;
+		// Same layout as BufferLines::m_prefix, the last entry may cover a partial block
+		std::unique_ptr<TextCounts[]> m_prefix;
+		std::size_t m_blocks{ 0 };
+		std::atomic<std::size_t> m_blocksDone{ 0 };
+
+		// Counts of every block on its own, until they are summed up
+		std::unique_ptr<TextCounts[]> m_local;
+		std::unique_ptr<std::atomic<bool>[]> m_groupDone;
+		std::atomic<std::size_t> m_nextGroup{ 0 };
+		// Serializes summing up, m_groupsSummed is guarded by it
+		std::mutex m_sumMutex;
+		std::size_t m_groupsSummed{ 0 };
+		std::vector<std::jthread> m_workers;
+
+		void run(std::stop_token stop) noexcept;
+		void sumUp() noexcept;
+
+	public:
+		// 0 threads means one per hardware thread
+		COMFYDX_API explicit LineIndexer(std::string_view buffer, unsigned threads = 0);
+		LineIndexer(const LineIndexer &) = delete;
+		LineIndexer & operator=(const LineIndexer &) = delete;
+
+		[[nodiscard]] bool done() const noexcept
+		{
+			return this->m_blocksDone.load(std::memory_order_acquire) == this->m_blocks;
+		}
+		// Bytes from the start of the buffer that are already indexed
+		[[nodiscard]] COMFYDX_API std::size_t indexed() const noexcept;
+		// Line feeds in the indexed part of the buffer
+		[[nodiscard]] COMFYDX_API std::size_t knownLineFeeds() const noexcept;
+		// All counts of the indexed part of the buffer
+		[[nodiscard]] COMFYDX_API TextCounts knownCounts() const noexcept;
+
+		// Line feeds in [0, end)
+		[[nodiscard]] COMFYDX_API std::size_t prefix(std::size_t end) const noexcept;
+		// All counts in [0, end)
+		[[nodiscard]] COMFYDX_API TextCounts counts(std::size_t end) const noexcept;
+		// Offset of the n-th (0-based) line feed, std::string_view::npos if there are fewer
+		[[nodiscard]] COMFYDX_API std::size_t find(std::size_t n) const noexcept;
+
+		// Waits for the workers and hands over the complete index
+		[[nodiscard]] COMFYDX_API BufferLines finish();
+	};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace cdx::io
+{
+	/*
+	 * Read-only view of a whole file. The file is memory-mapped when possible, so
+	 * pages are only read when touched; otherwise (pipes, some network shares) it
+	 * is read into memory in large chunks.
+	 */
+	class MappedFile
+	{
+	public:
+		static constexpr std::size_t readChunk{ 4 << 20 };
+
+	private:
+		const char * m_data{ nullptr };
+		std::size_t m_size{ 0 };
+		bool m_bMapped{ false }, m_bOpen{ false };
+
+		std::unique_ptr<char[]> m_fallback;
+#ifdef _WIN32
+		void * m_file{ nullptr };
+		void * m_mapping{ nullptr };
+#else
+		int m_fd{ -1 };
+#endif
+
+		bool readAll(std::uint64_t size) noexcept;
+
+	public:
+		MappedFile() noexcept = default;
+		MappedFile(const MappedFile &) = delete;
+		MappedFile & operator=(const MappedFile &) = delete;
+		COMFYDX_API ~MappedFile() noexcept;
+
+		// Maps the file, falling back to chunked reads when mapping is not possible
+		[[nodiscard]] COMFYDX_API bool open(const std::filesystem::path & path, bool allowMapping = true) noexcept;
+		COMFYDX_API void close() noexcept;
+
+		[[nodiscard]] std::string_view view() const noexcept
+		{
+			return { this->m_data, this->m_size };
+		}
+		[[nodiscard]] std::size_t size() const noexcept
+		{
+			return this->m_size;
+		}
+		[[nodiscard]] bool mapped() const noexcept
+		{
+			return this->m_bMapped;
+		}
+		[[nodiscard]] bool isOpen() const noexcept
+		{
+			return this->m_bOpen;
+		}
+	};
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+#include "textSearch.hpp"
+#include "undoHistory.hpp"
+
+namespace cdx::text
+{
+	/*
+	 * Find-all over a snapshot on a pool of workers. The text is split into
+	 * chunks that are searched independently, every chunk scan also looks into
+	 * the next chunk for matches that cross the border. A merger thread hands
+	 * the results to the sink in document order as soon as the chunks before
+	 * them are complete, so the UI can show matches while the search goes on.
+	 */
+	class ParallelSearch
+	{
+	public:
+		// Receives the next matches in document order, return false to stop the search
+		using Sink = std::function<bool(std::span<const SearchMatch>)>;
+
+		static constexpr std::size_t defChunkSize{ 4 << 20 };
+
+	private:
+		struct Chunk
+		{
+			std::vector<SearchMatch> matches;
+			bool bDone{ false };
+		};
+
+		TextSnapshot m_text;
+		LiteralSearch m_search;
+		Sink m_sink;
+		std::size_t m_chunkSize;
+		unsigned m_threads;
+
+		std::vector<Chunk> m_chunks;
+		std::atomic<std::size_t> m_nextChunk{ 0 };
+		std::mutex m_mutex;
+		std::condition_variable_any m_chunkDone;
+
+		std::atomic<std::uint64_t> m_bytesSearched{ 0 }, m_matchCount{ 0 };
+		std::atomic<bool> m_bDone{ false }, m_bOk{ false };
+		std::stop_source m_stop;
+		std::vector<std::jthread> m_workers;
+		std::jthread m_merger;
+
+		void work(std::stop_token stop) noexcept;
+		void merge(std::stop_token stop) noexcept;
+
+	public:
+		// 0 threads means one per hardware thread
+		COMFYDX_API ParallelSearch(TextSnapshot text, LiteralSearch search, Sink sink, unsigned threads = 0, std::size_t chunkSize = defChunkSize);
+		ParallelSearch(const ParallelSearch &) = delete;
+		ParallelSearch & operator=(const ParallelSearch &) = delete;
+		COMFYDX_API ~ParallelSearch() noexcept;
+
+		// Runs the workers; returns false if they are already running
+		COMFYDX_API bool start();
+		COMFYDX_API void cancel() noexcept;
+		COMFYDX_API void wait() noexcept;
+
+		[[nodiscard]] std::uint64_t bytesSearched() const noexcept
+		{
+			return this->m_bytesSearched.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] std::uint64_t matchCount() const noexcept
+		{
+			return this->m_matchCount.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] bool done() const noexcept
+		{
+			return this->m_bDone.load(std::memory_order_acquire);
+		}
+		// Whether the whole text was searched without the sink or cancel stopping it
+		[[nodiscard]] bool ok() const noexcept
+		{
+			return this->m_bOk.load(std::memory_order_acquire);
+		}
+	};
+
+	// All non-overlapping matches in order, searched in parallel
+	[[nodiscard]] COMFYDX_API std::vector<SearchMatch> findAll(const TextSnapshot & text, const LiteralSearch & search, unsigned threads = 0);
+	/*
+	 * Replaces all matches as one batch, recorded as a single undo step if a
+	 * history is given. Returns the amount of replacements.
+	 */
+	COMFYDX_API std::size_t replaceAll(PieceTable & table, UndoHistory * history, const LiteralSearch & search, std::string_view replacement, unsigned threads = 0);
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "api.hpp"
+#include "pieceTree.hpp"
+#include "lineIndex.hpp"
+#include "mappedFile.hpp"
+
+namespace cdx::text
+{
+	// Replaces 'count' bytes at 'offset' with 'text'
+	struct TextEdit
+	{
+		std::size_t offset{}, count{};
+		std::string_view text;
+	};
+	// Lines [first, first + removed] of the old text became [first, first + added]
+	struct LineEdit
+	{
+		std::size_t first{}, removed{}, added{};
+	};
+	// What a status bar shows about the text or a selection
+	struct TextStats
+	{
+		std::size_t bytes{}, codePoints{}, words{};
+		// Lines the range touches, 1 if it is empty
+		std::size_t lines{ 1 };
+	};
+
+	/*
+	 * Immutable version of a PieceTable's text. Taking one only copies a few
+	 * reference-counted pointers: the tree is persistent, the original buffer is
+	 * never modified and the add buffer only ever grows behind the bytes that
+	 * existed when the snapshot was taken. So a snapshot can be handed to a
+	 * worker thread and read without any locking while the table keeps being
+	 * edited.
+	 *
+	 * Offsets are byte offsets into the UTF-8 text, out of range offsets are
+	 * clamped to the end of the text. Lines are separated by '\n', every node
+	 * keeps the line feed count of its subtree, so line <-> offset mapping is
+	 * O(log n) as well. So do the code point and word counts, which keeps the
+	 * statistics of the whole text O(1) and those of a selection O(log n).
+	 */
+	class TextSnapshot
+	{
+	protected:
+		// Keeps whatever m_original points into alive
+		std::shared_ptr<const void> m_originalOwner;
+		std::string_view m_original;
+		std::shared_ptr<const char[]> m_addOwner;
+		std::string_view m_add;
+		std::shared_ptr<const BufferLines> m_originalLines, m_addLines;
+		std::shared_ptr<LineIndexer> m_indexer;
+		NodePtr m_root;
+
+		[[nodiscard]] std::string_view buffer(Source source) const noexcept
+		{
+			return (source == Source::original) ? this->m_original : this->m_add;
+		}
+		[[nodiscard]] const BufferLines & bufferLines(Source source) const noexcept
+		{
+			return (source == Source::original) ? *this->m_originalLines : *this->m_addLines;
+		}
+		// Fills in the counts of a piece from the index of its buffer
+		void countPiece(Piece & piece) const noexcept;
+		[[nodiscard]] std::pair<NodePtr, NodePtr> split(const NodePtr & node, std::size_t offset) const;
+		// Aggregates of [0, offset)
+		[[nodiscard]] Summary summaryBefore(std::size_t offset) const noexcept;
+
+	public:
+		[[nodiscard]] std::size_t size() const noexcept
+		{
+			return tree::length(this->m_root);
+		}
+		[[nodiscard]] bool empty() const noexcept
+		{
+			return this->size() == 0;
+		}
+		[[nodiscard]] std::size_t pieceCount() const noexcept
+		{
+			return tree::pieces(this->m_root);
+		}
+		[[nodiscard]] const NodePtr & root() const noexcept
+		{
+			return this->m_root;
+		}
+
+		[[nodiscard]] bool indexing() const noexcept
+		{
+			return this->m_indexer != nullptr;
+		}
+		[[nodiscard]] std::size_t lineCount() const noexcept
+		{
+			if (this->m_indexer)
+			{
+				return this->m_indexer->knownLineFeeds() + 1;
+			}
+			return tree::lineFeeds(this->m_root) + 1;
+		}
+		// Offset of the first byte of a 0-based line, lines past the end map to the last one
+		[[nodiscard]] COMFYDX_API std::size_t lineStart(std::size_t line) const noexcept;
+		// Offset of the line's '\n', or the end of the text for the last line
+		[[nodiscard]] COMFYDX_API std::size_t lineEnd(std::size_t line) const noexcept;
+		// 0-based line containing 'offset'
+		[[nodiscard]] COMFYDX_API std::size_t lineOf(std::size_t offset) const noexcept;
+		// Lines a normalized batch of edits in this text's offsets replaces, in order
+		[[nodiscard]] COMFYDX_API std::vector<LineEdit> lineEdits(std::span<const TextEdit> edits) const;
+
+		// Of the whole text, while indexing only of the part indexed so far like lineCount()
+		[[nodiscard]] COMFYDX_API TextStats stats() const noexcept;
+		// Of [offset, offset + count), a word cut by the range counts as one
+		[[nodiscard]] COMFYDX_API TextStats stats(std::size_t offset, std::size_t count) const noexcept;
+
+		[[nodiscard]] std::string_view pieceText(const Piece & piece) const noexcept
+		{
+			return this->buffer(piece.source).substr(piece.start, piece.length);
+		}
+		// Pieces covering [offset, offset + count), cut to the range
+		[[nodiscard]] COMFYDX_API std::vector<Piece> pieces(std::size_t offset, std::size_t count) const;
+
+		[[nodiscard]] COMFYDX_API char at(std::size_t offset) const noexcept;
+		// Copies up to out.size() bytes starting at 'offset', returns the amount copied
+		COMFYDX_API std::size_t copy(std::size_t offset, std::span<char> out) const;
+		[[nodiscard]] COMFYDX_API std::string text(std::size_t offset, std::size_t count) const;
+		[[nodiscard]] std::string text() const
+		{
+			return this->text(0, this->size());
+		}
+
+		/*
+		 * Calls fn(std::string_view) for every contiguous run of text in
+		 * [offset, offset + count), without copying. Returning false stops the walk.
+		 */
+		template<typename Fn>
+		void forEachChunk(std::size_t offset, std::size_t count, Fn && fn) const
+		{
+			offset = std::min(offset, this->size());
+			count = std::min(count, this->size() - offset);
+			for (PieceCursor it{ this->m_root, offset }; it.valid() && count != 0; it.next())
+			{
+				auto chunk = this->pieceText(it.piece()).substr(offset - it.offset());
+				chunk = chunk.substr(0, count);
+				count -= chunk.size();
+				offset += chunk.size();
+				if (!fn(chunk))
+				{
+					break;
+				}
+			}
+		}
+	};
+
+	/*
+	 * Piece table text buffer: the original file contents are never copied or
+	 * modified, inserted text goes to an append-only add buffer, and the document
+	 * is a balanced tree of pieces referencing either of them. Insertion, removal
+	 * and offset lookup are O(log n) in the number of pieces.
+	 *
+	 * The original buffer can be a memory-mapped file, its line index is then
+	 * built in the background. Line queries stay exact meanwhile, lineCount()
+	 * and stats() only count the part indexed so far. The first edit waits for
+	 * indexing to finish.
+	 */
+	class PieceTable : public TextSnapshot
+	{
+	public:
+		static constexpr std::size_t minAddCapacity{ 4096 };
+		// Longest add piece apply() copies to merge it with the text typed right after it
+		static constexpr std::size_t maxCopiedRun{ 16 };
+
+		// An edit of a batch in old text offsets, with its text already in the buffers
+		struct BatchEdit
+		{
+			std::size_t offset{}, count{};
+			std::span<const Piece> inserted;
+		};
+
+	private:
+		// Grows by reallocation, snapshots keep the old blocks alive
+		std::shared_ptr<char[]> m_addBlock;
+		std::size_t m_addCapacity{ 0 };
+
+		void setOriginal(std::shared_ptr<const void> owner, std::string_view original, bool background);
+		// Room for 'count' more bytes at the end of the add buffer, published by commitAdd()
+		[[nodiscard]] char * reserveAdd(std::size_t count);
+		void commitAdd(std::size_t count);
+		void appendAdd(std::string_view text);
+		// Rebuilds only the nodes whose range is touched by the edits
+		[[nodiscard]] NodePtr applyBatch(const NodePtr & node, std::size_t base, std::span<const BatchEdit> edits, bool bLast) const;
+
+	public:
+		PieceTable() = default;
+		COMFYDX_API explicit PieceTable(std::string original);
+		// References the file's pages directly, optionally indexing lines on a background thread
+		COMFYDX_API explicit PieceTable(std::shared_ptr<const io::MappedFile> file, bool backgroundIndexing = true);
+		// Copies would share and overwrite one add buffer, take a snapshot() instead
+		PieceTable(const PieceTable &) = delete;
+		PieceTable & operator=(const PieceTable &) = delete;
+		PieceTable(PieceTable &&) noexcept = default;
+		PieceTable & operator=(PieceTable &&) noexcept = default;
+
+		// Current version of the text, O(1)
+		[[nodiscard]] TextSnapshot snapshot() const noexcept
+		{
+			return *this;
+		}
+
+		// Adopts the background line index if it is complete, returns true when no indexing is pending
+		COMFYDX_API bool pollIndexing();
+		// Blocks until the background line index is complete
+		COMFYDX_API void finishIndexing();
+
+		COMFYDX_API void insert(std::size_t offset, std::string_view text);
+		COMFYDX_API void erase(std::size_t offset, std::size_t count);
+		COMFYDX_API void replace(std::size_t offset, std::size_t count, std::string_view text);
+		// Inserts pieces referencing this table's buffers, e.g. ones saved by pieces() earlier
+		COMFYDX_API void insertPieces(std::size_t offset, std::span<const Piece> pieces);
+
+		// Clamps a batch sorted by offset to the text, overlapping edits are trimmed
+		COMFYDX_API void normalize(std::span<TextEdit> edits) const noexcept;
+		/*
+		 * Applies a batch of edits sorted by offset, e.g. one per cursor. All
+		 * offsets refer to the text before the batch. The inserted text is
+		 * appended to the add buffer at once and the tree is modified in a single
+		 * recursive pass that shares every untouched subtree. The batch is
+		 * normalized in place, the returned pieces hold the text inserted by
+		 * every edit, with a zero length for pure removals. Text typed right
+		 * after a short add piece is merged with it: the edit then replaced that
+		 * piece as well, its returned piece starts with the merged bytes and
+		 * 'merged' receives the old piece, or an empty one for other edits.
+		 */
+		COMFYDX_API std::vector<Piece> apply(std::span<TextEdit> edits, std::vector<Piece> * merged = nullptr);
+		// Like apply() for pieces referencing this table's buffers, e.g. to replay an undo group
+		COMFYDX_API void applyPieces(std::span<const BatchEdit> edits);
+	};
+}
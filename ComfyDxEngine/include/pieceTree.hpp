@@ -0,0 +1,159 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace cdx::text
+{
+	enum class Source : std::uint8_t
+	{
+		original,
+		add
+	};
+
+	// A run of text in one of the buffers, pieces are never modified in place
+	struct Piece
+	{
+		Source source{ Source::original };
+		std::size_t start{}, length{};
+		std::size_t lineFeeds{};
+		// UTF-8 code points, and words as if the piece stood on its own
+		std::size_t codePoints{}, words{};
+		// Whether the first and last byte belong to a word, which continues in a neighbour
+		bool bWordFirst{ false }, bWordLast{ false };
+	};
+
+	// Aggregates kept in every node for its whole subtree
+	struct Summary
+	{
+		std::size_t length{}, pieces{}, lineFeeds{};
+		std::size_t codePoints{}, words{};
+		bool bWordFirst{ false }, bWordLast{ false };
+	};
+
+	class PieceNode;
+	using NodePtr = std::shared_ptr<const PieceNode>;
+
+	/*
+	 * Node of a persistent AVL tree ordered by text offset. Nodes are immutable,
+	 * every modification copies the path from the root, so old roots stay valid.
+	 */
+	class PieceNode
+	{
+	public:
+		Piece piece;
+		NodePtr left, right;
+		Summary sum;
+		std::uint8_t height;
+
+		COMFYDX_API PieceNode(NodePtr l, const Piece & p, NodePtr r) noexcept;
+	};
+
+	namespace tree
+	{
+		[[nodiscard]] inline std::size_t length(const NodePtr & node) noexcept
+		{
+			return node ? node->sum.length : 0;
+		}
+		[[nodiscard]] inline std::size_t pieces(const NodePtr & node) noexcept
+		{
+			return node ? node->sum.pieces : 0;
+		}
+		[[nodiscard]] inline std::size_t lineFeeds(const NodePtr & node) noexcept
+		{
+			return node ? node->sum.lineFeeds : 0;
+		}
+		[[nodiscard]] inline Summary summary(const NodePtr & node) noexcept
+		{
+			return node ? node->sum : Summary{};
+		}
+		[[nodiscard]] inline Summary summary(const Piece & piece) noexcept
+		{
+			return { piece.length, 1, piece.lineFeeds, piece.codePoints, piece.words, piece.bWordFirst, piece.bWordLast };
+		}
+		// Summary of a run of text followed by another, a word across the seam counts once
+		[[nodiscard]] COMFYDX_API Summary combine(const Summary & a, const Summary & b) noexcept;
+		// Grows a piece by the one right after it in the same buffer
+		COMFYDX_API void extend(Piece & piece, const Piece & next) noexcept;
+		[[nodiscard]] inline std::uint8_t height(const NodePtr & node) noexcept
+		{
+			return node ? node->height : 0;
+		}
+
+		[[nodiscard]] COMFYDX_API NodePtr make(NodePtr left, const Piece & piece, NodePtr right);
+		// Concatenates left + piece + right, rebalancing in O(|height(left) - height(right)|)
+		[[nodiscard]] COMFYDX_API NodePtr join(NodePtr left, const Piece & piece, NodePtr right);
+		[[nodiscard]] COMFYDX_API NodePtr concat(NodePtr left, NodePtr right);
+		// Detaches the last piece, 'node' must not be empty
+		[[nodiscard]] COMFYDX_API std::pair<NodePtr, Piece> splitLast(const NodePtr & node);
+		// Fills in the counts of a piece that was just cut off a longer one
+		using PieceCounter = std::function<void(Piece &)>;
+
+		// Cuts a piece in two at 'at' bytes from its start
+		[[nodiscard]] COMFYDX_API std::pair<Piece, Piece> cut(const Piece & piece, std::size_t at, const PieceCounter & count);
+		// Splits at a text offset, a piece crossing the offset is cut in two
+		[[nodiscard]] COMFYDX_API std::pair<NodePtr, NodePtr> split(const NodePtr & node, std::size_t offset, const PieceCounter & count);
+
+		[[nodiscard]] COMFYDX_API NodePtr fromPieces(const Piece * first, const Piece * last);
+
+		struct Location
+		{
+			const PieceNode * node{ nullptr };
+			// Offset of the piece start in the text and of the position inside the piece
+			std::size_t pieceOffset{}, inPiece{};
+		};
+		// Piece containing 'offset', the end of the text maps to the last piece
+		[[nodiscard]] COMFYDX_API Location locate(const NodePtr & root, std::size_t offset) noexcept;
+
+		struct LineLocation
+		{
+			const PieceNode * node{ nullptr };
+			std::size_t pieceOffset{};
+			// Line feeds before the piece, and which one of the piece's line feeds is wanted
+			std::size_t linesBefore{}, inPiece{};
+		};
+		// Piece containing the line feed with the 0-based index 'lineFeed'
+		[[nodiscard]] COMFYDX_API LineLocation locateLineFeed(const NodePtr & root, std::size_t lineFeed) noexcept;
+		// Line feeds before the piece containing 'offset', together with its location
+		[[nodiscard]] COMFYDX_API LineLocation locateOffset(const NodePtr & root, std::size_t offset) noexcept;
+	}
+
+	// In-order walk over the pieces, starting with the one containing an offset
+	class PieceCursor
+	{
+	private:
+		std::vector<const PieceNode *> m_stack;
+		const PieceNode * m_node{ nullptr };
+		std::size_t m_pieceOffset{};
+
+		void descend(const PieceNode * node);
+
+	public:
+		PieceCursor() noexcept = default;
+		COMFYDX_API PieceCursor(const NodePtr & root, std::size_t offset);
+
+		[[nodiscard]] bool valid() const noexcept
+		{
+			return this->m_node != nullptr;
+		}
+		[[nodiscard]] const Piece & piece() const noexcept
+		{
+			return this->m_node->piece;
+		}
+		[[nodiscard]] const PieceNode * node() const noexcept
+		{
+			return this->m_node;
+		}
+		// Text offset of the current piece start
+		[[nodiscard]] std::size_t offset() const noexcept
+		{
+			return this->m_pieceOffset;
+		}
+		COMFYDX_API void next();
+	};
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <optional>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+#include "pieceTable.hpp"
+
+namespace cdx::text
+{
+	struct RecoveredDocument
+	{
+		// Empty if the document was never saved
+		std::filesystem::path document;
+		PieceTable text;
+		// Edit batches replayed on top of the last checkpoint
+		std::size_t batches{};
+	};
+
+	struct JournalOptions
+	{
+		std::chrono::milliseconds flushInterval{ 2000 };
+		// Edits appended before compacting, at least as much as the checkpoint took
+		std::uint64_t compactThreshold{ 4 << 20 };
+		// Edits kept in memory before the worker is woken up early
+		std::size_t maxPending{ 1 << 20 };
+	};
+
+	/*
+	 * Append-only journal that lets a document be restored after a crash,
+	 * without ever writing the whole document again.
+	 *
+	 * The journal starts with a checkpoint of the text relative to the base,
+	 * the snapshot matching the document file: spans that are in the file are
+	 * stored as its offsets, only the rest as text. Recorded edit batches are
+	 * collected in memory and appended by a worker thread every flush interval.
+	 * Once they take more than the checkpoint, the journal is rewritten as a
+	 * new checkpoint aside and renamed over the old one.
+	 *
+	 * Records are checksummed, a torn write at the end is dropped on recovery.
+	 * Writes are flushed to the OS, so they survive the editor crashing, but
+	 * not necessarily the machine losing power.
+	 */
+	class RecoveryJournal
+	{
+	private:
+		std::filesystem::path m_path;
+		JournalOptions m_options;
+
+		// Guarded by m_mutex
+		std::mutex m_mutex;
+		std::condition_variable_any m_wake, m_written;
+		std::filesystem::path m_document;
+		TextSnapshot m_base, m_latest;
+		std::string m_pending;
+		bool m_bCheckpoint{ true }, m_bFlushNow{ true }, m_bDiscarded{ false };
+		std::uint64_t m_requested{ 0 }, m_completed{ 0 };
+
+		// Worker thread only
+		std::ofstream m_out;
+		std::uint64_t m_deltaSize{ 0 }, m_checkpointSize{ 0 };
+
+		std::atomic<std::uint64_t> m_size{ 0 };
+		std::atomic<bool> m_bOk{ true };
+		std::jthread m_worker;
+
+		void work(std::stop_token stop) noexcept;
+		[[nodiscard]] bool append(std::string_view records);
+		[[nodiscard]] bool compact(const std::filesystem::path & document, const TextSnapshot & base, const TextSnapshot & text);
+
+	public:
+		static constexpr std::uint64_t formatVersion{ 1 };
+		static constexpr const char * extension{ ".cdxj" };
+
+		/*
+		 * Starts a new journal at 'journal', overwriting an old one. 'base' is the
+		 * text of 'document' as it is on disk, the text a document that was never
+		 * saved started with otherwise.
+		 */
+		COMFYDX_API RecoveryJournal(std::filesystem::path journal, std::filesystem::path document, TextSnapshot base, JournalOptions options = {});
+		RecoveryJournal(const RecoveryJournal &) = delete;
+		RecoveryJournal & operator=(const RecoveryJournal &) = delete;
+		// Writes what is pending and keeps the file, discard() it if it isn't needed
+		COMFYDX_API ~RecoveryJournal() noexcept;
+
+		// A batch as normalized by PieceTable::apply(), 'after' is the text it resulted in
+		COMFYDX_API void record(std::span<const TextEdit> edits, const TextSnapshot & after);
+		// A change without edits at hand, e.g. undo or reload, written as a checkpoint
+		COMFYDX_API void record(const TextSnapshot & after);
+		// The document was saved, 'saved' is a snapshot of the same table that is now on disk
+		COMFYDX_API void rebase(std::filesystem::path document, TextSnapshot saved);
+		// Blocks until everything recorded so far is written
+		COMFYDX_API void flush();
+		// Stops journaling and removes the file, e.g. once the document is closed
+		COMFYDX_API void discard() noexcept;
+
+		[[nodiscard]] const std::filesystem::path & path() const noexcept
+		{
+			return this->m_path;
+		}
+		[[nodiscard]] std::uint64_t size() const noexcept
+		{
+			return this->m_size.load(std::memory_order_relaxed);
+		}
+		// False if the last write failed, the next one starts the journal over
+		[[nodiscard]] bool ok() const noexcept
+		{
+			return this->m_bOk.load(std::memory_order_relaxed);
+		}
+
+		/*
+		 * The document as journaled, with the base mapped from the document file.
+		 * Fails if the journal is damaged before its first edits or the file was
+		 * changed since.
+		 */
+		[[nodiscard]] COMFYDX_API static std::optional<RecoveredDocument> recover(const std::filesystem::path & journal, std::string & error);
+	};
+}
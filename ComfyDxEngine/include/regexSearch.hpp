@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <memory>
+#include <cstdint>
+
+#include "api.hpp"
+#include "textSearch.hpp"
+
+namespace cdx::text
+{
+	/*
+	 * Regular expression search over UTF-8 text, ECMAScript-like syntax:
+	 * classes, \d \w \s, anchors ^ $ (line based), \b, greedy and lazy
+	 * quantifiers, groups, backreferences and lookaround. '.' and negated sets
+	 * never match a line break, multi-line matches need an explicit \n or \s.
+	 *
+	 * Patterns are compiled to a byte-level NFA which is searched through a
+	 * lazily built DFA, a reverse DFA finds where the match starts. A literal
+	 * every match has to contain is looked up with LiteralSearch first, so most
+	 * of the text is only skimmed. Backreferences and lookaround fall back to
+	 * backtracking, line by line.
+	 *
+	 * The DFA cache makes searches on one object serialize, copies share the
+	 * compiled pattern but get their own cache.
+	 */
+	class RegexSearch
+	{
+	public:
+		struct Program;
+		struct Cache;
+
+	private:
+		std::shared_ptr<const Program> m_program;
+		std::unique_ptr<Cache> m_cache;
+		std::string m_error;
+		std::size_t m_errorOffset{ 0 };
+
+	public:
+		COMFYDX_API RegexSearch() noexcept;
+		// Check valid() afterwards, the pattern may not compile
+		COMFYDX_API explicit RegexSearch(std::string_view pattern, CaseMode mode = CaseMode::sensitive);
+		COMFYDX_API RegexSearch(const RegexSearch & other);
+		COMFYDX_API RegexSearch & operator=(const RegexSearch & other);
+		COMFYDX_API RegexSearch(RegexSearch && other) noexcept;
+		COMFYDX_API RegexSearch & operator=(RegexSearch && other) noexcept;
+		COMFYDX_API ~RegexSearch() noexcept;
+
+		[[nodiscard]] bool valid() const noexcept
+		{
+			return this->m_program != nullptr;
+		}
+		// Why the pattern did not compile and where, empty if it did
+		[[nodiscard]] const std::string & error() const noexcept
+		{
+			return this->m_error;
+		}
+		[[nodiscard]] std::size_t errorOffset() const noexcept
+		{
+			return this->m_errorOffset;
+		}
+		[[nodiscard]] COMFYDX_API std::size_t groupCount() const noexcept;
+		// Whether the pattern needs the backtracking matcher and only matches within lines
+		[[nodiscard]] COMFYDX_API bool backtracking() const noexcept;
+
+		// Appends the compiled pattern, only decode() of the same engine build reads it back
+		COMFYDX_API void encode(std::string & out) const;
+		// Replaces the pattern with one encode() wrote and moves 'in' past it, false if the data is damaged
+		COMFYDX_API bool decode(std::string_view & in);
+
+		// First match in a contiguous text starting at or after 'from'
+		[[nodiscard]] COMFYDX_API std::optional<SearchMatch> findIn(std::string_view text, std::size_t from = 0) const;
+
+		using MatchFn = LiteralSearch::MatchFn;
+		/*
+		 * Calls fn for the non-overlapping matches starting in [from, to), in
+		 * order. Returns false if fn stopped the scan by returning false.
+		 */
+		COMFYDX_API bool scan(const TextSnapshot & text, std::size_t from, std::size_t to, const MatchFn & fn) const;
+		[[nodiscard]] COMFYDX_API std::optional<SearchMatch> find(const TextSnapshot & text, std::size_t from) const;
+		// Last match starting before 'before', as found scanning from a line start
+		[[nodiscard]] COMFYDX_API std::optional<SearchMatch> findPrev(const TextSnapshot & text, std::size_t before) const;
+	};
+}
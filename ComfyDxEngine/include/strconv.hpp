@@ -5,94 +5,193 @@
 #include <concepts>
 #include <cstdlib>
 #include <stdexcept>
+#include <charconv>
+#include <system_error>
+#include <span>
+#include <vector>
+#include <algorithm>
 
+#include "api.hpp"
 #include "concepts.hpp"
 
 namespace ce
 {
-	template<std::floating_point F>
-	COMFYDX_API F stof(std::string_view str, std::size_t * pos = nullptr);
-
-	template<> COMFYDX_API float stof<float>(std::string_view str, std::size_t * pos);
-	template<> COMFYDX_API double stof<double>(std::string_view str, std::size_t * pos);
-	template<> COMFYDX_API long double stof<long double>(std::string_view str, std::size_t * pos);
-
-	template<concepts::signed_integral_until32 SI>
-	SI stoi(std::string_view str, std::size_t * pos = nullptr, int base = 10)
+	/*
+	 * Result of a non-throwing conversion, 'pos' is the amount of characters
+	 * consumed. Errors are std::errc::invalid_argument and std::errc::result_out_of_range.
+	 */
+	template<concepts::numeric N>
+	struct NumResult
 	{
-		char * ptr;
-		auto val = std::strtol(str.data(), &ptr, base);
-		if (str.data() == ptr)
+		N value{};
+		std::errc error{};
+		std::size_t pos{};
+
+		[[nodiscard]] explicit constexpr operator bool() const noexcept
 		{
-			throw std::invalid_argument("stoi");
+			return this->error == std::errc{};
 		}
-		else if ((errno == ERANGE) || (val < std::numeric_limits<SI>::min()) || (val > std::numeric_limits<SI>::max()))
+		[[nodiscard]] constexpr N valueOr(N def) const noexcept
 		{
-			throw std::out_of_range("stoi");
+			return bool(*this) ? this->value : def;
 		}
-		else if (pos != nullptr)
+	};
+
+	namespace detail
+	{
+		// Mimics strto*: leading blanks and a '+' sign are accepted
+		[[nodiscard]] constexpr std::size_t numPrefix(std::string_view str) noexcept
+		{
+			std::size_t i = 0;
+			while (i < str.size() && (str[i] == ' ' || str[i] == '\t'))
+			{
+				++i;
+			}
+			if (i + 1 < str.size() && str[i] == '+' && str[i + 1] != '-')
+			{
+				++i;
+			}
+			return i;
+		}
+
+		template<concepts::numeric N, typename ... Args>
+		[[nodiscard]] NumResult<N> fromChars(std::string_view str, Args ... args) noexcept
 		{
-			*pos = std::size_t(ptr - str.data());
+			NumResult<N> res;
+			auto first = str.data() + detail::numPrefix(str), last = str.data() + str.size();
+			auto [ptr, ec] = std::from_chars(first, last, res.value, args...);
+			res.error = ec;
+			res.pos = (ec == std::errc::invalid_argument) ? 0 : std::size_t(ptr - str.data());
+			return res;
 		}
-		return static_cast<SI>(val);
 	}
-	template<concepts::int64_t I64>
-	I64 stoi(std::string_view str, std::size_t * pos = nullptr, int base = 10)
+
+	// Unlike strto* there is no prefix detection, base 0 and bases outside 2..36 are invalid_argument
+	template<std::integral I>
+	[[nodiscard]] NumResult<I> toNum(std::string_view str, int base = 10) noexcept
 	{
-		char * ptr;
-		I64 val = std::strtoll(str.data(), &ptr, base);
-		if (pos != nullptr)
+		if (base < 2 || base > 36)
 		{
-			*pos = std::size_t(ptr - str.data());
+			return { I{}, std::errc::invalid_argument, 0 };
 		}
-		else if (errno == ERANGE)
+		else if constexpr (std::is_same_v<I, bool>)
 		{
-			throw std::out_of_range("stoi");
+			auto res = detail::fromChars<unsigned char>(str, base);
+			if (res && res.value > 1)
+			{
+				res.error = std::errc::result_out_of_range;
+			}
+			return { bool(res.value), res.error, res.pos };
 		}
-		else if (pos != nullptr)
+		else
 		{
-			*pos = std::size_t(ptr - str.data());
+			return detail::fromChars<I>(str, base);
 		}
-		return val;
+	}
+	template<std::floating_point F>
+	[[nodiscard]] NumResult<F> toNum(std::string_view str, std::chars_format fmt = std::chars_format::general) noexcept
+	{
+		return detail::fromChars<F>(str, fmt);
 	}
 
-	template<concepts::unsigned_integral_until32 UI>
-	UI stoi(std::string_view str, std::size_t * pos = nullptr, int base = 10)
+	struct NumBatchResult
 	{
-		char * ptr;
-		auto val = std::strtoul(str.data(), &ptr, base);
-		if (pos != nullptr)
+		std::size_t count{};
+		std::errc error{};
+		std::size_t pos{};
+
+		[[nodiscard]] explicit constexpr operator bool() const noexcept
 		{
-			*pos = std::size_t(ptr - str.data());
+			return this->error == std::errc{};
 		}
-		else if ((errno == ERANGE) || (val > static_cast<unsigned long>(std::numeric_limits<UI>::max())))
+	};
+
+	/*
+	 * Parses up to out.size() numbers separated by any of the separator characters,
+	 * e.g. "120:5" for line:column or one column of CSV data. Stops at the first
+	 * malformed number, 'pos' points at it.
+	 */
+	template<concepts::numeric N>
+	NumBatchResult toNums(std::string_view str, std::span<N> out, std::string_view separators = " \t\r\n,;:") noexcept
+	{
+		NumBatchResult res;
+		while (res.count < out.size())
 		{
-			throw std::out_of_range("stoi");
+			while (res.pos < str.size() && separators.find(str[res.pos]) != std::string_view::npos)
+			{
+				++res.pos;
+			}
+			if (res.pos == str.size())
+			{
+				break;
+			}
+
+			auto num = toNum<N>(str.substr(res.pos));
+			if (!num)
+			{
+				res.error = num.error;
+				return res;
+			}
+			out[res.count++] = num.value;
+			res.pos += num.pos;
+			if (res.pos < str.size() && separators.find(str[res.pos]) == std::string_view::npos)
+			{
+				// Number followed by garbage, e.g. "12ab"
+				res.error = std::errc::invalid_argument;
+				--res.count;
+				res.pos -= num.pos;
+				return res;
+			}
 		}
-		if (pos != nullptr)
+		return res;
+	}
+	template<concepts::numeric N>
+	NumBatchResult toNums(std::string_view str, std::vector<N> & out, std::string_view separators = " \t\r\n,;:")
+	{
+		NumBatchResult res;
+		while (true)
 		{
-			*pos = std::size_t(ptr - str.data());
+			auto size = out.size(), chunk = std::max<std::size_t>(16, size / 2);
+			out.resize(size + chunk);
+			auto part = ce::toNums<N>(str.substr(res.pos), std::span<N>{ out.data() + size, chunk }, separators);
+			out.resize(size + part.count);
+
+			res.count += part.count;
+			res.error = part.error;
+			res.pos += part.pos;
+			if (!part || part.count < chunk)
+			{
+				break;
+			}
 		}
-		return static_cast<UI>(val);
+		return res;
 	}
-	template<concepts::uint64_t U64>
-	U64 stoi(std::string_view str, std::size_t * pos = nullptr, int base = 10)
+
+	// Throwing wrappers, kept for older call sites
+	template<std::floating_point F>
+	COMFYDX_API F stof(std::string_view str, std::size_t * pos = nullptr);
+
+	template<> COMFYDX_API float stof<float>(std::string_view str, std::size_t * pos);
+	template<> COMFYDX_API double stof<double>(std::string_view str, std::size_t * pos);
+	template<> COMFYDX_API long double stof<long double>(std::string_view str, std::size_t * pos);
+
+	template<std::integral I>
+	I stoi(std::string_view str, std::size_t * pos = nullptr, int base = 10)
 	{
-		char * ptr;
-		U64 val = std::strtoull(str.data(), &ptr, base);
-		if (pos != nullptr)
+		auto res = ce::toNum<I>(str, base);
+		if (res.error == std::errc::invalid_argument)
 		{
-			*pos = std::size_t(ptr - str.data());
+			throw std::invalid_argument("stoi");
 		}
-		else if (errno == ERANGE)
+		else if (res.error == std::errc::result_out_of_range)
 		{
 			throw std::out_of_range("stoi");
 		}
-		if (pos != nullptr)
+		else if (pos != nullptr)
 		{
-			*pos = std::size_t(ptr - str.data());
+			*pos = res.pos;
 		}
-		return val;
+		return res.value;
 	}
 
 	COMFYDX_API std::string conv(std::wstring_view str);
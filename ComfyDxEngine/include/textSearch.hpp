@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <functional>
+#include <array>
+#include <cstdint>
+
+#include "api.hpp"
+#include "pieceTable.hpp"
+
+namespace cdx::text
+{
+	enum class CaseMode : std::uint8_t
+	{
+		sensitive,
+		// Only A-Z and a-z match each other
+		ascii,
+		// Unicode simple case folding, e.g. 'K', 'k' and KELVIN SIGN all match
+		unicode
+	};
+
+	// Simple case folding of a code point (CaseFolding.txt statuses C and S)
+	[[nodiscard]] COMFYDX_API char32_t foldCase(char32_t cp) noexcept;
+	// Calls fn(cp, folded) for every code point that does not fold to itself
+	COMFYDX_API void forEachCaseFold(const std::function<void(char32_t, char32_t)> & fn);
+
+	struct SearchMatch
+	{
+		std::size_t offset{}, length{};
+	};
+
+	/*
+	 * Literal substring search. Candidates are found 16 bytes at a time by
+	 * comparing the first and the last byte of the needle at once, only those
+	 * are compared in full. Documents are searched piece by piece, matches
+	 * crossing piece boundaries are found through a small junction buffer, so
+	 * the text is never flattened.
+	 *
+	 * With Unicode folding the match length in the text can differ from the
+	 * needle's, candidates are then filtered by their possible lead bytes.
+	 */
+	class LiteralSearch
+	{
+	private:
+		// Lowercased in ascii mode, folded in unicode mode
+		std::string m_needle;
+		std::u32string m_folded;
+		CaseMode m_mode{ CaseMode::sensitive };
+		// Bytes a match can start with, all 256 of them may be flagged in the table
+		std::array<char, 4> m_leads{};
+		std::size_t m_leadCount{ 0 };
+		std::array<bool, 256> m_leadTable{};
+		std::size_t m_maxLength{ 0 };
+
+		[[nodiscard]] std::optional<SearchMatch> findBytes(std::string_view text, std::size_t from) const noexcept;
+		[[nodiscard]] std::optional<SearchMatch> findFolded(std::string_view text, std::size_t from) const noexcept;
+		// Length of the folded match at 'pos', 0 if there is none
+		[[nodiscard]] std::size_t matchFolded(std::string_view text, std::size_t pos) const noexcept;
+
+	public:
+		LiteralSearch() noexcept = default;
+		COMFYDX_API explicit LiteralSearch(std::string_view needle, CaseMode mode = CaseMode::sensitive);
+
+		[[nodiscard]] bool empty() const noexcept
+		{
+			return this->m_needle.empty();
+		}
+		[[nodiscard]] CaseMode mode() const noexcept
+		{
+			return this->m_mode;
+		}
+		// The needle as given, lowercased in ascii mode
+		[[nodiscard]] const std::string & needle() const noexcept
+		{
+			return this->m_needle;
+		}
+		// Upper bound of a match's length in the text
+		[[nodiscard]] std::size_t maxLength() const noexcept
+		{
+			return this->m_maxLength;
+		}
+
+		// First match in a contiguous text starting at or after 'from'
+		[[nodiscard]] COMFYDX_API std::optional<SearchMatch> findIn(std::string_view text, std::size_t from = 0) const noexcept;
+
+		using MatchFn = std::function<bool(const SearchMatch &)>;
+		/*
+		 * Calls fn for the non-overlapping matches starting in [from, to), in
+		 * order. Returns false if fn stopped the scan by returning false.
+		 */
+		COMFYDX_API bool scan(const TextSnapshot & text, std::size_t from, std::size_t to, const MatchFn & fn) const;
+		[[nodiscard]] COMFYDX_API std::optional<SearchMatch> find(const TextSnapshot & text, std::size_t from) const;
+		// Last match starting before 'before', overlapping matches count as well
+		[[nodiscard]] COMFYDX_API std::optional<SearchMatch> findPrev(const TextSnapshot & text, std::size_t before) const;
+	};
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <array>
+#include <memory>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "api.hpp"
+#include "grammar.hpp"
+#include "pieceTable.hpp"
+#include "bracketIndex.hpp"
+
+namespace cdx::syntax
+{
+	// Token running from 'start' to the next token's start or the end of its line
+	struct Token
+	{
+		std::uint32_t start{ 0 };
+		TokenKind kind{ 0 };
+	};
+
+	/*
+	 * Incremental syntax highlighting of a document. Every line keeps the
+	 * lexer state it ends in, i.e. the grammar's state stack, so lines can be
+	 * lexed one by one. An edit invalidates the lines from the first changed one
+	 * on, re-lexing stops again as soon as a line ends in the same state as
+	 * before and no changed line follows.
+	 *
+	 * Lines below frontier() are up to date. The rest is lexed on a background
+	 * thread, viewport() lexes the visible lines first: synchronously if the
+	 * frontier is close enough, else starting from a guessed state until the
+	 * background thread gets there.
+	 *
+	 * Brackets and indentation of the lexed lines go into a BracketIndex for
+	 * matching and folding, so they are as current as the tokens are.
+	 *
+	 * The text's line index has to be complete, see PieceTable::finishIndexing().
+	 */
+	class Tokenizer
+	{
+	public:
+		// Called on the background thread after it updated lines, e.g. to request a repaint
+		using Notify = std::function<void()>;
+
+		// Stack id of lines that were never lexed
+		static constexpr std::uint32_t noStack{ 0xFFFFFFFF };
+		// Deeper pushes replace the top state instead
+		static constexpr std::uint16_t maxDepth{ 256 };
+		// Bytes of a line that are lexed, the last token runs over the rest
+		static constexpr std::size_t maxLineLength{ 64 << 10 };
+		// Lines viewport() lexes up to before it falls back to guessing
+		static constexpr std::size_t defSyncLines{ 2000 };
+		// Lines the background thread lexes per locked update
+		static constexpr std::size_t batchLines{ 256 };
+		static constexpr std::uint32_t defTabSize{ 4 };
+
+	private:
+		struct Line
+		{
+			std::vector<Token> tokens;
+			std::uint32_t stack{ noStack };
+		};
+		struct StackNode
+		{
+			std::uint32_t parent;
+			StateId state;
+			std::uint16_t depth;
+		};
+
+		std::shared_ptr<const Grammar> m_grammar;
+		Notify m_notify;
+		std::size_t m_syncLines;
+		std::uint32_t m_tabSize;
+		// Per ASCII character its bracket pair * 2, +1 for closing ones, or -1
+		std::array<std::int8_t, 128> m_bracketOf;
+
+		// Interned state stacks, 0 is the initial state alone
+		std::vector<StackNode> m_stacks;
+		std::unordered_map<std::uint64_t, std::uint32_t> m_stackIds;
+		std::mutex m_stackMutex;
+
+		std::mutex m_mutex;
+		std::condition_variable_any m_changed;
+		text::TextSnapshot m_text;
+		std::vector<Line> m_lines;
+		// Sorted changed lines at or past the frontier, their old end state can't be trusted
+		std::vector<std::size_t> m_dirty;
+		std::size_t m_valid{ 0 };
+		// Lines from here on were never lexed, converging can't skip over them
+		std::size_t m_reached{ 0 };
+		// Bumped on every change, background results of an older text are dropped
+		std::uint64_t m_generation{ 0 };
+		BracketIndex m_brackets;
+		std::jthread m_worker;
+
+		[[nodiscard]] std::uint32_t intern(std::uint32_t parent, StateId state);
+		[[nodiscard]] StateId top(std::uint32_t stack);
+		// Stack after a rule matched, 'state' receives its top
+		[[nodiscard]] std::uint32_t transition(std::uint32_t stack, const Rule & rule, StateId & state);
+		// Tokens of one line starting in 'stack', returns the stack it ends in
+		std::uint32_t lexLine(std::string_view line, std::uint32_t stack, std::vector<Token> & tokens);
+		// Also collects the line's brackets and indentation
+		std::uint32_t lexLine(const text::TextSnapshot & text, std::size_t line, std::uint32_t stack, std::vector<Token> & tokens, LineStructure & structure, std::string & buffer);
+		void scan(std::string_view line, const std::vector<Token> & tokens, LineStructure & structure) const;
+
+		// Next changed line after 'line', the lines before it follow from line's end state
+		[[nodiscard]] std::size_t nextDirty(std::size_t line) const noexcept;
+		// Stack the line starts in, with m_mutex held
+		[[nodiscard]] std::uint32_t startStack(std::size_t line) const noexcept;
+		// Stores the line at the frontier and moves it on, with m_mutex held
+		void store(std::vector<Token> tokens, std::uint32_t stack, LineStructure structure);
+		// Lexes at the frontier up to 'last', with m_mutex held
+		void advance(std::size_t last);
+		void work(std::stop_token stop) noexcept;
+
+	public:
+		COMFYDX_API explicit Tokenizer(std::shared_ptr<const Grammar> grammar, Notify notify = {}, std::size_t syncLines = defSyncLines, std::uint32_t tabSize = defTabSize);
+		Tokenizer(const Tokenizer &) = delete;
+		Tokenizer & operator=(const Tokenizer &) = delete;
+		COMFYDX_API ~Tokenizer() noexcept;
+
+		[[nodiscard]] const std::shared_ptr<const Grammar> & grammar() const noexcept
+		{
+			return this->m_grammar;
+		}
+
+		// Switches to a text without a known relation to the current one
+		COMFYDX_API void setText(text::TextSnapshot text);
+		/*
+		 * The current text was changed into 'text' by a batch of edits in old
+		 * offsets, sorted and normalized like PieceTable::apply() leaves them.
+		 */
+		COMFYDX_API void edit(text::TextSnapshot text, std::span<const text::TextEdit> edits);
+		// Makes tokens() of the lines [first, last) usable right away
+		COMFYDX_API void viewport(std::size_t first, std::size_t last);
+		// Lexes the rest on the calling thread
+		COMFYDX_API void finish();
+
+		[[nodiscard]] COMFYDX_API std::size_t lineCount();
+		// Lines below the frontier are lexed from their actual state
+		[[nodiscard]] COMFYDX_API std::size_t frontier();
+		[[nodiscard]] bool done()
+		{
+			return this->frontier() == this->lineCount();
+		}
+		/*
+		 * Empty for lines that weren't lexed yet and for empty lines. Past the
+		 * frontier the tokens may be outdated, starts can lie past the line end.
+		 */
+		[[nodiscard]] COMFYDX_API std::vector<Token> tokens(std::size_t line);
+
+		// See BracketIndex, lines past the frontier may be outdated or blank
+		[[nodiscard]] COMFYDX_API std::optional<BracketPos> matchingBracket(std::size_t line, std::uint32_t column);
+		[[nodiscard]] COMFYDX_API std::optional<BracketBlock> enclosingBlock(std::size_t line, std::uint32_t column);
+		[[nodiscard]] COMFYDX_API std::vector<FoldRange> foldRanges(std::size_t first, std::size_t last);
+	};
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <span>
+#include <string_view>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "api.hpp"
+
+namespace ce
+{
+	/*
+	 * Stateful UTF-8 -> UTF-16 decoder, chunks can be split at any byte.
+	 * Invalid sequences are replaced by U+FFFD (maximal subpart rule, same as
+	 * the WHATWG encoding standard), so the output is always valid UTF-16.
+	 */
+	class Utf8ToUtf16
+	{
+	public:
+		struct Result
+		{
+			std::size_t read{}, written{};
+		};
+
+		static constexpr char16_t replacement{ 0xFFFD };
+
+	private:
+		char32_t m_codePoint{ 0 };
+		std::uint8_t m_bytesNeeded{ 0 }, m_bytesSeen{ 0 };
+		std::uint8_t m_lower{ 0x80 }, m_upper{ 0xBF };
+
+	public:
+		// Upper bound of code units produced by feeding inputSize bytes, including a final flush
+		[[nodiscard]] static constexpr std::size_t maxOutput(std::size_t inputSize) noexcept
+		{
+			return inputSize + 2;
+		}
+
+		/*
+		 * Decodes as much of 'in' as fits into 'out'. 'last' flushes an unfinished
+		 * sequence at the end of the stream. Output needs room for at least 2 code
+		 * units to make progress.
+		 */
+		COMFYDX_API Result feed(std::span<const char> in, std::span<char16_t> out, bool last = false) noexcept;
+		[[nodiscard]] constexpr bool pending() const noexcept
+		{
+			return this->m_bytesNeeded != 0;
+		}
+		constexpr void reset() noexcept
+		{
+			*this = {};
+		}
+	};
+
+	/*
+	 * Stateful UTF-16 -> UTF-8 encoder, chunks can be split between the halves
+	 * of a surrogate pair. Lone surrogates are replaced by U+FFFD.
+	 */
+	class Utf16ToUtf8
+	{
+	public:
+		using Result = Utf8ToUtf16::Result;
+
+	private:
+		char16_t m_highSurrogate{ 0 };
+
+	public:
+		[[nodiscard]] static constexpr std::size_t maxOutput(std::size_t inputSize) noexcept
+		{
+			return 3 * inputSize + 3;
+		}
+
+		// Output needs room for at least 4 bytes to make progress
+		COMFYDX_API Result feed(std::span<const char16_t> in, std::span<char> out, bool last = false) noexcept;
+		[[nodiscard]] constexpr bool pending() const noexcept
+		{
+			return this->m_highSurrogate != 0;
+		}
+		constexpr void reset() noexcept
+		{
+			*this = {};
+		}
+	};
+
+	/*
+	 * Pulls raw UTF-8 from a source on a background thread and pushes decoded
+	 * UTF-16 chunks to a sink. Only one input and one output chunk are alive at
+	 * a time, so peak memory is bounded by the chunk size and not by the file.
+	 */
+	class AsyncTranscoder
+	{
+	public:
+		// Fills the span, returns the amount of bytes read, 0 means end of stream
+		using Source = std::function<std::size_t(std::span<char>)>;
+		// Receives decoded text, return false to stop transcoding
+		using Sink = std::function<bool(std::u16string_view)>;
+
+		static constexpr std::size_t defChunkSize{ 1 << 20 };
+
+	private:
+		Source m_source;
+		Sink m_sink;
+		std::size_t m_chunkSize;
+
+		std::atomic<std::uint64_t> m_bytesRead{ 0 };
+		std::atomic<bool> m_bDone{ false }, m_bOk{ false };
+		std::jthread m_worker;
+
+		void work(std::stop_token stop) noexcept;
+
+	public:
+		COMFYDX_API AsyncTranscoder(Source source, Sink sink, std::size_t chunkSize = defChunkSize);
+		AsyncTranscoder(const AsyncTranscoder &) = delete;
+		AsyncTranscoder & operator=(const AsyncTranscoder &) = delete;
+		COMFYDX_API ~AsyncTranscoder() noexcept;
+
+		// Runs the worker; returns false if it is already running
+		COMFYDX_API bool start();
+		COMFYDX_API void cancel() noexcept;
+		COMFYDX_API void wait() noexcept;
+
+		[[nodiscard]] std::uint64_t bytesRead() const noexcept
+		{
+			return this->m_bytesRead.load(std::memory_order_relaxed);
+		}
+		[[nodiscard]] bool done() const noexcept
+		{
+			return this->m_bDone.load(std::memory_order_acquire);
+		}
+		// Whether the whole source was consumed without the sink or cancel stopping it
+		[[nodiscard]] bool ok() const noexcept
+		{
+			return this->m_bOk.load(std::memory_order_acquire);
+		}
+	};
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+
+#include "api.hpp"
+#include "pieceTable.hpp"
+
+namespace cdx::text
+{
+	// At 'offset', the removed pieces were replaced by the inserted ones
+	struct EditRecord
+	{
+		std::size_t offset{};
+		std::size_t removedLength{}, insertedLength{};
+		std::uint32_t removedPieces{}, insertedPieces{};
+	};
+
+	/*
+	 * Edits that are undone and redone together. The pieces of every edit are
+	 * stored back to back, removed ones first. Pieces reference the buffers of
+	 * the table, so a group never holds any text itself.
+	 */
+	struct UndoGroup
+	{
+		std::vector<EditRecord> edits;
+		std::vector<Piece> pieces;
+
+		[[nodiscard]] std::size_t memoryUsage() const noexcept
+		{
+			return this->edits.capacity() * sizeof(EditRecord) + this->pieces.capacity() * sizeof(Piece);
+		}
+		// Compact varint encoding, offsets and piece starts are delta coded
+		COMFYDX_API void encode(std::string & out) const;
+		[[nodiscard]] COMFYDX_API bool decode(std::string_view in);
+
+		COMFYDX_API void undo(PieceTable & table) const;
+		COMFYDX_API void redo(PieceTable & table) const;
+	};
+
+	/*
+	 * Branching undo/redo history of a PieceTable. Adjacent typing, backspacing
+	 * and deleting are coalesced into one step until the caret moves (seal()) or
+	 * the user pauses. Undoing and then editing starts a new branch, the old one
+	 * can still be redone by index.
+	 *
+	 * Once the history needs more memory than the budget, the oldest steps are
+	 * written to a compressed journal file and loaded back when they are needed.
+	 */
+	class UndoHistory
+	{
+	public:
+		static constexpr std::size_t npos{ std::size_t(-1) };
+
+		struct Options
+		{
+			std::size_t memoryBudget{ 64 << 20 };
+			std::chrono::milliseconds coalesceTimeout{ 1000 };
+			// Temporary file if empty
+			std::filesystem::path journal;
+		};
+
+	private:
+		struct Node
+		{
+			std::size_t parent{ npos };
+			std::vector<std::size_t> children;
+			// Branch followed by redo(), the one most recently left or created
+			std::size_t redoChild{ npos };
+			UndoGroup group;
+			std::uint64_t journalOffset{}, journalSize{};
+			bool bSpilled{ false }, bJournaled{ false };
+		};
+
+		Options m_options;
+		std::vector<Node> m_nodes;
+		std::size_t m_current{ 0 };
+		std::size_t m_memory{ 0 };
+		// Nodes before this one were all considered for spilling already
+		std::size_t m_spillFrom{ 1 };
+		// Spilled nodes that were loaded back by undo/redo
+		std::vector<std::size_t> m_loaded;
+
+		std::size_t m_groupDepth{ 0 };
+		bool m_bOpen{ false };
+		std::chrono::steady_clock::time_point m_lastEdit;
+
+		std::filesystem::path m_journalPath;
+		std::fstream m_journal;
+		std::uint64_t m_journalSize{ 0 };
+
+		void newNode();
+		[[nodiscard]] bool coalesce(std::size_t offset, std::span<const Piece> removed, std::span<const Piece> inserted);
+		[[nodiscard]] bool openJournal();
+		[[nodiscard]] bool spill(std::size_t node);
+		[[nodiscard]] bool load(std::size_t node);
+		void trim();
+		void closeJournal() noexcept;
+
+	public:
+		COMFYDX_API UndoHistory();
+		COMFYDX_API explicit UndoHistory(Options options);
+		UndoHistory(const UndoHistory &) = delete;
+		UndoHistory & operator=(const UndoHistory &) = delete;
+		COMFYDX_API ~UndoHistory() noexcept;
+
+		// Edits the table and records the change
+		COMFYDX_API void insert(PieceTable & table, std::size_t offset, std::string_view text);
+		COMFYDX_API void erase(PieceTable & table, std::size_t offset, std::size_t count);
+		COMFYDX_API void replace(PieceTable & table, std::size_t offset, std::size_t count, std::string_view text);
+		// Applies a batch of edits as in PieceTable::apply(), recorded as one step
+		COMFYDX_API void apply(PieceTable & table, std::span<const TextEdit> edits);
+		// Records an edit that was already made on the table
+		COMFYDX_API void record(std::size_t offset, std::span<const Piece> removed, std::span<const Piece> inserted);
+
+		// Everything recorded between the outermost begin and end is one step
+		COMFYDX_API void beginGroup();
+		COMFYDX_API void endGroup();
+		// Stops coalescing with the previous edit, e.g. after the caret was moved
+		void seal() noexcept
+		{
+			this->m_bOpen = false;
+		}
+
+		[[nodiscard]] bool canUndo() const noexcept
+		{
+			return this->m_current != 0;
+		}
+		[[nodiscard]] bool canRedo() const noexcept
+		{
+			return this->m_nodes[this->m_current].redoChild != npos;
+		}
+		// Amount of branches that can be redone from the current state
+		[[nodiscard]] std::size_t branchCount() const noexcept
+		{
+			return this->m_nodes[this->m_current].children.size();
+		}
+		COMFYDX_API bool undo(PieceTable & table);
+		COMFYDX_API bool redo(PieceTable & table);
+		COMFYDX_API bool redo(PieceTable & table, std::size_t branch);
+
+		[[nodiscard]] std::size_t memoryUsage() const noexcept
+		{
+			return this->m_memory;
+		}
+		[[nodiscard]] std::uint64_t journalSize() const noexcept
+		{
+			return this->m_journalSize;
+		}
+		COMFYDX_API void clear();
+	};
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+
+namespace cdx::io
+{
+	// LEB128 encoding of unsigned integers, shared by the engine's binary formats
+	inline void putVarint(std::string & out, std::uint64_t value)
+	{
+		for (; value >= 0x80; value >>= 7)
+		{
+			out.push_back(char(value | 0x80));
+		}
+		out.push_back(char(value));
+	}
+	inline bool getVarint(std::string_view & in, std::uint64_t & value) noexcept
+	{
+		value = 0;
+		for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7)
+		{
+			auto byte = std::uint8_t(in.front());
+			in.remove_prefix(1);
+			value |= std::uint64_t(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Length-prefixed byte string
+	inline void putBytes(std::string & out, std::string_view bytes)
+	{
+		putVarint(out, bytes.size());
+		out.append(bytes);
+	}
+	inline bool getBytes(std::string_view & in, std::string_view & bytes) noexcept
+	{
+		std::uint64_t size;
+		if (!getVarint(in, size) || size > in.size())
+		{
+			return false;
+		}
+		bytes = in.substr(0, std::size_t(size));
+		in.remove_prefix(std::size_t(size));
+		return true;
+	}
+
+	// FNV-1a over 8 byte words, names cache entries and catches damaged records
+	[[nodiscard]] inline std::uint64_t checksum(std::string_view bytes) noexcept
+	{
+		constexpr std::uint64_t prime{ 0x100000001B3 };
+		std::uint64_t hash = 0xCBF29CE484222325 ^ bytes.size();
+		std::size_t i = 0;
+		for (; i + 8 <= bytes.size(); i += 8)
+		{
+			std::uint64_t word;
+			std::memcpy(&word, bytes.data() + i, sizeof(word));
+			hash = (hash ^ word) * prime;
+		}
+		for (; i < bytes.size(); ++i)
+		{
+			hash = (hash ^ std::uint8_t(bytes[i])) * prime;
+		}
+		return hash;
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <memory>
+#include <cstdint>
+
+#include "api.hpp"
+#include "pieceTable.hpp"
+
+namespace cdx::text
+{
+	// A row of the wrapped text
+	struct WrapRow
+	{
+		std::size_t line{};
+		// Row within the line
+		std::size_t row{};
+	};
+
+	struct WrapJob;
+
+	/*
+	 * Visual row count of every line when soft-wrapped, for scrolling and
+	 * mapping rows to lines in O(log n). Lines are kept in blocks of a few
+	 * hundred, two Fenwick trees over the blocks sum up their lines and rows.
+	 *
+	 * Lines are measured lazily: edited lines and all lines after a width
+	 * change are marked stale and keep an estimate meanwhile, the old count
+	 * scaled to the new width. ensure() measures the visible ones right away,
+	 * poll() hands the rest to a worker thread reading a text snapshot and
+	 * adopts what it measured, so resizing stays interactive on any size of
+	 * document.
+	 */
+	class WrapIndex
+	{
+	public:
+		// Blocks are split above this many lines
+		static constexpr std::size_t maxBlock{ 512 };
+		// Stale lines measured per background job
+		static constexpr std::size_t jobLines{ 32768 };
+
+	private:
+		struct Block
+		{
+			// Rows per line, staleBit set while it is an estimate
+			std::vector<std::uint32_t> rows;
+			std::size_t total{ 0 }, stale{ 0 };
+		};
+		static constexpr std::uint32_t staleBit{ 0x80000000 };
+
+		std::vector<Block> m_blocks;
+		// 1-based Fenwick trees over m_blocks
+		std::vector<std::size_t> m_lineTree, m_rowTree;
+		std::size_t m_lines{ 0 }, m_rows{ 0 }, m_stale{ 0 };
+
+		std::size_t m_columns{ 80 };
+		std::uint8_t m_tabSize{ 4 };
+		// Bumped by setLayout(), jobs measured for an older one are dropped
+		std::uint64_t m_layout{ 0 };
+
+		std::unique_ptr<WrapJob> m_job;
+		// Batches applied since the running job took its snapshot
+		std::vector<std::vector<LineEdit>> m_editsSince;
+
+		void rebuild();
+		void update(std::size_t block, std::size_t total, std::size_t stale);
+		// Block of a line and the line's index in it, the end of the last block for lineCount()
+		[[nodiscard]] std::pair<std::size_t, std::size_t> locate(std::size_t line) const noexcept;
+		void setRows(std::size_t block, std::size_t index, std::uint32_t rows);
+		void insertLines(std::size_t line, std::size_t count);
+		void eraseLines(std::size_t line, std::size_t count);
+		void startJob(const TextSnapshot & text, std::size_t near);
+		[[nodiscard]] bool adoptJob();
+
+	public:
+		COMFYDX_API WrapIndex();
+		WrapIndex(const WrapIndex &) = delete;
+		WrapIndex & operator=(const WrapIndex &) = delete;
+		COMFYDX_API ~WrapIndex() noexcept;
+
+		// Starts over with 'lines' stale lines of one row
+		COMFYDX_API void reset(std::size_t lines);
+		// A batch as returned by TextSnapshot::lineEdits(), the edited lines become stale
+		COMFYDX_API void edit(std::span<const LineEdit> edits);
+		/*
+		 * Wrap width in columns, e.g. App::Attributes::width over the cell width.
+		 * Every line becomes stale, returns false if nothing changed.
+		 */
+		COMFYDX_API bool setLayout(std::size_t columns, std::uint8_t tabSize = 4);
+
+		// Measures the stale lines in [first, last) now, returns true if a count changed
+		COMFYDX_API bool ensure(const TextSnapshot & text, std::size_t first, std::size_t last);
+		/*
+		 * Adopts what the worker measured and starts it on the next stale lines,
+		 * from 'near' on. Call it regularly, e.g. every frame, with the current
+		 * text; returns true if a count changed.
+		 */
+		COMFYDX_API bool poll(const TextSnapshot & text, std::size_t near = 0);
+		// Waits for the worker and measures everything that is stale
+		COMFYDX_API void finish(const TextSnapshot & text);
+
+		[[nodiscard]] std::size_t lineCount() const noexcept
+		{
+			return this->m_lines;
+		}
+		// Including the estimates of stale lines
+		[[nodiscard]] std::size_t rowCount() const noexcept
+		{
+			return this->m_rows;
+		}
+		[[nodiscard]] std::size_t staleCount() const noexcept
+		{
+			return this->m_stale;
+		}
+		[[nodiscard]] std::size_t columns() const noexcept
+		{
+			return this->m_columns;
+		}
+
+		[[nodiscard]] COMFYDX_API std::size_t rows(std::size_t line) const noexcept;
+		[[nodiscard]] COMFYDX_API bool stale(std::size_t line) const noexcept;
+		// First row of a line, lines past the end map to rowCount()
+		[[nodiscard]] COMFYDX_API std::size_t rowOf(std::size_t line) const noexcept;
+		// Line showing a row, rows past the end map to the last row
+		[[nodiscard]] COMFYDX_API WrapRow lineAt(std::size_t row) const noexcept;
+	};
+}
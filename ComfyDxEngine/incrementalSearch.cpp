@@ -0,0 +1,369 @@
+#include "pch.hpp"
+#include "incrementalSearch.hpp"
+
+#include <algorithm>
+
+namespace cdx::text
+{
+	namespace
+	{
+		// The needle as the search compares it, for the modes that keep byte lengths
+		[[nodiscard]] std::string folded(std::string_view needle, CaseMode mode)
+		{
+			std::string out{ needle };
+			if (mode == CaseMode::ascii)
+			{
+				for (auto & c : out)
+				{
+					if (c >= 'A' && c <= 'Z')
+					{
+						c = char(c - 'A' + 'a');
+					}
+				}
+			}
+			return out;
+		}
+		// Compares text with a needle folded as above
+		[[nodiscard]] bool equals(std::string_view text, std::string_view needle, CaseMode mode) noexcept
+		{
+			if (mode != CaseMode::ascii)
+			{
+				return text == needle;
+			}
+			return std::equal(text.begin(), text.end(), needle.begin(), needle.end(), [](char a, char b)
+			{
+				return ((a >= 'A' && a <= 'Z') ? char(a - 'A' + 'a') : a) == b;
+			});
+		}
+		// Whether two occurrences can overlap, e.g. "aa" or "abab", a scan then skips some of them
+		[[nodiscard]] bool selfOverlapping(std::string_view needle) noexcept
+		{
+			for (std::size_t shift = 1; shift < needle.size(); ++shift)
+			{
+				if (needle.substr(shift) == needle.substr(0, needle.size() - shift))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/*
+		 * Moves the matches of the old text over a batch of edits. The text from
+		 * a match length before every edit is searched again, until the scan
+		 * finds a match an old one has at the same place again: from there on
+		 * the old matches continue unchanged.
+		 */
+		[[nodiscard]] std::vector<SearchMatch> patch(const LiteralSearch & search, const TextSnapshot & text, std::span<const SearchMatch> old, std::span<const TextEdit> edits)
+		{
+			std::vector<SearchMatch> out;
+			out.reserve(old.size());
+			const auto margin = search.maxLength() - 1;
+
+			// Offsets behind the edits so far move by added - removed
+			std::size_t added = 0, removed = 0, lastEnd = 0, i = 0;
+			auto keep = [&](const SearchMatch & match)
+			{
+				auto offset = match.offset + added - removed;
+				if (offset >= lastEnd)
+				{
+					out.push_back({ offset, match.length });
+					lastEnd = offset + match.length;
+				}
+			};
+
+			for (std::size_t j = 0; j < edits.size(); ++j)
+			{
+				const auto & edit = edits[j];
+				auto editStart = edit.offset + added - removed;
+				auto editEnd = editStart + edit.text.size();
+				auto window = editStart - std::min(editStart, margin);
+				for (; i < old.size() && old[i].offset + added - removed < window; ++i)
+				{
+					keep(old[i]);
+				}
+
+				added += edit.text.size();
+				removed += edit.count;
+				auto editedEnd = edit.offset + edit.count;
+				// The next edit's window is searched by the next round
+				auto next = std::size_t(-1);
+				if (j + 1 < edits.size())
+				{
+					next = edits[j + 1].offset + added - removed;
+					next -= std::min(next, margin);
+				}
+
+				search.scan(text, std::max(window, lastEnd), text.size(), [&](const SearchMatch & match)
+				{
+					if (match.offset >= next)
+					{
+						return false;
+					}
+					if (match.offset >= editEnd)
+					{
+						while (i < old.size() && (old[i].offset < editedEnd || old[i].offset + added - removed < match.offset))
+						{
+							++i;
+						}
+						if (i < old.size() && old[i].offset + added - removed == match.offset && old[i].length == match.length)
+						{
+							return false;
+						}
+					}
+					out.push_back(match);
+					lastEnd = match.offset + match.length;
+					return true;
+				});
+
+				// Old matches the edit touched or the scan went past are gone
+				while (i < old.size() && (old[i].offset < editedEnd || old[i].offset + added - removed < lastEnd))
+				{
+					++i;
+				}
+			}
+			for (; i < old.size(); ++i)
+			{
+				keep(old[i]);
+			}
+			return out;
+		}
+	}
+
+	COMFYDX_API IncrementalSearch::IncrementalSearch(std::size_t cacheSize, unsigned threads)
+		: m_cacheSize{ std::max<std::size_t>(cacheSize, 1) }, m_threads{ threads }
+	{
+	}
+	COMFYDX_API IncrementalSearch::~IncrementalSearch() noexcept
+	{
+		this->stopSearch();
+	}
+
+	const IncrementalSearch::Entry * IncrementalSearch::lookup(const NodePtr & root, std::string_view query, CaseMode mode)
+	{
+		auto it = std::find_if(this->m_cache.begin(), this->m_cache.end(), [&](const Entry & entry)
+		{
+			return entry.root == root && entry.mode == mode && entry.query == query;
+		});
+		if (it == this->m_cache.end())
+		{
+			return nullptr;
+		}
+		this->m_cache.splice(this->m_cache.begin(), this->m_cache, it);
+		return &this->m_cache.front();
+	}
+	const IncrementalSearch::Entry & IncrementalSearch::remember(Entry entry)
+	{
+		this->m_cache.push_front(std::move(entry));
+		while (this->m_cache.size() > this->m_cacheSize)
+		{
+			this->m_cache.pop_back();
+		}
+		return this->m_cache.front();
+	}
+
+	bool IncrementalSearch::narrow()
+	{
+		// Folded matches may differ in length from the needle
+		if (this->m_mode == CaseMode::unicode)
+		{
+			return false;
+		}
+
+		// The longest cached query inside this one leaves the fewest candidates
+		auto needle = folded(this->m_query, this->m_mode);
+		const Entry * base = nullptr;
+		std::size_t at = 0;
+		for (const auto & entry : this->m_cache)
+		{
+			if (entry.root != this->m_text.root() || entry.mode != this->m_mode || entry.query.empty() ||
+				(base != nullptr && entry.query.size() <= base->query.size()))
+			{
+				continue;
+			}
+			auto inner = folded(entry.query, entry.mode);
+			if (auto pos = needle.find(inner); pos != std::string::npos && !selfOverlapping(inner))
+			{
+				base = &entry;
+				at = pos;
+			}
+		}
+		// Checking millions of candidates would stall typing, the background search takes over then
+		if (base == nullptr || base->matches.size() > maxNarrowed)
+		{
+			return false;
+		}
+
+		// Every match contains one of the base query's at 'at', the candidates are visited in one walk over the pieces
+		Entry entry{ this->m_text.root(), this->m_query, this->m_mode, {} };
+		std::string window(needle.size(), '\0');
+		std::size_t lastEnd = 0;
+		PieceCursor it{ this->m_text.root(), 0 };
+		for (const auto & match : base->matches)
+		{
+			if (match.offset < at || match.offset - at < lastEnd)
+			{
+				continue;
+			}
+			auto offset = match.offset - at;
+			while (it.valid() && it.offset() + it.piece().length <= offset)
+			{
+				it.next();
+			}
+			std::string_view text;
+			if (it.valid() && offset + needle.size() <= it.offset() + it.piece().length)
+			{
+				text = this->m_text.pieceText(it.piece()).substr(offset - it.offset(), needle.size());
+			}
+			else if (this->m_text.copy(offset, window) == window.size())
+			{
+				text = window;
+			}
+			if (!text.empty() && equals(text, needle, this->m_mode))
+			{
+				entry.matches.push_back({ offset, needle.size() });
+				lastEnd = offset + needle.size();
+			}
+		}
+		this->m_current = &this->remember(std::move(entry));
+		return true;
+	}
+
+	void IncrementalSearch::startSearch()
+	{
+		this->m_found.clear();
+		this->m_worker = std::make_unique<ParallelSearch>(this->m_text, this->m_search, [this](std::span<const SearchMatch> found)
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			this->m_found.insert(this->m_found.end(), found.begin(), found.end());
+			return true;
+		}, this->m_threads);
+		this->m_worker->start();
+	}
+	void IncrementalSearch::stopSearch() noexcept
+	{
+		if (this->m_worker)
+		{
+			this->m_worker->cancel();
+			this->m_worker->wait();
+			this->m_worker.reset();
+		}
+		std::scoped_lock lock{ this->m_mutex };
+		this->m_found.clear();
+	}
+	void IncrementalSearch::update()
+	{
+		this->m_current = this->lookup(this->m_text.root(), this->m_query, this->m_mode);
+		if (this->m_current != nullptr)
+		{
+			return;
+		}
+		if (this->m_query.empty())
+		{
+			this->m_current = &this->remember(Entry{ this->m_text.root(), this->m_query, this->m_mode, {} });
+			return;
+		}
+		if (!this->narrow())
+		{
+			this->startSearch();
+		}
+	}
+
+	COMFYDX_API void IncrementalSearch::setText(TextSnapshot text)
+	{
+		this->stopSearch();
+		this->m_text = std::move(text);
+		this->update();
+	}
+	COMFYDX_API void IncrementalSearch::edit(TextSnapshot text, std::span<const TextEdit> edits)
+	{
+		this->stopSearch();
+		this->m_text = std::move(text);
+		if (this->m_current == nullptr || this->lookup(this->m_text.root(), this->m_query, this->m_mode) != nullptr)
+		{
+			this->update();
+			return;
+		}
+
+		Entry entry{ this->m_text.root(), this->m_query, this->m_mode, {} };
+		if (!this->m_query.empty())
+		{
+			entry.matches = patch(this->m_search, this->m_text, this->m_current->matches, edits);
+		}
+		this->m_current = &this->remember(std::move(entry));
+	}
+	COMFYDX_API bool IncrementalSearch::setQuery(std::string_view query, CaseMode mode)
+	{
+		if (query == this->m_query && mode == this->m_mode && (this->m_current != nullptr || this->m_worker))
+		{
+			return this->m_current != nullptr;
+		}
+		this->stopSearch();
+		this->m_query = query;
+		this->m_mode = mode;
+		this->m_search = LiteralSearch{ query, mode };
+		this->update();
+		return this->m_current != nullptr;
+	}
+
+	COMFYDX_API bool IncrementalSearch::poll()
+	{
+		if (this->m_current != nullptr)
+		{
+			return true;
+		}
+		if (!this->m_worker || !this->m_worker->done())
+		{
+			return false;
+		}
+		this->m_worker->wait();
+		bool ok = this->m_worker->ok();
+		this->m_worker.reset();
+		if (!ok)
+		{
+			return false;
+		}
+
+		Entry entry{ this->m_text.root(), this->m_query, this->m_mode, {} };
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			entry.matches.swap(this->m_found);
+		}
+		this->m_current = &this->remember(std::move(entry));
+		return true;
+	}
+
+	COMFYDX_API std::vector<SearchMatch> IncrementalSearch::matchesIn(std::size_t from, std::size_t to) const
+	{
+		std::vector<SearchMatch> out;
+		if (this->m_current != nullptr)
+		{
+			const auto & matches = this->m_current->matches;
+			auto it = std::partition_point(matches.begin(), matches.end(), [from](const SearchMatch & match)
+			{
+				return match.offset + match.length <= from;
+			});
+			for (; it != matches.end() && it->offset < to; ++it)
+			{
+				out.push_back(*it);
+			}
+			return out;
+		}
+		if (this->m_search.empty())
+		{
+			return out;
+		}
+
+		// Matches overlapping 'from' start up to a match length before it
+		auto start = from - std::min(from, this->m_search.maxLength() - 1);
+		this->m_search.scan(this->m_text, start, to, [&](const SearchMatch & match)
+		{
+			if (match.offset + match.length > from)
+			{
+				out.push_back(match);
+			}
+			return true;
+		});
+		return out;
+	}
+}
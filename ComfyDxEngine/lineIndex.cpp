@@ -0,0 +1,330 @@
+#include "pch.hpp"
+#include "lineIndex.hpp"
+
+#include <bit>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CE_SSE2 1
+#endif
+
+namespace cdx::text
+{
+	namespace
+	{
+		TextCounts operator+(const TextCounts & a, const TextCounts & b) noexcept
+		{
+			return { a.lineFeeds + b.lineFeeds, a.codePoints + b.codePoints, a.words + b.words };
+		}
+		TextCounts operator-(const TextCounts & a, const TextCounts & b) noexcept
+		{
+			return { a.lineFeeds - b.lineFeeds, a.codePoints - b.codePoints, a.words - b.words };
+		}
+		// Whether a word can start right at 'pos'
+		bool afterSpace(std::string_view buffer, std::size_t pos) noexcept
+		{
+			return pos == 0 || !isWordByte(buffer[pos - 1]);
+		}
+	}
+
+	COMFYDX_API std::size_t countLineFeeds(std::string_view text) noexcept
+	{
+		std::size_t count = 0;
+		auto it = text.data(), end = it + text.size();
+#ifdef CE_SSE2
+		const auto lf = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+		while (end - it >= 16)
+		{
+			// Byte lanes hold up to 255 matches before they are summed up
+			auto rounds = std::min<std::ptrdiff_t>((end - it) / 16, 255);
+			auto acc = zero;
+			for (; rounds > 0; --rounds, it += 16)
+			{
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+				acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, lf));
+			}
+			auto sum = _mm_sad_epu8(acc, zero);
+			count += std::size_t(_mm_cvtsi128_si32(sum)) + std::size_t(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+		}
+#endif
+		for (; it != end; ++it)
+		{
+			count += (*it == '\n');
+		}
+		return count;
+	}
+	COMFYDX_API std::size_t findLineFeed(std::string_view text, std::size_t n) noexcept
+	{
+		auto begin = text.data(), it = begin, end = begin + text.size();
+#ifdef CE_SSE2
+		const auto lf = _mm_set1_epi8('\n');
+		for (; end - it >= 16; it += 16)
+		{
+			auto mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(it)), lf)));
+			auto found = std::size_t(std::popcount(mask));
+			if (n < found)
+			{
+				for (; n > 0; --n)
+				{
+					mask &= mask - 1;
+				}
+				return std::size_t(it - begin) + std::size_t(std::countr_zero(mask));
+			}
+			n -= found;
+		}
+#endif
+		for (; it != end; ++it)
+		{
+			if (*it == '\n' && n-- == 0)
+			{
+				return std::size_t(it - begin);
+			}
+		}
+		return std::string_view::npos;
+	}
+	COMFYDX_API TextCounts countText(std::string_view text, bool bAfterSpace) noexcept
+	{
+		TextCounts counts;
+		auto it = text.data(), end = it + text.size();
+		// Whether the previous byte was whitespace
+		bool bSpace = bAfterSpace;
+#ifdef CE_SSE2
+		// Most edits are a few bytes, those skip setting up the vectors
+		if (end - it >= 16)
+		{
+			const auto lf = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+			// Continuation bytes 0x80 - 0xBF are the lowest signed values
+			const auto lastContinuation = _mm_set1_epi8(char(0xBF));
+			const auto blank = _mm_set1_epi8(' '), belowTab = _mm_set1_epi8('\t' - 1), aboveCr = _mm_set1_epi8('\r' + 1);
+			// Whitespace lanes of the previous 16 bytes, only the last one is used
+			auto prevSpace = bSpace ? _mm_set1_epi8(char(0xFF)) : zero;
+			auto sum = [zero](__m128i acc)
+			{
+				auto sad = _mm_sad_epu8(acc, zero);
+				return std::size_t(_mm_cvtsi128_si32(sad)) + std::size_t(_mm_cvtsi128_si32(_mm_srli_si128(sad, 8)));
+			};
+			while (end - it >= 16)
+			{
+				auto rounds = std::min<std::ptrdiff_t>((end - it) / 16, 255);
+				auto lfAcc = zero, cpAcc = zero, wordAcc = zero;
+				for (; rounds > 0; --rounds, it += 16)
+				{
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+					lfAcc = _mm_sub_epi8(lfAcc, _mm_cmpeq_epi8(v, lf));
+					cpAcc = _mm_sub_epi8(cpAcc, _mm_cmpgt_epi8(v, lastContinuation));
+
+					auto space = _mm_or_si128(_mm_cmpeq_epi8(v, blank), _mm_and_si128(_mm_cmpgt_epi8(v, belowTab), _mm_cmplt_epi8(v, aboveCr)));
+					// Word bytes following a whitespace byte
+					auto before = _mm_or_si128(_mm_slli_si128(space, 1), _mm_srli_si128(prevSpace, 15));
+					wordAcc = _mm_sub_epi8(wordAcc, _mm_andnot_si128(space, before));
+					prevSpace = space;
+				}
+				counts.lineFeeds += sum(lfAcc);
+				counts.codePoints += sum(cpAcc);
+				counts.words += sum(wordAcc);
+			}
+			bSpace = (_mm_movemask_epi8(prevSpace) & 0x8000) != 0;
+		}
+#endif
+		for (; it != end; ++it)
+		{
+			auto bWord = isWordByte(*it);
+			counts.lineFeeds += (*it == '\n');
+			counts.codePoints += ((static_cast<unsigned char>(*it) & 0xC0) != 0x80);
+			counts.words += std::size_t(bWord && bSpace);
+			bSpace = !bWord;
+		}
+		return counts;
+	}
+
+	COMFYDX_API void BufferLines::update(std::string_view buffer)
+	{
+		while (this->m_indexed < buffer.size())
+		{
+			auto blockEnd = this->m_prefix.size() * block;
+			auto end = std::min(buffer.size(), blockEnd);
+			auto chunk = buffer.substr(this->m_indexed, end - this->m_indexed);
+			this->m_tail = this->m_tail + countText(chunk, afterSpace(buffer, this->m_indexed));
+			this->m_indexed = end;
+			if (end == blockEnd)
+			{
+				this->m_prefix.push_back(this->m_prefix.back() + this->m_tail);
+				this->m_tail = {};
+			}
+		}
+	}
+
+	COMFYDX_API std::size_t BufferLines::prefix(std::string_view buffer, std::size_t end) const noexcept
+	{
+		end = std::min(end, this->m_indexed);
+		auto b = std::min(end / block, this->m_prefix.size() - 1);
+		auto from = b * block;
+
+		// Scan from whichever block boundary is closer
+		if (b + 1 < this->m_prefix.size() && end - from > block / 2)
+		{
+			auto to = from + block;
+			return this->m_prefix[b + 1].lineFeeds - countLineFeeds(buffer.substr(end, to - end));
+		}
+		return this->m_prefix[b].lineFeeds + countLineFeeds(buffer.substr(from, end - from));
+	}
+	COMFYDX_API TextCounts BufferLines::counts(std::string_view buffer, std::size_t end) const noexcept
+	{
+		end = std::min(end, this->m_indexed);
+		auto b = std::min(end / block, this->m_prefix.size() - 1);
+		auto from = b * block;
+
+		if (b + 1 < this->m_prefix.size() && end - from > block / 2)
+		{
+			auto to = from + block;
+			return this->m_prefix[b + 1] - countText(buffer.substr(end, to - end), afterSpace(buffer, end));
+		}
+		return this->m_prefix[b] + countText(buffer.substr(from, end - from), afterSpace(buffer, from));
+	}
+	COMFYDX_API std::size_t BufferLines::find(std::string_view buffer, std::size_t start, std::size_t n) const noexcept
+	{
+		buffer = buffer.substr(0, this->m_indexed);
+		auto target = this->prefix(buffer, start) + n;
+
+		auto it = std::upper_bound(this->m_prefix.begin(), this->m_prefix.end(), target, [](std::size_t n, const TextCounts & c)
+		{
+			return n < c.lineFeeds;
+		});
+		auto b = std::size_t(it - this->m_prefix.begin()) - 1;
+		auto from = b * block;
+		auto local = target - this->m_prefix[b].lineFeeds;
+		if (from < start)
+		{
+			from = start;
+			local = n;
+		}
+
+		auto pos = findLineFeed(buffer.substr(from), local);
+		return (pos == std::string_view::npos) ? pos : from + pos;
+	}
+
+	COMFYDX_API LineIndexer::LineIndexer(std::string_view buffer, unsigned threads)
+		: m_buffer{ buffer }
+		, m_blocks{ (buffer.size() + BufferLines::block - 1) / BufferLines::block }
+	{
+		this->m_prefix = std::make_unique<TextCounts[]>(this->m_blocks + 1);
+		if (this->m_blocks == 0)
+		{
+			return;
+		}
+
+		auto groups = (this->m_blocks + groupBlocks - 1) / groupBlocks;
+		this->m_local = std::make_unique<TextCounts[]>(this->m_blocks);
+		this->m_groupDone = std::make_unique<std::atomic<bool>[]>(groups);
+		threads = (threads != 0) ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+		auto workers = std::min<std::size_t>(threads, groups);
+		this->m_workers.reserve(workers);
+		for (std::size_t i = 0; i < workers; ++i)
+		{
+			this->m_workers.emplace_back([this](std::stop_token stop)
+			{
+				this->run(stop);
+			});
+		}
+	}
+
+	void LineIndexer::run(std::stop_token stop) noexcept
+	{
+		auto groups = (this->m_blocks + groupBlocks - 1) / groupBlocks;
+		while (!stop.stop_requested())
+		{
+			// Groups are handed out in order, so the prefixes grow from the start
+			auto g = this->m_nextGroup.fetch_add(1, std::memory_order_relaxed);
+			if (g >= groups)
+			{
+				break;
+			}
+			auto last = std::min((g + 1) * groupBlocks, this->m_blocks);
+			for (auto b = g * groupBlocks; b < last; ++b)
+			{
+				auto from = b * BufferLines::block;
+				this->m_local[b] = countText(this->m_buffer.substr(from, BufferLines::block), afterSpace(this->m_buffer, from));
+			}
+			this->m_groupDone[g].store(true, std::memory_order_release);
+			this->sumUp();
+		}
+	}
+	void LineIndexer::sumUp() noexcept
+	{
+		std::lock_guard lock{ this->m_sumMutex };
+		auto groups = (this->m_blocks + groupBlocks - 1) / groupBlocks;
+		auto b = this->m_blocksDone.load(std::memory_order_relaxed);
+		// Whoever finishes the group everyone waits for sums up the ones done after it too
+		while (this->m_groupsSummed < groups && this->m_groupDone[this->m_groupsSummed].load(std::memory_order_acquire))
+		{
+			auto last = std::min((this->m_groupsSummed + 1) * groupBlocks, this->m_blocks);
+			for (; b < last; ++b)
+			{
+				this->m_prefix[b + 1] = this->m_prefix[b] + this->m_local[b];
+			}
+			++this->m_groupsSummed;
+			// Publishes the prefixes up to m_prefix[b] to the readers
+			this->m_blocksDone.store(b, std::memory_order_release);
+		}
+	}
+
+	COMFYDX_API std::size_t LineIndexer::indexed() const noexcept
+	{
+		return std::min(this->m_blocksDone.load(std::memory_order_acquire) * BufferLines::block, this->m_buffer.size());
+	}
+	COMFYDX_API std::size_t LineIndexer::knownLineFeeds() const noexcept
+	{
+		return this->m_prefix[this->m_blocksDone.load(std::memory_order_acquire)].lineFeeds;
+	}
+	COMFYDX_API TextCounts LineIndexer::knownCounts() const noexcept
+	{
+		return this->m_prefix[this->m_blocksDone.load(std::memory_order_acquire)];
+	}
+
+	COMFYDX_API std::size_t LineIndexer::prefix(std::size_t end) const noexcept
+	{
+		end = std::min(end, this->m_buffer.size());
+		auto b = std::min(end / BufferLines::block, this->m_blocksDone.load(std::memory_order_acquire));
+		auto from = b * BufferLines::block;
+		return this->m_prefix[b].lineFeeds + countLineFeeds(this->m_buffer.substr(from, end - from));
+	}
+	COMFYDX_API TextCounts LineIndexer::counts(std::size_t end) const noexcept
+	{
+		end = std::min(end, this->m_buffer.size());
+		auto b = std::min(end / BufferLines::block, this->m_blocksDone.load(std::memory_order_acquire));
+		auto from = b * BufferLines::block;
+		return this->m_prefix[b] + countText(this->m_buffer.substr(from, end - from), afterSpace(this->m_buffer, from));
+	}
+	COMFYDX_API std::size_t LineIndexer::find(std::size_t n) const noexcept
+	{
+		auto done = this->m_blocksDone.load(std::memory_order_acquire);
+		auto first = this->m_prefix.get(), last = first + done + 1;
+		auto b = std::size_t(std::upper_bound(first, last, n, [](std::size_t count, const TextCounts & c)
+		{
+			return count < c.lineFeeds;
+		}) - first) - 1;
+		auto from = b * BufferLines::block;
+
+		auto pos = findLineFeed(this->m_buffer.substr(from), n - this->m_prefix[b].lineFeeds);
+		return (pos == std::string_view::npos) ? pos : from + pos;
+	}
+
+	COMFYDX_API BufferLines LineIndexer::finish()
+	{
+		for (auto & worker : this->m_workers)
+		{
+			if (worker.joinable())
+			{
+				worker.join();
+			}
+		}
+
+		BufferLines lines;
+		auto full = this->m_buffer.size() / BufferLines::block;
+		lines.m_prefix.assign(this->m_prefix.get(), this->m_prefix.get() + full + 1);
+		lines.m_indexed = this->m_buffer.size();
+		lines.m_tail = this->m_prefix[this->m_blocks] - this->m_prefix[full];
+		return lines;
+	}
+}
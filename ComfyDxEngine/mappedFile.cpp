@@ -0,0 +1,200 @@
+#include "pch.hpp"
+#include "mappedFile.hpp"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace cdx::io
+{
+	COMFYDX_API MappedFile::~MappedFile() noexcept
+	{
+		this->close();
+	}
+
+#ifdef _WIN32
+
+	COMFYDX_API bool MappedFile::open(const std::filesystem::path & path, bool allowMapping) noexcept
+	{
+		this->close();
+
+		HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		this->m_file = file;
+
+		LARGE_INTEGER size;
+		if (!::GetFileSizeEx(file, &size) || std::uint64_t(size.QuadPart) > SIZE_MAX)
+		{
+			this->close();
+			return false;
+		}
+		this->m_size = std::size_t(size.QuadPart);
+		if (this->m_size == 0)
+		{
+			// Empty files can't be mapped, but there's nothing to read either
+			this->m_bOpen = true;
+			return true;
+		}
+
+		if (allowMapping)
+		{
+			this->m_mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (this->m_mapping != nullptr)
+			{
+				this->m_data = static_cast<const char *>(::MapViewOfFile(this->m_mapping, FILE_MAP_READ, 0, 0, 0));
+				if (this->m_data != nullptr)
+				{
+					this->m_bMapped = true;
+					this->m_bOpen = true;
+					return true;
+				}
+				::CloseHandle(this->m_mapping);
+				this->m_mapping = nullptr;
+			}
+		}
+
+		this->m_bOpen = this->readAll(this->m_size);
+		if (!this->m_bOpen)
+		{
+			this->close();
+		}
+		return this->m_bOpen;
+	}
+	bool MappedFile::readAll(std::uint64_t size) noexcept
+	{
+		this->m_fallback.reset(new (std::nothrow) char[std::size_t(size)]);
+		if (!this->m_fallback)
+		{
+			return false;
+		}
+
+		std::uint64_t done = 0;
+		while (done < size)
+		{
+			DWORD want = DWORD(std::min<std::uint64_t>(size - done, readChunk)), got = 0;
+			if (!::ReadFile(static_cast<HANDLE>(this->m_file), this->m_fallback.get() + done, want, &got, nullptr) || got == 0)
+			{
+				return false;
+			}
+			done += got;
+		}
+		this->m_data = this->m_fallback.get();
+		return true;
+	}
+	COMFYDX_API void MappedFile::close() noexcept
+	{
+		if (this->m_bMapped)
+		{
+			::UnmapViewOfFile(this->m_data);
+		}
+		if (this->m_mapping != nullptr)
+		{
+			::CloseHandle(this->m_mapping);
+			this->m_mapping = nullptr;
+		}
+		if (this->m_file != nullptr)
+		{
+			::CloseHandle(this->m_file);
+			this->m_file = nullptr;
+		}
+		this->m_fallback.reset();
+		this->m_data = nullptr;
+		this->m_size = 0;
+		this->m_bMapped = false;
+		this->m_bOpen = false;
+	}
+
+#else
+
+	COMFYDX_API bool MappedFile::open(const std::filesystem::path & path, bool allowMapping) noexcept
+	{
+		this->close();
+
+		this->m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (this->m_fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+		if (::fstat(this->m_fd, &st) != 0)
+		{
+			this->close();
+			return false;
+		}
+		this->m_size = std::size_t(st.st_size);
+		if (this->m_size == 0)
+		{
+			this->m_bOpen = true;
+			return true;
+		}
+
+		if (allowMapping && S_ISREG(st.st_mode))
+		{
+			void * data = ::mmap(nullptr, this->m_size, PROT_READ, MAP_SHARED, this->m_fd, 0);
+			if (data != MAP_FAILED)
+			{
+				::madvise(data, this->m_size, MADV_SEQUENTIAL);
+				this->m_data = static_cast<const char *>(data);
+				this->m_bMapped = true;
+				this->m_bOpen = true;
+				return true;
+			}
+		}
+
+		this->m_bOpen = this->readAll(this->m_size);
+		if (!this->m_bOpen)
+		{
+			this->close();
+		}
+		return this->m_bOpen;
+	}
+	bool MappedFile::readAll(std::uint64_t size) noexcept
+	{
+		this->m_fallback.reset(new (std::nothrow) char[std::size_t(size)]);
+		if (!this->m_fallback)
+		{
+			return false;
+		}
+
+		std::uint64_t done = 0;
+		while (done < size)
+		{
+			auto got = ::read(this->m_fd, this->m_fallback.get() + done, std::size_t(std::min<std::uint64_t>(size - done, readChunk)));
+			if (got <= 0)
+			{
+				return false;
+			}
+			done += std::uint64_t(got);
+		}
+		this->m_data = this->m_fallback.get();
+		return true;
+	}
+	COMFYDX_API void MappedFile::close() noexcept
+	{
+		if (this->m_bMapped)
+		{
+			::munmap(const_cast<char *>(this->m_data), this->m_size);
+		}
+		if (this->m_fd >= 0)
+		{
+			::close(this->m_fd);
+			this->m_fd = -1;
+		}
+		this->m_fallback.reset();
+		this->m_data = nullptr;
+		this->m_size = 0;
+		this->m_bMapped = false;
+		this->m_bOpen = false;
+	}
+
+#endif
+}
@@ -0,0 +1,223 @@
+#include "pch.hpp"
+#include "parallelSearch.hpp"
+
+#include <algorithm>
+
+namespace cdx::text
+{
+	COMFYDX_API ParallelSearch::ParallelSearch(TextSnapshot text, LiteralSearch search, Sink sink, unsigned threads, std::size_t chunkSize)
+		: m_text{ std::move(text) }, m_search{ std::move(search) }, m_sink{ std::move(sink) },
+		m_chunkSize{ std::max<std::size_t>(chunkSize, 4096) },
+		m_threads{ threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u) }
+	{
+	}
+	COMFYDX_API ParallelSearch::~ParallelSearch() noexcept
+	{
+		this->cancel();
+		this->wait();
+	}
+
+	COMFYDX_API bool ParallelSearch::start()
+	{
+		if (this->m_merger.joinable())
+		{
+			return false;
+		}
+		this->m_bDone.store(false, std::memory_order_relaxed);
+		this->m_bOk.store(false, std::memory_order_relaxed);
+		this->m_bytesSearched.store(0, std::memory_order_relaxed);
+		this->m_matchCount.store(0, std::memory_order_relaxed);
+		this->m_nextChunk.store(0, std::memory_order_relaxed);
+		this->m_stop = {};
+
+		auto chunks = (this->m_text.size() + this->m_chunkSize - 1) / this->m_chunkSize;
+		this->m_chunks.clear();
+		this->m_chunks.resize(chunks);
+		if (this->m_search.empty())
+		{
+			this->m_chunks.clear();
+		}
+
+		// Don't spawn more workers than there are chunks to search
+		auto workers = std::min<std::size_t>(this->m_threads, this->m_chunks.size());
+		this->m_workers.clear();
+		this->m_workers.reserve(workers);
+		for (std::size_t i = 0; i < workers; ++i)
+		{
+			this->m_workers.emplace_back([this, stop = this->m_stop.get_token()]
+			{
+				this->work(stop);
+			});
+		}
+		this->m_merger = std::jthread([this, stop = this->m_stop.get_token()]
+		{
+			this->merge(stop);
+		});
+		return true;
+	}
+	COMFYDX_API void ParallelSearch::cancel() noexcept
+	{
+		this->m_stop.request_stop();
+	}
+	COMFYDX_API void ParallelSearch::wait() noexcept
+	{
+		if (this->m_merger.joinable())
+		{
+			this->m_merger.join();
+		}
+		for (auto & worker : this->m_workers)
+		{
+			if (worker.joinable())
+			{
+				worker.join();
+			}
+		}
+		this->m_workers.clear();
+	}
+
+	void ParallelSearch::work(std::stop_token stop) noexcept
+	{
+		try
+		{
+			std::vector<SearchMatch> matches;
+			while (!stop.stop_requested())
+			{
+				auto index = this->m_nextChunk.fetch_add(1, std::memory_order_relaxed);
+				if (index >= this->m_chunks.size())
+				{
+					break;
+				}
+				auto from = index * this->m_chunkSize;
+				auto to = std::min(from + this->m_chunkSize, this->m_text.size());
+
+				// Matches starting in the chunk may run into the next one, scan() reads on as needed
+				matches.clear();
+				if (!this->m_search.scan(this->m_text, from, to, [&](const SearchMatch & match)
+				{
+					matches.push_back(match);
+					return !stop.stop_requested();
+				}))
+				{
+					break;
+				}
+				this->m_bytesSearched.fetch_add(to - from, std::memory_order_relaxed);
+
+				{
+					std::scoped_lock lock{ this->m_mutex };
+					auto & chunk = this->m_chunks[index];
+					chunk.matches.swap(matches);
+					chunk.bDone = true;
+				}
+				this->m_chunkDone.notify_all();
+			}
+		}
+		catch (...)
+		{
+			// The merger would wait for this chunk forever
+			this->m_stop.request_stop();
+		}
+	}
+	void ParallelSearch::merge(std::stop_token stop) noexcept
+	{
+		bool ok = false;
+		try
+		{
+			// End of the last match handed to the sink
+			std::size_t lastEnd = 0;
+			std::vector<SearchMatch> matches;
+			std::size_t index = 0;
+			for (; index < this->m_chunks.size(); ++index)
+			{
+				{
+					std::unique_lock lock{ this->m_mutex };
+					auto & chunk = this->m_chunks[index];
+					if (!this->m_chunkDone.wait(lock, stop, [&chunk] { return chunk.bDone; }))
+					{
+						break;
+					}
+					matches.swap(chunk.matches);
+					std::vector<SearchMatch>{}.swap(chunk.matches);
+				}
+
+				/*
+				 * A match of the previous chunk that runs into this one hides the
+				 * matches it overlaps, and the ones after them may then start at other
+				 * positions. This is only the case for self-overlapping needles, e.g.
+				 * "aa" in "aaa", the chunk is searched again from the end of that match.
+				 */
+				if (!matches.empty() && matches.front().offset < lastEnd)
+				{
+					auto from = lastEnd;
+					auto to = std::min((index + 1) * this->m_chunkSize, this->m_text.size());
+					matches.clear();
+					if (from < to)
+					{
+						this->m_search.scan(this->m_text, from, to, [&matches](const SearchMatch & match)
+						{
+							matches.push_back(match);
+							return true;
+						});
+					}
+				}
+				if (matches.empty())
+				{
+					continue;
+				}
+
+				lastEnd = matches.back().offset + matches.back().length;
+				this->m_matchCount.fetch_add(matches.size(), std::memory_order_relaxed);
+				if (!this->m_sink(matches))
+				{
+					break;
+				}
+			}
+			ok = (index == this->m_chunks.size());
+		}
+		catch (...)
+		{
+			ok = false;
+		}
+
+		// Stops the workers if the search ended early
+		this->m_stop.request_stop();
+		this->m_bOk.store(ok, std::memory_order_release);
+		this->m_bDone.store(true, std::memory_order_release);
+	}
+
+	COMFYDX_API std::vector<SearchMatch> findAll(const TextSnapshot & text, const LiteralSearch & search, unsigned threads)
+	{
+		std::vector<SearchMatch> matches;
+		ParallelSearch parallel{ text, search, [&matches](std::span<const SearchMatch> found)
+		{
+			matches.insert(matches.end(), found.begin(), found.end());
+			return true;
+		}, threads };
+		parallel.start();
+		parallel.wait();
+		return matches;
+	}
+	COMFYDX_API std::size_t replaceAll(PieceTable & table, UndoHistory * history, const LiteralSearch & search, std::string_view replacement, unsigned threads)
+	{
+		auto matches = findAll(table.snapshot(), search, threads);
+		if (matches.empty())
+		{
+			return 0;
+		}
+
+		std::vector<TextEdit> edits;
+		edits.reserve(matches.size());
+		for (const auto & match : matches)
+		{
+			edits.push_back({ match.offset, match.length, replacement });
+		}
+		if (history != nullptr)
+		{
+			history->apply(table, edits);
+		}
+		else
+		{
+			table.apply(edits);
+		}
+		return matches.size();
+	}
+}
@@ -6,7 +6,11 @@
 
 #pragma once
 // add headers that you want to pre-compile here
+#ifdef _WIN32
 #include <win32.hpp>
+#else
+#include <api.hpp>
+#endif
 
 #include <string>
 #include <string_view>
@@ -0,0 +1,616 @@
+#include "pch.hpp"
+#include "pieceTable.hpp"
+
+#include <algorithm>
+
+namespace cdx::text
+{
+	namespace
+	{
+		Piece textPiece(Source source, std::size_t start, std::string_view text) noexcept
+		{
+			auto counts = countText(text);
+			Piece piece{ source, start, text.size(), counts.lineFeeds, counts.codePoints, counts.words };
+			piece.bWordFirst = !text.empty() && isWordByte(text.front());
+			piece.bWordLast = !text.empty() && isWordByte(text.back());
+			return piece;
+		}
+	}
+
+	COMFYDX_API PieceTable::PieceTable(std::string original)
+	{
+		auto owner = std::make_shared<const std::string>(std::move(original));
+		std::string_view view{ *owner };
+		this->setOriginal(std::move(owner), view, false);
+	}
+	COMFYDX_API PieceTable::PieceTable(std::shared_ptr<const io::MappedFile> file, bool backgroundIndexing)
+	{
+		auto view = file->view();
+		this->setOriginal(std::move(file), view, backgroundIndexing);
+	}
+
+	void PieceTable::setOriginal(std::shared_ptr<const void> owner, std::string_view original, bool background)
+	{
+		this->m_originalOwner = std::move(owner);
+		this->m_original = original;
+		if (this->m_original.empty())
+		{
+			return;
+		}
+
+		if (background && this->m_original.size() > BufferLines::block)
+		{
+			// The counts are filled in once the indexer is done
+			this->m_indexer = std::make_shared<LineIndexer>(this->m_original);
+			this->m_root = tree::make(nullptr, Piece{ Source::original, 0, this->m_original.size() }, nullptr);
+			return;
+		}
+		auto lines = std::make_shared<BufferLines>();
+		lines->update(this->m_original);
+		this->m_originalLines = std::move(lines);
+		Piece piece{ Source::original, 0, this->m_original.size() };
+		this->countPiece(piece);
+		this->m_root = tree::make(nullptr, piece, nullptr);
+	}
+	char * PieceTable::reserveAdd(std::size_t count)
+	{
+		auto size = this->m_add.size();
+		if (count > this->m_addCapacity - size)
+		{
+			// Never written in place past the old size, so snapshots can keep reading the old block
+			auto capacity = std::max({ size + count, this->m_addCapacity * 2, minAddCapacity });
+			std::shared_ptr<char[]> block{ new char[capacity] };
+			std::copy_n(this->m_add.data(), size, block.get());
+			this->m_addBlock = std::move(block);
+			this->m_addOwner = this->m_addBlock;
+			this->m_addCapacity = capacity;
+		}
+		return this->m_addBlock.get() + size;
+	}
+	void PieceTable::commitAdd(std::size_t count)
+	{
+		this->m_add = { this->m_addBlock.get(), this->m_add.size() + count };
+
+		// Copy-on-write, the line index may be shared with snapshots
+		if (!this->m_addLines || this->m_addLines.use_count() != 1)
+		{
+			this->m_addLines = this->m_addLines ? std::make_shared<BufferLines>(*this->m_addLines) : std::make_shared<BufferLines>();
+		}
+		std::const_pointer_cast<BufferLines>(this->m_addLines)->update(this->m_add);
+	}
+	void PieceTable::appendAdd(std::string_view text)
+	{
+		std::copy(text.begin(), text.end(), this->reserveAdd(text.size()));
+		this->commitAdd(text.size());
+	}
+
+	COMFYDX_API bool PieceTable::pollIndexing()
+	{
+		if (this->m_indexer && this->m_indexer->done())
+		{
+			this->finishIndexing();
+		}
+		return this->m_indexer == nullptr;
+	}
+	COMFYDX_API void PieceTable::finishIndexing()
+	{
+		if (!this->m_indexer)
+		{
+			return;
+		}
+		this->m_originalLines = std::make_shared<const BufferLines>(this->m_indexer->finish());
+		this->m_indexer.reset();
+
+		// Nothing can be edited while indexing, the tree is still the single original piece
+		Piece piece{ Source::original, 0, this->m_original.size() };
+		this->countPiece(piece);
+		this->m_root = tree::make(nullptr, piece, nullptr);
+	}
+
+	void TextSnapshot::countPiece(Piece & piece) const noexcept
+	{
+		auto text = this->buffer(piece.source);
+		auto start = piece.start, end = piece.start + piece.length;
+		TextCounts before, after;
+		if (piece.source == Source::original && this->m_indexer)
+		{
+			before = this->m_indexer->counts(start);
+			after = this->m_indexer->counts(end);
+		}
+		else
+		{
+			const auto & lines = this->bufferLines(piece.source);
+			before = lines.counts(text, start);
+			after = lines.counts(text, end);
+		}
+		piece.lineFeeds = after.lineFeeds - before.lineFeeds;
+		piece.codePoints = after.codePoints - before.codePoints;
+		piece.words = after.words - before.words;
+		piece.bWordFirst = piece.bWordLast = false;
+		if (piece.length != 0)
+		{
+			piece.bWordFirst = isWordByte(text[start]);
+			piece.bWordLast = isWordByte(text[end - 1]);
+			// The buffer counted a word running in from before the piece where it started
+			piece.words += std::size_t(piece.bWordFirst && start != 0 && isWordByte(text[start - 1]));
+		}
+	}
+	std::pair<NodePtr, NodePtr> TextSnapshot::split(const NodePtr & node, std::size_t offset) const
+	{
+		return tree::split(node, offset, [this](Piece & piece)
+		{
+			this->countPiece(piece);
+		});
+	}
+
+	COMFYDX_API void PieceTable::insert(std::size_t offset, std::string_view text)
+	{
+		if (text.empty())
+		{
+			return;
+		}
+		this->finishIndexing();
+		offset = std::min(offset, this->size());
+
+		auto [left, right] = this->split(this->m_root, offset);
+		auto piece = textPiece(Source::add, this->m_add.size(), text);
+		this->appendAdd(text);
+
+		if (left)
+		{
+			// Typing appends to the add buffer, so the previous piece can usually just grow
+			auto [rest, last] = tree::splitLast(left);
+			if (last.source == Source::add && last.start + last.length == piece.start)
+			{
+				tree::extend(last, piece);
+				this->m_root = tree::join(std::move(rest), last, std::move(right));
+				return;
+			}
+		}
+		this->m_root = tree::join(std::move(left), piece, std::move(right));
+	}
+	COMFYDX_API void PieceTable::erase(std::size_t offset, std::size_t count)
+	{
+		offset = std::min(offset, this->size());
+		count = std::min(count, this->size() - offset);
+		if (count == 0)
+		{
+			return;
+		}
+		this->finishIndexing();
+
+		auto [left, rest] = this->split(this->m_root, offset);
+		auto [removed, right] = this->split(rest, count);
+		this->m_root = tree::concat(std::move(left), std::move(right));
+	}
+	COMFYDX_API void PieceTable::replace(std::size_t offset, std::size_t count, std::string_view text)
+	{
+		this->erase(offset, count);
+		this->insert(offset, text);
+	}
+
+	COMFYDX_API void PieceTable::insertPieces(std::size_t offset, std::span<const Piece> pieces)
+	{
+		if (pieces.empty())
+		{
+			return;
+		}
+		this->finishIndexing();
+		offset = std::min(offset, this->size());
+
+		auto [left, right] = this->split(this->m_root, offset);
+		auto middle = tree::fromPieces(pieces.data(), pieces.data() + pieces.size());
+		this->m_root = tree::concat(tree::concat(std::move(left), std::move(middle)), std::move(right));
+	}
+
+	COMFYDX_API void PieceTable::normalize(std::span<TextEdit> edits) const noexcept
+	{
+		std::size_t end = 0, size = this->size();
+		for (auto & e : edits)
+		{
+			e.offset = std::clamp(e.offset, end, size);
+			e.count = std::min(e.count, size - e.offset);
+			end = e.offset + e.count;
+		}
+	}
+	COMFYDX_API std::vector<Piece> PieceTable::apply(std::span<TextEdit> edits, std::vector<Piece> * merged)
+	{
+		this->finishIndexing();
+		this->normalize(edits);
+
+		/*
+		 * The texts of one batch are interleaved in the add buffer, so a cursor's
+		 * next keystroke can't just grow the piece it typed into like insert()
+		 * does. Instead a short add piece ending right at an edit is copied along
+		 * with the new text and replaced by the copy, which keeps typing with
+		 * many cursors at about one piece per cursor and run.
+		 */
+		std::vector<Piece> runs(edits.size());
+		std::size_t total = 0, end = 0, addEnd = this->m_add.size();
+		for (std::size_t i = 0; i < edits.size(); ++i)
+		{
+			const auto & e = edits[i];
+			if (!e.text.empty() && e.offset > end)
+			{
+				auto at = tree::locate(this->m_root, e.offset - 1);
+				const auto & p = at.node->piece;
+				if (p.source == Source::add && at.inPiece + 1 == p.length && e.offset - p.length >= end)
+				{
+					if (p.start + p.length == addEnd)
+					{
+						// Written right behind it, so it simply grows
+						runs[i] = p;
+					}
+					else if (p.length <= maxCopiedRun)
+					{
+						runs[i] = p;
+						total += p.length;
+						addEnd += p.length;
+					}
+				}
+			}
+			total += e.text.size();
+			addEnd += e.text.size();
+			end = e.offset + e.count;
+		}
+
+		// Referenced by the batch, so it must not reallocate
+		std::vector<Piece> inserted;
+		inserted.reserve(edits.size());
+		std::vector<BatchEdit> batch;
+		batch.reserve(edits.size());
+		auto out = this->reserveAdd(total);
+		// Old bytes are read from the new block, the add buffer may have been reallocated
+		const auto * add = out - this->m_add.size();
+		auto start = this->m_add.size();
+		for (std::size_t i = 0; i < edits.size(); ++i)
+		{
+			const auto & e = edits[i];
+			auto piece = runs[i];
+			if (piece.length != 0 && piece.start + piece.length != start)
+			{
+				out = std::copy_n(add + piece.start, piece.length, out);
+				piece.start = start;
+				start += piece.length;
+			}
+			tree::extend(piece, textPiece(Source::add, start, e.text));
+			out = std::copy(e.text.begin(), e.text.end(), out);
+			start += e.text.size();
+
+			inserted.push_back(piece);
+			std::span<const Piece> pieces;
+			if (piece.length != 0)
+			{
+				pieces = { &inserted.back(), 1 };
+			}
+			if (e.count != 0 || piece.length != 0)
+			{
+				batch.push_back(BatchEdit{ e.offset - runs[i].length, e.count + runs[i].length, pieces });
+			}
+		}
+		this->commitAdd(total);
+
+		this->m_root = this->applyBatch(this->m_root, 0, batch, true);
+		if (merged != nullptr)
+		{
+			*merged = std::move(runs);
+		}
+		return inserted;
+	}
+	COMFYDX_API void PieceTable::applyPieces(std::span<const BatchEdit> edits)
+	{
+		this->finishIndexing();
+
+		// Clamped like normalize() does
+		std::vector<BatchEdit> batch;
+		batch.reserve(edits.size());
+		std::size_t end = 0, size = this->size();
+		for (const auto & e : edits)
+		{
+			auto offset = std::clamp(e.offset, end, size);
+			auto count = std::min(e.count, size - offset);
+			if (count != 0 || !e.inserted.empty())
+			{
+				batch.push_back(BatchEdit{ offset, count, e.inserted });
+			}
+			end = offset + count;
+		}
+		this->m_root = this->applyBatch(this->m_root, 0, batch, true);
+	}
+
+	namespace
+	{
+		// Whether an edit removes from or inserts into [start, end)
+		bool touches(const PieceTable::BatchEdit & e, std::size_t start, std::size_t end, bool bAcceptEnd) noexcept
+		{
+			if (start < end && e.offset < end && e.offset + e.count > start)
+			{
+				return true;
+			}
+			return !e.inserted.empty() && e.offset >= start && (e.offset < end || (bAcceptEnd && e.offset == end));
+		}
+		// Edits touching a range, they are contiguous since the batch is sorted and without overlaps
+		std::span<const PieceTable::BatchEdit> touching(std::span<const PieceTable::BatchEdit> edits, std::size_t start, std::size_t end, bool bAcceptEnd) noexcept
+		{
+			// Skip the edits ending before the range, the rest is scanned
+			auto first = std::size_t(std::partition_point(edits.begin(), edits.end(), [start](const PieceTable::BatchEdit & e)
+			{
+				return e.offset < start && e.offset + e.count <= start;
+			}) - edits.begin());
+			while (first < edits.size() && !touches(edits[first], start, end, bAcceptEnd))
+			{
+				++first;
+			}
+			auto last = first;
+			while (last < edits.size() && touches(edits[last], start, end, bAcceptEnd))
+			{
+				++last;
+			}
+			return edits.subspan(first, last - first);
+		}
+	}
+
+	NodePtr PieceTable::applyBatch(const NodePtr & node, std::size_t base, std::span<const BatchEdit> edits, bool bLast) const
+	{
+		if (edits.empty())
+		{
+			// Untouched subtrees are shared with the old version
+			return node;
+		}
+		else if (!node)
+		{
+			std::vector<Piece> pieces;
+			for (const auto & e : edits)
+			{
+				pieces.insert(pieces.end(), e.inserted.begin(), e.inserted.end());
+			}
+			return tree::fromPieces(pieces.data(), pieces.data() + pieces.size());
+		}
+
+		const auto & p = node->piece;
+		auto pieceStart = base + tree::length(node->left), pieceEnd = pieceStart + p.length;
+		auto end = pieceEnd + tree::length(node->right);
+
+		auto left = this->applyBatch(node->left, base, touching(edits, base, pieceStart, false), false);
+		// Insertions at the very end go to the last piece
+		auto right = this->applyBatch(node->right, pieceEnd, touching(edits, pieceEnd, end, bLast && node->right), bLast);
+
+		auto inPiece = touching(edits, pieceStart, pieceEnd, bLast && !node->right);
+		if (inPiece.empty())
+		{
+			if (left == node->left && right == node->right)
+			{
+				return node;
+			}
+			return tree::join(std::move(left), p, std::move(right));
+		}
+
+		// Cut the piece around the edits falling into it
+		std::vector<Piece> middle;
+		auto pos = pieceStart;
+		auto keep = [this, &middle, &p, pieceStart](std::size_t from, std::size_t to)
+		{
+			if (from < to)
+			{
+				auto part = p;
+				if (to - from != p.length)
+				{
+					part = Piece{ p.source, p.start + (from - pieceStart), to - from };
+					this->countPiece(part);
+				}
+				middle.push_back(part);
+			}
+		};
+		for (const auto & e : inPiece)
+		{
+			auto from = std::max(e.offset, pieceStart);
+			keep(pos, from);
+			if (e.offset >= pieceStart)
+			{
+				middle.insert(middle.end(), e.inserted.begin(), e.inserted.end());
+			}
+			pos = std::max(pos, std::min(e.offset + e.count, pieceEnd));
+		}
+		keep(pos, pieceEnd);
+
+		if (middle.empty())
+		{
+			return tree::concat(std::move(left), std::move(right));
+		}
+		auto rest = tree::concat(tree::fromPieces(middle.data() + 1, middle.data() + middle.size()), std::move(right));
+		return tree::join(std::move(left), middle.front(), std::move(rest));
+	}
+
+	COMFYDX_API std::vector<Piece> TextSnapshot::pieces(std::size_t offset, std::size_t count) const
+	{
+		offset = std::min(offset, this->size());
+		count = std::min(count, this->size() - offset);
+
+		std::vector<Piece> out;
+		for (PieceCursor it{ this->m_root, offset }; it.valid() && count != 0; it.next())
+		{
+			auto piece = it.piece();
+			auto skip = offset - it.offset(), len = std::min(piece.length - skip, count);
+			if (skip != 0 || len != piece.length)
+			{
+				piece.start += skip;
+				piece.length = len;
+				this->countPiece(piece);
+			}
+			out.push_back(piece);
+			offset += len;
+			count -= len;
+		}
+		return out;
+	}
+
+	COMFYDX_API std::size_t TextSnapshot::lineStart(std::size_t line) const noexcept
+	{
+		if (this->m_indexer)
+		{
+			if (line == 0)
+			{
+				return 0;
+			}
+			auto pos = this->m_indexer->find(line - 1);
+			if (pos == std::string_view::npos)
+			{
+				// Past the end, which is only known after scanning the rest of the file
+				auto lineFeeds = this->m_indexer->prefix(this->m_original.size());
+				return (lineFeeds == 0) ? 0 : this->m_indexer->find(lineFeeds - 1) + 1;
+			}
+			return pos + 1;
+		}
+
+		line = std::min(line, this->lineCount() - 1);
+		if (line == 0)
+		{
+			return 0;
+		}
+
+		// Line 'line' starts right after the line feed with index line - 1
+		auto loc = tree::locateLineFeed(this->m_root, line - 1);
+		const auto & p = loc.node->piece;
+		auto pos = this->bufferLines(p.source).find(this->buffer(p.source), p.start, loc.inPiece);
+		return loc.pieceOffset + (pos - p.start) + 1;
+	}
+	COMFYDX_API std::size_t TextSnapshot::lineEnd(std::size_t line) const noexcept
+	{
+		if (this->m_indexer)
+		{
+			auto pos = this->m_indexer->find(line);
+			return (pos == std::string_view::npos) ? this->size() : pos;
+		}
+		if (line + 1 >= this->lineCount())
+		{
+			return this->size();
+		}
+		return this->lineStart(line + 1) - 1;
+	}
+	COMFYDX_API std::size_t TextSnapshot::lineOf(std::size_t offset) const noexcept
+	{
+		if (!this->m_root)
+		{
+			return 0;
+		}
+		if (this->m_indexer)
+		{
+			return this->m_indexer->prefix(offset);
+		}
+		auto loc = tree::locateOffset(this->m_root, std::min(offset, this->size()));
+		const auto & p = loc.node->piece;
+		return loc.linesBefore + this->bufferLines(p.source).count(this->buffer(p.source), p.start, p.start + loc.inPiece);
+	}
+
+	COMFYDX_API std::vector<LineEdit> TextSnapshot::lineEdits(std::span<const TextEdit> edits) const
+	{
+		std::vector<LineEdit> out;
+		out.reserve(edits.size());
+		for (const auto & e : edits)
+		{
+			auto first = this->lineOf(e.offset);
+			out.push_back({ first, this->lineOf(e.offset + e.count) - first, cdx::text::countLineFeeds(e.text) });
+		}
+		return out;
+	}
+
+	Summary TextSnapshot::summaryBefore(std::size_t offset) const noexcept
+	{
+		Summary sum;
+		if (offset == 0)
+		{
+			return sum;
+		}
+		else if (this->m_indexer)
+		{
+			// Still the single original piece, which has no counts yet
+			Piece piece{ Source::original, 0, offset };
+			this->countPiece(piece);
+			return tree::summary(piece);
+		}
+
+		const PieceNode * node = this->m_root.get();
+		while (node != nullptr)
+		{
+			auto ls = tree::length(node->left);
+			if (offset < ls)
+			{
+				node = node->left.get();
+				continue;
+			}
+			sum = tree::combine(sum, tree::summary(node->left));
+			offset -= ls;
+			if (offset < node->piece.length)
+			{
+				if (offset != 0)
+				{
+					Piece part{ node->piece.source, node->piece.start, offset };
+					this->countPiece(part);
+					sum = tree::combine(sum, tree::summary(part));
+				}
+				break;
+			}
+			sum = tree::combine(sum, tree::summary(node->piece));
+			offset -= node->piece.length;
+			node = node->right.get();
+		}
+		return sum;
+	}
+
+	COMFYDX_API TextStats TextSnapshot::stats() const noexcept
+	{
+		if (this->m_indexer)
+		{
+			auto counts = this->m_indexer->knownCounts();
+			return { this->m_indexer->indexed(), counts.codePoints, counts.words, counts.lineFeeds + 1 };
+		}
+		auto sum = tree::summary(this->m_root);
+		return { sum.length, sum.codePoints, sum.words, sum.lineFeeds + 1 };
+	}
+	COMFYDX_API TextStats TextSnapshot::stats(std::size_t offset, std::size_t count) const noexcept
+	{
+		offset = std::min(offset, this->size());
+		count = std::min(count, this->size() - offset);
+		if (count == 0)
+		{
+			return {};
+		}
+
+		auto before = this->summaryBefore(offset), through = this->summaryBefore(offset + count);
+		TextStats stats{ count, through.codePoints - before.codePoints, through.words - before.words, through.lineFeeds - before.lineFeeds + 1 };
+		// The word the range starts in was counted before it
+		stats.words += std::size_t(before.bWordLast && isWordByte(this->at(offset)));
+		return stats;
+	}
+
+	COMFYDX_API char TextSnapshot::at(std::size_t offset) const noexcept
+	{
+		if (offset >= this->size())
+		{
+			return '\0';
+		}
+		auto loc = tree::locate(this->m_root, offset);
+		return this->pieceText(loc.node->piece)[loc.inPiece];
+	}
+	COMFYDX_API std::size_t TextSnapshot::copy(std::size_t offset, std::span<char> out) const
+	{
+		std::size_t copied = 0;
+		this->forEachChunk(offset, out.size(), [&copied, out](std::string_view chunk)
+		{
+			std::copy(chunk.begin(), chunk.end(), out.begin() + copied);
+			copied += chunk.size();
+			return true;
+		});
+		return copied;
+	}
+	COMFYDX_API std::string TextSnapshot::text(std::size_t offset, std::size_t count) const
+	{
+		offset = std::min(offset, this->size());
+		count = std::min(count, this->size() - offset);
+
+		std::string out;
+		out.resize(count);
+		this->copy(offset, out);
+		return out;
+	}
+}
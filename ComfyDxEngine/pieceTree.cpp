@@ -0,0 +1,339 @@
+#include "pch.hpp"
+#include "pieceTree.hpp"
+
+#include <algorithm>
+
+namespace cdx::text
+{
+	COMFYDX_API PieceNode::PieceNode(NodePtr l, const Piece & p, NodePtr r) noexcept
+		: piece{ p }, left{ std::move(l) }, right{ std::move(r) }
+	{
+		static constexpr Summary none{};
+		const auto & ls = this->left ? this->left->sum : none;
+		const auto & rs = this->right ? this->right->sum : none;
+		this->sum.length = ls.length + this->piece.length + rs.length;
+		this->sum.pieces = ls.pieces + 1 + rs.pieces;
+		this->sum.lineFeeds = ls.lineFeeds + this->piece.lineFeeds + rs.lineFeeds;
+		this->sum.codePoints = ls.codePoints + this->piece.codePoints + rs.codePoints;
+		// Missing children have both flags unset, so only seams inside a word are subtracted
+		this->sum.words = ls.words + this->piece.words + rs.words - std::size_t(ls.bWordLast && this->piece.bWordFirst) - std::size_t(this->piece.bWordLast && rs.bWordFirst);
+		this->sum.bWordFirst = this->left ? ls.bWordFirst : this->piece.bWordFirst;
+		this->sum.bWordLast = this->right ? rs.bWordLast : this->piece.bWordLast;
+		this->height = std::uint8_t(std::max(tree::height(this->left), tree::height(this->right)) + 1);
+	}
+
+	namespace tree
+	{
+		namespace
+		{
+			NodePtr rotateLeft(const NodePtr & node)
+			{
+				const auto & r = node->right;
+				return make(make(node->left, node->piece, r->left), r->piece, r->right);
+			}
+			NodePtr rotateRight(const NodePtr & node)
+			{
+				const auto & l = node->left;
+				return make(l->left, l->piece, make(l->right, node->piece, node->right));
+			}
+
+			NodePtr joinRight(const NodePtr & left, const Piece & piece, const NodePtr & right)
+			{
+				const auto & c = left->right;
+				if (height(c) <= height(right) + 1)
+				{
+					auto t = make(c, piece, right);
+					if (height(t) <= height(left->left) + 1)
+					{
+						return make(left->left, left->piece, std::move(t));
+					}
+					return rotateLeft(make(left->left, left->piece, rotateRight(t)));
+				}
+
+				auto t = joinRight(c, piece, right);
+				auto hr = height(t);
+				auto res = make(left->left, left->piece, std::move(t));
+				return (hr <= height(left->left) + 1) ? res : rotateLeft(res);
+			}
+			NodePtr joinLeft(const NodePtr & left, const Piece & piece, const NodePtr & right)
+			{
+				const auto & c = right->left;
+				if (height(c) <= height(left) + 1)
+				{
+					auto t = make(left, piece, c);
+					if (height(t) <= height(right->right) + 1)
+					{
+						return make(std::move(t), right->piece, right->right);
+					}
+					return rotateRight(make(rotateLeft(t), right->piece, right->right));
+				}
+
+				auto t = joinLeft(left, piece, c);
+				auto hl = height(t);
+				auto res = make(std::move(t), right->piece, right->right);
+				return (hl <= height(right->right) + 1) ? res : rotateRight(res);
+			}
+		}
+
+		COMFYDX_API Summary combine(const Summary & a, const Summary & b) noexcept
+		{
+			if (a.pieces == 0)
+			{
+				return b;
+			}
+			else if (b.pieces == 0)
+			{
+				return a;
+			}
+			return {
+				a.length + b.length,
+				a.pieces + b.pieces,
+				a.lineFeeds + b.lineFeeds,
+				a.codePoints + b.codePoints,
+				a.words + b.words - std::size_t(a.bWordLast && b.bWordFirst),
+				a.bWordFirst,
+				b.bWordLast
+			};
+		}
+		COMFYDX_API void extend(Piece & piece, const Piece & next) noexcept
+		{
+			if (piece.length == 0)
+			{
+				piece = next;
+				return;
+			}
+			piece.length += next.length;
+			piece.lineFeeds += next.lineFeeds;
+			piece.codePoints += next.codePoints;
+			piece.words += next.words - std::size_t(piece.bWordLast && next.bWordFirst);
+			if (next.length != 0)
+			{
+				piece.bWordLast = next.bWordLast;
+			}
+		}
+
+		COMFYDX_API NodePtr make(NodePtr left, const Piece & piece, NodePtr right)
+		{
+			return std::make_shared<const PieceNode>(std::move(left), piece, std::move(right));
+		}
+
+		COMFYDX_API NodePtr join(NodePtr left, const Piece & piece, NodePtr right)
+		{
+			auto hl = height(left), hr = height(right);
+			if (hl > hr + 1)
+			{
+				return joinRight(left, piece, right);
+			}
+			else if (hr > hl + 1)
+			{
+				return joinLeft(left, piece, right);
+			}
+			return make(std::move(left), piece, std::move(right));
+		}
+		COMFYDX_API NodePtr concat(NodePtr left, NodePtr right)
+		{
+			if (!left)
+			{
+				return right;
+			}
+			else if (!right)
+			{
+				return left;
+			}
+			auto [rest, last] = splitLast(left);
+			return join(std::move(rest), last, std::move(right));
+		}
+
+		COMFYDX_API std::pair<Piece, Piece> cut(const Piece & p, std::size_t at, const PieceCounter & count)
+		{
+			// Both halves are counted from the buffer index, which costs the same for any length
+			Piece head{ p.source, p.start, at }, tail{ p.source, p.start + at, p.length - at };
+			count(head);
+			count(tail);
+			return { head, tail };
+		}
+		COMFYDX_API std::pair<NodePtr, NodePtr> split(const NodePtr & node, std::size_t offset, const PieceCounter & count)
+		{
+			if (!node)
+			{
+				return {};
+			}
+
+			auto ls = length(node->left);
+			const auto & p = node->piece;
+			if (offset <= ls)
+			{
+				auto [a, b] = split(node->left, offset, count);
+				return { std::move(a), join(std::move(b), p, node->right) };
+			}
+			else if (offset >= ls + p.length)
+			{
+				auto [a, b] = split(node->right, offset - ls - p.length, count);
+				return { join(node->left, p, std::move(a)), std::move(b) };
+			}
+
+			auto [head, tail] = cut(p, offset - ls, count);
+			return { join(node->left, head, nullptr), join(nullptr, tail, node->right) };
+		}
+
+		COMFYDX_API std::pair<NodePtr, Piece> splitLast(const NodePtr & node)
+		{
+			if (!node->right)
+			{
+				return { node->left, node->piece };
+			}
+			auto [rest, last] = splitLast(node->right);
+			return { join(node->left, node->piece, std::move(rest)), last };
+		}
+
+		COMFYDX_API NodePtr fromPieces(const Piece * first, const Piece * last)
+		{
+			if (first == last)
+			{
+				return nullptr;
+			}
+			auto mid = first + (last - first) / 2;
+			return make(fromPieces(first, mid), *mid, fromPieces(mid + 1, last));
+		}
+
+		COMFYDX_API Location locate(const NodePtr & root, std::size_t offset) noexcept
+		{
+			Location loc;
+			const PieceNode * node = root.get();
+			std::size_t base = 0;
+			while (node != nullptr)
+			{
+				auto ls = length(node->left);
+				if (offset < base + ls)
+				{
+					node = node->left.get();
+				}
+				else if (offset < base + ls + node->piece.length || !node->right)
+				{
+					loc.node = node;
+					loc.pieceOffset = base + ls;
+					loc.inPiece = std::min(offset - loc.pieceOffset, node->piece.length);
+					return loc;
+				}
+				else
+				{
+					base += ls + node->piece.length;
+					node = node->right.get();
+				}
+			}
+			return loc;
+		}
+
+		COMFYDX_API LineLocation locateLineFeed(const NodePtr & root, std::size_t lineFeed) noexcept
+		{
+			LineLocation loc;
+			const PieceNode * node = root.get();
+			while (node != nullptr)
+			{
+				auto ll = lineFeeds(node->left);
+				if (lineFeed < ll)
+				{
+					node = node->left.get();
+				}
+				else if (lineFeed < ll + node->piece.lineFeeds)
+				{
+					loc.node = node;
+					loc.pieceOffset += length(node->left);
+					loc.linesBefore += ll;
+					loc.inPiece = lineFeed - ll;
+					return loc;
+				}
+				else
+				{
+					lineFeed -= ll + node->piece.lineFeeds;
+					loc.linesBefore += ll + node->piece.lineFeeds;
+					loc.pieceOffset += length(node->left) + node->piece.length;
+					node = node->right.get();
+				}
+			}
+			return {};
+		}
+		COMFYDX_API LineLocation locateOffset(const NodePtr & root, std::size_t offset) noexcept
+		{
+			LineLocation loc;
+			const PieceNode * node = root.get();
+			while (node != nullptr)
+			{
+				auto ls = length(node->left);
+				if (offset < loc.pieceOffset + ls)
+				{
+					node = node->left.get();
+				}
+				else if (offset < loc.pieceOffset + ls + node->piece.length || !node->right)
+				{
+					loc.node = node;
+					loc.pieceOffset += ls;
+					loc.linesBefore += lineFeeds(node->left);
+					loc.inPiece = std::min(offset - loc.pieceOffset, node->piece.length);
+					return loc;
+				}
+				else
+				{
+					loc.linesBefore += lineFeeds(node->left) + node->piece.lineFeeds;
+					loc.pieceOffset += ls + node->piece.length;
+					node = node->right.get();
+				}
+			}
+			return {};
+		}
+	}
+
+	COMFYDX_API PieceCursor::PieceCursor(const NodePtr & root, std::size_t offset)
+	{
+		const PieceNode * node = root.get();
+		std::size_t base = 0;
+		while (node != nullptr)
+		{
+			auto ls = tree::length(node->left);
+			if (offset < base + ls)
+			{
+				this->m_stack.push_back(node);
+				node = node->left.get();
+			}
+			else if (offset < base + ls + node->piece.length)
+			{
+				this->m_node = node;
+				this->m_pieceOffset = base + ls;
+				return;
+			}
+			else
+			{
+				base += ls + node->piece.length;
+				node = node->right.get();
+			}
+		}
+		// Offset at or past the end
+		this->m_stack.clear();
+	}
+	void PieceCursor::descend(const PieceNode * node)
+	{
+		while (node->left)
+		{
+			this->m_stack.push_back(node);
+			node = node->left.get();
+		}
+		this->m_node = node;
+	}
+	COMFYDX_API void PieceCursor::next()
+	{
+		this->m_pieceOffset += this->m_node->piece.length;
+		if (this->m_node->right)
+		{
+			this->descend(this->m_node->right.get());
+		}
+		else if (!this->m_stack.empty())
+		{
+			this->m_node = this->m_stack.back();
+			this->m_stack.pop_back();
+		}
+		else
+		{
+			this->m_node = nullptr;
+		}
+	}
+}
@@ -0,0 +1,493 @@
+#include "pch.hpp"
+#include "recoveryJournal.hpp"
+#include "mappedFile.hpp"
+#include "varint.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace cdx::text
+{
+	namespace
+	{
+		constexpr std::string_view magic{ "CDXJ" };
+
+		enum class RecordType : std::uint8_t
+		{
+			// Document path and the stamp of the file the checkpoint refers to
+			header,
+			// Segments of base file offsets and text making up the whole document
+			checkpoint,
+			// A batch of TextEdits
+			edits
+		};
+
+		struct FileStamp
+		{
+			std::uint64_t size{}, time{};
+		};
+
+		[[nodiscard]] std::optional<FileStamp> stampOf(const std::filesystem::path & path)
+		{
+			std::error_code ec;
+			FileStamp stamp;
+			stamp.size = std::filesystem::file_size(path, ec);
+			if (!ec)
+			{
+				stamp.time = std::uint64_t(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+			}
+			if (ec)
+			{
+				return std::nullopt;
+			}
+			return stamp;
+		}
+
+		// Size, checksum, payload
+		void putRecord(std::string & out, std::string_view payload)
+		{
+			io::putVarint(out, payload.size());
+			io::putVarint(out, io::checksum(payload));
+			out += payload;
+		}
+		[[nodiscard]] bool getRecord(std::string_view & in, RecordType & type, std::string_view & payload) noexcept
+		{
+			std::uint64_t size, sum;
+			if (!io::getVarint(in, size) || !io::getVarint(in, sum) || size == 0 || size > in.size())
+			{
+				return false;
+			}
+			payload = in.substr(0, std::size_t(size));
+			if (sum != io::checksum(payload))
+			{
+				return false;
+			}
+			in.remove_prefix(std::size_t(size));
+			type = RecordType(payload.front());
+			payload.remove_prefix(1);
+			return true;
+		}
+
+		// Where the bytes of the base snapshot's buffers are in the document file
+		class BaseMap
+		{
+		private:
+			struct Span
+			{
+				Source source{};
+				std::size_t start{}, length{}, offset{};
+			};
+			// Sorted by buffer position
+			std::vector<Span> m_spans;
+
+			[[nodiscard]] static bool before(const Span & a, const Span & b) noexcept
+			{
+				return (a.source != b.source) ? (a.source < b.source) : (a.start < b.start);
+			}
+
+		public:
+			BaseMap() noexcept = default;
+			explicit BaseMap(const TextSnapshot & base)
+			{
+				std::size_t offset = 0;
+				for (const auto & piece : base.pieces(0, base.size()))
+				{
+					this->m_spans.push_back({ piece.source, piece.start, piece.length, offset });
+					offset += piece.length;
+				}
+				std::sort(this->m_spans.begin(), this->m_spans.end(), before);
+			}
+
+			// Calls ref(offset, length) for the parts of the piece that are in the file, text(start, length) in the piece for the rest
+			template<typename Ref, typename Text>
+			void split(const Piece & piece, Ref && ref, Text && text) const
+			{
+				auto pos = piece.start, end = piece.start + piece.length;
+				while (pos < end)
+				{
+					auto it = std::upper_bound(this->m_spans.begin(), this->m_spans.end(), Span{ piece.source, pos }, before);
+					if (it != this->m_spans.begin())
+					{
+						const auto & span = *std::prev(it);
+						if (span.source == piece.source && span.start + span.length > pos)
+						{
+							auto count = std::min(end, span.start + span.length) - pos;
+							ref(span.offset + (pos - span.start), count);
+							pos += count;
+							continue;
+						}
+					}
+					auto stop = (it != this->m_spans.end() && it->source == piece.source) ? std::min(end, it->start) : end;
+					text(pos - piece.start, stop - pos);
+					pos = stop;
+				}
+			}
+		};
+
+		/*
+		 * Segments are tagged with their length and kind, (length << 1) | 1
+		 * followed by the text, or length << 1 followed by the file offset.
+		 */
+		void encodeCheckpoint(std::string & out, const BaseMap & map, const TextSnapshot & text)
+		{
+			std::size_t refOffset = 0, refLength = 0;
+			auto endRef = [&]
+			{
+				if (refLength != 0)
+				{
+					io::putVarint(out, std::uint64_t(refLength) << 1);
+					io::putVarint(out, refOffset);
+					refLength = 0;
+				}
+			};
+			for (const auto & piece : text.pieces(0, text.size()))
+			{
+				map.split(piece, [&](std::size_t offset, std::size_t length)
+				{
+					if (refLength != 0 && refOffset + refLength == offset)
+					{
+						refLength += length;
+						return;
+					}
+					endRef();
+					refOffset = offset;
+					refLength = length;
+				}, [&](std::size_t start, std::size_t length)
+				{
+					endRef();
+					io::putVarint(out, (std::uint64_t(length) << 1) | 1);
+					out += text.pieceText(piece).substr(start, length);
+				});
+			}
+			endRef();
+		}
+		// Rebuilds the table from the segments, 'base' is the table as it was loaded from the file
+		[[nodiscard]] bool decodeCheckpoint(std::string_view in, PieceTable & table, const TextSnapshot & base)
+		{
+			table.erase(0, table.size());
+			while (!in.empty())
+			{
+				std::uint64_t tag, offset;
+				if (!io::getVarint(in, tag))
+				{
+					return false;
+				}
+				auto length = tag >> 1;
+				if (tag & 1)
+				{
+					if (length > in.size())
+					{
+						return false;
+					}
+					table.insert(table.size(), in.substr(0, std::size_t(length)));
+					in.remove_prefix(std::size_t(length));
+				}
+				else
+				{
+					if (!io::getVarint(in, offset) || offset > base.size() || length > base.size() - offset)
+					{
+						return false;
+					}
+					table.insertPieces(table.size(), base.pieces(std::size_t(offset), std::size_t(length)));
+				}
+			}
+			return true;
+		}
+	}
+
+	COMFYDX_API RecoveryJournal::RecoveryJournal(std::filesystem::path journal, std::filesystem::path document, TextSnapshot base, JournalOptions options)
+		: m_path{ std::move(journal) }, m_options{ options }, m_document{ std::move(document) }, m_base{ base }, m_latest{ std::move(base) }
+	{
+		this->m_worker = std::jthread([this](std::stop_token stop)
+		{
+			this->work(stop);
+		});
+	}
+	COMFYDX_API RecoveryJournal::~RecoveryJournal() noexcept
+	{
+		this->m_worker.request_stop();
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.join();
+		}
+	}
+
+	COMFYDX_API void RecoveryJournal::record(std::span<const TextEdit> edits, const TextSnapshot & after)
+	{
+		std::string payload(1, char(RecordType::edits));
+		io::putVarint(payload, edits.size());
+		for (const auto & e : edits)
+		{
+			io::putVarint(payload, e.offset);
+			io::putVarint(payload, e.count);
+			io::putBytes(payload, e.text);
+		}
+
+		std::scoped_lock lock{ this->m_mutex };
+		putRecord(this->m_pending, payload);
+		this->m_latest = after;
+		if (this->m_pending.size() > this->m_options.maxPending)
+		{
+			this->m_bFlushNow = true;
+			this->m_wake.notify_one();
+		}
+	}
+	COMFYDX_API void RecoveryJournal::record(const TextSnapshot & after)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		this->m_latest = after;
+		this->m_bCheckpoint = true;
+	}
+	COMFYDX_API void RecoveryJournal::rebase(std::filesystem::path document, TextSnapshot saved)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		this->m_document = std::move(document);
+		this->m_base = std::move(saved);
+		this->m_bCheckpoint = true;
+		this->m_bFlushNow = true;
+		this->m_wake.notify_one();
+	}
+	COMFYDX_API void RecoveryJournal::flush()
+	{
+		std::unique_lock lock{ this->m_mutex };
+		auto request = ++this->m_requested;
+		this->m_bFlushNow = true;
+		this->m_wake.notify_one();
+		this->m_written.wait(lock, [this, request]
+		{
+			return this->m_completed >= request || this->m_bDiscarded;
+		});
+	}
+	COMFYDX_API void RecoveryJournal::discard() noexcept
+	{
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			this->m_bDiscarded = true;
+			this->m_pending.clear();
+		}
+		this->m_worker.request_stop();
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.join();
+		}
+		this->m_out.close();
+		std::error_code ec;
+		std::filesystem::remove(this->m_path, ec);
+		this->m_size.store(0, std::memory_order_relaxed);
+	}
+
+	void RecoveryJournal::work(std::stop_token stop) noexcept
+	{
+		std::unique_lock lock{ this->m_mutex };
+		while (true)
+		{
+			this->m_wake.wait_for(lock, stop, this->m_options.flushInterval, [this]
+			{
+				return this->m_bFlushNow;
+			});
+			if (this->m_bDiscarded)
+			{
+				this->m_written.notify_all();
+				break;
+			}
+			bool bStopping = stop.stop_requested();
+
+			auto records = std::move(this->m_pending);
+			this->m_pending.clear();
+			auto request = this->m_requested;
+			// A checkpoint holds every edit recorded up to m_latest, those pending are dropped
+			bool bCheckpoint = this->m_bCheckpoint || this->m_deltaSize + records.size() > std::max(this->m_options.compactThreshold, this->m_checkpointSize);
+			auto document = this->m_document;
+			auto base = this->m_base;
+			auto latest = this->m_latest;
+			this->m_bCheckpoint = false;
+			this->m_bFlushNow = false;
+			lock.unlock();
+
+			bool ok = true;
+			try
+			{
+				if (bCheckpoint)
+				{
+					ok = this->compact(document, base, latest);
+				}
+				else if (!records.empty())
+				{
+					ok = this->append(records);
+				}
+			}
+			catch (...)
+			{
+				ok = false;
+			}
+			document.clear();
+			base = {};
+			latest = {};
+
+			lock.lock();
+			if (!ok)
+			{
+				// The file may end in anything now, the next round starts it over
+				this->m_bCheckpoint = true;
+			}
+			this->m_bOk.store(ok, std::memory_order_relaxed);
+			this->m_completed = request;
+			this->m_written.notify_all();
+			if (bStopping)
+			{
+				break;
+			}
+		}
+	}
+	bool RecoveryJournal::append(std::string_view records)
+	{
+		if (!this->m_out.is_open() || !this->m_out.write(records.data(), std::streamsize(records.size())) || !this->m_out.flush())
+		{
+			return false;
+		}
+		this->m_deltaSize += records.size();
+		this->m_size.fetch_add(records.size(), std::memory_order_relaxed);
+		return true;
+	}
+	bool RecoveryJournal::compact(const std::filesystem::path & document, const TextSnapshot & base, const TextSnapshot & text)
+	{
+		// Offsets into the file are only usable if the file still holds the base
+		auto stamp = document.empty() ? std::nullopt : stampOf(document);
+		if (stamp && stamp->size != base.size())
+		{
+			stamp.reset();
+		}
+
+		std::string header(1, char(RecordType::header));
+		auto name = document.generic_u8string();
+		io::putBytes(header, { reinterpret_cast<const char *>(name.data()), name.size() });
+		io::putVarint(header, stamp.has_value());
+		io::putVarint(header, stamp ? stamp->size : 0);
+		io::putVarint(header, stamp ? stamp->time : 0);
+
+		std::string checkpoint(1, char(RecordType::checkpoint));
+		encodeCheckpoint(checkpoint, stamp ? BaseMap{ base } : BaseMap{}, text);
+
+		std::string bytes{ magic };
+		io::putVarint(bytes, formatVersion);
+		putRecord(bytes, header);
+		putRecord(bytes, checkpoint);
+
+		// Written aside and renamed, a crash meanwhile leaves the old journal intact
+		auto temp = this->m_path;
+		temp += ".tmp";
+		bool bWritten;
+		{
+			std::ofstream out{ temp, std::ios::binary | std::ios::trunc };
+			bWritten = out && out.write(bytes.data(), std::streamsize(bytes.size())) && out.flush();
+		}
+		std::error_code ec;
+		this->m_out.close();
+		if (bWritten)
+		{
+			std::filesystem::rename(temp, this->m_path, ec);
+		}
+		if (!bWritten || ec)
+		{
+			std::filesystem::remove(temp, ec);
+			return false;
+		}
+
+		this->m_out.open(this->m_path, std::ios::binary | std::ios::app);
+		this->m_checkpointSize = bytes.size();
+		this->m_deltaSize = 0;
+		this->m_size.store(bytes.size(), std::memory_order_relaxed);
+		return this->m_out.is_open();
+	}
+
+	COMFYDX_API std::optional<RecoveredDocument> RecoveryJournal::recover(const std::filesystem::path & journal, std::string & error)
+	{
+		error.clear();
+		io::MappedFile file;
+		if (!file.open(journal))
+		{
+			error = "Can't read " + journal.string();
+			return std::nullopt;
+		}
+		auto in = file.view();
+		std::uint64_t version, bHasBase, size, time;
+		std::string_view payload, name;
+		RecordType type;
+		if (!in.starts_with(magic))
+		{
+			error = journal.string() + " is not a recovery journal";
+			return std::nullopt;
+		}
+		in.remove_prefix(magic.size());
+		if (!io::getVarint(in, version) || version != formatVersion)
+		{
+			error = journal.string() + " has an unsupported version";
+			return std::nullopt;
+		}
+		if (!getRecord(in, type, payload) || type != RecordType::header ||
+			!io::getBytes(payload, name) || !io::getVarint(payload, bHasBase) || !io::getVarint(payload, size) || !io::getVarint(payload, time))
+		{
+			error = journal.string() + " is damaged";
+			return std::nullopt;
+		}
+
+		RecoveredDocument doc;
+		doc.document = std::filesystem::path(std::u8string{ reinterpret_cast<const char8_t *>(name.data()), name.size() });
+		if (bHasBase)
+		{
+			auto stamp = stampOf(doc.document);
+			auto base = std::make_shared<io::MappedFile>();
+			if (!stamp || stamp->size != size || stamp->time != time || !base->open(doc.document))
+			{
+				error = "Can't recover " + doc.document.string() + ", it was changed since the journal was written";
+				return std::nullopt;
+			}
+			doc.text = PieceTable{ std::move(base) };
+			doc.text.finishIndexing();
+		}
+		auto base = doc.text.snapshot();
+
+		bool bCheckpoint = false;
+		std::vector<TextEdit> edits;
+		// A record cut short by the crash ends the journal
+		while (getRecord(in, type, payload))
+		{
+			if (type == RecordType::checkpoint)
+			{
+				if (!decodeCheckpoint(payload, doc.text, base))
+				{
+					break;
+				}
+				bCheckpoint = true;
+				doc.batches = 0;
+				continue;
+			}
+			std::uint64_t count;
+			if (type != RecordType::edits || !bCheckpoint || !io::getVarint(payload, count) || count > payload.size())
+			{
+				break;
+			}
+			edits.resize(std::size_t(count));
+			bool bValid = true;
+			for (auto & e : edits)
+			{
+				std::uint64_t offset, removed;
+				bValid = bValid && io::getVarint(payload, offset) && io::getVarint(payload, removed) && io::getBytes(payload, e.text);
+				e.offset = std::size_t(offset);
+				e.count = std::size_t(removed);
+			}
+			if (!bValid)
+			{
+				break;
+			}
+			doc.text.apply(edits);
+			++doc.batches;
+		}
+		if (!bCheckpoint)
+		{
+			error = journal.string() + " is damaged";
+			return std::nullopt;
+		}
+		return doc;
+	}
+}
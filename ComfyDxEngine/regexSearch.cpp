@@ -0,0 +1,2758 @@
+#include "pch.hpp"
+#include "regexSearch.hpp"
+#include "varint.hpp"
+
+#include <vector>
+#include <array>
+#include <span>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+#include <type_traits>
+
+namespace cdx::text
+{
+	namespace
+	{
+		constexpr char32_t maxCodePoint{ 0x10FFFF };
+		constexpr std::uint32_t infinite{ std::uint32_t(-1) };
+		// Bounds that keep pathological patterns from exhausting memory or the stack
+		constexpr std::uint32_t maxRepeat{ 1000 };
+		constexpr std::size_t maxDepth{ 200 };
+		constexpr std::size_t maxInsts{ 1 << 20 };
+		constexpr std::size_t npos{ std::size_t(-1) };
+
+		struct PatternError
+		{
+			const char * message;
+			std::size_t offset;
+		};
+
+		[[nodiscard]] constexpr bool isWord(unsigned char c) noexcept
+		{
+			return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+		}
+		[[nodiscard]] constexpr unsigned char asciiLower(unsigned char c) noexcept
+		{
+			return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
+		}
+
+		// Strict UTF-8 decoding, returns false on malformed input
+		bool decode(std::string_view text, std::size_t pos, char32_t & cp, std::size_t & length) noexcept
+		{
+			auto p = reinterpret_cast<const unsigned char *>(text.data()) + pos;
+			auto avail = text.size() - pos;
+			length = 1;
+			if (p[0] < 0x80)
+			{
+				cp = p[0];
+				return true;
+			}
+
+			std::size_t need = (p[0] >= 0xF0) ? 3 : (p[0] >= 0xE0) ? 2 : (p[0] >= 0xC2) ? 1 : 0;
+			if (need == 0 || p[0] > 0xF4 || avail <= need)
+			{
+				return false;
+			}
+			cp = p[0] & (0x3F >> need);
+			for (std::size_t i = 1; i <= need; ++i)
+			{
+				if ((p[i] & 0xC0) != 0x80)
+				{
+					return false;
+				}
+				cp = (cp << 6) | (p[i] & 0x3F);
+			}
+			constexpr char32_t minimum[]{ 0, 0x80, 0x800, 0x10000 };
+			if (cp < minimum[need] || cp > maxCodePoint || (cp >= 0xD800 && cp <= 0xDFFF))
+			{
+				return false;
+			}
+			length = need + 1;
+			return true;
+		}
+		std::size_t encode(char32_t cp, unsigned char * out) noexcept
+		{
+			if (cp < 0x80)
+			{
+				out[0] = (unsigned char)cp;
+				return 1;
+			}
+			else if (cp < 0x800)
+			{
+				out[0] = (unsigned char)(0xC0 | (cp >> 6));
+				out[1] = (unsigned char)(0x80 | (cp & 0x3F));
+				return 2;
+			}
+			else if (cp < 0x10000)
+			{
+				out[0] = (unsigned char)(0xE0 | (cp >> 12));
+				out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+				out[2] = (unsigned char)(0x80 | (cp & 0x3F));
+				return 3;
+			}
+			out[0] = (unsigned char)(0xF0 | (cp >> 18));
+			out[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+			out[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+			out[3] = (unsigned char)(0x80 | (cp & 0x3F));
+			return 4;
+		}
+		void appendUtf8(std::string & str, char32_t cp)
+		{
+			unsigned char bytes[4];
+			str.append(reinterpret_cast<const char *>(bytes), encode(cp, bytes));
+		}
+
+
+		// Sorted, non-overlapping, non-adjacent code point ranges
+		using Ranges = std::vector<std::pair<char32_t, char32_t>>;
+
+		void normalize(Ranges & ranges)
+		{
+			std::sort(ranges.begin(), ranges.end());
+			std::size_t out = 0;
+			for (const auto & range : ranges)
+			{
+				if (out != 0 && range.first <= ranges[out - 1].second + 1)
+				{
+					ranges[out - 1].second = std::max(ranges[out - 1].second, range.second);
+				}
+				else
+				{
+					ranges[out++] = range;
+				}
+			}
+			ranges.resize(out);
+		}
+		[[nodiscard]] bool contains(const Ranges & ranges, char32_t cp) noexcept
+		{
+			auto it = std::upper_bound(ranges.begin(), ranges.end(), cp, [](char32_t c, const auto & range)
+			{
+				return c < range.first;
+			});
+			return it != ranges.begin() && cp <= std::prev(it)->second;
+		}
+		// Everything except the ranges and a line break
+		[[nodiscard]] Ranges negate(Ranges ranges)
+		{
+			ranges.push_back({ '\n', '\n' });
+			normalize(ranges);
+
+			Ranges out;
+			char32_t next = 0;
+			for (const auto & [lo, hi] : ranges)
+			{
+				if (lo > next)
+				{
+					out.push_back({ next, lo - 1 });
+				}
+				next = hi + 1;
+			}
+			if (next <= maxCodePoint)
+			{
+				out.push_back({ next, maxCodePoint });
+			}
+			return out;
+		}
+		void foldRanges(Ranges & ranges, CaseMode mode)
+		{
+			if (mode == CaseMode::sensitive)
+			{
+				return;
+			}
+			normalize(ranges);
+
+			Ranges added;
+			if (mode == CaseMode::ascii)
+			{
+				for (const auto & [lo, hi] : ranges)
+				{
+					auto lower = std::make_pair(std::max<char32_t>(lo, 'a'), std::min<char32_t>(hi, 'z'));
+					auto upper = std::make_pair(std::max<char32_t>(lo, 'A'), std::min<char32_t>(hi, 'Z'));
+					if (lower.first <= lower.second)
+					{
+						added.push_back({ lower.first - 32, lower.second - 32 });
+					}
+					if (upper.first <= upper.second)
+					{
+						added.push_back({ upper.first + 32, upper.second + 32 });
+					}
+				}
+			}
+			else
+			{
+				// Everything folding to the same code point as a member is a member as well
+				std::vector<char32_t> folded;
+				forEachCaseFold([&](char32_t cp, char32_t fold)
+				{
+					if (contains(ranges, cp) || contains(ranges, fold))
+					{
+						folded.push_back(fold);
+					}
+				});
+				std::sort(folded.begin(), folded.end());
+				forEachCaseFold([&](char32_t cp, char32_t fold)
+				{
+					if (std::binary_search(folded.begin(), folded.end(), fold))
+					{
+						added.push_back({ cp, cp });
+					}
+				});
+				for (auto fold : folded)
+				{
+					added.push_back({ fold, fold });
+				}
+			}
+			ranges.insert(ranges.end(), added.begin(), added.end());
+			normalize(ranges);
+		}
+
+
+		enum class Assertion : std::uint8_t
+		{
+			lineStart,
+			lineEnd,
+			wordBoundary,
+			notWordBoundary
+		};
+
+		enum class NodeKind : std::uint8_t
+		{
+			empty,
+			set,
+			concat,
+			alternate,
+			repeat,
+			group,
+			assertion,
+			backref,
+			look
+		};
+
+		struct Node
+		{
+			NodeKind kind{ NodeKind::empty };
+			Ranges ranges;
+			// A set made of a single pattern character, possibly case folded
+			bool bLiteral{ false };
+			char32_t literal{};
+			std::vector<Node> children;
+			std::uint32_t min{}, max{};
+			bool bGreedy{ true };
+			// Capture index of groups and backreferences, 0 if not capturing
+			std::uint32_t group{};
+			Assertion assertion{};
+			bool bNegate{ false }, bBehind{ false };
+		};
+
+		[[nodiscard]] Node makeNode(NodeKind kind, std::vector<Node> children = {})
+		{
+			Node node;
+			node.kind = kind;
+			node.children = std::move(children);
+			return node;
+		}
+		[[nodiscard]] Node makeAssertion(Assertion assertion)
+		{
+			auto node = makeNode(NodeKind::assertion);
+			node.assertion = assertion;
+			return node;
+		}
+		[[nodiscard]] Node makeBackref(std::uint32_t group)
+		{
+			auto node = makeNode(NodeKind::backref);
+			node.group = group;
+			return node;
+		}
+
+		[[nodiscard]] bool nullable(const Node & node) noexcept
+		{
+			switch (node.kind)
+			{
+			case NodeKind::set:
+				return false;
+			case NodeKind::concat:
+				return std::all_of(node.children.begin(), node.children.end(), nullable);
+			case NodeKind::alternate:
+				return std::any_of(node.children.begin(), node.children.end(), nullable);
+			case NodeKind::repeat:
+				return node.min == 0 || nullable(node.children.front());
+			case NodeKind::group:
+				return nullable(node.children.front());
+			default:
+				return true;
+			}
+		}
+
+		class Parser
+		{
+		private:
+			std::string_view m_pattern;
+			std::size_t m_pos{ 0 };
+			CaseMode m_mode;
+			std::size_t m_depth{ 0 };
+			std::vector<std::pair<std::string, std::uint32_t>> m_names;
+			// Highest backreference and where it was, checked once all groups are known
+			std::uint32_t m_maxBackref{ 0 };
+			std::size_t m_backrefOffset{ 0 };
+
+		public:
+			std::uint32_t groups{ 0 };
+			bool bBackrefs{ false }, bLook{ false };
+
+			Parser(std::string_view pattern, CaseMode mode) noexcept
+				: m_pattern{ pattern }, m_mode{ mode }
+			{
+			}
+
+			[[nodiscard]] Node parse()
+			{
+				auto root = this->alternation();
+				if (this->m_pos < this->m_pattern.size())
+				{
+					throw PatternError{ "unmatched ')'", this->m_pos };
+				}
+				if (this->m_maxBackref > this->groups)
+				{
+					throw PatternError{ "backreference to a group that does not exist", this->m_backrefOffset };
+				}
+				return root;
+			}
+
+		private:
+			[[nodiscard]] bool eof() const noexcept
+			{
+				return this->m_pos >= this->m_pattern.size();
+			}
+			[[nodiscard]] char peek(std::size_t ahead = 0) const noexcept
+			{
+				return (this->m_pos + ahead < this->m_pattern.size()) ? this->m_pattern[this->m_pos + ahead] : '\0';
+			}
+			[[nodiscard]] bool accept(std::string_view str) noexcept
+			{
+				if (this->m_pattern.substr(this->m_pos).starts_with(str))
+				{
+					this->m_pos += str.size();
+					return true;
+				}
+				return false;
+			}
+			char32_t next()
+			{
+				char32_t cp;
+				std::size_t length;
+				if (!decode(this->m_pattern, this->m_pos, cp, length))
+				{
+					throw PatternError{ "invalid UTF-8 in the pattern", this->m_pos };
+				}
+				this->m_pos += length;
+				return cp;
+			}
+
+			[[nodiscard]] Node set(Ranges ranges, bool bNegate = false)
+			{
+				foldRanges(ranges, this->m_mode);
+				auto node = makeNode(NodeKind::set);
+				node.ranges = bNegate ? negate(std::move(ranges)) : std::move(ranges);
+				normalize(node.ranges);
+				return node;
+			}
+			[[nodiscard]] Node literal(char32_t cp)
+			{
+				auto node = this->set({ { cp, cp } });
+				node.bLiteral = true;
+				node.literal = cp;
+				return node;
+			}
+
+			Node alternation()
+			{
+				std::vector<Node> alternatives;
+				alternatives.push_back(this->concatenation());
+				while (this->peek() == '|' && !this->eof())
+				{
+					++this->m_pos;
+					alternatives.push_back(this->concatenation());
+				}
+				if (alternatives.size() == 1)
+				{
+					return std::move(alternatives.front());
+				}
+				return makeNode(NodeKind::alternate, std::move(alternatives));
+			}
+			Node concatenation()
+			{
+				std::vector<Node> items;
+				while (!this->eof() && this->peek() != '|' && this->peek() != ')')
+				{
+					items.push_back(this->repetition());
+				}
+				if (items.size() == 1)
+				{
+					return std::move(items.front());
+				}
+				return makeNode(NodeKind::concat, std::move(items));
+			}
+			// Parses {n}, {n,} or {n,m}, anything else is a literal '{'
+			bool braces(std::uint32_t & min, std::uint32_t & max)
+			{
+				auto start = this->m_pos;
+				auto number = [this](std::uint32_t & value)
+				{
+					auto begin = this->m_pos;
+					std::uint64_t n = 0;
+					while (this->peek() >= '0' && this->peek() <= '9' && !this->eof())
+					{
+						n = std::min<std::uint64_t>(n * 10 + std::uint64_t(this->peek() - '0'), std::uint64_t(maxRepeat) + 1);
+						++this->m_pos;
+					}
+					value = std::uint32_t(n);
+					return this->m_pos != begin;
+				};
+
+				++this->m_pos;
+				if (!number(min))
+				{
+					this->m_pos = start;
+					return false;
+				}
+				max = min;
+				if (this->accept(","))
+				{
+					if (!number(max))
+					{
+						max = infinite;
+					}
+				}
+				if (!this->accept("}"))
+				{
+					this->m_pos = start;
+					return false;
+				}
+				if (min > maxRepeat || (max != infinite && max > maxRepeat))
+				{
+					throw PatternError{ "repetition count is too large", start };
+				}
+				if (min > max)
+				{
+					throw PatternError{ "repetition range is out of order", start };
+				}
+				return true;
+			}
+			[[nodiscard]] bool quantifier(std::uint32_t & min, std::uint32_t & max)
+			{
+				switch (this->peek())
+				{
+				case '*':
+					min = 0, max = infinite;
+					break;
+				case '+':
+					min = 1, max = infinite;
+					break;
+				case '?':
+					min = 0, max = 1;
+					break;
+				case '{':
+					return !this->eof() && this->braces(min, max);
+				default:
+					return false;
+				}
+				++this->m_pos;
+				return true;
+			}
+			Node repetition()
+			{
+				auto start = this->m_pos;
+				auto atom = this->atom();
+
+				std::uint32_t min, max;
+				auto at = this->m_pos;
+				if (!this->quantifier(min, max))
+				{
+					return atom;
+				}
+				if (atom.kind == NodeKind::assertion)
+				{
+					throw PatternError{ "an anchor can't be repeated", at };
+				}
+				bool bGreedy = !this->accept("?");
+				if (this->quantifier(min, max))
+				{
+					throw PatternError{ "nothing to repeat", start };
+				}
+
+				auto node = makeNode(NodeKind::repeat);
+				node.min = min;
+				node.max = max;
+				node.bGreedy = bGreedy;
+				node.children.push_back(std::move(atom));
+				return node;
+			}
+			Node atom()
+			{
+				auto start = this->m_pos;
+				switch (this->peek())
+				{
+				case '(':
+					return this->group();
+				case '[':
+					return this->charClass();
+				case '.':
+					++this->m_pos;
+					return this->set({}, true);
+				case '^':
+					++this->m_pos;
+					return makeAssertion(Assertion::lineStart);
+				case '$':
+					++this->m_pos;
+					return makeAssertion(Assertion::lineEnd);
+				case '\\':
+					return this->escape();
+				case '*':
+				case '+':
+				case '?':
+					throw PatternError{ "nothing to repeat", start };
+				case '{':
+				{
+					std::uint32_t min, max;
+					if (this->braces(min, max))
+					{
+						throw PatternError{ "nothing to repeat", start };
+					}
+					++this->m_pos;
+					return this->literal('{');
+				}
+				default:
+					return this->literal(this->next());
+				}
+			}
+			Node group()
+			{
+				auto start = this->m_pos++;
+				if (++this->m_depth > maxDepth)
+				{
+					throw PatternError{ "groups are nested too deeply", start };
+				}
+
+				auto node = makeNode(NodeKind::group);
+				if (this->accept("?=") || this->accept("?!"))
+				{
+					node.kind = NodeKind::look;
+					node.bNegate = this->m_pattern[this->m_pos - 1] == '!';
+				}
+				else if (this->accept("?<=") || this->accept("?<!"))
+				{
+					node.kind = NodeKind::look;
+					node.bNegate = this->m_pattern[this->m_pos - 1] == '!';
+					node.bBehind = true;
+				}
+				else if (this->accept("?<"))
+				{
+					auto name = this->groupName();
+					node.group = ++this->groups;
+					this->m_names.push_back({ std::move(name), node.group });
+				}
+				else if (this->peek() == '?' && !this->eof())
+				{
+					if (!this->accept("?:"))
+					{
+						throw PatternError{ "unknown group type", start };
+					}
+				}
+				else
+				{
+					node.group = ++this->groups;
+				}
+				this->bLook = this->bLook || node.kind == NodeKind::look;
+
+				node.children.push_back(this->alternation());
+				if (!this->accept(")"))
+				{
+					throw PatternError{ "missing ')'", start };
+				}
+				--this->m_depth;
+				return node;
+			}
+			// Reads "name>", the opening '<' is already consumed
+			std::string groupName()
+			{
+				auto start = this->m_pos;
+				auto end = this->m_pattern.find('>', start);
+				if (end == std::string_view::npos || end == start)
+				{
+					throw PatternError{ "invalid group name", start };
+				}
+				auto name = this->m_pattern.substr(start, end - start);
+				if (!std::all_of(name.begin(), name.end(), [](char c) { return isWord((unsigned char)c); }))
+				{
+					throw PatternError{ "invalid group name", start };
+				}
+				this->m_pos = end + 1;
+				return std::string(name);
+			}
+
+			// \d \w \s and their negations, false for other escapes
+			static bool shorthand(char c, Ranges & ranges, bool & bNegate)
+			{
+				switch (c)
+				{
+				case 'd':
+				case 'D':
+					ranges = { { '0', '9' } };
+					break;
+				case 'w':
+				case 'W':
+					ranges = { { '0', '9' }, { 'A', 'Z' }, { '_', '_' }, { 'a', 'z' } };
+					break;
+				case 's':
+				case 'S':
+					ranges = {
+						{ '\t', '\r' }, { ' ', ' ' }, { 0xA0, 0xA0 }, { 0x1680, 0x1680 }, { 0x2000, 0x200A },
+						{ 0x2028, 0x2029 }, { 0x202F, 0x202F }, { 0x205F, 0x205F }, { 0x3000, 0x3000 }, { 0xFEFF, 0xFEFF }
+					};
+					break;
+				default:
+					return false;
+				}
+				bNegate = (c >= 'A' && c <= 'Z');
+				return true;
+			}
+			std::uint32_t hex(std::size_t digits, bool bBraced)
+			{
+				auto start = this->m_pos;
+				std::uint32_t value = 0;
+				std::size_t count = 0;
+				while (bBraced ? this->peek() != '}' : count < digits)
+				{
+					char c = this->peek();
+					std::uint32_t digit = (c >= '0' && c <= '9') ? std::uint32_t(c - '0') :
+						(c >= 'a' && c <= 'f') ? std::uint32_t(c - 'a' + 10) :
+						(c >= 'A' && c <= 'F') ? std::uint32_t(c - 'A' + 10) : 16;
+					if (digit == 16 || this->eof())
+					{
+						throw PatternError{ "invalid hexadecimal escape", start };
+					}
+					value = value * 16 + digit;
+					if (value > maxCodePoint)
+					{
+						throw PatternError{ "code point is out of range", start };
+					}
+					++this->m_pos;
+					++count;
+				}
+				if (bBraced && (count == 0 || !this->accept("}")))
+				{
+					throw PatternError{ "invalid hexadecimal escape", start };
+				}
+				return value;
+			}
+			// Escapes standing for a single character, the backslash is consumed
+			char32_t escapedChar(std::size_t start)
+			{
+				if (this->eof())
+				{
+					throw PatternError{ "pattern ends with a backslash", start };
+				}
+				auto c = this->next();
+				switch (c)
+				{
+				case 'n':
+					return '\n';
+				case 'r':
+					return '\r';
+				case 't':
+					return '\t';
+				case 'f':
+					return '\f';
+				case 'v':
+					return '\v';
+				case '0':
+					if (this->peek() >= '0' && this->peek() <= '9')
+					{
+						throw PatternError{ "invalid escape", start };
+					}
+					return 0;
+				case 'x':
+					return this->hex(2, false);
+				case 'u':
+				{
+					char32_t cp = this->accept("{") ? this->hex(0, true) : this->hex(4, false);
+					if (cp >= 0xD800 && cp <= 0xDFFF)
+					{
+						throw PatternError{ "surrogates can't be matched in UTF-8 text", start };
+					}
+					return cp;
+				}
+				default:
+					if (c < 0x80 && isWord((unsigned char)c))
+					{
+						throw PatternError{ "invalid escape", start };
+					}
+					return c;
+				}
+			}
+			Node escape()
+			{
+				auto start = this->m_pos++;
+				char c = this->peek();
+
+				Ranges ranges;
+				bool bNegate;
+				if (shorthand(c, ranges, bNegate))
+				{
+					++this->m_pos;
+					return this->set(std::move(ranges), bNegate);
+				}
+				if (c == 'b' || c == 'B')
+				{
+					++this->m_pos;
+					return makeAssertion((c == 'b') ? Assertion::wordBoundary : Assertion::notWordBoundary);
+				}
+				if (c >= '1' && c <= '9')
+				{
+					std::uint32_t group = 0;
+					while (this->peek() >= '0' && this->peek() <= '9' && !this->eof())
+					{
+						group = std::min<std::uint32_t>(group * 10 + std::uint32_t(this->peek() - '0'), 100000);
+						++this->m_pos;
+					}
+					if (group > this->m_maxBackref)
+					{
+						this->m_maxBackref = group;
+						this->m_backrefOffset = start;
+					}
+					this->bBackrefs = true;
+					return makeBackref(group);
+				}
+				if (c == 'k')
+				{
+					++this->m_pos;
+					if (!this->accept("<"))
+					{
+						throw PatternError{ "invalid escape", start };
+					}
+					auto name = this->groupName();
+					auto it = std::find_if(this->m_names.begin(), this->m_names.end(), [&name](const auto & entry)
+					{
+						return entry.first == name;
+					});
+					if (it == this->m_names.end())
+					{
+						throw PatternError{ "unknown group name", start };
+					}
+					this->bBackrefs = true;
+					return makeBackref(it->second);
+				}
+				return this->literal(this->escapedChar(start));
+			}
+			Node charClass()
+			{
+				auto start = this->m_pos++;
+				bool bNegate = this->accept("^");
+
+				Ranges ranges;
+				// Returns false for \d and friends, which were added to the ranges already
+				auto item = [&](char32_t & cp)
+				{
+					if (this->eof())
+					{
+						throw PatternError{ "missing ']'", start };
+					}
+					if (this->peek() != '\\')
+					{
+						cp = this->next();
+						return true;
+					}
+
+					auto escapeStart = this->m_pos++;
+					Ranges shorthandRanges;
+					bool bShorthandNegate;
+					if (shorthand(this->peek(), shorthandRanges, bShorthandNegate))
+					{
+						++this->m_pos;
+						if (bShorthandNegate)
+						{
+							normalize(shorthandRanges);
+							shorthandRanges = negate(std::move(shorthandRanges));
+						}
+						ranges.insert(ranges.end(), shorthandRanges.begin(), shorthandRanges.end());
+						return false;
+					}
+					if (this->accept("b"))
+					{
+						cp = '\b';
+						return true;
+					}
+					cp = this->escapedChar(escapeStart);
+					return true;
+				};
+
+				for (bool bFirst = true; ; bFirst = false)
+				{
+					if (this->peek() == ']' && !bFirst && !this->eof())
+					{
+						++this->m_pos;
+						break;
+					}
+
+					auto rangeStart = this->m_pos;
+					char32_t lo, hi;
+					if (!item(lo))
+					{
+						continue;
+					}
+					if (this->peek() == '-' && this->peek(1) != ']' && this->m_pos + 1 < this->m_pattern.size())
+					{
+						++this->m_pos;
+						if (!item(hi))
+						{
+							throw PatternError{ "invalid class range", rangeStart };
+						}
+						if (hi < lo)
+						{
+							throw PatternError{ "class range is out of order", rangeStart };
+						}
+						ranges.push_back({ lo, hi });
+					}
+					else
+					{
+						ranges.push_back({ lo, lo });
+					}
+				}
+				return this->set(std::move(ranges), bNegate);
+			}
+		};
+
+
+		// Literal text matches have to start with, end with or contain
+		struct Literals
+		{
+			bool bExact{ false };
+			std::string exact, prefix, suffix, required;
+		};
+
+		// Longest common prefix or suffix that does not cut a UTF-8 sequence
+		std::string commonPrefix(const std::string & a, const std::string & b)
+		{
+			auto n = std::size_t(std::mismatch(a.begin(), a.begin() + std::ptrdiff_t(std::min(a.size(), b.size())), b.begin()).first - a.begin());
+			while (n < a.size() && n != 0 && (a[n] & 0xC0) == 0x80)
+			{
+				--n;
+			}
+			return a.substr(0, n);
+		}
+		std::string commonSuffix(const std::string & a, const std::string & b)
+		{
+			std::size_t n = 0;
+			while (n < a.size() && n < b.size() && a[a.size() - 1 - n] == b[b.size() - 1 - n])
+			{
+				++n;
+			}
+			while (n != 0 && (a[a.size() - n] & 0xC0) == 0x80)
+			{
+				--n;
+			}
+			return a.substr(a.size() - n);
+		}
+		void keepLonger(std::string & required, std::string candidate)
+		{
+			if (candidate.size() > required.size())
+			{
+				required = std::move(candidate);
+			}
+		}
+
+		Literals literals(const Node & node)
+		{
+			Literals out;
+			switch (node.kind)
+			{
+			case NodeKind::set:
+				if (node.bLiteral)
+				{
+					out.bExact = true;
+					appendUtf8(out.exact, node.literal);
+					out.prefix = out.suffix = out.required = out.exact;
+				}
+				break;
+			case NodeKind::empty:
+			case NodeKind::assertion:
+			case NodeKind::look:
+				out.bExact = true;
+				break;
+			case NodeKind::group:
+				return literals(node.children.front());
+			case NodeKind::repeat:
+			{
+				if (node.min == 0)
+				{
+					break;
+				}
+				auto child = literals(node.children.front());
+				if (child.bExact && node.min == node.max && child.exact.size() * node.min <= 256)
+				{
+					out.bExact = true;
+					for (std::uint32_t i = 0; i < node.min; ++i)
+					{
+						out.exact += child.exact;
+					}
+					out.prefix = out.suffix = out.required = out.exact;
+				}
+				else
+				{
+					out.prefix = std::move(child.prefix);
+					out.suffix = std::move(child.suffix);
+					out.required = std::move(child.required);
+				}
+				break;
+			}
+			case NodeKind::concat:
+			{
+				// Exact children glue together with their neighbours' suffix and prefix
+				std::string run;
+				bool bLeading = true;
+				out.bExact = true;
+				for (const auto & item : node.children)
+				{
+					auto child = literals(item);
+					if (child.bExact)
+					{
+						run += child.exact;
+						continue;
+					}
+					keepLonger(out.required, run + child.prefix);
+					keepLonger(out.required, std::move(child.required));
+					if (bLeading)
+					{
+						out.prefix = run + child.prefix;
+						bLeading = false;
+					}
+					out.bExact = false;
+					run = std::move(child.suffix);
+				}
+				if (out.bExact)
+				{
+					out.exact = run;
+					out.prefix = run;
+				}
+				keepLonger(out.required, run);
+				out.suffix = std::move(run);
+				break;
+			}
+			case NodeKind::alternate:
+			{
+				auto first = literals(node.children.front());
+				out = first;
+				for (std::size_t i = 1; i < node.children.size(); ++i)
+				{
+					auto child = literals(node.children[i]);
+					out.bExact = out.bExact && child.bExact && child.exact == out.exact;
+					out.prefix = commonPrefix(out.prefix, child.prefix);
+					out.suffix = commonSuffix(out.suffix, child.suffix);
+				}
+				if (!out.bExact)
+				{
+					out.exact.clear();
+					out.required = (out.prefix.size() >= out.suffix.size()) ? out.prefix : out.suffix;
+				}
+				break;
+			}
+			case NodeKind::backref:
+				break;
+			}
+			return out;
+		}
+
+
+		enum class Op : std::uint8_t
+		{
+			byteRange,
+			// Any byte of a set, single byte classes like \w take one step instead of a split per range
+			byteSet,
+			split,
+			jump,
+			// Stores the position in a slot, for backreferences and empty loop checks
+			save,
+			// Fails if the position still equals the slot, stops empty loop iterations
+			progress,
+			assertion,
+			backref,
+			look,
+			match
+		};
+
+		struct Inst
+		{
+			Op op{};
+			std::uint8_t lo{}, hi{};
+			Assertion assertion{};
+			bool bNegate{ false }, bBehind{ false };
+			// 'alt' is the second branch of a split and the sub program of a look
+			std::uint32_t next{}, alt{};
+			// Slot of save and progress, group of backref, index of a byte set
+			std::uint32_t arg{};
+		};
+
+		using ByteSet = std::array<std::uint64_t, 4>;
+
+		[[nodiscard]] constexpr bool contains(const ByteSet & set, unsigned char c) noexcept
+		{
+			return (set[c / 64] >> (c % 64)) & 1;
+		}
+		[[nodiscard]] bool accepts(const Inst & inst, const std::vector<ByteSet> & sets, unsigned char c) noexcept
+		{
+			return (inst.op == Op::byteSet) ? contains(sets[inst.arg], c) : (c >= inst.lo && c <= inst.hi);
+		}
+
+		[[nodiscard]] constexpr Inst makeInst(Op op, std::uint32_t next = 0, std::uint32_t alt = 0, std::uint32_t arg = 0) noexcept
+		{
+			Inst inst;
+			inst.op = op;
+			inst.next = next;
+			inst.alt = alt;
+			inst.arg = arg;
+			return inst;
+		}
+		[[nodiscard]] constexpr Inst makeRange(std::uint8_t lo, std::uint8_t hi, std::uint32_t next) noexcept
+		{
+			auto inst = makeInst(Op::byteRange, next);
+			inst.lo = lo;
+			inst.hi = hi;
+			return inst;
+		}
+
+		// Byte ranges of one UTF-8 encoded code point range
+		struct ByteSequence
+		{
+			std::array<std::pair<std::uint8_t, std::uint8_t>, 4> bytes{};
+			std::size_t length{};
+		};
+
+		void utf8Sequences(char32_t lo, char32_t hi, std::vector<ByteSequence> & out)
+		{
+			if (lo <= 0xDFFF && hi >= 0xD800)
+			{
+				if (lo < 0xD800)
+				{
+					utf8Sequences(lo, 0xD7FF, out);
+				}
+				if (hi > 0xDFFF)
+				{
+					utf8Sequences(0xE000, hi, out);
+				}
+				return;
+			}
+			for (char32_t max : { char32_t(0x7F), char32_t(0x7FF), char32_t(0xFFFF) })
+			{
+				if (lo <= max && hi > max)
+				{
+					utf8Sequences(lo, max, out);
+					utf8Sequences(max + 1, hi, out);
+					return;
+				}
+			}
+
+			unsigned char a[4], b[4];
+			auto length = encode(lo, a);
+			for (std::size_t i = 1; i < length; ++i)
+			{
+				char32_t mask = (char32_t(1) << (6 * i)) - 1;
+				if ((lo & ~mask) != (hi & ~mask))
+				{
+					if ((lo & mask) != 0)
+					{
+						utf8Sequences(lo, lo | mask, out);
+						utf8Sequences((lo | mask) + 1, hi, out);
+						return;
+					}
+					if ((hi & mask) != mask)
+					{
+						utf8Sequences(lo, (hi & ~mask) - 1, out);
+						utf8Sequences(hi & ~mask, hi, out);
+						return;
+					}
+				}
+			}
+			encode(hi, b);
+			ByteSequence seq;
+			seq.length = length;
+			for (std::size_t i = 0; i < length; ++i)
+			{
+				seq.bytes[i] = { a[i], b[i] };
+			}
+			out.push_back(seq);
+		}
+
+		/*
+		 * Thompson construction, every node is compiled with the instruction it
+		 * continues with. Reverse programs match the reversed text; the reverse
+		 * DFA also swaps line anchors, lookbehinds run backwards over the text
+		 * with the anchors as they are.
+		 */
+		class Compiler
+		{
+		private:
+			std::vector<Inst> & m_insts;
+			std::vector<ByteSet> & m_sets;
+			bool m_bSaves, m_bSwapAnchors;
+			std::size_t m_slotBase;
+
+			std::uint32_t emit(const Inst & inst)
+			{
+				if (this->m_insts.size() >= maxInsts)
+				{
+					throw PatternError{ "pattern is too large", 0 };
+				}
+				this->m_insts.push_back(inst);
+				return std::uint32_t(this->m_insts.size() - 1);
+			}
+			std::uint32_t split(std::uint32_t preferred, std::uint32_t other)
+			{
+				return this->emit(makeInst(Op::split, preferred, other));
+			}
+
+			std::uint32_t compileSet(const Ranges & ranges, std::uint32_t next, bool bReverse)
+			{
+				std::vector<ByteSequence> sequences;
+				for (const auto & [lo, hi] : ranges)
+				{
+					utf8Sequences(lo, hi, sequences);
+				}
+				if (sequences.empty())
+				{
+					// Never matches
+					return this->emit(makeRange(1, 0, next));
+				}
+				if (sequences.size() > 1 && std::all_of(sequences.begin(), sequences.end(), [](const ByteSequence & seq) { return seq.length == 1; }))
+				{
+					ByteSet set{};
+					for (const auto & seq : sequences)
+					{
+						for (auto c = unsigned(seq.bytes[0].first); c <= seq.bytes[0].second; ++c)
+						{
+							set[c / 64] |= std::uint64_t(1) << (c % 64);
+						}
+					}
+					auto it = std::find(this->m_sets.begin(), this->m_sets.end(), set);
+					auto inst = makeInst(Op::byteSet, next, 0, std::uint32_t(it - this->m_sets.begin()));
+					if (it == this->m_sets.end())
+					{
+						this->m_sets.push_back(set);
+					}
+					return this->emit(inst);
+				}
+
+				// Sequences share their tails, e.g. the continuation bytes
+				std::unordered_map<std::uint64_t, std::uint32_t> shared;
+				auto range = [&](std::pair<std::uint8_t, std::uint8_t> bytes, std::uint32_t target)
+				{
+					auto key = (std::uint64_t(target) << 16) | (std::uint64_t(bytes.first) << 8) | bytes.second;
+					auto [it, bNew] = shared.try_emplace(key, 0);
+					if (bNew)
+					{
+						it->second = this->emit(makeRange(bytes.first, bytes.second, target));
+					}
+					return it->second;
+				};
+
+				std::vector<std::uint32_t> entries;
+				for (const auto & seq : sequences)
+				{
+					auto target = next;
+					for (std::size_t i = 0; i < seq.length; ++i)
+					{
+						auto index = bReverse ? i : seq.length - 1 - i;
+						target = range(seq.bytes[index], target);
+					}
+					entries.push_back(target);
+				}
+				std::sort(entries.begin(), entries.end());
+				entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+				auto entry = entries.back();
+				for (auto it = entries.rbegin() + 1; it != entries.rend(); ++it)
+				{
+					entry = this->split(*it, entry);
+				}
+				return entry;
+			}
+
+		public:
+			Compiler(std::vector<Inst> & insts, std::vector<ByteSet> & sets, bool bSaves, bool bSwapAnchors, std::size_t slotBase) noexcept
+				: m_insts{ insts }, m_sets{ sets }, m_bSaves{ bSaves }, m_bSwapAnchors{ bSwapAnchors }, m_slotBase{ slotBase }
+			{
+			}
+
+			std::uint32_t compile(const Node & node, std::uint32_t next, bool bReverse)
+			{
+				switch (node.kind)
+				{
+				case NodeKind::empty:
+					return next;
+				case NodeKind::set:
+					return this->compileSet(node.ranges, next, bReverse);
+				case NodeKind::concat:
+					if (bReverse)
+					{
+						for (const auto & child : node.children)
+						{
+							next = this->compile(child, next, bReverse);
+						}
+					}
+					else
+					{
+						for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+						{
+							next = this->compile(*it, next, bReverse);
+						}
+					}
+					return next;
+				case NodeKind::alternate:
+				{
+					std::vector<std::uint32_t> entries;
+					for (const auto & child : node.children)
+					{
+						entries.push_back(this->compile(child, next, bReverse));
+					}
+					auto entry = entries.back();
+					for (auto it = entries.rbegin() + 1; it != entries.rend(); ++it)
+					{
+						entry = this->split(*it, entry);
+					}
+					return entry;
+				}
+				case NodeKind::repeat:
+				{
+					const auto & child = node.children.front();
+					auto branch = [&node, this](std::uint32_t body, std::uint32_t skip)
+					{
+						return node.bGreedy ? this->split(body, skip) : this->split(skip, body);
+					};
+
+					auto target = next;
+					if (node.max == infinite)
+					{
+						// The split is patched once the body, which loops back to it, exists
+						auto loop = this->split(0, 0);
+						std::uint32_t body;
+						if (this->m_bSaves && nullable(child))
+						{
+							auto slot = std::uint32_t(this->m_slotBase + this->m_insts.size());
+							auto check = this->emit(makeInst(Op::progress, loop, 0, slot));
+							body = this->emit(makeInst(Op::save, this->compile(child, check, bReverse), 0, slot));
+						}
+						else
+						{
+							body = this->compile(child, loop, bReverse);
+						}
+						auto patched = branch(body, next);
+						this->m_insts[loop] = this->m_insts[patched];
+						this->m_insts.pop_back();
+						target = loop;
+					}
+					else
+					{
+						for (auto i = node.min; i < node.max; ++i)
+						{
+							target = branch(this->compile(child, target, bReverse), next);
+						}
+					}
+					for (std::uint32_t i = 0; i < node.min; ++i)
+					{
+						target = this->compile(child, target, bReverse);
+					}
+					return target;
+				}
+				case NodeKind::group:
+				{
+					if (node.group == 0 || !this->m_bSaves)
+					{
+						return this->compile(node.children.front(), next, bReverse);
+					}
+					auto first = 2 * node.group, second = first + 1;
+					if (bReverse)
+					{
+						std::swap(first, second);
+					}
+					auto close = this->emit(makeInst(Op::save, next, 0, second));
+					auto body = this->compile(node.children.front(), close, bReverse);
+					return this->emit(makeInst(Op::save, body, 0, first));
+				}
+				case NodeKind::assertion:
+				{
+					auto assertion = node.assertion;
+					if (bReverse && this->m_bSwapAnchors)
+					{
+						assertion = (assertion == Assertion::lineStart) ? Assertion::lineEnd :
+							(assertion == Assertion::lineEnd) ? Assertion::lineStart : assertion;
+					}
+					auto inst = makeInst(Op::assertion, next);
+					inst.assertion = assertion;
+					return this->emit(inst);
+				}
+				case NodeKind::backref:
+					return this->emit(makeInst(Op::backref, next, 0, node.group));
+				case NodeKind::look:
+				{
+					auto match = this->emit(makeInst(Op::match));
+					auto sub = this->compile(node.children.front(), match, node.bBehind);
+					auto inst = makeInst(Op::look, next, sub);
+					inst.bNegate = node.bNegate;
+					inst.bBehind = node.bBehind;
+					return this->emit(inst);
+				}
+				}
+				return next;
+			}
+		};
+
+
+		struct SparseSet
+		{
+			std::vector<std::uint32_t> dense, sparse;
+			std::size_t count{ 0 };
+
+			void resize(std::size_t size)
+			{
+				this->dense.resize(size);
+				this->sparse.resize(size);
+				this->count = 0;
+			}
+			[[nodiscard]] bool contains(std::uint32_t value) const noexcept
+			{
+				auto index = this->sparse[value];
+				return index < this->count && this->dense[index] == value;
+			}
+			// Returns false if the value was in the set already
+			bool insert(std::uint32_t value) noexcept
+			{
+				if (this->contains(value))
+				{
+					return false;
+				}
+				this->sparse[value] = std::uint32_t(this->count);
+				this->dense[this->count++] = value;
+				return true;
+			}
+			void clear() noexcept
+			{
+				this->count = 0;
+			}
+		};
+
+		using ByteClasses = std::array<std::uint8_t, 256>;
+
+		/*
+		 * DFA built from the NFA while searching. A state is the priority ordered
+		 * list of NFA threads waiting for a byte plus what is known about the byte
+		 * before. Anchors are only decided once the next byte is seen, so whether
+		 * a match ended right before a byte is a property of the state reached
+		 * through it. Leftmost-first DFAs drop threads of lower priority than a
+		 * match, longest-match DFAs keep running until they die.
+		 */
+		class Dfa
+		{
+		public:
+			// Context of the position before the next byte
+			static constexpr std::uint8_t lineBoundary{ 1 }, prevWord{ 2 }, addStart{ 4 }, matched{ 8 };
+			// Per state info
+			static constexpr std::uint8_t isMatch{ 1 }, isDead{ 2 };
+
+		private:
+			struct State
+			{
+				std::vector<std::uint32_t> insts;
+				std::uint8_t flags{};
+			};
+
+			const std::vector<Inst> * m_insts{ nullptr };
+			const std::vector<ByteSet> * m_sets{ nullptr };
+			std::uint32_t m_start{ 0 };
+			bool m_bLongest{ false };
+			ByteClasses m_classOf{};
+			std::array<std::uint8_t, 256> m_representative{};
+			std::size_t m_classCount{ 0 }, m_stride{ 0 }, m_maxStates{ 0 };
+
+			std::vector<State> m_states;
+			std::vector<std::int32_t> m_trans;
+			std::vector<std::uint8_t> m_info;
+			std::unordered_map<std::string, std::int32_t> m_index;
+			std::array<std::int32_t, 8> m_starts{};
+
+			std::vector<std::uint32_t> m_stack, m_threads;
+			SparseSet m_seen, m_targets;
+			std::string m_key;
+
+			void reset()
+			{
+				this->m_states.clear();
+				this->m_trans.clear();
+				this->m_info.clear();
+				this->m_index.clear();
+				this->m_starts.fill(-1);
+			}
+			std::int32_t intern(State && state)
+			{
+				this->m_key.assign(1, char(state.flags));
+				this->m_key.append(reinterpret_cast<const char *>(state.insts.data()), state.insts.size() * sizeof(std::uint32_t));
+				auto [it, bNew] = this->m_index.try_emplace(this->m_key, std::int32_t(this->m_states.size()));
+				if (!bNew)
+				{
+					return it->second;
+				}
+
+				std::uint8_t info = 0;
+				if (state.flags & matched)
+				{
+					info |= isMatch;
+				}
+				if (state.insts.empty() && !(state.flags & addStart))
+				{
+					info |= isDead;
+				}
+				this->m_info.push_back(info);
+				this->m_states.push_back(std::move(state));
+				this->m_trans.resize(this->m_trans.size() + this->m_stride, -1);
+				return it->second;
+			}
+			[[nodiscard]] bool holds(Assertion assertion, bool bLineStart, bool bLineEnd, bool bBoundary) const noexcept
+			{
+				switch (assertion)
+				{
+				case Assertion::lineStart:
+					return bLineStart;
+				case Assertion::lineEnd:
+					return bLineEnd;
+				case Assertion::wordBoundary:
+					return bBoundary;
+				case Assertion::notWordBoundary:
+					return !bBoundary;
+				}
+				return false;
+			}
+			// Class 'm_classCount' is the end of the text
+			State step(const State & from, std::size_t cls)
+			{
+				const auto & insts = *this->m_insts;
+				bool bEnd = (cls == this->m_classCount);
+				auto byte = bEnd ? 0 : this->m_representative[cls];
+				bool bLineStart = from.flags & lineBoundary;
+				bool bLineEnd = bEnd || byte == '\n';
+				bool bBoundary = bool(from.flags & prevWord) != (!bEnd && isWord(byte));
+
+				this->m_seen.clear();
+				this->m_threads.clear();
+				bool bMatch = false, bCut = false;
+				auto follow = [&](std::uint32_t pc)
+				{
+					this->m_stack.assign(1, pc);
+					while (!this->m_stack.empty())
+					{
+						pc = this->m_stack.back();
+						this->m_stack.pop_back();
+						if (!this->m_seen.insert(pc))
+						{
+							continue;
+						}
+						const auto & inst = insts[pc];
+						switch (inst.op)
+						{
+						case Op::byteRange:
+						case Op::byteSet:
+							this->m_threads.push_back(pc);
+							break;
+						case Op::split:
+							this->m_stack.push_back(inst.alt);
+							this->m_stack.push_back(inst.next);
+							break;
+						case Op::assertion:
+							if (!this->holds(inst.assertion, bLineStart, bLineEnd, bBoundary))
+							{
+								break;
+							}
+							[[fallthrough]];
+						case Op::jump:
+						case Op::save:
+						case Op::progress:
+							this->m_stack.push_back(inst.next);
+							break;
+						case Op::match:
+							bMatch = true;
+							if (!this->m_bLongest)
+							{
+								bCut = true;
+								return;
+							}
+							break;
+						default:
+							break;
+						}
+					}
+				};
+				for (auto pc : from.insts)
+				{
+					follow(pc);
+					if (bCut)
+					{
+						break;
+					}
+				}
+				if ((from.flags & addStart) && !bCut)
+				{
+					follow(this->m_start);
+				}
+
+				State to;
+				to.flags = bMatch ? matched : 0;
+				if (bEnd)
+				{
+					return to;
+				}
+				if (byte == '\n')
+				{
+					to.flags |= lineBoundary;
+				}
+				if (isWord(byte))
+				{
+					to.flags |= prevWord;
+				}
+				if ((from.flags & addStart) && !bCut)
+				{
+					to.flags |= addStart;
+				}
+				this->m_targets.clear();
+				for (auto pc : this->m_threads)
+				{
+					const auto & inst = insts[pc];
+					if (accepts(inst, *this->m_sets, byte) && this->m_targets.insert(inst.next))
+					{
+						to.insts.push_back(inst.next);
+					}
+				}
+				return to;
+			}
+			std::int32_t build(std::int32_t state, std::size_t cls)
+			{
+				auto target = this->step(this->m_states[std::size_t(state)], cls);
+				// Starting over is cheaper than tracking which states are still used
+				bool bFull = this->m_states.size() >= this->m_maxStates;
+				if (bFull)
+				{
+					this->reset();
+				}
+				auto index = this->intern(std::move(target));
+				if (!bFull)
+				{
+					this->m_trans[std::size_t(state) * this->m_stride + cls] = index;
+				}
+				return index;
+			}
+
+		public:
+			void init(const std::vector<Inst> & insts, const std::vector<ByteSet> & sets, std::uint32_t start, bool bLongest, const ByteClasses & classes, std::size_t classCount)
+			{
+				this->m_insts = &insts;
+				this->m_sets = &sets;
+				this->m_start = start;
+				this->m_bLongest = bLongest;
+				this->m_classOf = classes;
+				this->m_classCount = classCount;
+				for (std::size_t b = 256; b-- > 0;)
+				{
+					this->m_representative[classes[b]] = std::uint8_t(b);
+				}
+				this->m_stride = classCount + 1;
+				this->m_maxStates = std::max<std::size_t>(64, (4 << 20) / (this->m_stride * sizeof(std::int32_t)));
+				this->m_seen.resize(insts.size());
+				this->m_targets.resize(insts.size());
+				this->reset();
+			}
+
+			std::int32_t start(std::uint8_t flags, bool bAnchored)
+			{
+				auto & slot = this->m_starts[flags & 7];
+				if (slot < 0)
+				{
+					State state;
+					state.flags = flags;
+					if (bAnchored)
+					{
+						state.insts.push_back(this->m_start);
+					}
+					slot = this->intern(std::move(state));
+				}
+				return slot;
+			}
+			// The same state without new matches starting from here on
+			std::int32_t stopStarting(std::int32_t state)
+			{
+				if (!(this->m_states[std::size_t(state)].flags & addStart))
+				{
+					return state;
+				}
+				auto copy = this->m_states[std::size_t(state)];
+				copy.flags &= ~addStart;
+				if (this->m_states.size() >= this->m_maxStates)
+				{
+					this->reset();
+				}
+				return this->intern(std::move(copy));
+			}
+			std::int32_t next(std::int32_t state, unsigned char byte)
+			{
+				auto cls = this->m_classOf[byte];
+				auto target = this->m_trans[std::size_t(state) * this->m_stride + cls];
+				return (target >= 0) ? target : this->build(state, cls);
+			}
+			std::int32_t end(std::int32_t state)
+			{
+				auto target = this->m_trans[std::size_t(state) * this->m_stride + this->m_classCount];
+				return (target >= 0) ? target : this->build(state, this->m_classCount);
+			}
+			[[nodiscard]] std::uint8_t info(std::int32_t state) const noexcept
+			{
+				return this->m_info[std::size_t(state)];
+			}
+		};
+
+		// Bytes a match can start with, all of them if it can be empty or starts with a backreference
+		[[nodiscard]] ByteSet firstBytes(const std::vector<Inst> & insts, const std::vector<ByteSet> & sets, std::uint32_t start)
+		{
+			ByteSet first{};
+			std::vector<bool> seen(insts.size());
+			std::vector<std::uint32_t> stack{ start };
+			while (!stack.empty())
+			{
+				auto pc = stack.back();
+				stack.pop_back();
+				if (seen[pc])
+				{
+					continue;
+				}
+				seen[pc] = true;
+				const auto & inst = insts[pc];
+				switch (inst.op)
+				{
+				case Op::byteRange:
+				case Op::byteSet:
+					for (unsigned c = 0; c < 256; ++c)
+					{
+						if (accepts(inst, sets, (unsigned char)c))
+						{
+							first[c / 64] |= std::uint64_t(1) << (c % 64);
+						}
+					}
+					break;
+				case Op::split:
+					stack.push_back(inst.alt);
+					stack.push_back(inst.next);
+					break;
+				case Op::jump:
+				case Op::save:
+				case Op::progress:
+				case Op::assertion:
+				case Op::look:
+					stack.push_back(inst.next);
+					break;
+				case Op::backref:
+				case Op::match:
+					first.fill(~std::uint64_t(0));
+					return first;
+				}
+			}
+			return first;
+		}
+
+		enum class Strategy : std::uint8_t
+		{
+			// Every match starts with a literal, the DFA runs anchored at its occurrences
+			prefix,
+			// Matches contain a literal and stay within lines, only those lines are searched
+			lines,
+			// The unanchored DFA reads everything
+			scan
+		};
+	}
+
+	struct RegexSearch::Program
+	{
+		std::vector<Inst> insts, reverse;
+		std::vector<ByteSet> sets;
+		std::uint32_t start{}, reverseStart{};
+		std::uint32_t groups{};
+		// Saves, marks of empty loop checks included
+		std::size_t slots{};
+		CaseMode mode{};
+		bool bBacktrack{ false }, bBackrefs{ false };
+		Strategy strategy{ Strategy::scan };
+		// No match spans a line break
+		bool bSingleLine{ false };
+		LiteralSearch literal;
+		// Only set for the backtracker, the DFA skips bytes well enough
+		ByteSet first{};
+		ByteClasses classes{};
+		std::size_t classCount{};
+	};
+
+	namespace
+	{
+		using io::putVarint;
+		using io::getVarint;
+
+		// Plain structs are stored as they are in memory, the format is tied to the build anyway
+		template<typename T>
+		void putRaw(std::string & out, const std::vector<T> & items)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			putVarint(out, items.size());
+			out.append(reinterpret_cast<const char *>(items.data()), items.size() * sizeof(T));
+		}
+		template<typename T>
+		bool getRaw(std::string_view & in, std::vector<T> & items)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			std::uint64_t count;
+			if (!getVarint(in, count) || count > in.size() / sizeof(T))
+			{
+				return false;
+			}
+			items.resize(std::size_t(count));
+			if (!items.empty())
+			{
+				std::memcpy(items.data(), in.data(), items.size() * sizeof(T));
+			}
+			in.remove_prefix(items.size() * sizeof(T));
+			return true;
+		}
+		// Every reference of a decoded program has to stay in bounds, whatever the data said
+		[[nodiscard]] bool validProgram(const std::vector<Inst> & insts, std::size_t sets, std::size_t slots, std::size_t groups) noexcept
+		{
+			for (const auto & inst : insts)
+			{
+				if (inst.next >= insts.size() || inst.alt >= insts.size() || inst.op > Op::match ||
+					(inst.op == Op::byteSet && inst.arg >= sets) ||
+					((inst.op == Op::save || inst.op == Op::progress) && inst.arg >= slots) ||
+					(inst.op == Op::backref && inst.arg > groups))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	struct RegexSearch::Cache
+	{
+		std::mutex mutex;
+		Dfa forward, reverse;
+
+		explicit Cache(const Program & program)
+		{
+			if (!program.bBacktrack)
+			{
+				this->forward.init(program.insts, program.sets, program.start, false, program.classes, program.classCount);
+				this->reverse.init(program.reverse, program.sets, program.reverseStart, true, program.classes, program.classCount);
+			}
+		}
+	};
+
+	namespace
+	{
+		struct ViewText
+		{
+			std::string_view text;
+			mutable std::size_t lineStart{ 1 }, lineEnd{ 0 };
+
+			[[nodiscard]] std::size_t size() const noexcept
+			{
+				return this->text.size();
+			}
+			[[nodiscard]] unsigned char at(std::size_t offset) const noexcept
+			{
+				return (unsigned char)this->text[offset];
+			}
+			template<typename Fn>
+			void forEachChunk(std::size_t offset, std::size_t count, Fn && fn) const
+			{
+				if (count != 0)
+				{
+					fn(this->text.substr(offset, count));
+				}
+			}
+			std::size_t copy(std::size_t offset, std::span<char> out) const noexcept
+			{
+				return this->text.copy(out.data(), out.size(), offset);
+			}
+			// First byte of the line and its '\n' or the end of the text
+			[[nodiscard]] std::pair<std::size_t, std::size_t> line(std::size_t, std::size_t offset) const noexcept
+			{
+				if (this->lineStart > offset || offset > this->lineEnd)
+				{
+					auto start = (offset == 0) ? std::string_view::npos : this->text.rfind('\n', offset - 1);
+					auto end = this->text.find('\n', offset);
+					this->lineStart = (start == std::string_view::npos) ? 0 : start + 1;
+					this->lineEnd = (end == std::string_view::npos) ? this->text.size() : end;
+				}
+				return { this->lineStart, this->lineEnd };
+			}
+			[[nodiscard]] std::optional<SearchMatch> find(const LiteralSearch & literal, std::size_t from) const noexcept
+			{
+				return literal.findIn(this->text, from);
+			}
+		};
+
+		struct SnapshotText
+		{
+			// Lines starting this close to where the search resumed are found by reading the text
+			static constexpr std::size_t nearby{ 64 << 10 };
+
+			const TextSnapshot & text;
+			// The last line looked up, matches tend to come several per line
+			mutable std::size_t lineStart{ 1 }, lineEnd{ 0 };
+
+			[[nodiscard]] std::size_t size() const noexcept
+			{
+				return this->text.size();
+			}
+			[[nodiscard]] unsigned char at(std::size_t offset) const noexcept
+			{
+				return (unsigned char)this->text.at(offset);
+			}
+			template<typename Fn>
+			void forEachChunk(std::size_t offset, std::size_t count, Fn && fn) const
+			{
+				this->text.forEachChunk(offset, count, std::forward<Fn>(fn));
+			}
+			std::size_t copy(std::size_t offset, std::span<char> out) const
+			{
+				return this->text.copy(offset, out);
+			}
+			// Line of 'offset', the search went on from 'from' <= offset
+			[[nodiscard]] std::pair<std::size_t, std::size_t> line(std::size_t from, std::size_t offset) const
+			{
+				if (this->lineStart <= offset && offset <= this->lineEnd)
+				{
+					return { this->lineStart, this->lineEnd };
+				}
+
+				auto start = npos;
+				if (offset - from <= nearby)
+				{
+					// The byte before 'from' tells whether a line starts right there
+					auto begin = (from == 0) ? 0 : from - 1;
+					this->text.forEachChunk(begin, offset - begin, [&](std::string_view chunk)
+					{
+						if (auto at = chunk.rfind('\n'); at != std::string_view::npos)
+						{
+							start = begin + at + 1;
+						}
+						begin += chunk.size();
+						return true;
+					});
+					if (start == npos && from == 0)
+					{
+						start = 0;
+					}
+				}
+				if (start == npos)
+				{
+					start = this->text.lineStart(this->text.lineOf(offset));
+				}
+
+				auto end = offset;
+				bool bFound = false;
+				this->text.forEachChunk(offset, this->text.size() - offset, [&](std::string_view chunk)
+				{
+					if (auto at = chunk.find('\n'); at != std::string_view::npos)
+					{
+						end += at;
+						bFound = true;
+						return false;
+					}
+					end += chunk.size();
+					return true;
+				});
+
+				this->lineStart = start;
+				this->lineEnd = bFound ? end : this->text.size();
+				return { this->lineStart, this->lineEnd };
+			}
+			[[nodiscard]] std::optional<SearchMatch> find(const LiteralSearch & literal, std::size_t from) const
+			{
+				return literal.find(this->text, from);
+			}
+		};
+
+		template<typename Text>
+		[[nodiscard]] std::uint8_t contextBefore(const Text & text, std::size_t offset) noexcept
+		{
+			if (offset == 0)
+			{
+				return Dfa::lineBoundary;
+			}
+			auto c = text.at(offset - 1);
+			return (c == '\n') ? Dfa::lineBoundary : isWord(c) ? Dfa::prevWord : 0;
+		}
+
+		/*
+		 * Runs the leftmost-first DFA over [from, limit), matches may start before
+		 * 'startLimit'. Returns the end of the match found.
+		 */
+		template<typename Text>
+		std::optional<std::size_t> forward(Dfa & dfa, const Text & text, std::size_t from, std::size_t startLimit, std::size_t limit, bool bAnchored)
+		{
+			auto state = dfa.start(contextBefore(text, from) | (bAnchored ? 0 : Dfa::addStart), bAnchored);
+			std::optional<std::size_t> end;
+			bool bDead = false;
+
+			auto feed = [&](std::size_t begin, std::size_t stop)
+			{
+				auto pos = begin;
+				text.forEachChunk(begin, stop - begin, [&](std::string_view chunk)
+				{
+					auto p = reinterpret_cast<const unsigned char *>(chunk.data());
+					for (std::size_t i = 0; i < chunk.size(); ++i)
+					{
+						state = dfa.next(state, p[i]);
+						if (auto info = dfa.info(state); info != 0)
+						{
+							if (info & Dfa::isMatch)
+							{
+								end = pos + i;
+							}
+							if (info & Dfa::isDead)
+							{
+								bDead = true;
+								return false;
+							}
+						}
+					}
+					pos += chunk.size();
+					return true;
+				});
+			};
+
+			auto split = std::clamp(startLimit, from, limit);
+			feed(from, split);
+			if (!bDead && split < limit)
+			{
+				state = dfa.stopStarting(state);
+				bDead = (dfa.info(state) & Dfa::isDead) != 0;
+				if (!bDead)
+				{
+					feed(split, limit);
+				}
+			}
+			if (!bDead)
+			{
+				state = (limit < text.size()) ? dfa.next(state, text.at(limit)) : dfa.end(state);
+				if (dfa.info(state) & Dfa::isMatch)
+				{
+					end = limit;
+				}
+			}
+			return end;
+		}
+		// Runs the reverse longest-match DFA from 'end' back to 'limit', returns where the match starts
+		template<typename Text>
+		std::optional<std::size_t> backward(Dfa & dfa, const Text & text, std::size_t end, std::size_t limit)
+		{
+			std::uint8_t flags = Dfa::lineBoundary;
+			if (end < text.size())
+			{
+				auto c = text.at(end);
+				flags = (c == '\n') ? Dfa::lineBoundary : isWord(c) ? Dfa::prevWord : 0;
+			}
+			auto state = dfa.start(flags, true);
+			std::optional<std::size_t> start;
+
+			std::array<char, 4096> buffer;
+			auto pos = end;
+			while (pos > limit)
+			{
+				auto count = std::min(buffer.size(), pos - limit);
+				text.copy(pos - count, std::span{ buffer.data(), count });
+				for (auto i = count; i-- > 0;)
+				{
+					state = dfa.next(state, (unsigned char)buffer[i]);
+					if (auto info = dfa.info(state); info != 0)
+					{
+						if (info & Dfa::isMatch)
+						{
+							start = pos - count + i + 1;
+						}
+						if (info & Dfa::isDead)
+						{
+							return start;
+						}
+					}
+				}
+				pos -= count;
+			}
+			state = (limit > 0) ? dfa.next(state, text.at(limit - 1)) : dfa.end(state);
+			if (dfa.info(state) & Dfa::isMatch)
+			{
+				start = limit;
+			}
+			return start;
+		}
+
+		template<typename Text>
+		std::optional<SearchMatch> dfaSearch(const RegexSearch::Program & program, RegexSearch::Cache & cache, const Text & text, std::size_t from, std::size_t startLimit)
+		{
+			const auto size = text.size();
+			auto match = [&](std::size_t begin, std::size_t stop) -> std::optional<SearchMatch>
+			{
+				auto end = forward(cache.forward, text, begin, startLimit, stop, false);
+				if (!end)
+				{
+					return std::nullopt;
+				}
+				auto start = backward(cache.reverse, text, *end, begin).value_or(*end);
+				return SearchMatch{ start, *end - start };
+			};
+
+			switch (program.strategy)
+			{
+			case Strategy::prefix:
+				for (auto pos = from; ; )
+				{
+					auto candidate = text.find(program.literal, pos);
+					if (!candidate || candidate->offset >= startLimit)
+					{
+						return std::nullopt;
+					}
+					if (auto end = forward(cache.forward, text, candidate->offset, startLimit, size, true))
+					{
+						return SearchMatch{ candidate->offset, *end - candidate->offset };
+					}
+					pos = candidate->offset + 1;
+				}
+			case Strategy::lines:
+				for (auto pos = from; ; )
+				{
+					auto candidate = text.find(program.literal, pos);
+					if (!candidate)
+					{
+						return std::nullopt;
+					}
+					auto [lineStart, lineEnd] = text.line(pos, candidate->offset);
+					auto begin = std::max(lineStart, pos);
+					if (begin >= startLimit)
+					{
+						return std::nullopt;
+					}
+					if (auto found = match(begin, lineEnd))
+					{
+						return found;
+					}
+					if (lineEnd >= size)
+					{
+						return std::nullopt;
+					}
+					pos = lineEnd + 1;
+				}
+			case Strategy::scan:
+				return match(from, size);
+			}
+			return std::nullopt;
+		}
+
+		/*
+		 * Backtracking over one line, only used for backreferences and lookaround.
+		 * Without backreferences a failed (instruction, position) pair fails for
+		 * every later start as well, so each one is tried once.
+		 */
+		class Backtracker
+		{
+		private:
+			struct Frame
+			{
+				std::uint32_t pc;
+				// Restores 'slot' to 'pos' if it is set, otherwise retries pc at pos
+				std::uint32_t slot;
+				std::size_t pos;
+			};
+			static constexpr std::uint32_t noSlot{ std::uint32_t(-1) };
+
+			const RegexSearch::Program & m_program;
+			std::string_view m_text;
+			std::vector<std::size_t> m_slots;
+			std::vector<Frame> m_stack;
+			// Position major, so a search touches a contiguous range of it
+			std::vector<std::uint64_t> m_visited;
+			std::size_t m_visitedLow{ npos }, m_visitedHigh{ 0 };
+			bool m_bMemo{ false };
+			std::unordered_map<std::uint64_t, bool> m_looks;
+
+			[[nodiscard]] bool wordAt(std::size_t pos) const noexcept
+			{
+				return pos < this->m_text.size() && isWord((unsigned char)this->m_text[pos]);
+			}
+			[[nodiscard]] bool holds(Assertion assertion, std::size_t pos) const noexcept
+			{
+				switch (assertion)
+				{
+				case Assertion::lineStart:
+					return pos == 0;
+				case Assertion::lineEnd:
+					return pos == this->m_text.size();
+				case Assertion::wordBoundary:
+				case Assertion::notWordBoundary:
+				{
+					bool bBoundary = (pos != 0 && this->wordAt(pos - 1)) != this->wordAt(pos);
+					return bBoundary == (assertion == Assertion::wordBoundary);
+				}
+				}
+				return false;
+			}
+			// Compares the captured text with the text before or after pos, moving pos past it
+			bool backref(std::uint32_t group, std::size_t & pos, bool bBackward) const noexcept
+			{
+				auto begin = this->m_slots[2 * group], end = this->m_slots[2 * group + 1];
+				if (begin == npos || end == npos || end < begin)
+				{
+					return true;
+				}
+				auto length = end - begin;
+				if (bBackward ? pos < length : this->m_text.size() - pos < length)
+				{
+					return false;
+				}
+				auto at = bBackward ? pos - length : pos;
+				auto captured = this->m_text.substr(begin, length), other = this->m_text.substr(at, length);
+
+				bool bEqual = true;
+				switch (this->m_program.mode)
+				{
+				case CaseMode::sensitive:
+					bEqual = captured == other;
+					break;
+				case CaseMode::ascii:
+					bEqual = std::equal(captured.begin(), captured.end(), other.begin(), [](char a, char b)
+					{
+						return asciiLower((unsigned char)a) == asciiLower((unsigned char)b);
+					});
+					break;
+				case CaseMode::unicode:
+					for (std::size_t i = 0, lenA, lenB; bEqual && i < length; i += lenA)
+					{
+						char32_t a, b;
+						if (!decode(captured, i, a, lenA) || !decode(other, i, b, lenB))
+						{
+							lenA = lenB = 1;
+							a = (unsigned char)captured[i];
+							b = (unsigned char)other[i];
+						}
+						bEqual = lenA == lenB && foldCase(a) == foldCase(b);
+					}
+					break;
+				}
+				if (bEqual)
+				{
+					pos = bBackward ? at : at + length;
+				}
+				return bEqual;
+			}
+			bool look(const Inst & inst, std::uint32_t pc, std::size_t pos)
+			{
+				auto key = (std::uint64_t(pc) << 40) | pos;
+				if (this->m_bMemo)
+				{
+					if (auto it = this->m_looks.find(key); it != this->m_looks.end())
+					{
+						return it->second;
+					}
+				}
+				auto saved = this->m_slots;
+				std::size_t end;
+				bool bFound = this->run(inst.alt, pos, inst.bBehind, false, end);
+				if (bFound == inst.bNegate)
+				{
+					this->m_slots = std::move(saved);
+				}
+				if (this->m_bMemo)
+				{
+					this->m_looks.emplace(key, bFound);
+				}
+				return bFound != inst.bNegate;
+			}
+
+		public:
+			Backtracker(const RegexSearch::Program & program) noexcept
+				: m_program{ program }
+			{
+			}
+
+			void reset(std::string_view text)
+			{
+				this->m_text = text;
+				this->m_looks.clear();
+				// A bit per instruction and position, unless that gets too large
+				auto bits = std::uint64_t(this->m_program.insts.size()) * (text.size() + 1);
+				this->m_bMemo = !this->m_program.bBackrefs && bits <= (std::uint64_t(256) << 20);
+				this->m_visited.assign(this->m_bMemo ? std::size_t((bits + 63) / 64) : 0, 0);
+				this->m_visitedLow = npos;
+				this->m_visitedHigh = 0;
+			}
+			// Forgets what the last search visited, cheaper than reset() on the same text
+			void rewind() noexcept
+			{
+				this->m_looks.clear();
+				if (this->m_visitedLow <= this->m_visitedHigh)
+				{
+					auto count = this->m_program.insts.size();
+					auto first = this->m_visitedLow * count / 64, last = ((this->m_visitedHigh + 1) * count + 63) / 64;
+					std::fill(this->m_visited.begin() + first, this->m_visited.begin() + last, 0);
+				}
+				this->m_visitedLow = npos;
+				this->m_visitedHigh = 0;
+			}
+
+			bool run(std::uint32_t pc, std::size_t pos, bool bBackward, bool bTop, std::size_t & end)
+			{
+				const auto & insts = this->m_program.insts;
+				auto base = this->m_stack.size();
+				this->m_stack.push_back({ pc, noSlot, pos });
+				while (this->m_stack.size() > base)
+				{
+					auto frame = this->m_stack.back();
+					this->m_stack.pop_back();
+					if (frame.slot != noSlot)
+					{
+						this->m_slots[frame.slot] = frame.pos;
+						continue;
+					}
+
+					pc = frame.pc;
+					pos = frame.pos;
+					for (bool bAlive = true; bAlive; )
+					{
+						if (this->m_bMemo && bTop)
+						{
+							auto bit = std::uint64_t(pos) * insts.size() + pc;
+							auto & word = this->m_visited[bit / 64];
+							if (word & (std::uint64_t(1) << (bit % 64)))
+							{
+								break;
+							}
+							word |= std::uint64_t(1) << (bit % 64);
+							this->m_visitedLow = std::min(this->m_visitedLow, pos);
+							this->m_visitedHigh = std::max(this->m_visitedHigh, pos);
+						}
+
+						const auto & inst = insts[pc];
+						switch (inst.op)
+						{
+						case Op::byteRange:
+						case Op::byteSet:
+						{
+							if (bBackward ? pos == 0 : pos == this->m_text.size())
+							{
+								bAlive = false;
+								break;
+							}
+							auto c = (unsigned char)this->m_text[bBackward ? pos - 1 : pos];
+							bAlive = accepts(inst, this->m_program.sets, c);
+							pos = bBackward ? pos - 1 : pos + 1;
+							pc = inst.next;
+							break;
+						}
+						case Op::split:
+							this->m_stack.push_back({ inst.alt, noSlot, pos });
+							pc = inst.next;
+							break;
+						case Op::jump:
+							pc = inst.next;
+							break;
+						case Op::save:
+							this->m_stack.push_back({ 0, inst.arg, this->m_slots[inst.arg] });
+							this->m_slots[inst.arg] = pos;
+							pc = inst.next;
+							break;
+						case Op::progress:
+							bAlive = this->m_slots[inst.arg] != pos;
+							pc = inst.next;
+							break;
+						case Op::assertion:
+							bAlive = this->holds(inst.assertion, pos);
+							pc = inst.next;
+							break;
+						case Op::backref:
+							bAlive = this->backref(inst.arg, pos, bBackward);
+							pc = inst.next;
+							break;
+						case Op::look:
+							bAlive = this->look(inst, pc, pos);
+							pc = inst.next;
+							break;
+						case Op::match:
+							end = pos;
+							this->m_stack.resize(base);
+							return true;
+						}
+					}
+				}
+				return false;
+			}
+			// Leftmost match in the line starting in [from, startLimit)
+			std::optional<SearchMatch> search(std::size_t from, std::size_t startLimit)
+			{
+				const auto & first = this->m_program.first;
+				for (auto start = from; start < startLimit && start <= this->m_text.size(); ++start)
+				{
+					if (start < this->m_text.size() && !contains(first, (unsigned char)this->m_text[start]))
+					{
+						continue;
+					}
+					this->m_slots.assign(this->m_program.slots, npos);
+					std::size_t end;
+					if (this->run(this->m_program.start, start, false, true, end))
+					{
+						return SearchMatch{ start, end - start };
+					}
+				}
+				return std::nullopt;
+			}
+		};
+
+		// What the backtracker keeps between the searches of a scan
+		struct Scratch
+		{
+			Backtracker backtracker;
+			std::string line;
+			std::size_t lineStart{ npos };
+
+			explicit Scratch(const RegexSearch::Program & program) noexcept
+				: backtracker{ program }
+			{
+			}
+		};
+
+		template<typename Text>
+		std::optional<SearchMatch> backtrackSearch(const RegexSearch::Program & program, const Text & text, std::size_t from, std::size_t startLimit, Scratch & scratch)
+		{
+			auto & line = scratch.line;
+			for (auto pos = from; pos < startLimit && pos <= text.size(); )
+			{
+				auto at = pos;
+				if (!program.literal.empty())
+				{
+					auto candidate = text.find(program.literal, pos);
+					if (!candidate)
+					{
+						return std::nullopt;
+					}
+					at = candidate->offset;
+				}
+
+				auto [lineStart, lineEnd] = text.line(pos, at);
+				auto begin = std::max(lineStart, pos);
+				if (begin >= startLimit)
+				{
+					return std::nullopt;
+				}
+				if (scratch.lineStart != lineStart || line.size() != lineEnd - lineStart)
+				{
+					line.resize(lineEnd - lineStart);
+					text.copy(lineStart, line);
+					scratch.lineStart = lineStart;
+					scratch.backtracker.reset(line);
+				}
+				else
+				{
+					scratch.backtracker.rewind();
+				}
+				if (auto found = scratch.backtracker.search(begin - lineStart, startLimit - lineStart))
+				{
+					found->offset += lineStart;
+					return found;
+				}
+				pos = lineEnd + 1;
+			}
+			return std::nullopt;
+		}
+
+		template<typename Text>
+		std::optional<SearchMatch> search(const RegexSearch::Program & program, RegexSearch::Cache & cache, const Text & text, std::size_t from, std::size_t startLimit, Scratch & scratch)
+		{
+			startLimit = std::min(startLimit, text.size() + 1);
+			if (from >= startLimit)
+			{
+				return std::nullopt;
+			}
+			if (program.bBacktrack)
+			{
+				return backtrackSearch(program, text, from, startLimit, scratch);
+			}
+			std::scoped_lock lock{ cache.mutex };
+			return dfaSearch(program, cache, text, from, startLimit);
+		}
+
+		// Empty matches move the next search on by a code point
+		template<typename Text>
+		std::size_t nextStart(const Text & text, const SearchMatch & match)
+		{
+			auto pos = match.offset + match.length;
+			if (match.length == 0)
+			{
+				++pos;
+				while (pos < text.size() && (text.at(pos) & 0xC0) == 0x80)
+				{
+					++pos;
+				}
+			}
+			return pos;
+		}
+
+		/*
+		 * Scan for patterns whose matches never span a line break. Blocks of
+		 * whole lines are copied out of the snapshot and searched as one string,
+		 * so dense matches don't pay for finding their place in the tree.
+		 */
+		bool scanLines(const RegexSearch::Program & program, RegexSearch::Cache & cache, const TextSnapshot & text, std::size_t from, std::size_t to, const RegexSearch::MatchFn & fn)
+		{
+			constexpr std::size_t blockSize{ 256 << 10 };
+
+			Scratch scratch{ program };
+			std::string block;
+			auto blockStart = text.lineStart(text.lineOf(from));
+			auto pos = from;
+			while (pos < to)
+			{
+				// Up to the last line break, a line longer than the block makes it grow
+				auto end = std::min(blockStart + blockSize, text.size());
+				block.resize(end - blockStart);
+				text.copy(blockStart, block);
+				auto cut = block.rfind('\n');
+				while (cut == std::string::npos && end < text.size())
+				{
+					auto old = block.size();
+					end = std::min(end + blockSize, text.size());
+					block.resize(end - blockStart);
+					text.copy(blockStart + old, std::span{ block }.subspan(old));
+					cut = block.find('\n', old);
+				}
+				if (cut != std::string::npos)
+				{
+					block.resize(cut);
+				}
+				auto blockEnd = blockStart + block.size();
+
+				ViewText view{ block };
+				scratch.lineStart = npos;
+				auto startLimit = std::min(to, blockEnd + 1) - blockStart;
+				for (auto at = pos - blockStart; ; )
+				{
+					auto match = search(program, cache, view, at, startLimit, scratch);
+					if (!match)
+					{
+						break;
+					}
+					at = nextStart(view, *match);
+					match->offset += blockStart;
+					if (!fn(*match))
+					{
+						return false;
+					}
+				}
+				pos = blockStart = blockEnd + 1;
+			}
+			return true;
+		}
+	}
+
+	COMFYDX_API RegexSearch::RegexSearch() noexcept = default;
+	COMFYDX_API RegexSearch::RegexSearch(std::string_view pattern, CaseMode mode)
+	{
+		try
+		{
+			Parser parser{ pattern, mode };
+			auto root = parser.parse();
+
+			auto program = std::make_shared<Program>();
+			program->groups = parser.groups;
+			program->mode = mode;
+			program->bBackrefs = parser.bBackrefs;
+			program->bBacktrack = parser.bBackrefs || parser.bLook;
+
+			// Empty loop checks need slots of their own, after the groups'
+			auto groupSlots = 2 * (std::size_t(program->groups) + 1);
+			Compiler compiler{ program->insts, program->sets, program->bBacktrack, false, groupSlots };
+			auto match = std::uint32_t(program->insts.size());
+			program->insts.push_back(makeInst(Op::match));
+			program->start = compiler.compile(root, match, false);
+			program->slots = program->bBacktrack ? groupSlots + program->insts.size() : groupSlots;
+
+			auto lits = literals(root);
+			bool bNewline = false;
+			if (!program->bBacktrack)
+			{
+				Compiler reverse{ program->reverse, program->sets, false, true, 0 };
+				program->reverse.push_back(makeInst(Op::match));
+				program->reverseStart = reverse.compile(root, 0, true);
+
+				// Bytes no instruction tells apart share a class
+				std::array<bool, 257> boundary{};
+				boundary[0] = true;
+				for (auto c : { '\n', '0', 'A', '_', 'a' })
+				{
+					boundary[std::size_t(c)] = true;
+				}
+				for (auto c : { '\n', '9', 'Z', '_', 'z' })
+				{
+					boundary[std::size_t(c) + 1] = true;
+				}
+				for (const auto & inst : program->insts)
+				{
+					if (inst.op == Op::byteRange && inst.lo <= inst.hi)
+					{
+						boundary[inst.lo] = true;
+						boundary[std::size_t(inst.hi) + 1] = true;
+						bNewline = bNewline || (inst.lo <= '\n' && inst.hi >= '\n');
+					}
+				}
+				for (const auto & set : program->sets)
+				{
+					for (std::size_t b = 1; b < 256; ++b)
+					{
+						boundary[b] = boundary[b] || contains(set, std::uint8_t(b)) != contains(set, std::uint8_t(b - 1));
+					}
+					bNewline = bNewline || contains(set, '\n');
+				}
+				std::size_t cls = 0;
+				for (std::size_t b = 0; b < 256; ++b)
+				{
+					if (b != 0 && boundary[b])
+					{
+						++cls;
+					}
+					program->classes[b] = std::uint8_t(cls);
+				}
+				program->classCount = cls + 1;
+				program->bSingleLine = !bNewline;
+
+				if (!lits.prefix.empty() && lits.prefix.size() >= lits.required.size())
+				{
+					program->strategy = Strategy::prefix;
+					program->literal = LiteralSearch{ lits.prefix, mode };
+				}
+				else if (!lits.required.empty() && !bNewline)
+				{
+					program->strategy = Strategy::lines;
+					program->literal = LiteralSearch{ lits.required, mode };
+				}
+				else if (!lits.prefix.empty())
+				{
+					program->strategy = Strategy::prefix;
+					program->literal = LiteralSearch{ lits.prefix, mode };
+				}
+			}
+			else
+			{
+				program->strategy = Strategy::lines;
+				program->literal = LiteralSearch{ lits.required, mode };
+				program->first = firstBytes(program->insts, program->sets, program->start);
+				program->bSingleLine = true;
+			}
+
+			this->m_cache = std::make_unique<Cache>(*program);
+			this->m_program = std::move(program);
+		}
+		catch (const PatternError & e)
+		{
+			this->m_error = e.message;
+			this->m_errorOffset = e.offset;
+		}
+	}
+	COMFYDX_API RegexSearch::RegexSearch(const RegexSearch & other)
+		: m_program{ other.m_program }, m_error{ other.m_error }, m_errorOffset{ other.m_errorOffset }
+	{
+		if (this->m_program)
+		{
+			this->m_cache = std::make_unique<Cache>(*this->m_program);
+		}
+	}
+	COMFYDX_API RegexSearch & RegexSearch::operator=(const RegexSearch & other)
+	{
+		if (this != &other)
+		{
+			*this = RegexSearch{ other };
+		}
+		return *this;
+	}
+	COMFYDX_API RegexSearch::RegexSearch(RegexSearch && other) noexcept = default;
+	COMFYDX_API RegexSearch & RegexSearch::operator=(RegexSearch && other) noexcept = default;
+	COMFYDX_API RegexSearch::~RegexSearch() noexcept = default;
+
+	COMFYDX_API std::size_t RegexSearch::groupCount() const noexcept
+	{
+		return this->m_program ? this->m_program->groups : 0;
+	}
+	COMFYDX_API bool RegexSearch::backtracking() const noexcept
+	{
+		return this->m_program && this->m_program->bBacktrack;
+	}
+
+	COMFYDX_API void RegexSearch::encode(std::string & out) const
+	{
+		if (!this->m_program)
+		{
+			putVarint(out, 0);
+			return;
+		}
+		const auto & program = *this->m_program;
+		putVarint(out, 1);
+		putVarint(out, std::uint64_t(program.mode));
+		putVarint(out, std::uint64_t(program.strategy));
+		putVarint(out, std::uint64_t(program.bBacktrack) | (std::uint64_t(program.bBackrefs) << 1) | (std::uint64_t(program.bSingleLine) << 2));
+		putVarint(out, program.groups);
+		putVarint(out, program.slots);
+		putVarint(out, program.start);
+		putVarint(out, program.reverseStart);
+		putVarint(out, program.classCount);
+		io::putBytes(out, program.literal.needle());
+		putRaw(out, program.insts);
+		putRaw(out, program.reverse);
+		putRaw(out, program.sets);
+		out.append(reinterpret_cast<const char *>(program.first.data()), sizeof(program.first));
+		out.append(reinterpret_cast<const char *>(program.classes.data()), sizeof(program.classes));
+	}
+	COMFYDX_API bool RegexSearch::decode(std::string_view & in)
+	{
+		*this = RegexSearch{};
+		std::uint64_t bValid;
+		if (!getVarint(in, bValid) || bValid > 1)
+		{
+			return false;
+		}
+		if (!bValid)
+		{
+			return true;
+		}
+
+		auto program = std::make_shared<Program>();
+		std::uint64_t mode, strategy, flags, groups, slots, start, reverseStart, classCount;
+		std::string_view needle;
+		if (!getVarint(in, mode) || !getVarint(in, strategy) || !getVarint(in, flags) || !getVarint(in, groups) || !getVarint(in, slots) ||
+			!getVarint(in, start) || !getVarint(in, reverseStart) || !getVarint(in, classCount) || !io::getBytes(in, needle) ||
+			!getRaw(in, program->insts) || !getRaw(in, program->reverse) || !getRaw(in, program->sets) ||
+			in.size() < sizeof(program->first) + sizeof(program->classes))
+		{
+			return false;
+		}
+		std::memcpy(program->first.data(), in.data(), sizeof(program->first));
+		in.remove_prefix(sizeof(program->first));
+		std::memcpy(program->classes.data(), in.data(), sizeof(program->classes));
+		in.remove_prefix(sizeof(program->classes));
+
+		if (mode > std::uint64_t(CaseMode::unicode) || strategy > std::uint64_t(Strategy::scan) || flags > 7 || classCount > 256 ||
+			start >= program->insts.size() || (!program->reverse.empty() && reverseStart >= program->reverse.size()) ||
+			!validProgram(program->insts, program->sets.size(), slots, groups) || !validProgram(program->reverse, program->sets.size(), slots, groups))
+		{
+			return false;
+		}
+		// The backtracker has no byte classes
+		for (auto cls : program->classes)
+		{
+			if (cls >= classCount && classCount != 0)
+			{
+				return false;
+			}
+		}
+		program->mode = CaseMode(mode);
+		program->strategy = Strategy(strategy);
+		program->bBacktrack = (flags & 1) != 0;
+		program->bBackrefs = (flags & 2) != 0;
+		program->bSingleLine = (flags & 4) != 0;
+		program->groups = std::uint32_t(groups);
+		program->slots = std::size_t(slots);
+		program->start = std::uint32_t(start);
+		program->reverseStart = std::uint32_t(reverseStart);
+		program->classCount = std::size_t(classCount);
+		program->literal = LiteralSearch{ needle, program->mode };
+
+		this->m_cache = std::make_unique<Cache>(*program);
+		this->m_program = std::move(program);
+		return true;
+	}
+
+	COMFYDX_API std::optional<SearchMatch> RegexSearch::findIn(std::string_view text, std::size_t from) const
+	{
+		if (!this->m_program)
+		{
+			return std::nullopt;
+		}
+		Scratch scratch{ *this->m_program };
+		return search(*this->m_program, *this->m_cache, ViewText{ text }, from, text.size() + 1, scratch);
+	}
+
+	COMFYDX_API bool RegexSearch::scan(const TextSnapshot & text, std::size_t from, std::size_t to, const MatchFn & fn) const
+	{
+		to = std::min(to, text.size());
+		if (!this->m_program || from >= to)
+		{
+			return true;
+		}
+		if (this->m_program->bSingleLine)
+		{
+			return scanLines(*this->m_program, *this->m_cache, text, from, to, fn);
+		}
+
+		SnapshotText source{ text };
+		Scratch scratch{ *this->m_program };
+		for (auto pos = from; pos < to; )
+		{
+			auto match = search(*this->m_program, *this->m_cache, source, pos, to, scratch);
+			if (!match)
+			{
+				break;
+			}
+			if (!fn(*match))
+			{
+				return false;
+			}
+			pos = nextStart(source, *match);
+		}
+		return true;
+	}
+	COMFYDX_API std::optional<SearchMatch> RegexSearch::find(const TextSnapshot & text, std::size_t from) const
+	{
+		if (!this->m_program)
+		{
+			return std::nullopt;
+		}
+		Scratch scratch{ *this->m_program };
+		return search(*this->m_program, *this->m_cache, SnapshotText{ text }, from, text.size() + 1, scratch);
+	}
+	COMFYDX_API std::optional<SearchMatch> RegexSearch::findPrev(const TextSnapshot & text, std::size_t before) const
+	{
+		if (!this->m_program)
+		{
+			return std::nullopt;
+		}
+		before = std::min(before, text.size());
+
+		// Scans forward from line starts further and further back
+		std::size_t window = 64 * 1024;
+		while (before > 0)
+		{
+			auto start = text.lineStart(text.lineOf((before > window) ? before - window : 0));
+			std::optional<SearchMatch> last;
+			this->scan(text, start, before, [&last](const SearchMatch & match)
+			{
+				last = match;
+				return true;
+			});
+			if (last)
+			{
+				return last;
+			}
+			before = start;
+			window *= 2;
+		}
+		return std::nullopt;
+	}
+}
@@ -55,57 +55,37 @@ COMFYDX_API std::wstring ce::conv(std::string_view str)
 	return out;
 }
 
-template<> COMFYDX_API float ce::stof<float>(std::string_view str, std::size_t * pos)
+namespace
 {
-	char * ptr;
-	auto val = std::strtof(str.data(), &ptr);
-	if (str.data() == ptr)
-	{
-		throw std::invalid_argument("stof<float>");
-	}
-	else if (errno == ERANGE)
+	template<std::floating_point F>
+	F stofImpl(std::string_view str, std::size_t * pos, const char * name)
 	{
-		throw std::out_of_range("stof<float>");
+		auto res = ce::toNum<F>(str);
+		if (res.error == std::errc::invalid_argument)
+		{
+			throw std::invalid_argument(name);
+		}
+		else if (res.error == std::errc::result_out_of_range)
+		{
+			throw std::out_of_range(name);
+		}
+		else if (pos != nullptr)
+		{
+			*pos = res.pos;
+		}
+		return res.value;
 	}
-	else if (pos != nullptr)
-	{
-		*pos = std::size_t(ptr - str.data());
-	}
-	return val;
+}
+
+template<> COMFYDX_API float ce::stof<float>(std::string_view str, std::size_t * pos)
+{
+	return stofImpl<float>(str, pos, "stof<float>");
 }
 template<> COMFYDX_API double ce::stof<double>(std::string_view str, std::size_t * pos)
 {
-	char * ptr;
-	auto val = std::strtod(str.data(), &ptr);
-	if (str.data() == ptr)
-	{
-		throw std::invalid_argument("stof<double>");
-	}
-	else if (errno == ERANGE)
-	{
-		throw std::out_of_range("stof<double>");
-	}
-	else if (pos != nullptr)
-	{
-		*pos = std::size_t(ptr - str.data());
-	}
-	return val;
+	return stofImpl<double>(str, pos, "stof<double>");
 }
 template<> COMFYDX_API long double ce::stof<long double>(std::string_view str, std::size_t * pos)
 {
-	char * ptr;
-	auto val = std::strtold(str.data(), &ptr);
-	if (str.data() == ptr)
-	{
-		throw std::invalid_argument("stof<long double>");
-	}
-	else if (errno == ERANGE)
-	{
-		throw std::out_of_range("stof<long double>");
-	}
-	if (pos != nullptr)
-	{
-		*pos = std::size_t(ptr - str.data());
-	}
-	return val;
-}
\ No newline at end of file
+	return stofImpl<long double>(str, pos, "stof<long double>");
+}
@@ -0,0 +1,469 @@
+#include "pch.hpp"
+#include "textSearch.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <bit>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CE_SSE2 1
+#endif
+
+namespace cdx::text
+{
+	namespace
+	{
+		// 'count' code points from 'first' on, 'stride' apart, fold to themselves + 'delta'
+		struct FoldRun
+		{
+			char32_t first;
+			std::uint16_t count;
+			std::uint8_t stride;
+			std::int32_t delta;
+		};
+
+		// Generated from CaseFolding.txt (Unicode 14.0), statuses C and S
+		constexpr FoldRun caseFolds[]
+		{
+			{ 0x0041, 26, 1, 32 }, { 0x00B5, 1, 1, 775 }, { 0x00C0, 23, 1, 32 }, { 0x00D8, 7, 1, 32 },
+			{ 0x0100, 24, 2, 1 }, { 0x0132, 3, 2, 1 }, { 0x0139, 8, 2, 1 }, { 0x014A, 23, 2, 1 },
+			{ 0x0178, 1, 1, -121 }, { 0x0179, 3, 2, 1 }, { 0x017F, 1, 1, -268 }, { 0x0181, 1, 1, 210 },
+			{ 0x0182, 2, 2, 1 }, { 0x0186, 1, 1, 206 }, { 0x0187, 1, 1, 1 }, { 0x0189, 2, 1, 205 },
+			{ 0x018B, 1, 1, 1 }, { 0x018E, 1, 1, 79 }, { 0x018F, 1, 1, 202 }, { 0x0190, 1, 1, 203 },
+			{ 0x0191, 1, 1, 1 }, { 0x0193, 1, 1, 205 }, { 0x0194, 1, 1, 207 }, { 0x0196, 1, 1, 211 },
+			{ 0x0197, 1, 1, 209 }, { 0x0198, 1, 1, 1 }, { 0x019C, 1, 1, 211 }, { 0x019D, 1, 1, 213 },
+			{ 0x019F, 1, 1, 214 }, { 0x01A0, 3, 2, 1 }, { 0x01A6, 1, 1, 218 }, { 0x01A7, 1, 1, 1 },
+			{ 0x01A9, 1, 1, 218 }, { 0x01AC, 1, 1, 1 }, { 0x01AE, 1, 1, 218 }, { 0x01AF, 1, 1, 1 },
+			{ 0x01B1, 2, 1, 217 }, { 0x01B3, 2, 2, 1 }, { 0x01B7, 1, 1, 219 }, { 0x01B8, 1, 1, 1 },
+			{ 0x01BC, 1, 1, 1 }, { 0x01C4, 1, 1, 2 }, { 0x01C5, 1, 1, 1 }, { 0x01C7, 1, 1, 2 },
+			{ 0x01C8, 1, 1, 1 }, { 0x01CA, 1, 1, 2 }, { 0x01CB, 9, 2, 1 }, { 0x01DE, 9, 2, 1 },
+			{ 0x01F1, 1, 1, 2 }, { 0x01F2, 2, 2, 1 }, { 0x01F6, 1, 1, -97 }, { 0x01F7, 1, 1, -56 },
+			{ 0x01F8, 20, 2, 1 }, { 0x0220, 1, 1, -130 }, { 0x0222, 9, 2, 1 }, { 0x023A, 1, 1, 10795 },
+			{ 0x023B, 1, 1, 1 }, { 0x023D, 1, 1, -163 }, { 0x023E, 1, 1, 10792 }, { 0x0241, 1, 1, 1 },
+			{ 0x0243, 1, 1, -195 }, { 0x0244, 1, 1, 69 }, { 0x0245, 1, 1, 71 }, { 0x0246, 5, 2, 1 },
+			{ 0x0345, 1, 1, 116 }, { 0x0370, 2, 2, 1 }, { 0x0376, 1, 1, 1 }, { 0x037F, 1, 1, 116 },
+			{ 0x0386, 1, 1, 38 }, { 0x0388, 3, 1, 37 }, { 0x038C, 1, 1, 64 }, { 0x038E, 2, 1, 63 },
+			{ 0x0391, 17, 1, 32 }, { 0x03A3, 9, 1, 32 }, { 0x03C2, 1, 1, 1 }, { 0x03CF, 1, 1, 8 },
+			{ 0x03D0, 1, 1, -30 }, { 0x03D1, 1, 1, -25 }, { 0x03D5, 1, 1, -15 }, { 0x03D6, 1, 1, -22 },
+			{ 0x03D8, 12, 2, 1 }, { 0x03F0, 1, 1, -54 }, { 0x03F1, 1, 1, -48 }, { 0x03F4, 1, 1, -60 },
+			{ 0x03F5, 1, 1, -64 }, { 0x03F7, 1, 1, 1 }, { 0x03F9, 1, 1, -7 }, { 0x03FA, 1, 1, 1 },
+			{ 0x03FD, 3, 1, -130 }, { 0x0400, 16, 1, 80 }, { 0x0410, 32, 1, 32 }, { 0x0460, 17, 2, 1 },
+			{ 0x048A, 27, 2, 1 }, { 0x04C0, 1, 1, 15 }, { 0x04C1, 7, 2, 1 }, { 0x04D0, 48, 2, 1 },
+			{ 0x0531, 38, 1, 48 }, { 0x10A0, 38, 1, 7264 }, { 0x10C7, 1, 1, 7264 }, { 0x10CD, 1, 1, 7264 },
+			{ 0x13F8, 6, 1, -8 }, { 0x1C80, 1, 1, -6222 }, { 0x1C81, 1, 1, -6221 }, { 0x1C82, 1, 1, -6212 },
+			{ 0x1C83, 2, 1, -6210 }, { 0x1C85, 1, 1, -6211 }, { 0x1C86, 1, 1, -6204 }, { 0x1C87, 1, 1, -6180 },
+			{ 0x1C88, 1, 1, 35267 }, { 0x1C90, 43, 1, -3008 }, { 0x1CBD, 3, 1, -3008 }, { 0x1E00, 75, 2, 1 },
+			{ 0x1E9B, 1, 1, -58 }, { 0x1E9E, 1, 1, -7615 }, { 0x1EA0, 48, 2, 1 }, { 0x1F08, 8, 1, -8 },
+			{ 0x1F18, 6, 1, -8 }, { 0x1F28, 8, 1, -8 }, { 0x1F38, 8, 1, -8 }, { 0x1F48, 6, 1, -8 },
+			{ 0x1F59, 4, 2, -8 }, { 0x1F68, 8, 1, -8 }, { 0x1F88, 8, 1, -8 }, { 0x1F98, 8, 1, -8 },
+			{ 0x1FA8, 8, 1, -8 }, { 0x1FB8, 2, 1, -8 }, { 0x1FBA, 2, 1, -74 }, { 0x1FBC, 1, 1, -9 },
+			{ 0x1FBE, 1, 1, -7173 }, { 0x1FC8, 4, 1, -86 }, { 0x1FCC, 1, 1, -9 }, { 0x1FD8, 2, 1, -8 },
+			{ 0x1FDA, 2, 1, -100 }, { 0x1FE8, 2, 1, -8 }, { 0x1FEA, 2, 1, -112 }, { 0x1FEC, 1, 1, -7 },
+			{ 0x1FF8, 2, 1, -128 }, { 0x1FFA, 2, 1, -126 }, { 0x1FFC, 1, 1, -9 }, { 0x2126, 1, 1, -7517 },
+			{ 0x212A, 1, 1, -8383 }, { 0x212B, 1, 1, -8262 }, { 0x2132, 1, 1, 28 }, { 0x2160, 16, 1, 16 },
+			{ 0x2183, 1, 1, 1 }, { 0x24B6, 26, 1, 26 }, { 0x2C00, 48, 1, 48 }, { 0x2C60, 1, 1, 1 },
+			{ 0x2C62, 1, 1, -10743 }, { 0x2C63, 1, 1, -3814 }, { 0x2C64, 1, 1, -10727 }, { 0x2C67, 3, 2, 1 },
+			{ 0x2C6D, 1, 1, -10780 }, { 0x2C6E, 1, 1, -10749 }, { 0x2C6F, 1, 1, -10783 }, { 0x2C70, 1, 1, -10782 },
+			{ 0x2C72, 1, 1, 1 }, { 0x2C75, 1, 1, 1 }, { 0x2C7E, 2, 1, -10815 }, { 0x2C80, 50, 2, 1 },
+			{ 0x2CEB, 2, 2, 1 }, { 0x2CF2, 1, 1, 1 }, { 0xA640, 23, 2, 1 }, { 0xA680, 14, 2, 1 },
+			{ 0xA722, 7, 2, 1 }, { 0xA732, 31, 2, 1 }, { 0xA779, 2, 2, 1 }, { 0xA77D, 1, 1, -35332 },
+			{ 0xA77E, 5, 2, 1 }, { 0xA78B, 1, 1, 1 }, { 0xA78D, 1, 1, -42280 }, { 0xA790, 2, 2, 1 },
+			{ 0xA796, 10, 2, 1 }, { 0xA7AA, 1, 1, -42308 }, { 0xA7AB, 1, 1, -42319 }, { 0xA7AC, 1, 1, -42315 },
+			{ 0xA7AD, 1, 1, -42305 }, { 0xA7AE, 1, 1, -42308 }, { 0xA7B0, 1, 1, -42258 }, { 0xA7B1, 1, 1, -42282 },
+			{ 0xA7B2, 1, 1, -42261 }, { 0xA7B3, 1, 1, 928 }, { 0xA7B4, 8, 2, 1 }, { 0xA7C4, 1, 1, -48 },
+			{ 0xA7C5, 1, 1, -42307 }, { 0xA7C6, 1, 1, -35384 }, { 0xA7C7, 2, 2, 1 }, { 0xA7D0, 1, 1, 1 },
+			{ 0xA7D6, 2, 2, 1 }, { 0xA7F5, 1, 1, 1 }, { 0xAB70, 80, 1, -38864 }, { 0xFF21, 26, 1, 32 },
+			{ 0x10400, 40, 1, 40 }, { 0x104B0, 36, 1, 40 }, { 0x10570, 11, 1, 39 }, { 0x1057C, 15, 1, 39 },
+			{ 0x1058C, 7, 1, 39 }, { 0x10594, 2, 1, 39 }, { 0x10C80, 51, 1, 64 }, { 0x118A0, 32, 1, 32 },
+			{ 0x16E40, 32, 1, 32 }, { 0x1E900, 34, 1, 34 },
+		};
+
+		[[nodiscard]] constexpr unsigned char asciiLower(unsigned char c) noexcept
+		{
+			return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
+		}
+		[[nodiscard]] constexpr unsigned char asciiUpper(unsigned char c) noexcept
+		{
+			return (unsigned char)(c - 'a') < 26 ? c & ~0x20 : c;
+		}
+
+		// Lenient UTF-8 decoding, a byte that does not start a valid sequence decodes to U+FFFD
+		char32_t decode(std::string_view text, std::size_t pos, std::size_t & length) noexcept
+		{
+			auto p = reinterpret_cast<const unsigned char *>(text.data()) + pos;
+			auto avail = text.size() - pos;
+			length = 1;
+			if (p[0] < 0x80)
+			{
+				return p[0];
+			}
+
+			std::size_t need = (p[0] >= 0xF0) ? 3 : (p[0] >= 0xE0) ? 2 : (p[0] >= 0xC2) ? 1 : 0;
+			if (need == 0 || p[0] > 0xF4 || avail <= need)
+			{
+				return 0xFFFD;
+			}
+			char32_t cp = p[0] & (0x3F >> need);
+			for (std::size_t i = 1; i <= need; ++i)
+			{
+				if ((p[i] & 0xC0) != 0x80)
+				{
+					return 0xFFFD;
+				}
+				cp = (cp << 6) | (p[i] & 0x3F);
+			}
+			constexpr char32_t minimum[]{ 0, 0x80, 0x800, 0x10000 };
+			if (cp < minimum[need] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+			{
+				return 0xFFFD;
+			}
+			length = need + 1;
+			return cp;
+		}
+		[[nodiscard]] unsigned char leadByte(char32_t cp) noexcept
+		{
+			if (cp < 0x80)
+			{
+				return (unsigned char)cp;
+			}
+			else if (cp < 0x800)
+			{
+				return (unsigned char)(0xC0 | (cp >> 6));
+			}
+			else if (cp < 0x10000)
+			{
+				return (unsigned char)(0xE0 | (cp >> 12));
+			}
+			return (unsigned char)(0xF0 | (cp >> 18));
+		}
+	}
+
+	COMFYDX_API char32_t foldCase(char32_t cp) noexcept
+	{
+		if (cp < 0x80)
+		{
+			return asciiLower((unsigned char)cp);
+		}
+		auto it = std::upper_bound(std::begin(caseFolds), std::end(caseFolds), cp, [](char32_t c, const FoldRun & run)
+		{
+			return c < run.first;
+		});
+		if (it == std::begin(caseFolds))
+		{
+			return cp;
+		}
+		const auto & run = *std::prev(it);
+		auto index = cp - run.first;
+		if (index % run.stride != 0 || index / run.stride >= run.count)
+		{
+			return cp;
+		}
+		return char32_t(std::int32_t(cp) + run.delta);
+	}
+	COMFYDX_API void forEachCaseFold(const std::function<void(char32_t, char32_t)> & fn)
+	{
+		for (const auto & run : caseFolds)
+		{
+			for (std::uint32_t i = 0; i < run.count; ++i)
+			{
+				auto cp = run.first + char32_t(i * run.stride);
+				fn(cp, char32_t(std::int32_t(cp) + run.delta));
+			}
+		}
+	}
+
+	COMFYDX_API LiteralSearch::LiteralSearch(std::string_view needle, CaseMode mode)
+		: m_mode{ mode }
+	{
+		if (needle.empty())
+		{
+			return;
+		}
+
+		auto addLead = [this](unsigned char c)
+		{
+			if (!this->m_leadTable[c])
+			{
+				this->m_leadTable[c] = true;
+				if (this->m_leadCount < this->m_leads.size())
+				{
+					this->m_leads[this->m_leadCount] = char(c);
+				}
+				++this->m_leadCount;
+			}
+		};
+
+		if (mode != CaseMode::unicode)
+		{
+			this->m_needle = needle;
+			if (mode == CaseMode::ascii)
+			{
+				std::transform(this->m_needle.begin(), this->m_needle.end(), this->m_needle.begin(), [](char c)
+				{
+					return char(asciiLower((unsigned char)c));
+				});
+			}
+			this->m_maxLength = this->m_needle.size();
+			addLead((unsigned char)this->m_needle.front());
+			if (mode == CaseMode::ascii)
+			{
+				addLead(asciiUpper((unsigned char)this->m_needle.front()));
+			}
+			return;
+		}
+
+		for (std::size_t pos = 0, len; pos < needle.size(); pos += len)
+		{
+			this->m_folded.push_back(foldCase(decode(needle, pos, len)));
+		}
+		this->m_needle = needle;
+		this->m_maxLength = this->m_folded.size() * 4;
+
+		// Every code point folding to the first one can start a match
+		auto first = this->m_folded.front();
+		addLead(leadByte(first));
+		for (const auto & run : caseFolds)
+		{
+			auto base = std::int32_t(first) - run.delta - std::int32_t(run.first);
+			if (base >= 0 && base % run.stride == 0 && std::uint32_t(base / run.stride) < run.count)
+			{
+				addLead(leadByte(run.first + char32_t(base)));
+			}
+		}
+	}
+
+	std::optional<SearchMatch> LiteralSearch::findBytes(std::string_view text, std::size_t from) const noexcept
+	{
+		const auto m = this->m_needle.size();
+		if (text.size() < m || from > text.size() - m)
+		{
+			return std::nullopt;
+		}
+		const auto s = text.data(), needle = this->m_needle.data();
+		const auto last = text.size() - m;
+		const bool bFold = this->m_mode == CaseMode::ascii;
+
+		auto equal = [=](std::size_t i) noexcept
+		{
+			if (!bFold)
+			{
+				return m <= 2 || std::memcmp(s + i + 1, needle + 1, m - 2) == 0;
+			}
+			for (std::size_t j = 0; j < m; ++j)
+			{
+				if (asciiLower((unsigned char)s[i + j]) != (unsigned char)needle[j])
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+
+		auto i = from;
+#ifdef CE_SSE2
+		auto lastLower = (unsigned char)needle[m - 1];
+		const auto f0 = _mm_set1_epi8(this->m_leads[0]), f1 = _mm_set1_epi8(this->m_leads[this->m_leadCount - 1]);
+		const auto l0 = _mm_set1_epi8(char(lastLower)), l1 = _mm_set1_epi8(char(bFold ? asciiUpper(lastLower) : lastLower));
+		for (; i + 16 <= last + 1; i += 16)
+		{
+			auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+			auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i + m - 1));
+			auto eqFirst = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+			auto eqLast = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+			for (auto mask = unsigned(_mm_movemask_epi8(_mm_and_si128(eqFirst, eqLast))); mask != 0; mask &= mask - 1)
+			{
+				auto pos = i + std::size_t(std::countr_zero(mask));
+				if (equal(pos))
+				{
+					return SearchMatch{ pos, m };
+				}
+			}
+		}
+#endif
+		for (; i <= last; ++i)
+		{
+			if (this->m_leadTable[(unsigned char)s[i]] && equal(i) && (bFold || s[i + m - 1] == needle[m - 1]))
+			{
+				return SearchMatch{ i, m };
+			}
+		}
+		return std::nullopt;
+	}
+
+	std::size_t LiteralSearch::matchFolded(std::string_view text, std::size_t pos) const noexcept
+	{
+		auto p = pos;
+		for (auto folded : this->m_folded)
+		{
+			if (p >= text.size())
+			{
+				return 0;
+			}
+			std::size_t len;
+			if (foldCase(decode(text, p, len)) != folded)
+			{
+				return 0;
+			}
+			p += len;
+		}
+		return p - pos;
+	}
+	std::optional<SearchMatch> LiteralSearch::findFolded(std::string_view text, std::size_t from) const noexcept
+	{
+		const auto s = text.data();
+		auto i = from;
+#ifdef CE_SSE2
+		if (this->m_leadCount <= this->m_leads.size())
+		{
+			__m128i leads[4];
+			for (std::size_t j = 0; j < 4; ++j)
+			{
+				leads[j] = _mm_set1_epi8(this->m_leads[std::min(j, this->m_leadCount - 1)]);
+			}
+			for (; i + 16 <= text.size(); i += 16)
+			{
+				auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+				auto eq = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(a, leads[0]), _mm_cmpeq_epi8(a, leads[1])),
+					_mm_or_si128(_mm_cmpeq_epi8(a, leads[2]), _mm_cmpeq_epi8(a, leads[3]))
+				);
+				for (auto mask = unsigned(_mm_movemask_epi8(eq)); mask != 0; mask &= mask - 1)
+				{
+					auto pos = i + std::size_t(std::countr_zero(mask));
+					if (auto len = this->matchFolded(text, pos); len != 0)
+					{
+						return SearchMatch{ pos, len };
+					}
+				}
+			}
+		}
+#endif
+		for (; i < text.size(); ++i)
+		{
+			if (this->m_leadTable[(unsigned char)s[i]])
+			{
+				if (auto len = this->matchFolded(text, i); len != 0)
+				{
+					return SearchMatch{ i, len };
+				}
+			}
+		}
+		return std::nullopt;
+	}
+
+	COMFYDX_API std::optional<SearchMatch> LiteralSearch::findIn(std::string_view text, std::size_t from) const noexcept
+	{
+		if (this->empty() || from >= text.size())
+		{
+			return std::nullopt;
+		}
+		return (this->m_mode == CaseMode::unicode) ? this->findFolded(text, from) : this->findBytes(text, from);
+	}
+
+	COMFYDX_API bool LiteralSearch::scan(const TextSnapshot & text, std::size_t from, std::size_t to, const MatchFn & fn) const
+	{
+		to = std::min(to, text.size());
+		if (this->empty() || from >= to)
+		{
+			return true;
+		}
+
+		// Matches starting before 'to' may end after it
+		const auto overlap = this->m_maxLength - 1;
+		std::string carry, junction;
+		std::size_t chunkStart = from, resume = from;
+		bool bGoing = true, bStopped = false;
+
+		auto report = [&](std::size_t offset, std::size_t length)
+		{
+			if (offset >= to)
+			{
+				bGoing = false;
+				return;
+			}
+			resume = offset + length;
+			bGoing = fn(SearchMatch{ offset, length });
+			bStopped = !bGoing;
+		};
+
+		text.forEachChunk(from, to - from + overlap, [&](std::string_view chunk)
+		{
+			// Matches starting in the tail of the previous chunks and crossing into this one
+			if (!carry.empty())
+			{
+				junction.assign(carry);
+				junction.append(chunk.substr(0, overlap));
+				auto carryStart = chunkStart - carry.size();
+				for (auto m = this->findIn(junction, 0); bGoing && m && m->offset < carry.size(); m = this->findIn(junction, m->offset + 1))
+				{
+					if (carryStart + m->offset >= resume)
+					{
+						report(carryStart + m->offset, m->length);
+					}
+				}
+			}
+
+			auto pos = std::max(resume, chunkStart) - chunkStart;
+			for (auto m = this->findIn(chunk, pos); bGoing && m; m = this->findIn(chunk, m->offset + m->length))
+			{
+				report(chunkStart + m->offset, m->length);
+			}
+
+			if (chunk.size() >= overlap)
+			{
+				carry.assign(chunk.substr(chunk.size() - overlap));
+			}
+			else
+			{
+				carry.append(chunk);
+				carry.erase(0, carry.size() - std::min(carry.size(), overlap));
+			}
+			chunkStart += chunk.size();
+			return bGoing;
+		});
+		return !bStopped;
+	}
+
+	COMFYDX_API std::optional<SearchMatch> LiteralSearch::find(const TextSnapshot & text, std::size_t from) const
+	{
+		std::optional<SearchMatch> found;
+		this->scan(text, from, text.size(), [&found](const SearchMatch & m)
+		{
+			found = m;
+			return false;
+		});
+		return found;
+	}
+
+	COMFYDX_API std::optional<SearchMatch> LiteralSearch::findPrev(const TextSnapshot & text, std::size_t before) const
+	{
+		if (this->empty())
+		{
+			return std::nullopt;
+		}
+		before = std::min(before, text.size());
+
+		// Windows are copied, going backwards over pieces is not worth the complexity
+		const std::size_t window = std::max<std::size_t>(64 * 1024, this->m_maxLength * 4);
+		std::string buffer;
+		while (before > 0)
+		{
+			auto start = (before > window) ? before - window : 0;
+			buffer = text.text(start, before - start + this->m_maxLength - 1);
+
+			std::optional<SearchMatch> last;
+			for (auto m = this->findIn(buffer, 0); m && start + m->offset < before; m = this->findIn(buffer, m->offset + 1))
+			{
+				last = SearchMatch{ start + m->offset, m->length };
+			}
+			if (last)
+			{
+				return last;
+			}
+			before = start;
+		}
+		return std::nullopt;
+	}
+}
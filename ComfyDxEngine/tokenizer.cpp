@@ -0,0 +1,498 @@
+#include "pch.hpp"
+#include "tokenizer.hpp"
+
+#include <algorithm>
+#include <optional>
+
+namespace cdx::syntax
+{
+	namespace
+	{
+		// Empty matches that change the state in a row before a byte is skipped, breaks push/pop cycles
+		constexpr std::size_t maxEmptyChanges{ 16 };
+	}
+
+	COMFYDX_API Tokenizer::Tokenizer(std::shared_ptr<const Grammar> grammar, Notify notify, std::size_t syncLines, std::uint32_t tabSize)
+		: m_grammar{ std::move(grammar) }, m_notify{ std::move(notify) }, m_syncLines{ syncLines }, m_tabSize{ std::max<std::uint32_t>(tabSize, 1) }
+	{
+		this->m_bracketOf.fill(-1);
+		const auto & pairs = this->m_grammar->brackets();
+		for (std::size_t i = 0; i < pairs.size(); ++i)
+		{
+			this->m_bracketOf[std::size_t(pairs[i].open)] = std::int8_t(2 * i);
+			this->m_bracketOf[std::size_t(pairs[i].close)] = std::int8_t(2 * i + 1);
+		}
+		static_cast<void>(this->intern(noStack, 0));
+		this->m_lines.resize(this->m_text.lineCount());
+		this->m_brackets.reset(this->m_lines.size());
+		this->m_worker = std::jthread([this](std::stop_token stop)
+		{
+			this->work(stop);
+		});
+	}
+	COMFYDX_API Tokenizer::~Tokenizer() noexcept
+	{
+		this->m_worker.request_stop();
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.join();
+		}
+	}
+
+	std::uint32_t Tokenizer::intern(std::uint32_t parent, StateId state)
+	{
+		auto key = (std::uint64_t(parent) << 16) | state;
+		if (auto it = this->m_stackIds.find(key); it != this->m_stackIds.end())
+		{
+			return it->second;
+		}
+		auto depth = std::uint16_t(parent != noStack ? this->m_stacks[parent].depth + 1 : 1);
+		this->m_stacks.push_back({ parent, state, depth });
+		auto id = std::uint32_t(this->m_stacks.size() - 1);
+		this->m_stackIds.emplace(key, id);
+		return id;
+	}
+	StateId Tokenizer::top(std::uint32_t stack)
+	{
+		std::scoped_lock lock{ this->m_stackMutex };
+		return this->m_stacks[stack].state;
+	}
+	std::uint32_t Tokenizer::transition(std::uint32_t stack, const Rule & rule, StateId & state)
+	{
+		if (rule.action == RuleAction::none)
+		{
+			return stack;
+		}
+		std::scoped_lock lock{ this->m_stackMutex };
+		auto node = this->m_stacks[stack];
+		switch (rule.action)
+		{
+		case RuleAction::push:
+			if (node.depth < maxDepth)
+			{
+				stack = this->intern(stack, rule.target);
+				break;
+			}
+			[[fallthrough]];
+		case RuleAction::set:
+			stack = this->intern(node.parent, rule.target);
+			break;
+		case RuleAction::pop:
+			if (node.parent != noStack)
+			{
+				stack = node.parent;
+			}
+			break;
+		default:
+			break;
+		}
+		state = this->m_stacks[stack].state;
+		return stack;
+	}
+
+	std::uint32_t Tokenizer::lexLine(std::string_view line, std::uint32_t stack, std::vector<Token> & tokens)
+	{
+		const auto & states = this->m_grammar->states();
+		auto state = this->top(stack);
+		auto emit = [&](std::size_t start, TokenKind kind)
+		{
+			if (start >= line.size())
+			{
+				return;
+			}
+			// An empty token is overwritten by the one following it
+			if (!tokens.empty() && tokens.back().start == start)
+			{
+				tokens.pop_back();
+			}
+			if (tokens.empty() || tokens.back().kind != kind)
+			{
+				tokens.push_back({ std::uint32_t(start), kind });
+			}
+		};
+
+		// Next match of every rule, kept until the position passes it or the state changes
+		const auto * rules = &states[state].rules;
+		std::vector<std::optional<text::SearchMatch>> next(rules->size());
+		std::vector<bool> known(rules->size());
+		std::size_t pos = 0, emptyChanges = 0;
+		while (pos <= line.size())
+		{
+			auto best = rules->size();
+			for (std::size_t i = 0; i < rules->size(); ++i)
+			{
+				if (!known[i] || (next[i] && next[i]->offset < pos))
+				{
+					next[i] = (*rules)[i].regex.findIn(line, pos);
+					known[i] = true;
+				}
+				if (next[i] && (best == rules->size() || next[i]->offset < next[best]->offset))
+				{
+					best = i;
+				}
+			}
+			if (best == rules->size())
+			{
+				break;
+			}
+
+			auto match = *next[best];
+			const auto & rule = (*rules)[best];
+			emit(pos, states[state].kind);
+			emit(match.offset, rule.kind);
+			auto changed = this->transition(stack, rule, state);
+			pos = match.offset + match.length;
+			if (match.length != 0)
+			{
+				emptyChanges = 0;
+			}
+			else if (changed == stack || ++emptyChanges > maxEmptyChanges)
+			{
+				// No progress, the byte goes to the state it is in
+				emit(pos, states[state].kind);
+				++pos;
+				emptyChanges = 0;
+			}
+			if (changed != stack)
+			{
+				stack = changed;
+				rules = &states[state].rules;
+				next.assign(rules->size(), std::nullopt);
+				known.assign(rules->size(), false);
+			}
+		}
+		emit(pos, states[state].kind);
+		return stack;
+	}
+	std::uint32_t Tokenizer::lexLine(const text::TextSnapshot & text, std::size_t line, std::uint32_t stack, std::vector<Token> & tokens, LineStructure & structure, std::string & buffer)
+	{
+		auto start = text.lineStart(line);
+		auto count = std::min(text.lineEnd(line) - start, maxLineLength);
+
+		// Lines within one piece aren't copied
+		std::string_view view;
+		buffer.clear();
+		text.forEachChunk(start, count, [&](std::string_view chunk)
+		{
+			if (buffer.empty() && chunk.size() == count)
+			{
+				view = chunk;
+				return false;
+			}
+			buffer.append(chunk);
+			return true;
+		});
+		if (view.empty())
+		{
+			view = buffer;
+		}
+		if (!view.empty() && view.back() == '\r')
+		{
+			view.remove_suffix(1);
+		}
+		stack = this->lexLine(view, stack, tokens);
+		this->scan(view, tokens, structure);
+		return stack;
+	}
+	void Tokenizer::scan(std::string_view line, const std::vector<Token> & tokens, LineStructure & structure) const
+	{
+		structure.brackets.clear();
+		structure.indent = LineStructure::blank;
+		std::uint32_t column = 0;
+		for (auto c : line)
+		{
+			if (c == ' ')
+			{
+				++column;
+			}
+			else if (c == '\t')
+			{
+				column += this->m_tabSize - column % this->m_tabSize;
+			}
+			else
+			{
+				structure.indent = column;
+				break;
+			}
+		}
+		if (this->m_grammar->brackets().empty())
+		{
+			return;
+		}
+
+		// The token at i runs up to the next one's start
+		std::size_t token = 0;
+		for (std::size_t i = 0; i < line.size(); ++i)
+		{
+			auto c = (unsigned char)line[i];
+			if (c >= 0x80 || this->m_bracketOf[c] < 0)
+			{
+				continue;
+			}
+			while (token + 1 < tokens.size() && tokens[token + 1].start <= i)
+			{
+				++token;
+			}
+			if (token < tokens.size() && !this->m_grammar->bracketsIn(tokens[token].kind))
+			{
+				continue;
+			}
+			auto code = this->m_bracketOf[c];
+			structure.brackets.push_back({ std::uint32_t(i), std::uint8_t(code / 2), (code & 1) == 0 });
+		}
+	}
+
+	std::size_t Tokenizer::nextDirty(std::size_t line) const noexcept
+	{
+		auto it = std::upper_bound(this->m_dirty.begin(), this->m_dirty.end(), line);
+		return it != this->m_dirty.end() ? *it : this->m_lines.size();
+	}
+	std::uint32_t Tokenizer::startStack(std::size_t line) const noexcept
+	{
+		auto stack = line != 0 ? this->m_lines[line - 1].stack : 0;
+		// The frontier never passes an unlexed line, this only keeps a slip from indexing m_stacks with it
+		return stack != noStack ? stack : 0;
+	}
+	void Tokenizer::store(std::vector<Token> tokens, std::uint32_t stack, LineStructure structure)
+	{
+		auto & line = this->m_lines[this->m_valid];
+		bool bConverged = line.stack == stack;
+		line.tokens = std::move(tokens);
+		line.stack = stack;
+		this->m_brackets.setLine(this->m_valid, std::move(structure));
+		this->m_reached = std::max(this->m_reached, this->m_valid + 1);
+		this->m_valid = bConverged ? std::min(this->nextDirty(this->m_valid), this->m_reached) : this->m_valid + 1;
+
+		auto passed = std::lower_bound(this->m_dirty.begin(), this->m_dirty.end(), this->m_valid);
+		this->m_dirty.erase(this->m_dirty.begin(), passed);
+	}
+	void Tokenizer::advance(std::size_t last)
+	{
+		std::string buffer;
+		last = std::min(last, this->m_lines.size());
+		while (this->m_valid < last)
+		{
+			std::vector<Token> tokens;
+			LineStructure structure;
+			auto stack = this->lexLine(this->m_text, this->m_valid, this->startStack(this->m_valid), tokens, structure, buffer);
+			this->store(std::move(tokens), stack, std::move(structure));
+		}
+	}
+
+	void Tokenizer::work(std::stop_token stop) noexcept
+	{
+		try
+		{
+			std::string buffer;
+			std::vector<Line> lexed;
+			std::vector<LineStructure> structures;
+			std::unique_lock lock{ this->m_mutex };
+			while (this->m_changed.wait(lock, stop, [this] { return this->m_valid < this->m_lines.size(); }))
+			{
+				auto text = this->m_text;
+				auto generation = this->m_generation;
+				auto from = this->m_valid;
+				auto count = std::min(batchLines, this->m_lines.size() - from);
+				auto stack = this->startStack(from);
+				lexed.resize(count);
+				structures.resize(count);
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					lexed[i].stack = this->m_lines[from + i].stack;
+				}
+				lock.unlock();
+
+				// Up to the first line ending in its old state, store() takes it from there
+				std::size_t n = 0;
+				while (n < count && !stop.stop_requested())
+				{
+					auto & line = lexed[n++];
+					auto old = line.stack;
+					line.tokens.clear();
+					line.stack = stack = this->lexLine(text, from + n - 1, stack, line.tokens, structures[n - 1], buffer);
+					if (stack == old)
+					{
+						break;
+					}
+				}
+
+				lock.lock();
+				if (generation != this->m_generation || from != this->m_valid)
+				{
+					continue;
+				}
+				for (std::size_t i = 0; i < n; ++i)
+				{
+					this->store(std::move(lexed[i].tokens), lexed[i].stack, std::move(structures[i]));
+				}
+				if (this->m_notify)
+				{
+					lock.unlock();
+					this->m_notify();
+					lock.lock();
+				}
+			}
+		}
+		catch (...)
+		{
+			// Lines past the frontier are left to viewport() and finish()
+		}
+	}
+
+	COMFYDX_API void Tokenizer::setText(text::TextSnapshot text)
+	{
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			this->m_text = std::move(text);
+			this->m_lines.clear();
+			this->m_lines.resize(this->m_text.lineCount());
+			this->m_brackets.reset(this->m_lines.size());
+			this->m_dirty.clear();
+			this->m_valid = 0;
+			this->m_reached = 0;
+			++this->m_generation;
+		}
+		this->m_changed.notify_all();
+	}
+	COMFYDX_API void Tokenizer::edit(text::TextSnapshot text, std::span<const text::TextEdit> edits)
+	{
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			// Last edit first, the line numbers of the ones before stay valid
+			auto lineEdits = this->m_text.lineEdits(edits);
+			// The frontier line was lexed from an end state that may have changed since
+			auto frontier = this->m_valid;
+			for (auto it = lineEdits.rbegin(); it != lineEdits.rend(); ++it)
+			{
+				auto first = it->first;
+				auto last = first + it->removed;
+				auto removed = it->removed;
+				auto added = it->added;
+
+				// The edited lines' records are replaced, the last keeps the state the line after followed from
+				auto at = this->m_lines.begin() + std::ptrdiff_t(first);
+				if (removed > added)
+				{
+					this->m_lines.erase(at, at + std::ptrdiff_t(removed - added));
+					this->m_brackets.erase(first, removed - added);
+				}
+				else if (added > removed)
+				{
+					this->m_lines.insert(at, added - removed, Line{});
+					this->m_brackets.insert(first, added - removed);
+				}
+
+				auto lo = std::lower_bound(this->m_dirty.begin(), this->m_dirty.end(), first);
+				auto hi = std::upper_bound(lo, this->m_dirty.end(), last);
+				for (auto d = hi; d != this->m_dirty.end(); ++d)
+				{
+					*d = *d - removed + added;
+				}
+				auto pos = this->m_dirty.erase(lo, hi);
+				std::vector<std::size_t> changed(added + 1);
+				for (std::size_t i = 0; i <= added; ++i)
+				{
+					changed[i] = first + i;
+				}
+				this->m_dirty.insert(pos, changed.begin(), changed.end());
+				this->m_valid = std::min(this->m_valid, first);
+				frontier = (frontier > last) ? frontier - removed + added : std::min(frontier, first);
+				// The lines after an edit reaching past the lexed ones weren't lexed either
+				this->m_reached = (last < this->m_reached) ? this->m_reached - removed + added : std::min(this->m_reached, first);
+			}
+			// Converging must not skip it once the frontier is behind it
+			if (frontier > this->m_valid && frontier < this->m_lines.size())
+			{
+				auto it = std::lower_bound(this->m_dirty.begin(), this->m_dirty.end(), frontier);
+				if (it == this->m_dirty.end() || *it != frontier)
+				{
+					this->m_dirty.insert(it, frontier);
+				}
+			}
+			this->m_text = std::move(text);
+			++this->m_generation;
+
+			auto passed = std::lower_bound(this->m_dirty.begin(), this->m_dirty.end(), this->m_valid);
+			this->m_dirty.erase(this->m_dirty.begin(), passed);
+		}
+		this->m_changed.notify_all();
+	}
+	COMFYDX_API void Tokenizer::viewport(std::size_t first, std::size_t last)
+	{
+		{
+			std::scoped_lock lock{ this->m_mutex };
+			last = std::min(last, this->m_lines.size());
+			if (first >= last || this->m_valid >= last)
+			{
+				return;
+			}
+			if (last - this->m_valid <= this->m_syncLines)
+			{
+				this->advance(last);
+			}
+			else
+			{
+				// Too far off, the lines before are assumed to end in the state they did before
+				std::string buffer;
+				auto line = std::max(first, this->m_valid);
+				auto stack = this->startStack(line);
+				for (; line < last; ++line)
+				{
+					std::vector<Token> tokens;
+					LineStructure structure;
+					stack = this->lexLine(this->m_text, line, stack, tokens, structure, buffer);
+					this->m_lines[line].tokens = std::move(tokens);
+					this->m_brackets.setLine(line, std::move(structure));
+					// The guess must not survive the frontier jumping over it
+					auto it = std::lower_bound(this->m_dirty.begin(), this->m_dirty.end(), line);
+					if (it == this->m_dirty.end() || *it != line)
+					{
+						this->m_dirty.insert(it, line);
+					}
+				}
+			}
+		}
+		this->m_changed.notify_all();
+	}
+	COMFYDX_API void Tokenizer::finish()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		this->advance(this->m_lines.size());
+	}
+
+	COMFYDX_API std::size_t Tokenizer::lineCount()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		return this->m_lines.size();
+	}
+	COMFYDX_API std::size_t Tokenizer::frontier()
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		return this->m_valid;
+	}
+	COMFYDX_API std::vector<Token> Tokenizer::tokens(std::size_t line)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		if (line >= this->m_lines.size())
+		{
+			return {};
+		}
+		return this->m_lines[line].tokens;
+	}
+
+	COMFYDX_API std::optional<BracketPos> Tokenizer::matchingBracket(std::size_t line, std::uint32_t column)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		return this->m_brackets.matchingBracket(line, column);
+	}
+	COMFYDX_API std::optional<BracketBlock> Tokenizer::enclosingBlock(std::size_t line, std::uint32_t column)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		return this->m_brackets.enclosingBlock(line, column);
+	}
+	COMFYDX_API std::vector<FoldRange> Tokenizer::foldRanges(std::size_t first, std::size_t last)
+	{
+		std::scoped_lock lock{ this->m_mutex };
+		return this->m_brackets.foldRanges(first, last);
+	}
+}
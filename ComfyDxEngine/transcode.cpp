@@ -0,0 +1,267 @@
+#include "pch.hpp"
+#include "transcode.hpp"
+
+#include <vector>
+#include <algorithm>
+
+namespace ce
+{
+	namespace
+	{
+		constexpr std::uint64_t asciiMask{ 0x8080808080808080ULL };
+
+		// Length of the leading ASCII run, checks 8 bytes at a time
+		std::size_t asciiRun(const char * it, std::size_t size) noexcept
+		{
+			std::size_t i = 0;
+			for (; i + 8 <= size; i += 8)
+			{
+				std::uint64_t word;
+				std::memcpy(&word, it + i, sizeof word);
+				if (word & asciiMask)
+				{
+					break;
+				}
+			}
+			while (i < size && static_cast<unsigned char>(it[i]) < 0x80)
+			{
+				++i;
+			}
+			return i;
+		}
+
+		std::size_t putUtf16(char32_t cp, char16_t * out) noexcept
+		{
+			if (cp < 0x10000)
+			{
+				out[0] = char16_t(cp);
+				return 1;
+			}
+			cp -= 0x10000;
+			out[0] = char16_t(0xD800 + (cp >> 10));
+			out[1] = char16_t(0xDC00 + (cp & 0x3FF));
+			return 2;
+		}
+		std::size_t putUtf8(char32_t cp, char * out) noexcept
+		{
+			if (cp < 0x80)
+			{
+				out[0] = char(cp);
+				return 1;
+			}
+			else if (cp < 0x800)
+			{
+				out[0] = char(0xC0 | (cp >> 6));
+				out[1] = char(0x80 | (cp & 0x3F));
+				return 2;
+			}
+			else if (cp < 0x10000)
+			{
+				out[0] = char(0xE0 | (cp >> 12));
+				out[1] = char(0x80 | ((cp >> 6) & 0x3F));
+				out[2] = char(0x80 | (cp & 0x3F));
+				return 3;
+			}
+			out[0] = char(0xF0 | (cp >> 18));
+			out[1] = char(0x80 | ((cp >> 12) & 0x3F));
+			out[2] = char(0x80 | ((cp >> 6) & 0x3F));
+			out[3] = char(0x80 | (cp & 0x3F));
+			return 4;
+		}
+	}
+
+	COMFYDX_API Utf8ToUtf16::Result Utf8ToUtf16::feed(std::span<const char> in, std::span<char16_t> out, bool last) noexcept
+	{
+		std::size_t r = 0, w = 0;
+		while (r < in.size() && w + 2 <= out.size())
+		{
+			if (this->m_bytesNeeded == 0)
+			{
+				// Widen ASCII runs without going through the state machine
+				auto run = asciiRun(in.data() + r, std::min(in.size() - r, out.size() - w));
+				for (std::size_t i = 0; i < run; ++i)
+				{
+					out[w + i] = char16_t(in[r + i]);
+				}
+				r += run;
+				w += run;
+				if (r == in.size() || w + 2 > out.size())
+				{
+					break;
+				}
+
+				auto byte = static_cast<unsigned char>(in[r]);
+				++r;
+				if (byte >= 0xC2 && byte <= 0xDF)
+				{
+					this->m_bytesNeeded = 1;
+					this->m_codePoint = byte & 0x1F;
+				}
+				else if (byte >= 0xE0 && byte <= 0xEF)
+				{
+					this->m_lower = (byte == 0xE0) ? 0xA0 : 0x80;
+					this->m_upper = (byte == 0xED) ? 0x9F : 0xBF;
+					this->m_bytesNeeded = 2;
+					this->m_codePoint = byte & 0x0F;
+				}
+				else if (byte >= 0xF0 && byte <= 0xF4)
+				{
+					this->m_lower = (byte == 0xF0) ? 0x90 : 0x80;
+					this->m_upper = (byte == 0xF4) ? 0x8F : 0xBF;
+					this->m_bytesNeeded = 3;
+					this->m_codePoint = byte & 0x07;
+				}
+				else
+				{
+					out[w++] = replacement;
+				}
+				continue;
+			}
+
+			auto byte = static_cast<unsigned char>(in[r]);
+			if (byte < this->m_lower || byte > this->m_upper)
+			{
+				// Broken sequence, the offending byte is reprocessed as a new lead
+				this->reset();
+				out[w++] = replacement;
+				continue;
+			}
+			++r;
+			this->m_lower = 0x80;
+			this->m_upper = 0xBF;
+			this->m_codePoint = (this->m_codePoint << 6) | (byte & 0x3F);
+			if (++this->m_bytesSeen == this->m_bytesNeeded)
+			{
+				w += putUtf16(this->m_codePoint, out.data() + w);
+				this->reset();
+			}
+		}
+
+		if (last && r == in.size() && this->pending() && w < out.size())
+		{
+			this->reset();
+			out[w++] = replacement;
+		}
+		return { r, w };
+	}
+
+	COMFYDX_API Utf16ToUtf8::Result Utf16ToUtf8::feed(std::span<const char16_t> in, std::span<char> out, bool last) noexcept
+	{
+		std::size_t r = 0, w = 0;
+		while (r < in.size() && w + 4 <= out.size())
+		{
+			char32_t unit = in[r];
+			if (this->m_highSurrogate != 0)
+			{
+				if (unit >= 0xDC00 && unit <= 0xDFFF)
+				{
+					char32_t cp = 0x10000 + ((char32_t(this->m_highSurrogate) - 0xD800) << 10) + (unit - 0xDC00);
+					w += putUtf8(cp, out.data() + w);
+					++r;
+				}
+				else
+				{
+					// Lone high surrogate, the current unit is reprocessed
+					w += putUtf8(0xFFFD, out.data() + w);
+				}
+				this->m_highSurrogate = 0;
+				continue;
+			}
+
+			++r;
+			if (unit >= 0xD800 && unit <= 0xDBFF)
+			{
+				this->m_highSurrogate = char16_t(unit);
+			}
+			else if (unit >= 0xDC00 && unit <= 0xDFFF)
+			{
+				w += putUtf8(0xFFFD, out.data() + w);
+			}
+			else
+			{
+				w += putUtf8(unit, out.data() + w);
+			}
+		}
+
+		if (last && r == in.size() && this->pending() && w + 3 <= out.size())
+		{
+			this->m_highSurrogate = 0;
+			w += putUtf8(0xFFFD, out.data() + w);
+		}
+		return { r, w };
+	}
+
+
+	COMFYDX_API AsyncTranscoder::AsyncTranscoder(Source source, Sink sink, std::size_t chunkSize)
+		: m_source{ std::move(source) }, m_sink{ std::move(sink) }, m_chunkSize{ std::max<std::size_t>(chunkSize, 16) }
+	{
+	}
+	COMFYDX_API AsyncTranscoder::~AsyncTranscoder() noexcept
+	{
+		this->cancel();
+		this->wait();
+	}
+
+	COMFYDX_API bool AsyncTranscoder::start()
+	{
+		if (this->m_worker.joinable())
+		{
+			return false;
+		}
+		this->m_bDone.store(false, std::memory_order_relaxed);
+		this->m_bOk.store(false, std::memory_order_relaxed);
+		this->m_bytesRead.store(0, std::memory_order_relaxed);
+		this->m_worker = std::jthread([this](std::stop_token stop)
+		{
+			this->work(stop);
+		});
+		return true;
+	}
+	COMFYDX_API void AsyncTranscoder::cancel() noexcept
+	{
+		this->m_worker.request_stop();
+	}
+	COMFYDX_API void AsyncTranscoder::wait() noexcept
+	{
+		if (this->m_worker.joinable())
+		{
+			this->m_worker.join();
+		}
+	}
+
+	void AsyncTranscoder::work(std::stop_token stop) noexcept
+	{
+		bool ok = false;
+		try
+		{
+			std::vector<char> in(this->m_chunkSize);
+			std::vector<char16_t> out(Utf8ToUtf16::maxOutput(this->m_chunkSize));
+			Utf8ToUtf16 decoder;
+
+			while (!stop.stop_requested())
+			{
+				auto read = this->m_source(in);
+				this->m_bytesRead.fetch_add(read, std::memory_order_relaxed);
+
+				bool last = (read == 0);
+				auto res = decoder.feed({ in.data(), read }, out, last);
+				if (res.written != 0 && !this->m_sink({ out.data(), res.written }))
+				{
+					break;
+				}
+				if (last)
+				{
+					ok = true;
+					break;
+				}
+			}
+		}
+		catch (...)
+		{
+			ok = false;
+		}
+
+		this->m_bOk.store(ok, std::memory_order_release);
+		this->m_bDone.store(true, std::memory_order_release);
+	}
+}
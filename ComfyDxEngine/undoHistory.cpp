@@ -0,0 +1,581 @@
+#include "pch.hpp"
+#include "undoHistory.hpp"
+#include "varint.hpp"
+
+#include <algorithm>
+
+namespace cdx::text
+{
+	namespace
+	{
+		using io::putVarint;
+		using io::getVarint;
+
+		std::uint64_t zigzag(std::size_t value, std::size_t base) noexcept
+		{
+			auto diff = std::int64_t(value - base);
+			return (std::uint64_t(diff) << 1) ^ std::uint64_t(diff >> 63);
+		}
+		std::size_t unzigzag(std::uint64_t value, std::size_t base) noexcept
+		{
+			return base + std::size_t((value >> 1) ^ (~(value & 1) + 1));
+		}
+
+		bool mergePieces(Piece & a, const Piece & b) noexcept
+		{
+			if (a.source != b.source || a.start + a.length != b.start)
+			{
+				return false;
+			}
+			tree::extend(a, b);
+			return true;
+		}
+		std::size_t totalLength(std::span<const Piece> pieces) noexcept
+		{
+			std::size_t length = 0;
+			for (const auto & p : pieces)
+			{
+				length += p.length;
+			}
+			return length;
+		}
+		// Whether no edit of a group reaches into the text inserted by the ones before it
+		bool isBatch(std::span<const EditRecord> edits) noexcept
+		{
+			for (std::size_t i = 1; i < edits.size(); ++i)
+			{
+				if (edits[i].offset < edits[i - 1].offset + edits[i - 1].insertedLength)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	COMFYDX_API void UndoGroup::encode(std::string & out) const
+	{
+		putVarint(out, this->edits.size());
+		std::size_t prevOffset = 0;
+		for (const auto & e : this->edits)
+		{
+			putVarint(out, zigzag(e.offset, prevOffset));
+			putVarint(out, e.removedPieces);
+			putVarint(out, e.insertedPieces);
+			prevOffset = e.offset;
+		}
+
+		// Pieces of one buffer tend to follow each other closely
+		std::size_t prevEnd[2]{};
+		for (const auto & p : this->pieces)
+		{
+			auto & end = prevEnd[std::size_t(p.source)];
+			putVarint(out, std::uint64_t(p.source));
+			putVarint(out, zigzag(p.start, end));
+			putVarint(out, p.length);
+			putVarint(out, p.lineFeeds);
+			putVarint(out, p.codePoints);
+			putVarint(out, p.words);
+			putVarint(out, std::uint64_t(p.bWordFirst) | (std::uint64_t(p.bWordLast) << 1));
+			end = p.start + p.length;
+		}
+	}
+	COMFYDX_API bool UndoGroup::decode(std::string_view in)
+	{
+		this->edits.clear();
+		this->pieces.clear();
+
+		std::uint64_t count, a, b, c;
+		if (!getVarint(in, count))
+		{
+			return false;
+		}
+		std::size_t prevOffset = 0, pieceCount = 0;
+		this->edits.reserve(std::size_t(count));
+		for (; count > 0; --count)
+		{
+			if (!getVarint(in, a) || !getVarint(in, b) || !getVarint(in, c))
+			{
+				return false;
+			}
+			EditRecord e;
+			e.offset = unzigzag(a, prevOffset);
+			e.removedPieces = std::uint32_t(b);
+			e.insertedPieces = std::uint32_t(c);
+			prevOffset = e.offset;
+			pieceCount += e.removedPieces + e.insertedPieces;
+			this->edits.push_back(e);
+		}
+
+		std::size_t prevEnd[2]{};
+		std::uint64_t d, codePoints, words, flags;
+		this->pieces.reserve(pieceCount);
+		for (; pieceCount > 0; --pieceCount)
+		{
+			if (!getVarint(in, a) || a > 1 || !getVarint(in, b) || !getVarint(in, c) || !getVarint(in, d) ||
+				!getVarint(in, codePoints) || !getVarint(in, words) || !getVarint(in, flags) || flags > 3)
+			{
+				return false;
+			}
+			auto & end = prevEnd[a];
+			Piece p{ Source(a), unzigzag(b, end), std::size_t(c), std::size_t(d), std::size_t(codePoints), std::size_t(words), (flags & 1) != 0, (flags & 2) != 0 };
+			end = p.start + p.length;
+			this->pieces.push_back(p);
+		}
+
+		// Lengths follow from the pieces
+		std::span<const Piece> all{ this->pieces };
+		for (auto & e : this->edits)
+		{
+			e.removedLength = totalLength(all.first(e.removedPieces));
+			all = all.subspan(e.removedPieces);
+			e.insertedLength = totalLength(all.first(e.insertedPieces));
+			all = all.subspan(e.insertedPieces);
+		}
+		return in.empty();
+	}
+
+	COMFYDX_API void UndoGroup::undo(PieceTable & table) const
+	{
+		std::span<const Piece> pieces{ this->pieces };
+		if (isBatch(this->edits))
+		{
+			// Every edit is still where it was recorded, one pass replaces all of them
+			std::vector<PieceTable::BatchEdit> batch;
+			batch.reserve(this->edits.size());
+			std::size_t first = 0;
+			for (const auto & e : this->edits)
+			{
+				batch.push_back({ e.offset, e.insertedLength, pieces.subspan(first, e.removedPieces) });
+				first += e.removedPieces + e.insertedPieces;
+			}
+			table.applyPieces(batch);
+			return;
+		}
+
+		auto end = pieces.size();
+		for (auto it = this->edits.rbegin(); it != this->edits.rend(); ++it)
+		{
+			end -= it->insertedPieces + it->removedPieces;
+			table.erase(it->offset, it->insertedLength);
+			table.insertPieces(it->offset, pieces.subspan(end, it->removedPieces));
+		}
+	}
+	COMFYDX_API void UndoGroup::redo(PieceTable & table) const
+	{
+		std::span<const Piece> pieces{ this->pieces };
+		if (isBatch(this->edits))
+		{
+			// Offsets before the group are the recorded ones without the shift of the earlier edits
+			std::vector<PieceTable::BatchEdit> batch;
+			batch.reserve(this->edits.size());
+			std::size_t first = 0, shift = 0;
+			for (const auto & e : this->edits)
+			{
+				batch.push_back({ e.offset - shift, e.removedLength, pieces.subspan(first + e.removedPieces, e.insertedPieces) });
+				first += e.removedPieces + e.insertedPieces;
+				// Wraps around for removals, which is fine for unsigned arithmetic
+				shift += e.insertedLength - e.removedLength;
+			}
+			table.applyPieces(batch);
+			return;
+		}
+
+		std::size_t first = 0;
+		for (const auto & e : this->edits)
+		{
+			table.erase(e.offset, e.removedLength);
+			table.insertPieces(e.offset, pieces.subspan(first + e.removedPieces, e.insertedPieces));
+			first += e.removedPieces + e.insertedPieces;
+		}
+	}
+
+	COMFYDX_API UndoHistory::UndoHistory()
+		: UndoHistory{ Options{} }
+	{
+	}
+	COMFYDX_API UndoHistory::UndoHistory(Options options)
+		: m_options{ std::move(options) }
+	{
+		this->m_nodes.emplace_back();
+	}
+	COMFYDX_API UndoHistory::~UndoHistory() noexcept
+	{
+		this->closeJournal();
+	}
+
+	COMFYDX_API void UndoHistory::insert(PieceTable & table, std::size_t offset, std::string_view text)
+	{
+		offset = std::min(offset, table.size());
+		table.insert(offset, text);
+		this->record(offset, {}, table.pieces(offset, text.size()));
+	}
+	COMFYDX_API void UndoHistory::erase(PieceTable & table, std::size_t offset, std::size_t count)
+	{
+		offset = std::min(offset, table.size());
+		auto removed = table.pieces(offset, count);
+		table.erase(offset, count);
+		this->record(offset, removed, {});
+	}
+	COMFYDX_API void UndoHistory::replace(PieceTable & table, std::size_t offset, std::size_t count, std::string_view text)
+	{
+		offset = std::min(offset, table.size());
+		auto removed = table.pieces(offset, count);
+		table.replace(offset, count, text);
+		this->record(offset, removed, table.pieces(offset, text.size()));
+	}
+
+	COMFYDX_API void UndoHistory::apply(PieceTable & table, std::span<const TextEdit> edits)
+	{
+		std::vector<TextEdit> batch{ edits.begin(), edits.end() };
+		table.normalize(batch);
+
+		std::vector<Piece> removed;
+		std::vector<std::size_t> firstRemoved;
+		firstRemoved.reserve(batch.size() + 1);
+		for (const auto & e : batch)
+		{
+			firstRemoved.push_back(removed.size());
+			if (e.count != 0)
+			{
+				auto pieces = table.pieces(e.offset, e.count);
+				removed.insert(removed.end(), pieces.begin(), pieces.end());
+			}
+		}
+		firstRemoved.push_back(removed.size());
+		std::vector<Piece> merged;
+		auto inserted = table.apply(batch, &merged);
+
+		// Recorded edits are replayed in order, so their offsets include the earlier edits
+		this->beginGroup();
+		std::size_t shift = 0;
+		std::vector<Piece> replaced;
+		for (std::size_t i = 0; i < batch.size(); ++i)
+		{
+			std::span<const Piece> ins;
+			if (inserted[i].length != 0)
+			{
+				ins = { &inserted[i], 1 };
+			}
+			auto offset = batch[i].offset + shift;
+			std::span<const Piece> rem{ removed.data() + firstRemoved[i], firstRemoved[i + 1] - firstRemoved[i] };
+			if (merged[i].length != 0)
+			{
+				// The edit replaced the add piece its text was merged with as well
+				offset -= merged[i].length;
+				replaced.assign(1, merged[i]);
+				replaced.insert(replaced.end(), rem.begin(), rem.end());
+				rem = replaced;
+			}
+			this->record(offset, rem, ins);
+			// Wraps around for removals, which is fine for unsigned arithmetic
+			shift += batch[i].text.size() - batch[i].count;
+		}
+		this->endGroup();
+	}
+
+	void UndoHistory::newNode()
+	{
+		auto index = this->m_nodes.size();
+		Node node;
+		node.parent = this->m_current;
+		this->m_nodes.push_back(std::move(node));
+
+		auto & parent = this->m_nodes[this->m_current];
+		parent.children.push_back(index);
+		parent.redoChild = index;
+		this->m_current = index;
+		this->m_bOpen = true;
+	}
+
+	bool UndoHistory::coalesce(std::size_t offset, std::span<const Piece> removed, std::span<const Piece> inserted)
+	{
+		auto & group = this->m_nodes[this->m_current].group;
+		if (group.edits.empty())
+		{
+			return false;
+		}
+		auto & e = group.edits.back();
+		auto & pieces = group.pieces;
+
+		auto append = [&pieces](std::span<const Piece> add, bool bMerge)
+		{
+			auto first = add.begin();
+			if (bMerge && mergePieces(pieces.back(), *first))
+			{
+				++first;
+			}
+			pieces.insert(pieces.end(), first, add.end());
+			return std::uint32_t(add.end() - first);
+		};
+
+		if (removed.empty() && offset == e.offset + e.insertedLength)
+		{
+			// Typing on
+			e.insertedPieces += append(inserted, e.insertedPieces != 0);
+			e.insertedLength += totalLength(inserted);
+			return true;
+		}
+		else if (inserted.empty() && e.insertedLength == 0)
+		{
+			if (offset == e.offset)
+			{
+				// Deleting forward
+				e.removedPieces += append(removed, e.removedPieces != 0);
+			}
+			else if (offset + totalLength(removed) == e.offset)
+			{
+				// Backspacing, the removed pieces go in front of the earlier ones
+				auto at = pieces.end() - e.removedPieces;
+				auto last = removed.end();
+				if (e.removedPieces != 0)
+				{
+					Piece merged = removed.back();
+					if (mergePieces(merged, *at))
+					{
+						*at = merged;
+						--last;
+					}
+				}
+				pieces.insert(at, removed.begin(), last);
+				e.removedPieces += std::uint32_t(last - removed.begin());
+				e.offset = offset;
+			}
+			else
+			{
+				return false;
+			}
+			e.removedLength += totalLength(removed);
+			return true;
+		}
+		return false;
+	}
+
+	COMFYDX_API void UndoHistory::record(std::size_t offset, std::span<const Piece> removed, std::span<const Piece> inserted)
+	{
+		if (removed.empty() && inserted.empty())
+		{
+			return;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		bool bPaused = now - this->m_lastEdit > this->m_options.coalesceTimeout;
+		this->m_lastEdit = now;
+
+		if (!this->m_bOpen || (this->m_groupDepth == 0 && bPaused))
+		{
+			this->newNode();
+		}
+		auto & group = this->m_nodes[this->m_current].group;
+		auto before = group.memoryUsage();
+		if (!this->coalesce(offset, removed, inserted))
+		{
+			if (this->m_groupDepth == 0 && !group.edits.empty())
+			{
+				// Unrelated edits are separate steps unless grouped explicitly
+				this->newNode();
+				this->record(offset, removed, inserted);
+				return;
+			}
+			EditRecord e{ offset, totalLength(removed), totalLength(inserted), std::uint32_t(removed.size()), std::uint32_t(inserted.size()) };
+			group.edits.push_back(e);
+			group.pieces.insert(group.pieces.end(), removed.begin(), removed.end());
+			group.pieces.insert(group.pieces.end(), inserted.begin(), inserted.end());
+		}
+		this->m_memory += group.memoryUsage() - before;
+		this->trim();
+	}
+
+	COMFYDX_API void UndoHistory::beginGroup()
+	{
+		if (this->m_groupDepth++ == 0)
+		{
+			this->seal();
+		}
+	}
+	COMFYDX_API void UndoHistory::endGroup()
+	{
+		if (this->m_groupDepth != 0 && --this->m_groupDepth == 0)
+		{
+			this->seal();
+		}
+	}
+
+	COMFYDX_API bool UndoHistory::undo(PieceTable & table)
+	{
+		this->seal();
+		auto index = this->m_current;
+		if (index == 0 || !this->load(index))
+		{
+			return false;
+		}
+		auto & node = this->m_nodes[index];
+		node.group.undo(table);
+		this->m_nodes[node.parent].redoChild = index;
+		this->m_current = node.parent;
+		this->trim();
+		return true;
+	}
+	COMFYDX_API bool UndoHistory::redo(PieceTable & table)
+	{
+		auto child = this->m_nodes[this->m_current].redoChild;
+		if (child == npos)
+		{
+			return false;
+		}
+		const auto & children = this->m_nodes[this->m_current].children;
+		return this->redo(table, std::size_t(std::find(children.begin(), children.end(), child) - children.begin()));
+	}
+	COMFYDX_API bool UndoHistory::redo(PieceTable & table, std::size_t branch)
+	{
+		this->seal();
+		auto & node = this->m_nodes[this->m_current];
+		if (branch >= node.children.size())
+		{
+			return false;
+		}
+		auto child = node.children[branch];
+		if (!this->load(child))
+		{
+			return false;
+		}
+		this->m_nodes[child].group.redo(table);
+		this->m_nodes[this->m_current].redoChild = child;
+		this->m_current = child;
+		this->trim();
+		return true;
+	}
+
+	COMFYDX_API void UndoHistory::clear()
+	{
+		this->closeJournal();
+		this->m_nodes.clear();
+		this->m_nodes.emplace_back();
+		this->m_loaded.clear();
+		this->m_current = 0;
+		this->m_memory = 0;
+		this->m_spillFrom = 1;
+		this->m_bOpen = false;
+	}
+
+	bool UndoHistory::openJournal()
+	{
+		if (this->m_journal.is_open())
+		{
+			return true;
+		}
+
+		std::error_code ec;
+		this->m_journalPath = this->m_options.journal;
+		if (this->m_journalPath.empty())
+		{
+			auto dir = std::filesystem::temp_directory_path(ec);
+			if (ec)
+			{
+				return false;
+			}
+			auto id = std::uintptr_t(this) ^ std::uintptr_t(std::chrono::steady_clock::now().time_since_epoch().count());
+			this->m_journalPath = dir / ("comfyedit-undo-" + std::to_string(id) + ".journal");
+		}
+		this->m_journal.open(this->m_journalPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+		this->m_journalSize = 0;
+		return this->m_journal.is_open();
+	}
+	void UndoHistory::closeJournal() noexcept
+	{
+		if (this->m_journal.is_open())
+		{
+			this->m_journal.close();
+			std::error_code ec;
+			std::filesystem::remove(this->m_journalPath, ec);
+		}
+		this->m_journalSize = 0;
+	}
+
+	bool UndoHistory::spill(std::size_t index)
+	{
+		auto & node = this->m_nodes[index];
+		if (node.bSpilled || node.group.edits.empty())
+		{
+			return true;
+		}
+		if (!node.bJournaled)
+		{
+			if (!this->openJournal())
+			{
+				return false;
+			}
+			std::string bytes;
+			node.group.encode(bytes);
+			this->m_journal.seekp(std::streamoff(this->m_journalSize));
+			if (!this->m_journal.write(bytes.data(), std::streamsize(bytes.size())))
+			{
+				this->m_journal.clear();
+				return false;
+			}
+			node.journalOffset = this->m_journalSize;
+			node.journalSize = bytes.size();
+			node.bJournaled = true;
+			this->m_journalSize += bytes.size();
+		}
+		this->m_memory -= node.group.memoryUsage();
+		node.group = {};
+		node.bSpilled = true;
+		return true;
+	}
+	bool UndoHistory::load(std::size_t index)
+	{
+		auto & node = this->m_nodes[index];
+		if (!node.bSpilled)
+		{
+			return true;
+		}
+
+		std::string bytes(std::size_t(node.journalSize), '\0');
+		this->m_journal.seekg(std::streamoff(node.journalOffset));
+		if (!this->m_journal.read(bytes.data(), std::streamsize(bytes.size())) || !node.group.decode(bytes))
+		{
+			this->m_journal.clear();
+			return false;
+		}
+		node.bSpilled = false;
+		this->m_memory += node.group.memoryUsage();
+		this->m_loaded.push_back(index);
+		return true;
+	}
+
+	void UndoHistory::trim()
+	{
+		auto keep = [this](std::size_t index)
+		{
+			// The step being typed and the neighbours undo/redo need next
+			return index == this->m_current || this->m_nodes[index].parent == this->m_current;
+		};
+
+		// Steps that were loaded back are already journaled, dropping them is cheap
+		for (auto it = this->m_loaded.begin(); it != this->m_loaded.end() && this->m_memory > this->m_options.memoryBudget;)
+		{
+			if (keep(*it))
+			{
+				++it;
+				continue;
+			}
+			if (!this->spill(*it))
+			{
+				return;
+			}
+			it = this->m_loaded.erase(it);
+		}
+		for (; this->m_memory > this->m_options.memoryBudget && this->m_spillFrom < this->m_nodes.size(); ++this->m_spillFrom)
+		{
+			if (keep(this->m_spillFrom))
+			{
+				break;
+			}
+			if (!this->spill(this->m_spillFrom))
+			{
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,554 @@
+#include "pch.hpp"
+#include "wrapIndex.hpp"
+#include "columnIndex.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <bit>
+
+namespace cdx::text
+{
+	struct WrapJob
+	{
+		TextSnapshot text;
+		std::uint64_t layout{ 0 };
+		std::size_t columns{ 0 };
+		std::uint8_t tabSize{ 0 };
+		// Lines [first, last) to measure, in the snapshot's line numbers
+		std::vector<std::pair<std::size_t, std::size_t>> ranges;
+		// Rows of every line in 'ranges', in order
+		std::vector<std::uint32_t> rows;
+		std::atomic<bool> bDone{ false };
+		// Declared last, so it is joined before the rest is destroyed
+		std::jthread worker;
+
+		void measure(std::stop_token stop) noexcept;
+	};
+
+	namespace
+	{
+		[[nodiscard]] std::uint32_t rowsOf(std::uint32_t entry) noexcept
+		{
+			return entry & ~0x80000000u;
+		}
+		[[nodiscard]] std::uint32_t measureLine(std::string_view line, std::size_t columns, std::uint8_t tabSize) noexcept
+		{
+			return std::uint32_t(std::min<std::size_t>(ce::wrappedRows(line, columns, tabSize), 0x7FFFFFFF));
+		}
+
+		// Sum of the first 'count' entries
+		[[nodiscard]] std::size_t prefix(const std::vector<std::size_t> & tree, std::size_t count) noexcept
+		{
+			std::size_t sum = 0;
+			for (; count > 0; count &= count - 1)
+			{
+				sum += tree[count];
+			}
+			return sum;
+		}
+		// Last entry whose prefix sum is <= value, 'value' becomes the rest
+		[[nodiscard]] std::size_t descend(const std::vector<std::size_t> & tree, std::size_t & value) noexcept
+		{
+			auto n = tree.size() - 1;
+			std::size_t pos = 0;
+			for (auto step = std::bit_floor(n); step != 0; step >>= 1)
+			{
+				if (pos + step <= n && tree[pos + step] <= value)
+				{
+					pos += step;
+					value -= tree[pos];
+				}
+			}
+			return pos;
+		}
+		void add(std::vector<std::size_t> & tree, std::size_t index, std::size_t delta) noexcept
+		{
+			// Wraps around for negative deltas
+			for (++index; index < tree.size(); index += index & (~index + 1))
+			{
+				tree[index] += delta;
+			}
+		}
+	}
+
+	void WrapJob::measure(std::stop_token stop) noexcept
+	{
+		try
+		{
+			std::string carry;
+			for (auto [first, last] : this->ranges)
+			{
+				auto start = this->text.lineStart(first);
+				auto end = this->text.lineEnd(last - 1);
+				this->text.forEachChunk(start, end - start, [&](std::string_view chunk)
+				{
+					for (auto lf = chunk.find('\n'); lf != std::string_view::npos; lf = chunk.find('\n'))
+					{
+						// Checked per line, a chunk of the original text can hold all of them
+						if (stop.stop_requested())
+						{
+							return false;
+						}
+						if (carry.empty())
+						{
+							this->rows.push_back(measureLine(chunk.substr(0, lf), this->columns, this->tabSize));
+						}
+						else
+						{
+							carry.append(chunk.substr(0, lf));
+							this->rows.push_back(measureLine(carry, this->columns, this->tabSize));
+							carry.clear();
+						}
+						chunk.remove_prefix(lf + 1);
+					}
+					carry.append(chunk);
+					return true;
+				});
+				if (stop.stop_requested())
+				{
+					return;
+				}
+				this->rows.push_back(measureLine(carry, this->columns, this->tabSize));
+				carry.clear();
+			}
+		}
+		catch (...)
+		{
+			// Dropped for a short count, measured again by the next job
+			this->rows.clear();
+		}
+		this->bDone.store(true, std::memory_order_release);
+	}
+
+	COMFYDX_API WrapIndex::WrapIndex()
+	{
+		this->reset(1);
+	}
+	COMFYDX_API WrapIndex::~WrapIndex() noexcept = default;
+
+	void WrapIndex::rebuild()
+	{
+		auto n = this->m_blocks.size();
+		this->m_lineTree.assign(n + 1, 0);
+		this->m_rowTree.assign(n + 1, 0);
+		this->m_lines = 0;
+		this->m_rows = 0;
+		this->m_stale = 0;
+		for (std::size_t i = 1; i <= n; ++i)
+		{
+			const auto & block = this->m_blocks[i - 1];
+			this->m_lines += block.rows.size();
+			this->m_rows += block.total;
+			this->m_stale += block.stale;
+			this->m_lineTree[i] += block.rows.size();
+			this->m_rowTree[i] += block.total;
+			if (auto parent = i + (i & (~i + 1)); parent <= n)
+			{
+				this->m_lineTree[parent] += this->m_lineTree[i];
+				this->m_rowTree[parent] += this->m_rowTree[i];
+			}
+		}
+	}
+	void WrapIndex::update(std::size_t block, std::size_t total, std::size_t stale)
+	{
+		auto & b = this->m_blocks[block];
+		add(this->m_rowTree, block, total - b.total);
+		this->m_rows += total - b.total;
+		this->m_stale += stale - b.stale;
+		b.total = total;
+		b.stale = stale;
+	}
+	std::pair<std::size_t, std::size_t> WrapIndex::locate(std::size_t line) const noexcept
+	{
+		if (line >= this->m_lines)
+		{
+			return { this->m_blocks.size() - 1, this->m_blocks.back().rows.size() };
+		}
+		auto block = descend(this->m_lineTree, line);
+		return { block, line };
+	}
+	void WrapIndex::setRows(std::size_t block, std::size_t index, std::uint32_t rows)
+	{
+		auto & b = this->m_blocks[block];
+		auto old = b.rows[index];
+		b.rows[index] = rows;
+		this->update(block, b.total - rowsOf(old) + rowsOf(rows), b.stale - ((old & staleBit) != 0) + ((rows & staleBit) != 0));
+	}
+
+	void WrapIndex::insertLines(std::size_t line, std::size_t count)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		auto [block, index] = this->locate(line);
+		auto & rows = this->m_blocks[block].rows;
+		rows.insert(rows.begin() + std::ptrdiff_t(index), count, staleBit | 1);
+
+		if (rows.size() > maxBlock)
+		{
+			// Split into half-full blocks, so the next inserts don't split again right away
+			std::vector<std::uint32_t> all = std::move(rows);
+			std::vector<Block> parts((all.size() + maxBlock / 2 - 1) / (maxBlock / 2));
+			for (std::size_t i = 0; i < parts.size(); ++i)
+			{
+				auto from = all.begin() + std::ptrdiff_t(i * (maxBlock / 2));
+				auto to = (i + 1 == parts.size()) ? all.end() : from + std::ptrdiff_t(maxBlock / 2);
+				parts[i].rows.assign(from, to);
+			}
+			this->m_blocks.erase(this->m_blocks.begin() + std::ptrdiff_t(block));
+			this->m_blocks.insert(this->m_blocks.begin() + std::ptrdiff_t(block), std::make_move_iterator(parts.begin()), std::make_move_iterator(parts.end()));
+			for (std::size_t i = block; i < block + parts.size(); ++i)
+			{
+				auto & b = this->m_blocks[i];
+				b.total = b.rows.size();
+				b.stale = b.rows.size();
+				for (auto r : b.rows)
+				{
+					b.total += rowsOf(r) - 1;
+					b.stale -= (r & staleBit) == 0;
+				}
+			}
+		}
+		else
+		{
+			auto & b = this->m_blocks[block];
+			b.total += count;
+			b.stale += count;
+		}
+		this->rebuild();
+	}
+	void WrapIndex::eraseLines(std::size_t line, std::size_t count)
+	{
+		count = std::min(count, this->m_lines - std::min(line, this->m_lines));
+		if (count == 0)
+		{
+			return;
+		}
+		auto [first, index] = this->locate(line);
+		auto block = first;
+		for (; count > 0; ++block, index = 0)
+		{
+			auto & b = this->m_blocks[block];
+			auto n = std::min(count, b.rows.size() - index);
+			auto from = b.rows.begin() + std::ptrdiff_t(index);
+			std::for_each(from, from + std::ptrdiff_t(n), [&b](std::uint32_t r)
+			{
+				b.total -= rowsOf(r);
+				b.stale -= (r & staleBit) != 0;
+			});
+			b.rows.erase(from, from + std::ptrdiff_t(n));
+			count -= n;
+		}
+
+		// Drops emptied blocks and merges a small one into its neighbour
+		auto begin = this->m_blocks.begin();
+		this->m_blocks.erase(std::remove_if(begin + std::ptrdiff_t(first), begin + std::ptrdiff_t(block), [](const Block & b)
+		{
+			return b.rows.empty();
+		}), begin + std::ptrdiff_t(block));
+		if (this->m_blocks.empty())
+		{
+			this->m_blocks.emplace_back();
+		}
+		first = std::min(first, this->m_blocks.size() - 1);
+		if (first + 1 < this->m_blocks.size() && this->m_blocks[first].rows.size() + this->m_blocks[first + 1].rows.size() <= maxBlock / 2)
+		{
+			auto & b = this->m_blocks[first];
+			auto & next = this->m_blocks[first + 1];
+			b.rows.insert(b.rows.end(), next.rows.begin(), next.rows.end());
+			b.total += next.total;
+			b.stale += next.stale;
+			this->m_blocks.erase(this->m_blocks.begin() + std::ptrdiff_t(first + 1));
+		}
+		this->rebuild();
+	}
+
+	COMFYDX_API void WrapIndex::reset(std::size_t lines)
+	{
+		this->m_job.reset();
+		this->m_editsSince.clear();
+		this->m_blocks.assign(1, Block{});
+		this->rebuild();
+		this->insertLines(0, lines);
+	}
+	COMFYDX_API void WrapIndex::edit(std::span<const LineEdit> edits)
+	{
+		if (this->m_job)
+		{
+			this->m_editsSince.emplace_back(edits.begin(), edits.end());
+		}
+		// Back to front, so every edit still sees the line numbers it was made in
+		for (auto e = edits.rbegin(); e != edits.rend(); ++e)
+		{
+			if (e->first >= this->m_lines)
+			{
+				continue;
+			}
+			auto [block, index] = this->locate(e->first);
+			this->setRows(block, index, this->m_blocks[block].rows[index] | staleBit);
+			this->eraseLines(e->first + 1, e->removed);
+			this->insertLines(e->first + 1, e->added);
+		}
+	}
+	COMFYDX_API bool WrapIndex::setLayout(std::size_t columns, std::uint8_t tabSize)
+	{
+		columns = std::max<std::size_t>(columns, 1);
+		tabSize = (tabSize == 0) ? std::uint8_t(1) : tabSize;
+		if (columns == this->m_columns && tabSize == this->m_tabSize)
+		{
+			return false;
+		}
+
+		this->m_job.reset();
+		this->m_editsSince.clear();
+		++this->m_layout;
+		// Wrapped lines keep their length in columns roughly, the scroll position stays close
+		for (auto & b : this->m_blocks)
+		{
+			b.total = 0;
+			for (auto & r : b.rows)
+			{
+				std::size_t rows = rowsOf(r);
+				if (rows > 1)
+				{
+					rows = std::min<std::size_t>((rows * this->m_columns + columns - 1) / columns, 0x7FFFFFFF);
+				}
+				r = staleBit | std::uint32_t(rows);
+				b.total += rows;
+			}
+			b.stale = b.rows.size();
+		}
+		this->m_columns = columns;
+		this->m_tabSize = tabSize;
+		this->rebuild();
+		return true;
+	}
+
+	COMFYDX_API bool WrapIndex::ensure(const TextSnapshot & text, std::size_t first, std::size_t last)
+	{
+		last = std::min({ last, this->m_lines, text.lineCount() });
+		if (first >= last)
+		{
+			return false;
+		}
+
+		bool bChanged = false;
+		auto [block, index] = this->locate(first);
+		for (auto line = first; line < last; ++index, ++line)
+		{
+			if (index == this->m_blocks[block].rows.size())
+			{
+				++block;
+				index = 0;
+			}
+			auto old = this->m_blocks[block].rows[index];
+			if ((old & staleBit) == 0)
+			{
+				continue;
+			}
+			auto start = text.lineStart(line);
+			auto rows = measureLine(text.text(start, text.lineEnd(line) - start), this->m_columns, this->m_tabSize);
+			bChanged |= rows != rowsOf(old);
+			this->setRows(block, index, rows);
+		}
+		return bChanged;
+	}
+
+	void WrapIndex::startJob(const TextSnapshot & text, std::size_t near)
+	{
+		auto job = std::make_unique<WrapJob>();
+		job->text = text;
+		job->layout = this->m_layout;
+		job->columns = this->m_columns;
+		job->tabSize = this->m_tabSize;
+
+		// Stale lines from 'near' to the end, then from the start
+		auto lines = std::min(this->m_lines, text.lineCount());
+		auto start = this->locate(std::min(near, this->m_lines)).first;
+		std::size_t wanted = jobLines;
+		for (std::size_t n = 0; n < this->m_blocks.size() && wanted > 0; ++n)
+		{
+			auto block = (start + n) % this->m_blocks.size();
+			const auto & b = this->m_blocks[block];
+			if (b.stale == 0)
+			{
+				continue;
+			}
+			auto line = prefix(this->m_lineTree, block);
+			for (std::size_t i = 0; i < b.rows.size() && wanted > 0 && line + i < lines; ++i)
+			{
+				if ((b.rows[i] & staleBit) == 0)
+				{
+					continue;
+				}
+				if (!job->ranges.empty() && job->ranges.back().second == line + i)
+				{
+					++job->ranges.back().second;
+				}
+				else
+				{
+					job->ranges.emplace_back(line + i, line + i + 1);
+				}
+				--wanted;
+			}
+		}
+		if (job->ranges.empty())
+		{
+			return;
+		}
+		job->rows.reserve(jobLines - wanted);
+
+		auto raw = job.get();
+		job->worker = std::jthread([raw](std::stop_token stop)
+		{
+			raw->measure(stop);
+		});
+		this->m_job = std::move(job);
+	}
+	bool WrapIndex::adoptJob()
+	{
+		const auto & job = *this->m_job;
+		std::size_t measured = 0;
+		for (auto [first, last] : job.ranges)
+		{
+			measured += last - first;
+		}
+		if (job.layout != this->m_layout || job.rows.size() != measured)
+		{
+			return false;
+		}
+
+		bool bChanged = false;
+		auto it = job.rows.begin();
+		for (auto [first, last] : job.ranges)
+		{
+			for (auto line = first; line < last; ++line, ++it)
+			{
+				// Follows the line through the edits made since, edited lines are stale again
+				auto current = line;
+				bool bValid = true;
+				for (const auto & batch : this->m_editsSince)
+				{
+					auto shifted = current;
+					for (const auto & e : batch)
+					{
+						if (current < e.first)
+						{
+							break;
+						}
+						if (current <= e.first + e.removed)
+						{
+							bValid = false;
+							break;
+						}
+						shifted += e.added;
+						shifted -= e.removed;
+					}
+					if (!bValid)
+					{
+						break;
+					}
+					current = shifted;
+				}
+				if (!bValid || current >= this->m_lines)
+				{
+					continue;
+				}
+
+				auto [block, index] = this->locate(current);
+				auto old = this->m_blocks[block].rows[index];
+				if ((old & staleBit) != 0)
+				{
+					bChanged |= *it != rowsOf(old);
+					this->setRows(block, index, *it);
+				}
+			}
+		}
+		return bChanged;
+	}
+	COMFYDX_API bool WrapIndex::poll(const TextSnapshot & text, std::size_t near)
+	{
+		bool bChanged = false;
+		if (this->m_job && this->m_job->bDone.load(std::memory_order_acquire))
+		{
+			bChanged = this->adoptJob();
+			this->m_job.reset();
+			this->m_editsSince.clear();
+		}
+		if (!this->m_job && this->m_stale != 0)
+		{
+			this->startJob(text, near);
+		}
+		return bChanged;
+	}
+	COMFYDX_API void WrapIndex::finish(const TextSnapshot & text)
+	{
+		if (this->m_job)
+		{
+			this->m_job->worker.join();
+			(void)this->adoptJob();
+			this->m_job.reset();
+			this->m_editsSince.clear();
+		}
+		(void)this->ensure(text, 0, this->m_lines);
+	}
+
+	COMFYDX_API std::size_t WrapIndex::rows(std::size_t line) const noexcept
+	{
+		if (line >= this->m_lines)
+		{
+			return 0;
+		}
+		auto [block, index] = this->locate(line);
+		return rowsOf(this->m_blocks[block].rows[index]);
+	}
+	COMFYDX_API bool WrapIndex::stale(std::size_t line) const noexcept
+	{
+		if (line >= this->m_lines)
+		{
+			return false;
+		}
+		auto [block, index] = this->locate(line);
+		return (this->m_blocks[block].rows[index] & staleBit) != 0;
+	}
+	COMFYDX_API std::size_t WrapIndex::rowOf(std::size_t line) const noexcept
+	{
+		if (line >= this->m_lines)
+		{
+			return this->m_rows;
+		}
+		auto [block, index] = this->locate(line);
+		auto row = prefix(this->m_rowTree, block);
+		const auto & rows = this->m_blocks[block].rows;
+		for (std::size_t i = 0; i < index; ++i)
+		{
+			row += rowsOf(rows[i]);
+		}
+		return row;
+	}
+	COMFYDX_API WrapRow WrapIndex::lineAt(std::size_t row) const noexcept
+	{
+		if (this->m_lines == 0)
+		{
+			return {};
+		}
+		if (row >= this->m_rows)
+		{
+			return { this->m_lines - 1, this->rows(this->m_lines - 1) - 1 };
+		}
+		auto block = descend(this->m_rowTree, row);
+		auto line = prefix(this->m_lineTree, block);
+		for (auto r : this->m_blocks[block].rows)
+		{
+			if (row < rowsOf(r))
+			{
+				break;
+			}
+			row -= rowsOf(r);
+			++line;
+		}
+		return { line, row };
+	}
+}
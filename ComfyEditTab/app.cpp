@@ -1,6 +1,8 @@
 #include "pch.hpp"
 #include "app.hpp"
 
+#include <fileSaver.hpp>
+
 ce::App::App(HINSTANCE hInst, int nCmdShow)
 	: m_instance{ hInst }, m_cmdShow{ nCmdShow }
 {
@@ -11,6 +13,16 @@ ce::App::App(HINSTANCE hInst, int nCmdShow)
 	}
 
 	this->m_bCanRun = this->m_bCanRun && this->initAttributes();
+
+	std::error_code ec;
+	auto tempDir = std::filesystem::temp_directory_path(ec);
+	// Without a temporary directory there is no default, only an explicit --recovery= enables recovery
+	auto defRecoveryDir = ec ? std::string{} : (tempDir / "ComfyEdit" / "recovery").string();
+	this->m_recoveryDir = this->m_argTokeniser.tokenise(argparser::regex::dashTemplate("recovery="), 1).getDef(defRecoveryDir);
+	if (ec && this->m_recoveryDir.empty())
+	{
+		std::cout << "No temporary directory (" << ec.message() << "), crash recovery is disabled" << std::endl;
+	}
 }
 ce::App::~App() noexcept
 {
@@ -36,6 +48,78 @@ ce::App::~App() noexcept
 	return true;
 }
 
+[[nodiscard]] bool ce::App::writeRecovered(const std::filesystem::path & journal, const cdx::text::RecoveredDocument & doc, std::filesystem::path & copy, std::string & error)
+{
+	// <journal>.recovered<document extension> next to the journal, numbered if an earlier copy is still there
+	auto base = journal;
+	base.replace_extension(".recovered");
+	auto ext = doc.document.empty() ? std::filesystem::path{ ".txt" } : doc.document.extension();
+	copy = base;
+	copy += ext;
+	std::error_code ec;
+	for (std::size_t n = 2; std::filesystem::exists(copy, ec); ++n)
+	{
+		copy = base;
+		copy += "." + std::to_string(n);
+		copy += ext;
+	}
+
+	// The bytes as the journal held them, flushed to disk before the copy appears under its name
+	cdx::io::SaveOptions options{ .encoding = ce::Encoding::binary, .bSync = true };
+	if (!cdx::io::saveFile(doc.text.snapshot(), copy, options, error))
+	{
+		return false;
+	}
+	// The copy holds everything now, the journal would only recover it again on every launch
+	std::filesystem::remove(journal, ec);
+	return true;
+}
+void ce::App::recoverDocuments() noexcept
+{
+	if (this->m_recoveryDir.empty())
+	{
+		return;
+	}
+
+	/*
+	 * There is no document view to reopen them in yet, recovered documents are
+	 * offered as plain copies next to their journals instead
+	 */
+	try
+	{
+		std::error_code ec;
+		for (const auto & entry : std::filesystem::directory_iterator(this->m_recoveryDir, ec))
+		{
+			if (entry.path().extension() != cdx::text::RecoveryJournal::extension)
+			{
+				continue;
+			}
+			std::string error;
+			auto doc = cdx::text::RecoveryJournal::recover(entry.path(), error);
+			if (!doc)
+			{
+				std::cout << error << std::endl;
+				continue;
+			}
+
+			auto name = doc->document.empty() ? entry.path().stem().string() : doc->document.string();
+			std::filesystem::path copy;
+			if (App::writeRecovered(entry.path(), *doc, copy, error))
+			{
+				std::cout << "Recovered " << name << " (" << doc->batches << " edits) to " << copy.string() << std::endl;
+			}
+			else
+			{
+				std::cout << "Recovered " << name << ", but couldn't write " << copy.string() << " (" << error << "), the journal is kept" << std::endl;
+			}
+		}
+	}
+	catch (const std::exception & e)
+	{
+		std::cout << "Recovery failed: " << e.what() << std::endl;
+	}
+}
+
 int ce::App::run()
 {
 	if (!this->m_bCanRun)
@@ -44,6 +128,7 @@ int ce::App::run()
 	}
 
 	std::cout << "Width attribute: " << this->m_attributes.width << std::endl;
+	this->recoverDocuments();
 
 	return 0;
 }
@@ -4,6 +4,9 @@
 #include <argparser.hpp>
 #include "argHelper.hpp"
 
+#include <recoveryJournal.hpp>
+#include <filesystem>
+
 namespace ce
 {
 	class App
@@ -25,6 +28,9 @@ namespace ce
 			[[nodiscard]] bool init(argparser::Tokeniser & tok) noexcept;
 		} m_attributes{};
 
+		// Journals of documents that were open when the editor crashed, empty disables recovery
+		std::filesystem::path m_recoveryDir;
+
 		bool m_bCanRun{ true };
 
 		App() = delete;
@@ -34,6 +40,8 @@ namespace ce
 
 		[[nodiscard]] bool initTerminal() noexcept;
 		[[nodiscard]] bool initAttributes() noexcept;
+		[[nodiscard]] static bool writeRecovered(const std::filesystem::path & journal, const cdx::text::RecoveredDocument & doc, std::filesystem::path & copy, std::string & error);
+		void recoverDocuments() noexcept;
 		int run();
 	};
 }
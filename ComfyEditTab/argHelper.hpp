@@ -14,28 +14,16 @@ namespace ce
 		return token.getDef(std::to_string(defArg));
 	}
 
-	template<std::integral I>
-	[[nodiscard]] I getDefArg(const argparser::Token & token, I defArg) noexcept
-	{
-		try
-		{
-			return ce::stoi<I>(ce::getDefArgStr(token, defArg));
-		}
-		catch (const std::exception &)
-		{
-			return std::numeric_limits<I>::max();
-		}
-	}
-	template<std::floating_point F>
-	[[nodiscard]] F getDefArg(const argparser::Token & token, F defArg) noexcept
+	template<concepts::numeric N>
+	[[nodiscard]] N getDefArg(const argparser::Token & token, N defArg) noexcept
 	{
 		try
 		{
-			return ce::stof<F>(ce::getDefArgStr(token, defArg));
+			return ce::toNum<N>(ce::getDefArgStr(token, defArg)).valueOr(std::numeric_limits<N>::max());
 		}
-		catch (const std::exception &)
+		catch (const std::bad_alloc &)
 		{
-			return std::numeric_limits<F>::max();
+			return std::numeric_limits<N>::max();
 		}
 	}
 
@@ -0,0 +1,221 @@
+/*
+ * portable command line splitter
+ * @details Splits a command line into arguments by the same rules as
+ * CommandLineToArgvW, in one pass and without any OS calls:
+ * - arguments are separated by spaces or tabs
+ * - the first argument (executable path) ends at the next space, or at the
+ *   closing quote if it starts with one; nothing is escaped in it
+ * - quotes serve as optional argument delimiters
+ *   '"a b"'   -> 'a b'
+ * - 2n   backslashes + quote -> n backslashes + quote as an argument delimiter
+ * - 2n+1 backslashes + quote -> n backslashes + literal quote
+ * - backslashes that are not followed by a quote are copied literally
+ * - in quoted strings, consecutive quotes (counting the opening one) are
+ *   divided by three, the remainder decides whether the string is closed:
+ *   (1+) 3n   quotes -> n quotes
+ *   (1+) 3n+1 quotes -> n quotes plus closes the quoted string
+ *   (1+) 3n+2 quotes -> n+1 quotes plus closes the quoted string
+ * Unlike CommandLineToArgvW, an empty command line has no arguments at all,
+ * the executable path isn't known here. win32::BasicArgcArgv substitutes it.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+namespace cmdline
+{
+	// Size of the output buffer that is always enough for a command line of 'len' characters
+	[[nodiscard]] constexpr std::size_t bufferSize(std::size_t len) noexcept
+	{
+		return len + 1;
+	}
+	// Upper bound of the argument count for a command line of 'len' characters
+	[[nodiscard]] constexpr std::size_t maxArgs(std::size_t len) noexcept
+	{
+		return len / 2 + 2;
+	}
+
+	/*
+	 * Unescapes the arguments into 'buf' (at least bufferSize(cmdLine.size())
+	 * characters), each one terminated by NUL. 'onArg' receives a pointer to every
+	 * argument in the buffer and its length. Returns the argument count.
+	 */
+	template<typename CharT, typename OnArg>
+	std::size_t split(std::basic_string_view<CharT> cmdLine, CharT * buf, OnArg && onArg)
+	{
+		constexpr CharT quote{ '"' }, backslash{ '\\' }, nul{ 0 };
+		auto isBlank = [](CharT ch) noexcept
+		{
+			return ch == CharT(' ') || ch == CharT('\t');
+		};
+
+		auto s = cmdLine.data(), e = s + cmdLine.size();
+		if (s == e)
+		{
+			return 0;
+		}
+
+		std::size_t argc = 0;
+		CharT * d = buf, * arg = buf;
+		auto close = [&]()
+		{
+			*d = nul;
+			onArg(arg, std::size_t(d - arg));
+			++argc;
+			++d;
+		};
+
+		// The executable path follows special rules
+		if (*s == quote)
+		{
+			for (++s; s != e;)
+			{
+				if (*s == quote)
+				{
+					++s;
+					break;
+				}
+				*d++ = *s++;
+			}
+		}
+		else
+		{
+			while (s != e && !isBlank(*s))
+			{
+				*d++ = *s++;
+			}
+		}
+		close();
+
+		while (s != e && isBlank(*s))
+		{
+			++s;
+		}
+		if (s == e)
+		{
+			return argc;
+		}
+
+		arg = d;
+		bool open = true;
+		unsigned qcount = 0, bcount = 0;
+		while (s != e)
+		{
+			if (isBlank(*s) && qcount == 0)
+			{
+				close();
+				bcount = 0;
+				do
+				{
+					++s;
+				} while (s != e && isBlank(*s));
+
+				open = (s != e);
+				arg = d;
+			}
+			else if (*s == backslash)
+			{
+				*d++ = *s++;
+				++bcount;
+			}
+			else if (*s == quote)
+			{
+				if ((bcount & 1) == 0)
+				{
+					// Even number of backslashes, half of them stay and the quote is erased
+					d -= bcount / 2;
+					++qcount;
+				}
+				else
+				{
+					// Odd number, half of them stay, followed by a literal quote
+					d -= bcount / 2 + 1;
+					*d++ = quote;
+				}
+				++s;
+				bcount = 0;
+				// qcount already counts the opening quote and the one that lead us here
+				while (s != e && *s == quote)
+				{
+					if (++qcount == 3)
+					{
+						*d++ = quote;
+						qcount = 0;
+					}
+					++s;
+				}
+				if (qcount == 2)
+				{
+					qcount = 0;
+				}
+			}
+			else
+			{
+				*d++ = *s++;
+				bcount = 0;
+			}
+		}
+		if (open)
+		{
+			close();
+		}
+		return argc;
+	}
+
+	/*
+	 * Owns the unescaped arguments: one character buffer, string views into it
+	 * and a C-style argv array terminated by nullptr.
+	 */
+	template<typename CharT>
+	class BasicCommandLine
+	{
+	public:
+		using view_type = std::basic_string_view<CharT>;
+
+	private:
+		std::unique_ptr<CharT[]> m_buf;
+		std::vector<view_type> m_args;
+		std::vector<CharT *> m_argv;
+
+	public:
+		BasicCommandLine() noexcept = default;
+		explicit BasicCommandLine(view_type cmdLine)
+		{
+			this->assign(cmdLine);
+		}
+
+		void assign(view_type cmdLine)
+		{
+			this->m_buf = std::make_unique_for_overwrite<CharT[]>(cmdline::bufferSize(cmdLine.size()));
+			this->m_args.clear();
+			this->m_argv.clear();
+
+			cmdline::split(cmdLine, this->m_buf.get(), [this](CharT * arg, std::size_t len)
+			{
+				this->m_args.emplace_back(arg, len);
+				this->m_argv.push_back(arg);
+			});
+			this->m_argv.push_back(nullptr);
+		}
+
+		[[nodiscard]] const std::vector<view_type> & args() const noexcept
+		{
+			return this->m_args;
+		}
+		[[nodiscard]] int argc() const noexcept
+		{
+			return int(this->m_args.size());
+		}
+		[[nodiscard]] CharT ** argv() noexcept
+		{
+			return this->m_argv.empty() ? nullptr : this->m_argv.data();
+		}
+	};
+
+	using CommandLine = BasicCommandLine<char>;
+	using CommandLineW = BasicCommandLine<wchar_t>;
+}
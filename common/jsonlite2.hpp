@@ -7,6 +7,7 @@
 #include <unordered_map>
 #include <memory>
 #include <stdexcept>
+#include <charconv>
 
 #include <cstdint>
 #include <cstring>
@@ -270,6 +271,10 @@ namespace jsonlite2
 
 	public:
 
+		std::size_t size() const noexcept
+		{
+			return this->m_vals.size();
+		}
 		jsonValue & operator[](std::size_t idx) noexcept
 		{
 			return this->m_vals[idx];
@@ -373,6 +378,10 @@ namespace jsonlite2
 
 	public:
 
+		bool contains(const std::string & key) const
+		{
+			return this->m_map.find(key) != this->m_map.end();
+		}
 		jsonKeyValue & operator[](const std::string & key)
 		{
 			auto it = this->m_map.find(key);
@@ -471,6 +480,8 @@ namespace jsonlite2
 		case type::object:
 			this->m_d.object = new jsonObject(*other.m_d.object);
 			break;
+		case type::null:
+			break;
 		}
 	}
 	inline jsonValue::jsonValue(jsonValue && other) noexcept
@@ -500,6 +511,8 @@ namespace jsonlite2
 		case type::object:
 			this->m_d.object = new jsonObject(*other.m_d.object);
 			break;
+		case type::null:
+			break;
 		}
 		return *this;
 	}
@@ -526,6 +539,10 @@ namespace jsonlite2
 		case type::object:
 			delete this->m_d.object;
 			break;
+		case type::null:
+		case type::boolean:
+		case type::number:
+			break;
 		}
 		this->m_type = type::null;
 	}
@@ -889,16 +906,20 @@ namespace jsonlite2
 			case type::number:
 			{
 				char temp[MAX_NUMBERLEN];
-				auto stringLen = sprintf_s(temp, MAX_NUMBERLEN, "%.15g", this->m_d.number);
+				auto [end, ec] = std::to_chars(temp, temp + MAX_NUMBERLEN, this->m_d.number, std::chars_format::general, 15);
 
-				if (stringLen <= 0)
+				if (ec != std::errc{})
 				{
 					throw std::runtime_error("Failed to convert number to string!");
 				}
-				out.append(temp, stringLen);
+				out.append(temp, end);
 
 				break;
 			}
+			case type::array:
+			case type::object:
+				// Dumped above
+				break;
 			}
 			out += '\n';
 			return out;
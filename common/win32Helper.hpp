@@ -8,318 +8,142 @@
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "cmdline.hpp"
 
 namespace win32
 {
-	/*************************************************************************
-	 * CommandLineToArgvA			[SHELL32.@]
-	 *
-	 * We must interpret the quotes in the command line to rebuild the argv
-	 * array correctly:
-	 * - arguments are separated by spaces or tabs
-	 * - quotes serve as optional argument delimiters
-	 *   '"a b"'   -> 'a b'
-	 * - escaped quotes must be converted back to '"'
-	 *   '\"'	  -> '"'
-	 * - consecutive backslashes preceding a quote see their number halved with
-	 *   the remainder escaping the quote:
-	 *   2n   backslashes + quote -> n backslashes + quote as an argument delimiter
-	 *   2n+1 backslashes + quote -> n backslashes + literal quote
-	 * - backslashes that are not followed by a quote are copied literally:
-	 *   'a\b'	 -> 'a\b'
-	 *   'a\\b'	-> 'a\\b'
-	 * - in quoted strings, consecutive quotes see their number divided by three
-	 *   with the remainder modulo 3 deciding whether to close the string or not.
-	 *   Note that the opening quote must be counted in the consecutive quotes,
-	 *   that's the (1+) below:
-	 *   (1+) 3n   quotes -> n quotes
-	 *   (1+) 3n+1 quotes -> n quotes plus closes the quoted string
-	 *   (1+) 3n+2 quotes -> n+1 quotes plus closes the quoted string
-	 * - in unquoted strings, the first quote opens the quoted string and the
-	 *   remaining consecutive quotes follow the above rule.
+	/*
+	 * CommandLineToArgvA counterpart of CommandLineToArgvW, the splitting rules are
+	 * described in cmdline.hpp. The string array and the strings are allocated in a
+	 * single lump, so the caller frees both with one LocalFree() call.
 	 */
-	/* Credit to GitHub repo: https://github.com/futurist/CommandLineToArgvA */
+	/* Based on Wine's implementation, credit to GitHub repo: https://github.com/futurist/CommandLineToArgvA */
 	inline LPSTR * WINAPI CommandLineToArgvA_wine(LPSTR lpCmdline, int * numargs) noexcept
 	{
-		DWORD argc;
-		LPSTR * argv;
-		LPSTR s;
-		LPSTR d;
-		LPSTR cmdline;
-		int qcount, bcount;
-
 		if (!numargs || lpCmdline == nullptr || *lpCmdline == 0)
 		{
 			::SetLastError(ERROR_INVALID_PARAMETER);
 			return nullptr;
 		}
 
-		/* --- First count the arguments */
-		argc = 1;
-		s = lpCmdline;
-		/* The first argument, the executable path, follows special rules */
-		if (*s == '"')
-		{
-			/* The executable path ends at the next quote, no matter what */
-			s++;
-			while (*s)
-			{
-				if (*s++ == '"')
-				{
-					break;
-				}
-			}
-		}
-		else
-		{
-			/* The executable path ends at the next space, no matter what */
-			while (*s && *s != ' ' && *s != '\t')
-			{
-				s++;
-			}
-		}
-		/* skip to the first argument, if any */
-		while (*s == ' ' || *s == '\t')
+		std::string_view cmdLine{ lpCmdline };
+		auto maxArgs = cmdline::maxArgs(cmdLine.size());
+		auto argv = static_cast<LPSTR *>(::LocalAlloc(LMEM_FIXED, maxArgs * sizeof(LPSTR) + cmdline::bufferSize(cmdLine.size()) * sizeof(char)));
+		if (argv == nullptr) [[unlikely]]
 		{
-			s++;
+			return nullptr;
 		}
-		if (*s)
+
+		auto argc = cmdline::split(cmdLine, reinterpret_cast<LPSTR>(argv + maxArgs), [it = argv](char * arg, std::size_t) mutable noexcept
 		{
-			argc++;
-		}
+			*it++ = arg;
+		});
+		argv[argc] = nullptr;
+		*numargs = int(argc);
 
-		/* Analyze the remaining arguments */
-		qcount = bcount = 0;
-		while (*s)
+		return argv;
+	}
+
+	template<typename CharT>
+	class BasicArgcArgv
+	{
+	private:
+		cmdline::BasicCommandLine<CharT> m_cmdLine;
+
+		static CharT * commandLine() noexcept
 		{
-			if ((*s == ' ' || *s == '\t') && qcount == 0)
+			if constexpr (std::is_same_v<CharT, wchar_t>)
 			{
-				/* skip to the next argument and count it if any */
-				while (*s == ' ' || *s == '\t')
-				{
-					s++;
-				}
-				if (*s)
-				{
-					argc++;
-				}
-				bcount = 0;
+				return ::GetCommandLineW();
 			}
-			else if (*s == '\\')
+			else
 			{
-				/* '\', count them */
-				bcount++;
-				s++;
+				return ::GetCommandLineA();
 			}
-			else if (*s == '"')
+		}
+		/*
+		 * CommandLineToArgvW returns the executable path as the only argument of an
+		 * empty command line, cmdline::split can't know it and returns none
+		 */
+		static std::basic_string<CharT> modulePath()
+		{
+			std::basic_string<CharT> path(MAX_PATH, CharT{});
+			while (true)
 			{
-				/* '"' */
-				if ((bcount & 1) == 0)
+				DWORD len;
+				if constexpr (std::is_same_v<CharT, wchar_t>)
 				{
-					qcount++; /* unescaped '"' */
+					len = ::GetModuleFileNameW(nullptr, path.data(), DWORD(path.size()));
 				}
-				s++;
-				bcount = 0;
-				/* consecutive quotes, see comment in copying code below */
-				while (*s == '"')
+				else
 				{
-					qcount++;
-					s++;
+					len = ::GetModuleFileNameA(nullptr, path.data(), DWORD(path.size()));
 				}
-				qcount = qcount % 3;
-				if (qcount == 2)
+
+				if (len == 0) [[unlikely]]
 				{
-					qcount = 0;
+					return {};
 				}
-			}
-			else
-			{
-				/* a regular character */
-				bcount = 0;
-				s++;
-			}
-		}
-
-		/* Allocate in a single lump, the string array, and the strings that go
-		 * with it. This way the caller can make a single LocalFree() call to free
-		 * both, as per MSDN.
-		 */
-		auto lpCmdlineLen = std::strlen(lpCmdline);
-		argv = static_cast<LPSTR *>(::LocalAlloc(LMEM_FIXED, (argc + 1) * sizeof(LPSTR) + (lpCmdlineLen + 1) * sizeof(char)));
-		if (argv == nullptr) [[unlikely]]
-		{
-			return nullptr;
-		}
-		cmdline = reinterpret_cast<LPSTR>(argv + argc + 1);
-		strcpy_s(cmdline, (lpCmdlineLen + 1) * sizeof(char), lpCmdline);
-
-		/* --- Then split and copy the arguments */
-		argv[0] = d = cmdline;
-		argc = 1;
-		/* The first argument, the executable path, follows special rules */
-		if (*d == '"')
-		{
-			/* The executable path ends at the next quote, no matter what */
-			s = d + 1;
-			while (*s)
-			{
-				if (*s == '"')
+				else if (len < path.size())
 				{
-					s++;
+					path.resize(len);
 					break;
 				}
-				*d++ = *s++;
+				path.resize(path.size() * 2);
 			}
+			// Quoted, so spaces in the path don't split it, the first argument has no escapes
+			path.insert(path.begin(), CharT('"'));
+			path.push_back(CharT('"'));
+			return path;
 		}
-		else
-		{
-			/* The executable path ends at the next space, no matter what */
-			while (*d && *d != ' ' && *d != '\t')
-			{
-				d++;
-			}
-			s = d;
-			if (*s)
-			{
-				s++;
-			}
-		}
-		/* close the executable path */
-		*d++ = 0;
-		/* skip to the first argument and initialize it if any */
-		while (*s == ' ' || *s == '\t')
-		{
-			s++;
-		}
-		if (!*s)
+
+	public:
+		CharT * o_cmdArgs{ nullptr };
+		int argc{ 0 };
+		CharT ** argv{ nullptr };
+
+		BasicArgcArgv() noexcept
+			: BasicArgcArgv{ BasicArgcArgv::commandLine() }
 		{
-			/* There are no parameters so we are all done */
-			argv[argc] = nullptr;
-			*numargs = argc;
-			return argv;
 		}
-
-		/* Split and copy the remaining arguments */
-		argv[argc++] = d;
-		qcount = bcount = 0;
-		while (*s)
+		BasicArgcArgv(CharT * cmdArgs) noexcept
+			: o_cmdArgs{ cmdArgs }
 		{
-			if ((*s == ' ' || *s == '\t') && qcount == 0)
+			try
 			{
-				/* close the argument */
-				*d++ = 0;
-				bcount = 0;
-
-				/* skip to the next one and initialize it if any */
-				do
-				{
-					s++;
-				} while (*s == ' ' || *s == '\t');
-				if (*s)
+				if (cmdArgs != nullptr && *cmdArgs != 0)
 				{
-					argv[argc++] = d;
-				}
-			}
-			else if (*s == '\\')
-			{
-				*d++ = *s++;
-				bcount++;
-			}
-			else if (*s == '"')
-			{
-				if ((bcount & 1) == 0)
-				{
-					/* Preceded by an even number of '\', this is half that
-					 * number of '\', plus a quote which we erase.
-					 */
-					d -= bcount / 2;
-					qcount++;
+					this->m_cmdLine.assign(cmdArgs);
 				}
 				else
 				{
-					/* Preceded by an odd number of '\', this is half that
-					 * number of '\' followed by a '"'
-					 */
-					d = d - bcount / 2 - 1;
-					*d++ = '"';
-				}
-				s++;
-				bcount = 0;
-				/* Now count the number of consecutive quotes. Note that qcount
-				 * already takes into account the opening quote if any, as well as
-				 * the quote that lead us here.
-				 */
-				while (*s == '"')
-				{
-					if (++qcount == 3)
-					{
-						*d++ = '"';
-						qcount = 0;
-					}
-					s++;
-				}
-				if (qcount == 2)
-				{
-					qcount = 0;
+					this->m_cmdLine.assign(BasicArgcArgv::modulePath());
 				}
+				this->argc = this->m_cmdLine.argc();
+				this->argv = this->m_cmdLine.argv();
 			}
-			else
+			catch (const std::bad_alloc &)
 			{
-				/* a regular character */
-				*d++ = *s++;
-				bcount = 0;
+				this->argc = 0;
+				this->argv = nullptr;
 			}
 		}
-		*d = '\0';
-		argv[argc] = nullptr;
-		*numargs = argc;
-
-		return argv;
-	}
+		BasicArgcArgv(const BasicArgcArgv &) = delete;
+		BasicArgcArgv & operator=(const BasicArgcArgv &) = delete;
+		~BasicArgcArgv() noexcept = default;
 
-	class ArgcArgvW
-	{
-	public:
-		LPWSTR o_lpCmdArgs{ nullptr };
-		int argc;
-		wchar_t ** argv;
-
-		ArgcArgvW() noexcept
+		[[nodiscard]] const auto & args() const noexcept
 		{
-			this->o_lpCmdArgs = ::GetCommandLineW();
-			this->argv = ::CommandLineToArgvW(this->o_lpCmdArgs, &this->argc);
-		}
-		ArgcArgvW(LPWSTR lpcmdArgs) noexcept
-		{
-			this->argv = ::CommandLineToArgvW(lpcmdArgs, &this->argc);
-		}
-		~ArgcArgvW() noexcept
-		{
-			::LocalFree(this->argv);
+			return this->m_cmdLine.args();
 		}
 	};
 
-	class ArgcArgv
-	{
-	public:
-		LPSTR o_cmdArgs{ nullptr };
-		int argc;
-		char ** argv;
-
-		ArgcArgv() noexcept
-		{
-			this->o_cmdArgs = ::GetCommandLineA();
-			this->argv = win32::CommandLineToArgvA_wine(this->o_cmdArgs, &this->argc);
-		}
-		ArgcArgv(LPSTR cmdArgs) noexcept
-		{
-			this->argv = win32::CommandLineToArgvA_wine(cmdArgs, &this->argc);
-		}
-		~ArgcArgv() noexcept
-		{
-			::LocalFree(this->argv);
-		}
-	};
+	using ArgcArgv = BasicArgcArgv<char>;
+	using ArgcArgvW = BasicArgcArgv<wchar_t>;
 
 	class WinConsole
 	{
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string_view>
+
+namespace cdx::tests
+{
+	// Small C-like grammar with nested blocks, comments and strings that span states
+	inline constexpr std::string_view cGrammar{ R"({
+  "name": "C",
+  "states": [
+    { "name": "root", "rules": [
+      { "match": "//.*", "token": "comment" },
+      { "match": "/\\*", "token": "comment", "push": "comment" },
+      { "match": "\"", "token": "string", "push": "string" },
+      { "match": "\\b(?:if|else|while|for|return|int|char|void|static)\\b", "token": "keyword" },
+      { "match": "\\b\\d+\\b", "token": "number" },
+      { "match": "\\{", "token": "punct", "push": "block" },
+      { "match": "\\}", "token": "punct", "pop": true },
+      { "match": "#\\w+", "token": "preproc" } ] },
+    { "name": "block", "rules": [
+      { "match": "//.*", "token": "comment" },
+      { "match": "/\\*", "token": "comment", "push": "comment" },
+      { "match": "\"", "token": "string", "push": "string" },
+      { "match": "\\b(?:if|else|while|for|return|int|char|void|static)\\b", "token": "keyword" },
+      { "match": "\\{", "token": "punct", "push": "block" },
+      { "match": "\\}", "token": "punct", "pop": true } ] },
+    { "name": "comment", "token": "comment", "rules": [
+      { "match": "\\*/", "token": "comment", "pop": true } ] },
+    { "name": "string", "token": "string", "rules": [
+      { "match": "\\\\.", "token": "escape" },
+      { "match": "\"|$", "token": "string", "pop": true } ] }
+  ]
+})" };
+}
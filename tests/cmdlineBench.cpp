@@ -0,0 +1,77 @@
+/*
+ * Throughput of cmdline::split against the reference splitter on one long
+ * command line with quoted paths, escaped quotes and plain arguments.
+ * Usage: cmdlineBench [arguments] [repetitions]
+ */
+
+#include "cmdline.hpp"
+#include "cmdlineReference.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	// Best of 5 runs, in MB/s
+	template<typename Fn>
+	double throughput(std::size_t bytes, unsigned long reps, Fn && fn)
+	{
+		double best = 0.0;
+		for (int run = 0; run < 5; ++run)
+		{
+			auto start = Clock::now();
+			for (unsigned long i = 0; i < reps; ++i)
+			{
+				fn();
+			}
+			auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			best = std::max(best, double(bytes) * double(reps) / seconds / 1e6);
+		}
+		return best;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned long args = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 2000;
+	unsigned long reps = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 500;
+
+	std::string cmdLine{ "\"C:\\Program Files\\ComfyEdit\\ComfyEdit.exe\"" };
+	for (unsigned long i = 0; i < args; ++i)
+	{
+		cmdLine += " --opt=\"some value\" \\\"x\\\\\" plain";
+	}
+
+	// Keeps the work from being optimized away
+	std::size_t sink = 0;
+	auto reference = throughput(cmdLine.size(), reps, [&]()
+	{
+		sink += cmdline::reference::split(cmdLine).size();
+	});
+	std::vector<char> buf(cmdline::bufferSize(cmdLine.size()));
+	auto split = throughput(cmdLine.size(), reps, [&]()
+	{
+		sink += cmdline::split(std::string_view{ cmdLine }, buf.data(), [&sink](char *, std::size_t len)
+		{
+			sink += len;
+		});
+	});
+	cmdline::CommandLine owner;
+	auto owned = throughput(cmdLine.size(), reps, [&]()
+	{
+		owner.assign(cmdLine);
+		sink += owner.args().size();
+	});
+
+	std::printf("cmdlineBench: %zu byte command line, best of 5\n", cmdLine.size());
+	std::printf("  reference          %8.0f MB/s\n", reference);
+	std::printf("  cmdline::split     %8.0f MB/s\n", split);
+	std::printf("  CommandLine        %8.0f MB/s\n", owned);
+	return (sink != 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
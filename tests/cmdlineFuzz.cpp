@@ -0,0 +1,120 @@
+/*
+ * Differential fuzzer of cmdline::split against the reference splitter, on
+ * random command lines made of the characters the quoting rules care about.
+ * Usage: cmdlineFuzz [iterations] [seed]
+ */
+
+#include "cmdline.hpp"
+#include "cmdlineReference.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+#include <iterator>
+
+namespace
+{
+	std::size_t g_failures{ 0 };
+
+	template<typename CharT>
+	std::vector<std::string> splitWith(std::string_view cmdLine)
+	{
+		std::basic_string<CharT> wide{ cmdLine.begin(), cmdLine.end() };
+		// Exactly the documented size, so a sanitizer catches any overrun
+		auto buf = std::make_unique<CharT[]>(cmdline::bufferSize(wide.size()));
+
+		std::vector<std::string> args;
+		auto argc = cmdline::split(std::basic_string_view<CharT>{ wide }, buf.get(), [&args](CharT * arg, std::size_t len)
+		{
+			if (arg[len] != CharT(0))
+			{
+				args.emplace_back("<not terminated>");
+				return;
+			}
+			args.emplace_back(arg, arg + len);
+		});
+		if (argc != args.size() || argc > cmdline::maxArgs(wide.size()))
+		{
+			args.emplace_back("<wrong count>");
+		}
+		return args;
+	}
+
+	void check(std::string_view cmdLine)
+	{
+		auto expected = cmdline::reference::split(cmdLine);
+		auto narrow = splitWith<char>(cmdLine);
+		auto wide = splitWith<wchar_t>(cmdLine);
+
+		cmdline::CommandLine owner{ cmdLine };
+		bool bOwner = owner.args().size() == expected.size() && owner.argv()[expected.size()] == nullptr;
+		for (std::size_t i = 0; bOwner && i < expected.size(); ++i)
+		{
+			bOwner = owner.args()[i] == expected[i] && owner.argv()[i] == owner.args()[i].data();
+		}
+
+		if (narrow == expected && wide == expected && bOwner)
+		{
+			return;
+		}
+		if (++g_failures <= 10)
+		{
+			std::printf("mismatch for [%.*s]:\n  expected", int(cmdLine.size()), cmdLine.data());
+			for (const auto & arg : expected)
+			{
+				std::printf(" [%s]", arg.c_str());
+			}
+			std::printf("\n  got     ");
+			for (const auto & arg : narrow)
+			{
+				std::printf(" [%s]", arg.c_str());
+			}
+			std::printf("\n");
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned long iterations = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1'000'000;
+	unsigned long seed = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 42;
+
+	// Examples of the rules documented in cmdline.hpp
+	const char * samples[]{
+		"",
+		"app",
+		"\"C:\\Program Files\\app.exe\" a b",
+		"app \"a b\"",
+		"app a\\\\\\\"b",
+		"app a\\\\\"b c\" d",
+		"app a\\\\b",
+		"app \"\"\"\"\"\" \"\"\"\"\" \"\"\"\"",
+		"app a\"\"\"b",
+		"\"app\"x y",
+		"app\t \t",
+		"  leading blanks"
+	};
+	for (auto sample : samples)
+	{
+		check(sample);
+	}
+
+	std::mt19937 rng{ seed };
+	const char alphabet[]{ ' ', '\t', '"', '\\', 'a', 'b' };
+	std::string cmdLine;
+	for (unsigned long i = 0; i < iterations; ++i)
+	{
+		cmdLine.resize(rng() % 24);
+		for (auto & ch : cmdLine)
+		{
+			ch = alphabet[rng() % std::size(alphabet)];
+		}
+		check(cmdLine);
+	}
+
+	std::printf("cmdlineFuzz: %lu command lines, %zu mismatches\n", iterations + std::size(samples), g_failures);
+	return (g_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,142 @@
+/*
+ * reference command line splitter
+ * @details The two-pass algorithm common/win32Helper.hpp used before
+ * cmdline::split replaced it, which follows Wine's CommandLineToArgvW. Only
+ * its copying pass is kept, on std::string, since the counting pass merely
+ * sized the output. cmdlineFuzz and cmdlineBench compare cmdline::split with
+ * it.
+ * Credit to GitHub repo: https://github.com/futurist/CommandLineToArgvA
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cmdline::reference
+{
+	[[nodiscard]] inline std::vector<std::string> split(std::string_view cmdLine)
+	{
+		std::vector<std::string> argv;
+		if (cmdLine.empty())
+		{
+			return argv;
+		}
+
+		// Terminated like the C string the original walked
+		std::string copy{ cmdLine };
+		auto s = copy.c_str();
+		std::string arg;
+
+		/* The first argument, the executable path, follows special rules */
+		if (*s == '"')
+		{
+			/* The executable path ends at the next quote, no matter what */
+			++s;
+			while (*s)
+			{
+				if (*s == '"')
+				{
+					++s;
+					break;
+				}
+				arg += *s++;
+			}
+		}
+		else
+		{
+			/* The executable path ends at the next space, no matter what */
+			while (*s && *s != ' ' && *s != '\t')
+			{
+				arg += *s++;
+			}
+		}
+		argv.push_back(std::move(arg));
+		arg.clear();
+
+		/* skip to the first argument, if any */
+		while (*s == ' ' || *s == '\t')
+		{
+			++s;
+		}
+		if (!*s)
+		{
+			return argv;
+		}
+
+		int qcount = 0, bcount = 0;
+		bool open = true;
+		while (*s)
+		{
+			if ((*s == ' ' || *s == '\t') && qcount == 0)
+			{
+				/* close the argument */
+				argv.push_back(std::move(arg));
+				arg.clear();
+				bcount = 0;
+
+				/* skip to the next one and initialize it if any */
+				do
+				{
+					++s;
+				} while (*s == ' ' || *s == '\t');
+				open = *s != 0;
+			}
+			else if (*s == '\\')
+			{
+				arg += *s++;
+				++bcount;
+			}
+			else if (*s == '"')
+			{
+				if ((bcount & 1) == 0)
+				{
+					/* Preceded by an even number of '\', this is half that
+					 * number of '\', plus a quote which we erase.
+					 */
+					arg.resize(arg.size() - bcount / 2);
+					++qcount;
+				}
+				else
+				{
+					/* Preceded by an odd number of '\', this is half that
+					 * number of '\' followed by a '"'
+					 */
+					arg.resize(arg.size() - bcount / 2 - 1);
+					arg += '"';
+				}
+				++s;
+				bcount = 0;
+				/* Now count the number of consecutive quotes. Note that qcount
+				 * already takes into account the opening quote if any, as well as
+				 * the quote that lead us here.
+				 */
+				while (*s == '"')
+				{
+					if (++qcount == 3)
+					{
+						arg += '"';
+						qcount = 0;
+					}
+					++s;
+				}
+				if (qcount == 2)
+				{
+					qcount = 0;
+				}
+			}
+			else
+			{
+				/* a regular character */
+				arg += *s++;
+				bcount = 0;
+			}
+		}
+		if (open)
+		{
+			argv.push_back(std::move(arg));
+		}
+		return argv;
+	}
+}
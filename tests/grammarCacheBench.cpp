@@ -0,0 +1,198 @@
+/*
+ * Startup cost of loading many grammars: parsing their JSON every time
+ * against GrammarCache with an empty (cold) and a filled (warm) cache
+ * directory. The grammars are generated into a temporary directory.
+ * Usage: grammarCacheBench [grammars] [runs]
+ */
+
+#include "grammarCache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cdx::syntax;
+namespace fs = std::filesystem;
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double msSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// 6 states, 112 rules: keyword lists, numbers, lookaheads and pushes/pops between the states
+	std::string makeGrammar(std::size_t index, std::mt19937 & rng)
+	{
+		auto word = [&rng]()
+		{
+			std::string w(3 + rng() % 6, 'a');
+			for (auto & ch : w)
+			{
+				ch = char('a' + rng() % 26);
+			}
+			return w;
+		};
+
+		const char * states[]{ "root", "block", "comment", "string", "template", "attr" };
+		std::string json{ "{ \"name\": \"lang" + std::to_string(index) + "\", \"states\": [\n" };
+		for (std::size_t s = 0; s < std::size(states); ++s)
+		{
+			json += (s != 0) ? "," : "";
+			json += "{ \"name\": \"" + std::string{ states[s] } + "\", \"token\": \"t" + std::to_string(s) + "\", \"rules\": [\n";
+			int rules = (s < 2) ? 40 : 8;
+			for (int r = 0; r < rules; ++r)
+			{
+				std::string match;
+				switch (r % 8)
+				{
+				case 0:
+					match = "\\\\b(?:";
+					for (int k = 0; k < 25; ++k)
+					{
+						match += (k != 0) ? "|" : "";
+						match += word();
+					}
+					match += ")\\\\b";
+					break;
+				case 1:
+					match = "\\\\b0[xX][0-9a-fA-F]+\\\\b|\\\\b\\\\d+(?:\\\\.\\\\d+)?(?:[eE][+-]?\\\\d+)?\\\\b";
+					break;
+				case 2:
+					match = "[A-Z][A-Za-z0-9_]*(?=\\\\s*\\\\()";
+					break;
+				case 3:
+					match = "@" + word() + "\\\\w*";
+					break;
+				case 4:
+					match = "(?:[-+*/%=<>!&|^~?:]|" + word() + ")=?";
+					break;
+				case 5:
+					match = "\\\\b" + word() + "\\\\s*::\\\\s*\\\\w+";
+					break;
+				case 6:
+					match = "#\\\\s*(?:include|define|" + word() + ")\\\\b.*";
+					break;
+				default:
+					match = "\\\\$\\\\{?[a-z_]\\\\w*\\\\}?";
+					break;
+				}
+				json += (r != 0) ? "," : "";
+				json += "{ \"match\": \"" + match + "\", \"token\": \"k" + std::to_string(r % 12) + "\"";
+				if (r == 9)
+				{
+					json += ", \"push\": \"comment\"";
+				}
+				else if (r == 17)
+				{
+					json += ", \"push\": \"string\"";
+				}
+				else if (r == 25 && s > 1)
+				{
+					json += ", \"pop\": true";
+				}
+				json += " }\n";
+			}
+			json += "] }\n";
+		}
+		return json + "] }\n";
+	}
+
+	double median(std::vector<double> values)
+	{
+		std::sort(values.begin(), values.end());
+		return values[values.size() / 2];
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	std::size_t count = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 40;
+	std::size_t runs = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 7;
+
+	auto root = fs::temp_directory_path() / "cdxGrammarCacheBench";
+	auto sources = root / "grammars", cache = root / "cache";
+	fs::remove_all(root);
+	fs::create_directories(sources);
+
+	std::mt19937 rng{ 11 };
+	std::vector<fs::path> paths;
+	std::uintmax_t bytes = 0;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		paths.push_back(sources / ("lang" + std::to_string(i) + ".json"));
+		std::ofstream{ paths.back(), std::ios::binary } << makeGrammar(i, rng);
+		bytes += fs::file_size(paths.back());
+	}
+
+	std::string error;
+	auto loadAll = [&](GrammarCache & gc)
+	{
+		for (const auto & path : paths)
+		{
+			if (!gc.load(path, error))
+			{
+				std::printf("%s: %s\n", path.string().c_str(), error.c_str());
+				std::exit(EXIT_FAILURE);
+			}
+		}
+	};
+
+	std::vector<double> json, cold, warm, touched;
+	for (std::size_t run = 0; run < runs; ++run)
+	{
+		auto start = Clock::now();
+		for (const auto & path : paths)
+		{
+			std::ifstream in{ path, std::ios::binary };
+			std::stringstream ss;
+			ss << in.rdbuf();
+			if (!Grammar::fromJson(ss.str(), error))
+			{
+				std::printf("%s: %s\n", path.string().c_str(), error.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+		json.push_back(msSince(start));
+
+		fs::remove_all(cache);
+		{
+			GrammarCache gc{ cache };
+			start = Clock::now();
+			loadAll(gc);
+			cold.push_back(msSince(start));
+		}
+		{
+			GrammarCache gc{ cache };
+			start = Clock::now();
+			loadAll(gc);
+			warm.push_back(msSince(start));
+		}
+
+		// A changed source invalidates only its own entry
+		fs::last_write_time(paths.front(), fs::last_write_time(paths.front()) + std::chrono::seconds{ 1 });
+		{
+			GrammarCache gc{ cache };
+			start = Clock::now();
+			loadAll(gc);
+			touched.push_back(msSince(start));
+		}
+	}
+	fs::remove_all(root);
+
+	std::printf("grammarCacheBench: %zu grammars, %ju KiB JSON, median of %zu runs\n", count, bytes >> 10, runs);
+	std::printf("  JSON only, no cache     %8.1f ms\n", median(json));
+	std::printf("  cold (compile + write)  %8.1f ms\n", median(cold));
+	std::printf("  warm (mapped cache)     %8.1f ms\n", median(warm));
+	std::printf("  one source touched      %8.1f ms\n", median(touched));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+/*
+ * Latency of the incremental Tokenizer on a 100,000-line C-like file: opening
+ * it, typing, pasting and edits that change the state of every later line.
+ * Usage: tokenizerBench [lines]
+ */
+
+#include "tokenizer.hpp"
+#include "cGrammar.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cdx::syntax;
+using namespace cdx::text;
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double msSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+	void wait(Tokenizer & tok)
+	{
+		while (!tok.done())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	std::size_t lines = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 100'000;
+
+	std::string error;
+	auto grammar = Grammar::fromJson(cdx::tests::cGrammar, error);
+	if (!grammar)
+	{
+		std::printf("grammar: %s\n", error.c_str());
+		return EXIT_FAILURE;
+	}
+
+	const char * source[]{
+		"static int count_items(const char * name, int flags)",
+		"{",
+		"\tint total = 0; // running sum",
+		"\tfor (int i = 0; i < 100; ++i)",
+		"\t{",
+		"\t\tif (name[i] == '\\\\n') return \"line \\\"break\\\"\";",
+		"\t\ttotal += flags * 42;",
+		"\t}",
+		"\t/* block comment */ return total;",
+		"}",
+		"#include <stdio.h>",
+		""
+	};
+	std::string text;
+	for (std::size_t i = 0; i < lines; ++i)
+	{
+		text += source[i % std::size(source)];
+		text += '\n';
+	}
+	std::printf("tokenizerBench: %zu lines, %zu bytes\n", lines, text.size());
+
+	PieceTable table{ text };
+	std::atomic<std::size_t> notifications{ 0 };
+	Tokenizer tok{ grammar, [&notifications]()
+	{
+		++notifications;
+	} };
+
+	auto start = Clock::now();
+	tok.setText(table.snapshot());
+	tok.viewport(0, 60);
+	auto firstScreen = msSince(start);
+	wait(tok);
+	std::printf("  open: first screen %.3f ms, whole file %.1f ms\n", firstScreen, msSince(start));
+
+	start = Clock::now();
+	{
+		Tokenizer full{ grammar };
+		full.setText(table.snapshot());
+		full.finish();
+	}
+	std::printf("  full relex on one thread: %.1f ms\n", msSince(start));
+
+	// Types 'text' into every 12th line from 'line' on and takes it out again
+	auto keystroke = [&](const char * what, std::size_t line, std::string_view insert, std::size_t reps)
+	{
+		std::vector<double> visible, all;
+		for (std::size_t r = 0; r < reps; ++r)
+		{
+			auto at = std::min(line + r * std::size(source), lines - 1);
+			auto offset = table.lineStart(at) + 2;
+			std::vector<TextEdit> edits{ { offset, 0, insert } };
+
+			auto begin = Clock::now();
+			table.apply(edits);
+			tok.edit(table.snapshot(), edits);
+			tok.viewport(at - std::min<std::size_t>(at, 30), at + 30);
+			visible.push_back(msSince(begin));
+			wait(tok);
+			all.push_back(msSince(begin));
+
+			std::vector<TextEdit> undo{ { offset, insert.size(), {} } };
+			table.apply(undo);
+			tok.edit(table.snapshot(), undo);
+			tok.viewport(at - std::min<std::size_t>(at, 30), at + 30);
+			wait(tok);
+		}
+		std::sort(visible.begin(), visible.end());
+		std::sort(all.begin(), all.end());
+		std::printf("  %-26s edit+viewport median %.3f ms, p99 %.3f ms; all lines valid median %.3f ms\n",
+			what, visible[visible.size() / 2], visible[visible.size() * 99 / 100], all[all.size() / 2]);
+	};
+	std::string paste{ text.substr(0, text.find("}\n#") + 2) };
+	keystroke("type a character", lines / 2, "x", 200);
+	keystroke("press enter", lines / 2, "\n", 200);
+	keystroke("paste 10 lines", lines / 2, paste, 100);
+	keystroke("open a block comment", lines / 2 + 10, "/*", 20);
+	keystroke("open a brace at line 10", 10, "{", 10);
+
+	// The viewport is far past an edit that changes every later line
+	std::vector<TextEdit> edits{ { 0, 0, "{" } };
+	table.apply(edits);
+	tok.edit(table.snapshot(), edits);
+	start = Clock::now();
+	tok.viewport(lines - 1000, lines - 940);
+	auto guessed = msSince(start);
+	wait(tok);
+	std::printf("  viewport far past an edit: %.3f ms guessed, exact after %.1f ms\n", guessed, msSince(start));
+	std::printf("  notifications: %zu\n", notifications.load());
+	return EXIT_SUCCESS;
+}
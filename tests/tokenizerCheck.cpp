@@ -0,0 +1,173 @@
+/*
+ * Randomized check of the incremental Tokenizer: after random edits, viewport
+ * jumps and pauses that let the background thread run, every line must lex
+ * exactly as in a tokenizer that lexed the final text from scratch.
+ * Usage: tokenizerCheck [rounds] [seed]
+ */
+
+#include "tokenizer.hpp"
+#include "cGrammar.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cdx::syntax;
+using namespace cdx::text;
+
+namespace
+{
+	std::size_t g_failures{ 0 };
+
+	void fail(const char * what, std::size_t index, std::size_t line)
+	{
+		if (++g_failures <= 10)
+		{
+			std::printf("%s: case %zu, line %zu differs from a full relex\n", what, index, line);
+		}
+	}
+
+	bool sameTokens(const std::vector<Token> & a, const std::vector<Token> & b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+		for (std::size_t i = 0; i < a.size(); ++i)
+		{
+			if (a[i].start != b[i].start || a[i].kind != b[i].kind)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	// Finishes 'tok' and compares it with a fresh tokenizer of the same text
+	void compare(const char * what, std::size_t round, const std::shared_ptr<const Grammar> & grammar, Tokenizer & tok, const PieceTable & table)
+	{
+		tok.finish();
+		Tokenizer ref{ grammar };
+		ref.setText(table.snapshot());
+		ref.finish();
+
+		if (tok.lineCount() != ref.lineCount())
+		{
+			fail(what, round, tok.lineCount());
+			return;
+		}
+		for (std::size_t line = 0; line < ref.lineCount(); ++line)
+		{
+			if (!sameTokens(tok.tokens(line), ref.tokens(line)))
+			{
+				fail(what, round, line);
+				return;
+			}
+		}
+		auto a = tok.foldRanges(0, tok.lineCount()), b = ref.foldRanges(0, ref.lineCount());
+		bool bSame = a.size() == b.size();
+		for (std::size_t i = 0; bSame && i < a.size(); ++i)
+		{
+			bSame = a[i].first == b[i].first && a[i].last == b[i].last;
+		}
+		if (!bSame)
+		{
+			fail(what, round, 0);
+		}
+	}
+	void edit(PieceTable & table, Tokenizer & tok, std::size_t offset, std::size_t count, std::string_view text)
+	{
+		std::vector<TextEdit> edits{ { offset, count, text } };
+		table.apply(edits);
+		tok.edit(table.snapshot(), edits);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	std::size_t rounds = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 20;
+	std::mt19937 rng{ (argc > 2) ? unsigned(std::strtoul(argv[2], nullptr, 10)) : 9u };
+
+	std::string error;
+	auto grammar = Grammar::fromJson(cdx::tests::cGrammar, error);
+	if (!grammar)
+	{
+		std::printf("grammar: %s\n", error.c_str());
+		return EXIT_FAILURE;
+	}
+
+	const char * parts[]{ "int x = 1;", "{", "}", "/* c", "*/", "\"s\"", "if (a) { b(); }", "// note", "\n", "\n", "\n" };
+	auto part = [&]()
+	{
+		return parts[rng() % std::size(parts)];
+	};
+	for (std::size_t round = 0; round < rounds; ++round)
+	{
+		std::string text;
+		for (auto n = 5000 + rng() % 40000; n > 0; --n)
+		{
+			text += part();
+		}
+		PieceTable table{ text };
+		Tokenizer tok{ grammar, {}, (rng() % 2) ? 50 : Tokenizer::defSyncLines };
+		tok.setText(table.snapshot());
+
+		// Edits keep referring to their text until the tokenizer is done
+		std::deque<std::string> texts;
+		for (int step = 0; step < 40; ++step)
+		{
+			texts.push_back(part());
+			if (rng() % 2)
+			{
+				texts.back() += part();
+			}
+			auto offset = rng() % (table.size() + 1);
+			auto count = std::min<std::size_t>(rng() % 8, table.size() - offset);
+			edit(table, tok, offset, count, texts.back());
+
+			if (rng() % 3 == 0)
+			{
+				auto first = rng() % tok.lineCount();
+				tok.viewport(first, first + 40);
+			}
+			if (rng() % 4 == 0)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(rng() % 3000));
+			}
+		}
+		compare("random edits", round, grammar, tok, table);
+	}
+
+	/*
+	 * A viewport below an edit that changes every later line moves the frontier
+	 * past lines it didn't relex. An edit above then moves the frontier back,
+	 * and converging must not skip the lines in between.
+	 */
+	std::size_t scenarios = 0;
+	for (int delay : { 0, 50, 200, 1000, 5000 })
+	{
+		std::string text;
+		for (int i = 0; i < 5000; ++i)
+		{
+			text += "int x = f(a, b); { y(); }\n";
+		}
+		PieceTable table{ text };
+		Tokenizer tok{ grammar };
+		tok.setText(table.snapshot());
+		tok.finish();
+
+		edit(table, tok, table.lineStart(10), 0, "/*");
+		tok.viewport(0, 60);
+		std::this_thread::sleep_for(std::chrono::microseconds(delay));
+		edit(table, tok, table.lineStart(5), 0, "x");
+		compare("frontier moved back", std::size_t(delay), grammar, tok, table);
+		++scenarios;
+	}
+
+	std::printf("tokenizerCheck: %zu random rounds, %zu frontier scenarios, %zu failures\n", rounds, scenarios, g_failures);
+	return (g_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}